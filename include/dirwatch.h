@@ -0,0 +1,37 @@
+/*
+ *  dirwatch -- A routine for ZMailer  libz.a -library.
+ *
+ *  Change notifications on the spool directories, so that the
+ *  router and the scheduler need not re-read whole hashed directory
+ *  trees every few seconds to find new work.  Backend is inotify(7)
+ *  where available, elsewhere  dirwatch_open()  fails, and the caller
+ *  keeps on doing the periodic directory scans.
+ *
+ *  dirwatch_read() reports completed (IN_CLOSE_WRITE), and renamed-in
+ *  (IN_MOVED_TO) files with  isdir == 0, and created or renamed-in
+ *  subdirectories with  isdir == 1, for the caller to decide, if the
+ *  new directory is to be watched as well.  The 'dir' given to the
+ *  callback is the same string that was given to dirwatch_add().
+ *  Return value is the number of callbacks done, or -1 when the
+ *  kernel had to drop events -- then a full rescan is needed.
+ *
+ *  dirwatch_tree() adds the directory, and its "A" .. "Z" hash
+ *  subdirectories down to the level 2.
+ */
+
+#ifndef __ZM_DIRWATCH_H__
+#define __ZM_DIRWATCH_H__ 1
+
+struct dirwatch;  /* Opaque */
+
+typedef void (*dirwatch_fn) __((void *__ctx, const char *__dir, const char *__name, int __isdir));
+
+extern struct dirwatch *dirwatch_open __((void));
+extern void dirwatch_close __((struct dirwatch *__dw));
+extern int  dirwatch_fd    __((struct dirwatch *__dw));
+extern int  dirwatch_add   __((struct dirwatch *__dw, const char *__dir));
+extern int  dirwatch_count __((struct dirwatch *__dw));
+extern int  dirwatch_read  __((struct dirwatch *__dw, dirwatch_fn __fn, void *__ctx));
+extern int  dirwatch_tree  __((struct dirwatch *__dw, const char *__dir, int __level));
+
+#endif
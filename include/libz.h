@@ -224,6 +224,8 @@ extern const char *CC_user;
 extern const char *CC_pwd;
 
 /* zshmmibattach.c */
+struct MIB_Histogram; /* a "forward" declaration */
+struct timeval; /* a "forward" declaration */
 extern int  Z_SHM_MIB_Attach      __((int rw));
 extern int  Z_SHM_MIB_is_attached __((void)); /* True if we do have the segment */
 extern void Z_SHM_MIB_Detach      __((void)); /* automatic atexit() handling */
@@ -232,6 +234,13 @@ extern struct MIB_MtaEntry *MIBMtaEntry; /* public MIB block pointer, either
 					    private data before attach call,
 					    or possibly shared data after the
 					    call... */
+extern struct MIB_MtaEntry *MIBMtaCnt;   /* the counters of this process,
+					    its own slab in the segment */
+extern void Z_SHM_MIB_Forked      __((void)); /* new slab for a fork() child */
+extern struct MIB_MtaEntry *Z_SHM_MIB_Sum __((void)); /* all slabs added up */
+extern void Z_SHM_MIB_Hist        __((struct MIB_Histogram *h, unsigned long ms));
+extern void Z_SHM_MIB_Since       __((struct MIB_Histogram *h, const struct timeval *tv));
+extern unsigned long Z_SHM_MIB_Hist_pct __((const struct MIB_Histogram *h, int pct));
 
 /* fdstatfs.c */
 extern int fd_statfs __((int fd, long *bavailp, long *busedp, long *iavailp, long *iusedp));
@@ -252,6 +261,9 @@ extern void fdpass_to_child_fds   __((int *tochild));
 extern void fdpass_shutdown_child __((int fd)); /* At parent, shutdown channel towards child */
 extern int  fdpass_receivefd      __((int fd, int *receivedfdp));
 extern int  fdpass_sendfd         __((int fd, int passfd));
+extern int  fdpass_create_msgsock __((int *tochild));
+extern int  fdpass_sendmsg        __((int fd, int passfd, const void *buf, int len));
+extern int  fdpass_receivemsg     __((int fd, int *receivedfdp, void *buf, int len));
 
 /* resources.c */
 extern int  resources_query_nofiles  __((void));
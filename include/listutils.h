@@ -56,7 +56,8 @@ typedef struct _conscell {
 #define ELEMENT		0x010	/* result of element expansion */
 #define DSW_MARKER	0x020	/* for garbage collection run.. */
 #define DSW_FREEMARK	0x040	/* for gc tracking, marks already free cell */
-#define _DSW_MASK	0x060
+#define DSW_OLDGEN	0x080	/* tenured cell in a nursery block */
+#define _DSW_MASK	0x0E0
 
 #define	dtpr		u.u_dtpr
 #define	string		u.u_string
@@ -171,6 +172,7 @@ extern conscell * conststring __((const char *s, const int slen));
 EXTINLINE conscell *copycell(conscell *X) {
   conscell *tmp = newcell();
   *tmp = *X;
+  tmp->flags &= ~_DSW_MASK;	/* Not the GC state of X */
   if (STRING(tmp)) {
     tmp->string = dupnstr(tmp->cstring,tmp->slen);
     /* Copycell does *NOT* preserve other string flags,
@@ -247,6 +249,7 @@ EXTINLINE conscell * conststring(const char *cs, const int slen)
 
 #define copycell(X)					\
 ({conscell *_tmp = newcell(); *_tmp = *(X);		\
+ _tmp->flags &= ~_DSW_MASK;				\
  if (STRING(_tmp)) {					\
    _tmp->string = dupnstr(_tmp->cstring,_tmp->slen);	\
     /* Copycell does *NOT* preserve other string flags, \
@@ -309,6 +312,11 @@ extern conscell *s_copy_chain __((conscell *));
 
 /* LISPic memory allocator, and other stuff.. */
 extern int cons_garbage_collect __(( void ));
+extern void cons_region_begin __(( void ));
+extern void cons_region_end __(( void ));
+extern conscell *cons_promote __(( conscell * ));
+extern void cons_gc_stats __(( void ));
+extern int cons_generational;
 extern int consvar_register __(( conscell ** ));
 extern void *consvar_mark __(( void ));
 extern void consvar_release __(( void * ));
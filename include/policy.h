@@ -106,6 +106,60 @@ struct attribute {
 	unsigned char data[1];
 };
 
+
+/* The "mmap" policy database:  makedb -p mmap  compiles the keys and
+   their attribute lists into a read-only image file ("NAME.zmdb"),
+   which the smtpserver maps into memory, and reads in place.
+   There are no pointers in it, all references are byte offsets from
+   the start of the file (0 = none), in the byte order of the host
+   that made it.  The attribute lists are exactly as in the other
+   database types.
+
+   The IPv4 and IPv6 keys are in path-compressed binary tries: each
+   node is a prefix 'addr/width' that all of the keys below it share;
+   child[b] continues with the bit 'width' of the address being 'b'.
+   The domain keys are in a trie of their labels, the rightmost label
+   first: "foo.example.com" is the 'exact' of the node at the path
+   com,example,foo and ".foo.example.com" is the 'wild' of that same
+   node;  "." is the 'wild' of the root.  The children of a node are
+   in an array sorted by their labels.  All other keys (tags, users)
+   are in an array sorted by the key bytes.				*/
+
+#define PMDB_MAGIC	"ZMPOLDB1"
+#define PMDB_BYTEORDER	0x01020304
+#define PMDB_SUFFIX	".zmdb"
+
+struct pmdb_head {
+	char		magic[8];	/* PMDB_MAGIC			*/
+	unsigned int	byteorder;	/* PMDB_BYTEORDER		*/
+	unsigned int	size;		/* Of the whole file		*/
+	unsigned int	ip4root;	/* struct pmdb_ipnode		*/
+	unsigned int	ip6root;	/* struct pmdb_ipnode		*/
+	unsigned int	domroot;	/* struct pmdb_domnode		*/
+	unsigned int	keytab;		/* struct pmdb_key [nkeys]	*/
+	unsigned int	nkeys;
+};
+
+struct pmdb_ipnode {
+	unsigned int	child[2];
+	unsigned int	data, dlen;	/* Attributes of 'addr/width'	*/
+	unsigned char	width;
+	unsigned char	pad[3];
+	unsigned char	addr[16];	/* IPv4 uses the first 4	*/
+};
+
+struct pmdb_domnode {
+	unsigned int	label;		/* NUL terminated		*/
+	unsigned int	children, nchildren;
+	unsigned int	exact, exactlen;
+	unsigned int	wild, wildlen;
+};
+
+struct pmdb_key {
+	unsigned int	key;		/* len, type, data[]		*/
+	unsigned int	data, dlen;
+};
+
 #ifdef _POLICYTEST_INTERNAL_
 
 static char *_KK[] = {
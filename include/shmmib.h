@@ -15,7 +15,18 @@
 #define Vtime_t  volatile time_t
 #define Vuint    volatile uint
 
-#define ZM_MIB_MAGIC 0x33120006
+#define ZM_MIB_MAGIC 0x33120007
+
+/* Latency histograms, in milliseconds:  bucket 0 counts the times
+   under 1 ms, bucket N those from 2^(N-1) ms to under 2^N ms, and
+   the last bucket everything above. */
+
+#define ZM_MIB_HBUCKETS 32
+
+struct MIB_Histogram {
+	Vuint	count;
+	Vuint	bucket[ZM_MIB_HBUCKETS];
+};
 
 struct timeserver {
 	Vuint	pid;
@@ -163,8 +174,14 @@ struct MIB_MtaEntrySs {
   Vuint		Irouter_queue_G;
   Vuint		Cfilter_queue_G;
 
+  Vuint		IncomingSMTP_RBL_queries;	/* counter */
+  Vuint		IncomingSMTP_RBL_cachehits;	/* counter */
 
-  Vuint	space[24]; /* Add to tail without need to change MAGIC */
+  Vuint		IncomingSMTP_spool_syncs;	/* counter, group commits */
+
+  struct MIB_Histogram CommandTime;	/* SMTP command latency */
+
+  Vuint	space[21]; /* Add to tail without need to change MAGIC */
 };
 
 
@@ -188,8 +205,15 @@ struct MIB_MtaEntryRt {
   Vuint		StoredMessages;		/* gauge, router	*/
   Vuint		StoredVolume;		/* gauge,	in kB	*/
 
+  /* Relation lookup caches, all router processes together */
+  Vuint		RouterDbCacheHits;	/* counter	*/
+  Vuint		RouterDbCacheMisses;	/* counter	*/
+  Vuint		RouterDbCacheEvictions;	/* counter	*/
+  Vuint		RouterDbCacheExpiries;	/* counter	*/
 
-  Vuint	space[32]; /* Add to tail without need to change MAGIC */
+  struct MIB_Histogram MessageTime;	/* Router time per message */
+
+  Vuint	space[28]; /* Add to tail without need to change MAGIC */
 
 };
 
@@ -328,7 +352,12 @@ struct MIB_MtaEntryTaS {
 
   double dummy99; /* Alignment, etc.. */
 
-  Vuint	space[32]; /* Add to tail without need to change MAGIC */
+  Vuint		SmtpConnCacheParks;	/* counter, connections parked	*/
+  Vuint		SmtpConnCacheHits;	/* counter, .. and reused	*/
+
+  struct MIB_Histogram TaDeliveryTime;	/* Arrival to delivery */
+
+  Vuint	space[30]; /* Add to tail without need to change MAGIC */
 
 };
 
@@ -344,6 +373,8 @@ struct MIB_MtaEntryTaSm {
   Vuint		TaRcptsRetry;
   Vuint		TaRcptsFail;
 
+  struct MIB_Histogram TaDeliveryTime;	/* Arrival to delivery */
+
   double dummy99; /* Alignment, etc.. */
 
   Vuint	space[32]; /* Add to tail without need to change MAGIC */
@@ -360,6 +391,7 @@ struct MIB_MtaEntryTaMbx {
   Vuint		TaRcptsRetry;
   Vuint		TaRcptsFail;
 
+  struct MIB_Histogram TaDeliveryTime;	/* Arrival to delivery */
 
   double dummy99; /* Alignment, etc.. */
 
@@ -377,6 +409,7 @@ struct MIB_MtaEntryTaHo {
   Vuint		TaRcptsRetry;
   Vuint		TaRcptsFail;
 
+  struct MIB_Histogram TaDeliveryTime;	/* Arrival to delivery */
 
   double dummy99; /* Alignment, etc.. */
 
@@ -394,6 +427,7 @@ struct MIB_MtaEntryTaErr {
   Vuint		TaRcptsRetry;
   Vuint		TaRcptsFail;
 
+  struct MIB_Histogram TaDeliveryTime;	/* Arrival to delivery */
 
   double dummy99; /* Alignment, etc.. */
 
@@ -411,6 +445,7 @@ struct MIB_MtaEntryTaExpi {
   Vuint		TaRcptsRetry;
   Vuint		TaRcptsFail;
 
+  struct MIB_Histogram TaDeliveryTime;	/* Arrival to delivery */
 
   double dummy99; /* Alignment, etc.. */
 
@@ -428,6 +463,7 @@ struct MIB_MtaEntryTaRert {
   Vuint		TaRcptsRetry;
   Vuint		TaRcptsFail;
 
+  struct MIB_Histogram TaDeliveryTime;	/* Arrival to delivery */
 
   double dummy99; /* Alignment, etc.. */
 
@@ -486,3 +522,37 @@ struct MIB_MtaEntry {
 
 	struct MIB_MtaEntryTaRert tarert;
 };
+
+
+/*
+ * The counters proper are kept per process:  every process that
+ * writes into the segment claims a slab of its own, and increments
+ * there without locks, and without its cache lines bouncing between
+ * the CPUs.  The readers add the slabs up with  Z_SHM_MIB_Sum().
+ *
+ * The gauges, and the values that are set instead of incremented,
+ * stay in the  MIB_MtaEntry  at the start of the segment, as do the
+ * counts of a process that found no free slab.  A slab of a process
+ * that has exited is added into the 'retired' one.
+ */
+
+#define ZM_MIB_SLABS 256
+
+struct MIB_MtaSlab {
+	Vpid_t	owner;		/* Process using this slab, 0 if free */
+
+	double dummy0; /* Alignment / spacer .. */
+
+	struct MIB_MtaEntry	c;
+
+	double dummy1[8]; /* Keep off the next slab's cache lines */
+};
+
+struct MIB_MtaSegment {
+	struct MIB_MtaEntry	m;
+
+	double dummy0[8]; /* Alignment / spacer .. */
+
+	struct MIB_MtaSlab	retired;
+	struct MIB_MtaSlab	slab[ZM_MIB_SLABS];
+};
@@ -128,6 +128,12 @@ struct ctldesc {
 	const char	*let_buffer;	/* MMAP()ed memory area containing */
 	const char	*let_end;	/* the mail -- and its end..	   */
 	int		let_buffer_size; /* != 0 If it is 'malloc()ed! */
+	char		*diagbuf;	/* diagnostics not yet appended	*/
+	int		diagbuflen;	/* .. bytes in it		*/
+	int		diagbufspace;	/* .. and its size		*/
+	time_t		diagbuftime;	/* .. when the first one came	*/
+	struct ctldiag	*diagpend;	/* reports held for the commit	*/
+	struct ctldiag	**diagpendtail;
 };
 
 
@@ -175,6 +181,12 @@ extern void            notary_setwttip __(( const char *ip ));
 extern void            notary_settaid __(( const char *name, int ));
 extern void            notary_setcvtmode __(( CONVERTMODE ));
 extern void	       notaryflush __(( void ));
+extern int	       ta_diagcommit;
+extern void	       ctlcommit __(( struct ctldesc *dp ));
+
+/* The transport agent's delivery time histogram in the shared MIB */
+struct MIB_Histogram;
+extern struct MIB_Histogram *MIBTaDeliveryTime;
 #if defined(HAVE_STDARG_H)
 extern void	       diagnostic __((FILE *verboselog, struct rcpt *rp, int rc, int timeout, const char *fmt, ... ));
 #else
@@ -189,6 +201,14 @@ extern void	       diagnostic __((/* FILE *verboselog, struct rcpt *, int, int,
 /* emptyline.c: */
 extern int	       emptyline __(( char *line, int size ));
 
+/* tajobs.c: */
+extern void	       ta_askjob __(( void ));
+extern char	      *ta_getjob __(( char *buf, int bufsize ));
+extern char	      *ta_nextjob __(( char *buf, int bufsize ));
+extern int	       ta_jobfd __(( void ));
+extern void	       ta_resync __(( const char *file ));
+extern void	       ta_report __(( int ctlid, int id, const char *notary, const char *statmsg, const char *message ));
+
 extern int zmalloc_failure;
 
 /* lockaddr.c: */
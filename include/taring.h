@@ -0,0 +1,71 @@
+/*
+ *  taring -- A routine for ZMailer  libz.a -library.
+ *
+ *  Shared memory job rings in between the scheduler and a transport
+ *  agent.  Instead of writing "spool/file\thost\n" lines into the TA,
+ *  and parsing "#hungry" and diagnostic lines back, both directions
+ *  carry binary records in a single-producer/single-consumer ring,
+ *  and an eventfd wakes the other side up -- but only when it has
+ *  said that it is going to sleep.  A busy pair passes jobs and
+ *  results without any system calls at all.
+ *
+ *  The scheduler creates the ring at the TA start, and hands it over
+ *  as fds  TARING_FD  (the memory),  TARING_FD+1  (wakes the TA) and
+ *  TARING_FD+2  (wakes the scheduler), and tells so with environment
+ *  variable  TARING.  A TA that does not know of it just keeps on
+ *  talking the text protocol, which the scheduler sees at the first
+ *  "#hungry", and drops the ring.
+ */
+
+#ifndef __ZM_TARING_H__
+#define __ZM_TARING_H__ 1
+
+#define TARING_FD	3
+#define TARING_ENV	"TARING"
+
+/* Directions of the two queues */
+#define TARING_DOWN	0	/* scheduler -> TA			*/
+#define TARING_UP	1	/* TA -> scheduler			*/
+
+/* Record types */
+#define TARING_PAD	0	/* Skip to the start of the ring	*/
+#define TARING_JOB	1	/* DOWN: str[0] = file, str[1] = host	*/
+#define TARING_IDLE	2	/* DOWN: "#idle"			*/
+#define TARING_END	3	/* DOWN: empty line -- exit		*/
+#define TARING_HUNGRY	4	/* UP:   "#hungry"			*/
+#define TARING_DIAG	5	/* UP:   id[0]/id[1], str[0] = notary,
+					 str[1] = status, str[2] = message */
+#define TARING_TEXT	6	/* UP:   str[0] = any other report line	*/
+
+#define TARING_MAXSTR	4
+
+struct taring_rec {
+	unsigned int	len;	/* Of the whole record, 8 aligned	*/
+	unsigned short	type;
+	unsigned short	nstr;	/* NUL terminated strings after this	*/
+	int		id[2];
+};
+
+/* A record copied out of the ring, with the strings validated */
+struct taring_msg {
+	int		type;
+	int		id[2];
+	int		nstr;
+	const char	*str[TARING_MAXSTR];
+	char		*buf;	/* Space for the strings		*/
+	int		bufspace;
+};
+
+struct taring;  /* Opaque */
+
+extern struct taring *taring_create __((int __size));
+extern struct taring *taring_attach __((void));
+extern void taring_free   __((struct taring *__r));
+extern void taring_child  __((struct taring *__r));
+extern int  taring_fd     __((struct taring *__r));
+extern int  taring_put    __((struct taring *__r, int __type, int __id0, int __id1, int __nstr, const char **__str));
+extern int  taring_get    __((struct taring *__r, struct taring_msg *__m));
+extern int  taring_sleep  __((struct taring *__r));
+extern void taring_parent __((struct taring *__r));
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ *  tlsscache -- A routine for ZMailer  libz.a -library.
+ *
+ *  Shared TLS session cache.  A file of fixed size slots is mapped
+ *  into all processes that use it: the smtpserver children, and the
+ *  smtp transport agents.  A session is stored by its id (server) or
+ *  by its peer (client) as the DER encoded  SSL_SESSION  that the
+ *  caller makes;  this code does not call OpenSSL at all.
+ *
+ *  The slots are in sets of TLSSCACHE_WAYS, and the sets are locked
+ *  in stripes with  fcntl()  record locks, which go away when their
+ *  holder dies.  The file also keeps the session ticket keys: the
+ *  current one, and the previous one that still decrypts the tickets
+ *  made before the last rotation.
+ */
+
+#ifndef __ZM_TLSSCACHE_H__
+#define __ZM_TLSSCACHE_H__ 1
+
+#define TLSSCACHE_IDMAX		64	/* Max key length		*/
+#define TLSSCACHE_SLOTSIZE	4096	/* Bytes per slot, key and all	*/
+#define TLSSCACHE_WAYS		4	/* Slots per set		*/
+#define TLSSCACHE_STRIPES	32	/* Locks over the sets		*/
+#define TLSSCACHE_SLOTS		1024	/* Default size			*/
+
+/* The DER buffers of the callers, the server and the client alike */
+#ifndef SSL_SESSION_MAX_DER
+#define SSL_SESSION_MAX_DER	(10*1024)
+#endif
+
+struct tlsscache_tkey {
+	unsigned char	name[16];
+	unsigned char	hmac[16];
+	unsigned char	aes[16];
+};
+
+struct tlsscache;  /* Opaque */
+
+extern struct tlsscache *tlsscache_open __((const char *__path, int __slots));
+extern void tlsscache_close  __((struct tlsscache *__c));
+extern int  tlsscache_store  __((struct tlsscache *__c, const void *__id, int __idlen, const void *__data, int __datalen, time_t __expire));
+extern int  tlsscache_fetch  __((struct tlsscache *__c, const void *__id, int __idlen, void *__buf, int __bufsize));
+extern void tlsscache_remove __((struct tlsscache *__c, const void *__id, int __idlen));
+extern int  tlsscache_tkeys  __((struct tlsscache *__c, long __lifetime, int (*__rand) __((unsigned char *, int)), struct tlsscache_tkey *__keys));
+
+#endif
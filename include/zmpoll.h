@@ -33,4 +33,41 @@ extern int zmpoll __((struct zmpollfd *__fds, int __nfds, long __timeout));
     for both directions, both fds must be same.  */
 extern int zmpoll_addfd __((struct zmpollfd **fdsp, int* nfdsp, int rdfd, int wrfd, struct zmpollfd **backptr));
 
+
+/*
+ *  Persistent event sets -- "zmpollset"
+ *
+ *  Long-lived servers with lots of descriptors (scheduler with its
+ *  transport agents, smtpserver subdaemons with their clients, router
+ *  with its children) register each fd once, change the interest
+ *  mask only when it really changes, and remove the fd before they
+ *  close() it.  Backend is epoll(7) where available, otherwise poll(2)
+ *  over an array that is maintained incrementally.
+ *
+ *  zmpollset_add() on an fd already in the set replaces its mask and
+ *  cookie.  An interest mask of zero keeps the fd known, but parks it
+ *  away from the kernel.  zmpollset_wait() can also carry a small
+ *  transient zmpollfd array (built by zmpoll_addfd()) for those
+ *  callers that still prepare some of their fds per pass; their
+ *  'revents' are filled in place.  Events of the persistent set are
+ *  collected with zmpollset_events() after the wait.
+ */
+
+struct zmpollset;  /* Opaque */
+
+struct zmpollev {
+  int   fd;
+  short revents;
+  void *cookie;
+};
+
+extern struct zmpollset *zmpollset_new __((int sizehint));
+extern void zmpollset_free   __((struct zmpollset *__set));
+extern int  zmpollset_add    __((struct zmpollset *__set, int __fd, int __events, void *__cookie));
+extern int  zmpollset_mod    __((struct zmpollset *__set, int __fd, int __events));
+extern int  zmpollset_del    __((struct zmpollset *__set, int __fd));
+extern int  zmpollset_count  __((struct zmpollset *__set));
+extern int  zmpollset_wait   __((struct zmpollset *__set, struct zmpollfd *__xfds, int __nxfds, long __timeout));
+extern struct zmpollev *zmpollset_events __((struct zmpollset *__set, int *__nevp));
+
 #endif
@@ -101,6 +101,9 @@ out:
 #endif	/* notdef */
 	umask(022); /* clear any inherited file mode creation mask */
 
+	/* Count no more into the slab of the parent, which exited */
+	Z_SHM_MIB_Forked();
+
 	/* Clean out our environment from personal contamination */
 	cleanenv();
 
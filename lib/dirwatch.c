@@ -0,0 +1,281 @@
+/*
+ *  dirwatch -- A routine for ZMailer  libz.a -library.
+ *
+ *  Spool directory change notifications for the router and the
+ *  scheduler.  See  include/dirwatch.h  for the interface.
+ */
+
+#include "hostenv.h"
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_DIRENT_H
+# include <dirent.h>
+#else /* not HAVE_DIRENT_H */
+# define dirent direct
+# ifdef HAVE_SYS_NDIR_H
+#  include <sys/ndir.h>
+# endif /* HAVE_SYS_NDIR_H */
+# ifdef HAVE_SYS_DIR_H
+#  include <sys/dir.h>
+# endif /* HAVE_SYS_DIR_H */
+# ifdef HAVE_NDIR_H
+#  include <ndir.h>
+# endif /* HAVE_NDIR_H */
+#endif /* HAVE_DIRENT_H */
+
+#include "dirwatch.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+
+/*
+ *  The watch descriptors from the kernel are small integers, thus
+ *  the directory names are kept at  dw->dirs[wd]  -- much like the
+ *  zmpollset keeps its slots indexed by the fd.
+ */
+
+struct dirwatch {
+  int    fd;		/* The inotify instance			*/
+  int    ndirs;		/* size of dirs[] -- indexed by wd	*/
+  char **dirs;
+  int    count;		/* watches in use			*/
+};
+
+#define DIRWATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR)
+
+
+struct dirwatch *dirwatch_open()
+{
+	struct dirwatch *dw;
+	int fd;
+
+	fd = inotify_init();
+	if (fd < 0) return NULL; /* ENOSYS, EMFILE, ... */
+
+	dw = calloc(1, sizeof(*dw));
+	if (!dw) {
+	  close(fd);
+	  return NULL;
+	}
+	dw->fd = fd;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#if defined(F_SETFD)
+	fcntl(fd, F_SETFD, 1); /* close-on-exec */
+#endif
+	return dw;
+}
+
+void dirwatch_close(dw)
+	struct dirwatch *dw;
+{
+	int i;
+
+	if (!dw) return;
+	close(dw->fd);
+	for (i = 0; i < dw->ndirs; ++i)
+	  if (dw->dirs[i]) free(dw->dirs[i]);
+	if (dw->dirs) free(dw->dirs);
+	free(dw);
+}
+
+int dirwatch_fd(dw)
+	struct dirwatch *dw;
+{
+	return dw->fd;
+}
+
+int dirwatch_count(dw)
+	struct dirwatch *dw;
+{
+	return dw->count;
+}
+
+int dirwatch_add(dw, dir)
+	struct dirwatch *dw;
+	const char *dir;
+{
+	int wd;
+	char *s;
+
+	wd = inotify_add_watch(dw->fd, dir, DIRWATCH_MASK);
+	if (wd < 0) return -1;
+
+	if (wd >= dw->ndirs) {
+	  int n = dw->ndirs ? dw->ndirs : 32;
+	  char **d;
+	  while (n <= wd) n <<= 1;
+	  d = realloc(dw->dirs, sizeof(*d) * n);
+	  if (!d) {
+	    inotify_rm_watch(dw->fd, wd);
+	    errno = ENOMEM;
+	    return -1;
+	  }
+	  memset(d + dw->ndirs, 0, sizeof(*d) * (n - dw->ndirs));
+	  dw->dirs  = d;
+	  dw->ndirs = n;
+	}
+
+	s = strdup(dir);
+	if (!s) {
+	  inotify_rm_watch(dw->fd, wd);
+	  errno = ENOMEM;
+	  return -1;
+	}
+
+	/* The same directory again gives the same wd back */
+	if (dw->dirs[wd])
+	  free(dw->dirs[wd]);
+	else
+	  dw->count += 1;
+	dw->dirs[wd] = s;
+
+	return 0;
+}
+
+int dirwatch_read(dw, fn, ctx)
+	struct dirwatch *dw;
+	dirwatch_fn fn;
+	void *ctx;
+{
+	/* Room for dozens of events with names of at most NAME_MAX */
+	long buf[ (64 * (sizeof(struct inotify_event) + 256)) / sizeof(long) ];
+	struct inotify_event *ev;
+	char *p;
+	int rc, cnt = 0, overflow = 0;
+
+	for (;;) {
+	  rc = read(dw->fd, buf, sizeof(buf));
+	  if (rc < 0 && errno == EINTR)
+	    continue;
+	  if (rc <= 0)
+	    break; /* EAGAIN -- all read */
+
+	  for (p = (char *)buf; p < (char *)buf + rc;
+	       p += sizeof(*ev) + ev->len) {
+	    ev = (struct inotify_event *)p;
+
+	    if (ev->mask & IN_Q_OVERFLOW) {
+	      overflow = 1;
+	      continue;
+	    }
+	    if (ev->wd < 0 || ev->wd >= dw->ndirs || !dw->dirs[ev->wd])
+	      continue;
+
+	    if (ev->mask & IN_IGNORED) {
+	      /* The directory is gone, or the watch was removed */
+	      free(dw->dirs[ev->wd]);
+	      dw->dirs[ev->wd] = NULL;
+	      dw->count -= 1;
+	      continue;
+	    }
+	    if (ev->len == 0 || ev->name[0] == 0)
+	      continue;
+
+	    if (ev->mask & IN_ISDIR) {
+	      if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		fn(ctx, dw->dirs[ev->wd], ev->name, 1);
+		++cnt;
+	      }
+	    } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+	      fn(ctx, dw->dirs[ev->wd], ev->name, 0);
+	      ++cnt;
+	    }
+	  }
+	}
+
+	return overflow ? -1 : cnt;
+}
+
+#else /* No  <sys/inotify.h>  */
+
+struct dirwatch *dirwatch_open()
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void dirwatch_close(dw)
+	struct dirwatch *dw;
+{
+}
+
+int dirwatch_fd(dw)
+	struct dirwatch *dw;
+{
+	return -1;
+}
+
+int dirwatch_count(dw)
+	struct dirwatch *dw;
+{
+	return 0;
+}
+
+int dirwatch_add(dw, dir)
+	struct dirwatch *dw;
+	const char *dir;
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int dirwatch_read(dw, fn, ctx)
+	struct dirwatch *dw;
+	dirwatch_fn fn;
+	void *ctx;
+{
+	return -1;
+}
+
+#endif
+
+
+/*
+ *  Watch the 'dir', and its "A" .. "Z" hash directories, two levels
+ *  of them below the 'level' at most.  Returns -1 with the errno of
+ *  the first directory that could not be watched.
+ */
+int dirwatch_tree(dw, dir, level)
+	struct dirwatch *dw;
+	const char *dir;
+	int level;
+{
+	DIR *dirp;
+	struct dirent *dp;
+	struct stat stbuf;
+	char file[MAXNAMLEN+1];
+	int rc = 0;
+
+	if (dirwatch_add(dw, dir) < 0)
+	  return -1;
+	if (level >= 2)
+	  return 0;
+
+	dirp = opendir(dir);
+	if (!dirp) return 0;
+
+	for (dp = readdir(dirp); dp != NULL; dp = readdir(dirp)) {
+	  if (dp->d_name[0] < 'A' || dp->d_name[0] > 'Z' ||
+	      dp->d_name[1] != 0)
+	    continue;
+	  if (dir[0] == '.' && dir[1] == 0)
+	    strcpy(file, dp->d_name);
+	  else
+	    snprintf(file, sizeof(file), "%s/%s", dir, dp->d_name);
+	  if (lstat(file,&stbuf) != 0 || !S_ISDIR(stbuf.st_mode))
+	    continue;
+	  if (dirwatch_tree(dw, file, level+1) < 0) {
+	    rc = -1;
+	    break;
+	  }
+	}
+	closedir(dirp);
+
+	return rc;
+}
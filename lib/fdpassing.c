@@ -176,6 +176,131 @@ int fdpass_sendfd(passfd, sendfd)
 }
 
 
+/*
+ *  Message sockets: each send is one record, thus several processes
+ *  can share the sending end without interleaving their messages.
+ */
+
+int fdpass_create_msgsock(tochild)
+     int tochild[2];
+{
+#ifdef SOCK_SEQPACKET
+	int rc = socketpair(PF_UNIX, SOCK_SEQPACKET, 0, tochild);
+#else
+	int rc = socketpair(PF_UNIX, SOCK_DGRAM, 0, tochild);
+#endif
+	if (rc == 0 && tochild[0] >= 0)
+	  fcntl(tochild[0], F_SETFD, FD_CLOEXEC);
+	if (rc == 0 && tochild[1] >= 0)
+	  fcntl(tochild[1], F_SETFD, FD_CLOEXEC);
+
+	return rc;
+}
+
+/* Like fdpass_sendfd(), but with 'len' bytes of data in the same record */
+int fdpass_sendmsg(passfd, sendfd, buf, len)
+     int passfd, sendfd;
+     const void *buf;
+     int len;
+{
+	struct msghdr msg;
+	struct iovec iov[1];
+	int rc;
+
+#ifdef CMSG_SPACE /* HAVE_MSGHDR_MSG_CONTROL */
+	union {
+	  struct cmsghdr cm;
+	  char	control[CMSG_SPACE(sizeof(int))];
+	} control_un;
+	struct cmsghdr *cmptr;
+
+	msg.msg_control    = control_un.control;
+	msg.msg_controllen = sizeof(control_un.control);
+
+	cmptr = CMSG_FIRSTHDR(&msg);
+	cmptr->cmsg_len   =  CMSG_LEN(sizeof(int));
+	cmptr->cmsg_level = SOL_SOCKET;
+	cmptr->cmsg_type  = SCM_RIGHTS;
+	*((int*) CMSG_DATA(cmptr)) = sendfd;
+#else
+	msg.msg_accrights    = (void*) &sendfd;
+	msg.msg_accrightslen = sizeof(sendfd);
+#endif
+
+	msg.msg_name    = NULL;
+	msg.msg_namelen = 0;
+
+	iov[0].iov_base = (void*) buf;
+	iov[0].iov_len  = len;
+	msg.msg_iov     = iov;
+	msg.msg_iovlen  = 1;
+
+	errno = 0;
+	rc = sendmsg(passfd, &msg, 0);
+	if (rc == len) return 0;
+	return -1;
+}
+
+/* Receive one record from  fdpass_sendmsg(),  returns its size */
+int fdpass_receivemsg(fd, newfdp, buf, len)
+     int fd;
+     int *newfdp;
+     void *buf;
+     int len;
+{
+	int n;
+	struct iovec iov[1];
+	struct msghdr msg;
+
+#ifdef CMSG_SPACE /* HAVE_MSGHDR_MSG_CONTROL */
+	union {
+	  struct cmsghdr cm;
+	  char control[CMSG_SPACE(sizeof(int))];
+	} control_un;
+	struct cmsghdr *cmptr;
+
+	msg.msg_control = control_un.control;
+	msg.msg_controllen = sizeof(control_un.control);
+#else
+	int newfd;	
+
+	msg.msg_accrights    = (void*) &newfd;
+	msg.msg_accrightslen = sizeof(newfd);
+#endif
+
+	msg.msg_name  = NULL;
+	msg.msg_namelen = 0;
+
+	iov[0].iov_base = buf;
+	iov[0].iov_len  = len;
+
+	msg.msg_iov     = iov;
+	msg.msg_iovlen  = 1;
+
+	*newfdp = -1;
+
+	n = recvmsg(fd,  &msg, 0);
+	if (n <= 0)  return n;
+
+#ifdef CMSG_SPACE /* HAVE_MSGHDR_MSG_CONTROL */
+	cmptr = CMSG_FIRSTHDR(&msg);
+	if (cmptr  &&  cmptr->cmsg_len == CMSG_LEN(sizeof(int))) {
+	  if ( (cmptr->cmsg_level == SOL_SOCKET) &&
+	       (cmptr->cmsg_type  == SCM_RIGHTS) ) {
+	    *newfdp = *((int*) CMSG_DATA(cmptr));
+	    fcntl(*newfdp, F_SETFD, FD_CLOEXEC);
+	  }
+	}
+#else
+	if (msg.msg_accrightslen == sizeof(int)) {
+	  *newfdp = newfd;
+	  fcntl(*newfdp, F_SETFD, FD_CLOEXEC);
+	}
+#endif
+	return n;
+}
+
+
 #else
 
 FIXME:FIXME:FIXME:  Can not handle here a case without AF_UNIX sockets!
@@ -0,0 +1,460 @@
+/*
+ *  taring -- A routine for ZMailer  libz.a -library.
+ *
+ *  Shared memory job rings in between the scheduler and transport
+ *  agents.  See  include/taring.h  for the interface.
+ */
+
+#include "hostenv.h"
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <sys/stat.h>
+
+#include "taring.h"
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define taring_barrier() __sync_synchronize()
+#endif
+
+#if defined(HAVE_SYS_EVENTFD_H) && defined(HAVE_MMAP) && defined(taring_barrier)
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+/*
+ *  The memory has a header page, and then the data areas of the
+ *  DOWN and UP queues.  The positions are free-running byte counts;
+ *  the producer moves only the 'head', and the consumer only the
+ *  'tail', each on its own cache line.
+ */
+
+#define TARING_MAGIC	0x7a6d5231	/* "zmR1" */
+#define TARING_HDRSIZE	4096
+
+struct taring_queue {
+	volatile unsigned int head;	/* Producer's position		*/
+	volatile unsigned int sleeping;	/* Consumer waits at its eventfd */
+	char	pad1[64 - 2*sizeof(int)];
+	volatile unsigned int tail;	/* Consumer's position		*/
+	char	pad2[64 - sizeof(int)];
+};
+
+struct taring_shm {
+	unsigned int	magic;
+	unsigned int	size;		/* Of each data area, power of 2 */
+	char		pad[64 - 2*sizeof(int)];
+	struct taring_queue q[2];
+};
+
+struct taring {
+	struct taring_shm *shm;
+	int	mapsize;
+	int	memfd;		/* Until handed to the child	*/
+	int	efd[2];		/* efd[TARING_DOWN] wakes the TA,
+				   efd[TARING_UP] the scheduler	*/
+	int	out, in;	/* Our queues			*/
+};
+
+#define RECALIGN(x) (((x) + 7) & ~7)
+
+static char *taring_data __((struct taring *, int));
+static char *taring_data(r, dir)
+	struct taring *r;
+	int dir;
+{
+	return (char *)r->shm + TARING_HDRSIZE + dir * r->shm->size;
+}
+
+struct taring *taring_create(size)
+	int size;
+{
+	struct taring *r;
+	const char *dirs[2];
+	char path[64];
+	int i, n, fd = -1;
+
+	for (n = 4096; n < size && n < (1 << 24); n <<= 1)
+	  ;
+
+	r = calloc(1, sizeof(*r));
+	if (!r) return NULL;
+	r->efd[0] = r->efd[1] = -1;
+	r->out = TARING_DOWN;
+	r->in  = TARING_UP;
+	r->mapsize = TARING_HDRSIZE + 2 * n;
+
+	/* A file that nobody can find; it lives as long as
+	   there are fds and mappings of it. */
+	dirs[0] = "/dev/shm";
+	dirs[1] = "/tmp";
+	for (i = 0; i < 2 && fd < 0; ++i) {
+	  sprintf(path, "%s/.zmtaring.XXXXXX", dirs[i]);
+	  fd = mkstemp(path);
+	  if (fd >= 0)
+	    unlink(path);
+	}
+	if (fd < 0) goto fail;
+	r->memfd = fd;
+#if defined(F_SETFD)
+	fcntl(fd, F_SETFD, 1); /* close-on-exec */
+#endif
+
+	if (ftruncate(fd, r->mapsize) < 0) goto fail;
+	r->shm = (struct taring_shm *) mmap(NULL, r->mapsize,
+					    PROT_READ|PROT_WRITE,
+					    MAP_SHARED, fd, 0);
+	if ((void *)r->shm == MAP_FAILED) {
+	  r->shm = NULL;
+	  goto fail;
+	}
+	memset(r->shm, 0, TARING_HDRSIZE);
+	r->shm->size  = n;
+	r->shm->magic = TARING_MAGIC;
+	/* The scheduler waits at its fd from the start, thus
+	   the first "#hungry" must wake it up. */
+	r->shm->q[TARING_UP].sleeping = 1;
+
+	for (i = 0; i < 2; ++i) {
+	  r->efd[i] = eventfd(0, 0);
+	  if (r->efd[i] < 0) goto fail;
+#if defined(F_SETFD)
+	  fcntl(r->efd[i], F_SETFD, 1); /* close-on-exec */
+#endif
+	}
+	/* We only peek at the one that wakes us */
+	fcntl(r->efd[TARING_UP], F_SETFL,
+	      fcntl(r->efd[TARING_UP], F_GETFL, 0) | O_NONBLOCK);
+
+	return r;
+
+ fail:
+	r->memfd = fd;
+	taring_free(r);
+	return NULL;
+}
+
+/* In the forked child, before the exec of the TA */
+void taring_child(r)
+	struct taring *r;
+{
+	int i, fds[3];
+
+	/* First out of the way of each other ... */
+	fds[0] = fcntl(r->memfd, F_DUPFD, TARING_FD + 3);
+	fds[1] = fcntl(r->efd[TARING_DOWN], F_DUPFD, TARING_FD + 3);
+	fds[2] = fcntl(r->efd[TARING_UP],   F_DUPFD, TARING_FD + 3);
+
+	/* ... and then into their places, without close-on-exec */
+	for (i = 0; i < 3; ++i) {
+	  dup2(fds[i], TARING_FD + i);
+	  close(fds[i]);
+	}
+}
+
+/* In the scheduler after the fork */
+void taring_parent(r)
+	struct taring *r;
+{
+	if (r->memfd >= 0)
+	  close(r->memfd);
+	r->memfd = -1;
+}
+
+struct taring *taring_attach()
+{
+	struct taring *r;
+	struct stat stbuf;
+	const char *s = getenv(TARING_ENV);
+	int fd;
+
+	if (!s) return NULL;
+	fd = atoi(s);
+	if (fd < 0 || fstat(fd, &stbuf) < 0 ||
+	    stbuf.st_size < TARING_HDRSIZE + 2 * 4096)
+	  return NULL;
+
+	r = calloc(1, sizeof(*r));
+	if (!r) return NULL;
+	r->memfd   = -1;
+	r->out     = TARING_UP;
+	r->in      = TARING_DOWN;
+	r->efd[TARING_DOWN] = fd + 1;
+	r->efd[TARING_UP]   = fd + 2;
+	r->mapsize = stbuf.st_size;
+
+	r->shm = (struct taring_shm *) mmap(NULL, r->mapsize,
+					    PROT_READ|PROT_WRITE,
+					    MAP_SHARED, fd, 0);
+	close(fd);
+	if ((void *)r->shm == MAP_FAILED ||
+	    r->shm->magic != TARING_MAGIC ||
+	    r->mapsize != TARING_HDRSIZE + 2 * r->shm->size) {
+	  if ((void *)r->shm != MAP_FAILED)
+	    munmap((void *)r->shm, r->mapsize);
+	  free(r);
+	  return NULL;
+	}
+
+	fcntl(r->efd[TARING_DOWN], F_SETFL,
+	      fcntl(r->efd[TARING_DOWN], F_GETFL, 0) | O_NONBLOCK);
+#if defined(F_SETFD)
+	fcntl(r->efd[0], F_SETFD, 1); /* close-on-exec */
+	fcntl(r->efd[1], F_SETFD, 1);
+#endif
+	return r;
+}
+
+void taring_free(r)
+	struct taring *r;
+{
+	if (!r) return;
+	if (r->shm)
+	  munmap((void *)r->shm, r->mapsize);
+	if (r->memfd  >= 0) close(r->memfd);
+	if (r->efd[0] >= 0) close(r->efd[0]);
+	if (r->efd[1] >= 0) close(r->efd[1]);
+	free(r);
+}
+
+/* The fd to poll for our incoming records */
+int taring_fd(r)
+	struct taring *r;
+{
+	return r->efd[r->in];
+}
+
+/*
+ *  Put a record into our outgoing queue; -1 with EAGAIN when it
+ *  does not fit now, with E2BIG when it never will.
+ */
+int taring_put(r, type, id0, id1, nstr, str)
+	struct taring *r;
+	int type, id0, id1, nstr;
+	const char **str;
+{
+	struct taring_queue *q = &r->shm->q[r->out];
+	unsigned int size = r->shm->size;
+	unsigned int head, tail, off, contig, need, len;
+	struct taring_rec *rec;
+	char *data = taring_data(r, r->out);
+	char *p;
+	int i, l;
+
+	len = sizeof(*rec);
+	for (i = 0; i < nstr; ++i)
+	  len += strlen(str[i]) + 1;
+	len = RECALIGN(len);
+	if (nstr > TARING_MAXSTR || len > size / 2) {
+	  errno = E2BIG;
+	  return -1;
+	}
+
+	head = q->head;
+	tail = q->tail;
+	off = head & (size - 1);
+	contig = size - off;
+	need = (len > contig) ? contig + len : len;
+	if (size - (head - tail) < need) {
+	  errno = EAGAIN;
+	  return -1;
+	}
+
+	if (len > contig) {
+	  /* Does not fit at the end, skip over it */
+	  rec = (struct taring_rec *)(data + off);
+	  rec->len  = contig;
+	  rec->type = TARING_PAD;
+	  head += contig;
+	  off = 0;
+	}
+
+	rec = (struct taring_rec *)(data + off);
+	rec->len   = len;
+	rec->type  = type;
+	rec->nstr  = nstr;
+	rec->id[0] = id0;
+	rec->id[1] = id1;
+	p = (char *)(rec + 1);
+	for (i = 0; i < nstr; ++i) {
+	  l = strlen(str[i]) + 1;
+	  memcpy(p, str[i], l);
+	  p += l;
+	}
+
+	/* The record is complete before the head moves past it,
+	   and the head has moved before we look at the sleeper. */
+	taring_barrier();
+	q->head = head + len;
+	taring_barrier();
+
+	if (q->sleeping) {
+	  eventfd_t one = 1;
+	  q->sleeping = 0;
+	  while (write(r->efd[r->out], &one, sizeof(one)) < 0 &&
+		 errno == EINTR)
+	    ;
+	}
+	return 0;
+}
+
+/*
+ *  Copy the next incoming record into 'm'; returns 1 for a record,
+ *  0 when the queue is empty, and -1 when it is corrupted.
+ */
+int taring_get(r, m)
+	struct taring *r;
+	struct taring_msg *m;
+{
+	struct taring_queue *q = &r->shm->q[r->in];
+	unsigned int size = r->shm->size;
+	unsigned int head, tail, off, len, l;
+	struct taring_rec rec;
+	char *data = taring_data(r, r->in);
+	char *p, *e;
+	int i;
+
+	for (;;) {
+	  head = q->head;
+	  tail = q->tail;
+	  taring_barrier();
+	  if (head == tail)
+	    return 0;
+
+	  off = tail & (size - 1);
+	  memcpy(&rec, data + off, sizeof(rec.len) + 2*sizeof(short));
+	  len = rec.len;
+	  if (len < 8 || (len & 7) || len > size - off || len > head - tail) {
+	    errno = EINVAL;
+	    return -1;
+	  }
+	  if (rec.type != TARING_PAD)
+	    break;
+	  taring_barrier();
+	  q->tail = tail + len;
+	}
+
+	if (len < sizeof(rec) || rec.nstr > TARING_MAXSTR) {
+	  errno = EINVAL;
+	  return -1;
+	}
+	memcpy(&rec, data + off, sizeof(rec));
+
+	l = len - sizeof(rec);
+	if (m->bufspace < l + 1) {
+	  p = realloc(m->buf, l + 1);
+	  if (!p) return -1;
+	  m->buf = p;
+	  m->bufspace = l + 1;
+	}
+	memcpy(m->buf, data + off + sizeof(rec), l);
+	m->buf[l] = 0;
+
+	/* Our copy is complete before the space is given back */
+	taring_barrier();
+	q->tail = tail + len;
+
+	/* The strings must be within the record */
+	m->type  = rec.type;
+	m->id[0] = rec.id[0];
+	m->id[1] = rec.id[1];
+	m->nstr  = rec.nstr;
+	p = m->buf;
+	e = m->buf + l;
+	for (i = 0; i < m->nstr; ++i) {
+	  m->str[i] = p;
+	  while (p < e && *p) ++p;
+	  if (p >= e) {
+	    errno = EINVAL;
+	    return -1;
+	  }
+	  ++p;
+	}
+	for (; i < TARING_MAXSTR; ++i)
+	  m->str[i] = "";
+
+	return 1;
+}
+
+/*
+ *  The consumer is going to wait for its fd.  Returns 1 if records
+ *  arrived meanwhile -- then it must not sleep, but read them.
+ */
+int taring_sleep(r)
+	struct taring *r;
+{
+	struct taring_queue *q = &r->shm->q[r->in];
+	eventfd_t cnt;
+
+	/* Eat the wakeups that we have seen already */
+	while (read(r->efd[r->in], &cnt, sizeof(cnt)) > 0)
+	  ;
+
+	q->sleeping = 1;
+	taring_barrier();
+	if (q->head != q->tail) {
+	  q->sleeping = 0;
+	  return 1;
+	}
+	return 0;
+}
+
+#else /* No eventfd(), mmap(), or memory barriers */
+
+struct taring *taring_create(size)
+	int size;
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+struct taring *taring_attach()
+{
+	return NULL;
+}
+
+void taring_free(r)
+	struct taring *r;
+{
+}
+
+void taring_child(r)
+	struct taring *r;
+{
+}
+
+void taring_parent(r)
+	struct taring *r;
+{
+}
+
+int taring_fd(r)
+	struct taring *r;
+{
+	return -1;
+}
+
+int taring_put(r, type, id0, id1, nstr, str)
+	struct taring *r;
+	int type, id0, id1, nstr;
+	const char **str;
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int taring_get(r, m)
+	struct taring *r;
+	struct taring_msg *m;
+{
+	return -1;
+}
+
+int taring_sleep(r)
+	struct taring *r;
+{
+	return 1;
+}
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ *  tlsscache -- A routine for ZMailer  libz.a -library.
+ *
+ *  Shared TLS session cache in a memory mapped file.
+ *  See  include/tlsscache.h  for the interface.
+ */
+
+#include "hostenv.h"
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <sys/stat.h>
+
+#include "tlsscache.h"
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+
+/*
+ *  The file has a header page, and then the slots.  A slot is free
+ *  when its 'expire' is zero or in the past.  The record locks are
+ *  on the bytes of the header page:  byte N for the stripe N of the
+ *  sets, and byte TLSSCACHE_STRIPES for the ticket keys and for the
+ *  initialization of the file.
+ */
+
+#define TLSSCACHE_MAGIC		0x7a6d5331	/* "zmS1" */
+#define TLSSCACHE_HDRSIZE	4096
+#define TLSSCACHE_GLOBAL	TLSSCACHE_STRIPES
+
+struct tlsscache_slot {
+	time_t		expire;
+	time_t		stored;
+	unsigned short	idlen;
+	unsigned short	datalen;
+	unsigned char	id[TLSSCACHE_IDMAX];
+	/* ... and the data up to TLSSCACHE_SLOTSIZE */
+};
+
+#define TLSSCACHE_DATAMAX ((int)(TLSSCACHE_SLOTSIZE - sizeof(struct tlsscache_slot)))
+
+struct tlsscache_shm {
+	unsigned int	magic;
+	unsigned int	slots;
+	time_t		tkey_time;	/* When tkey[0] was made, 0: never */
+	struct tlsscache_tkey tkey[2];	/* The current, and the previous */
+};
+
+struct tlsscache {
+	struct tlsscache_shm *shm;
+	int	mapsize;
+	int	nsets;
+	int	fd;
+};
+
+#define SLOT(c,i) ((struct tlsscache_slot *) \
+		   ((char *)(c)->shm + TLSSCACHE_HDRSIZE + (i) * TLSSCACHE_SLOTSIZE))
+
+static int scache_lock __((struct tlsscache *, int, int));
+static int scache_lock(c, which, type)
+	struct tlsscache *c;
+	int which, type;
+{
+	struct flock fl;
+
+	fl.l_type   = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start  = which;
+	fl.l_len    = 1;
+	while (fcntl(c->fd, F_SETLKW, &fl) < 0)
+	  if (errno != EINTR)
+	    return -1;
+	return 0;
+}
+
+/* FNV-1a; the keys are short, and the client ones much alike */
+static unsigned int scache_hash __((const void *, int));
+static unsigned int scache_hash(id, idlen)
+	const void *id;
+	int idlen;
+{
+	const unsigned char *p = id;
+	unsigned int h = 2166136261U;
+
+	while (idlen-- > 0)
+	  h = (h ^ *p++) * 16777619U;
+	return h ^ (h >> 15);
+}
+
+/* The first slot of the set of the key, and lock its stripe */
+static int scache_set __((struct tlsscache *, const void *, int, int));
+static int scache_set(c, id, idlen, type)
+	struct tlsscache *c;
+	const void *id;
+	int idlen, type;
+{
+	int set = scache_hash(id, idlen) % c->nsets;
+
+	if (scache_lock(c, set % TLSSCACHE_STRIPES, type) < 0)
+	  return -1;
+	return set * TLSSCACHE_WAYS;
+}
+
+static void scache_unlock __((struct tlsscache *, int));
+static void scache_unlock(c, first)
+	struct tlsscache *c;
+	int first;
+{
+	scache_lock(c, (first / TLSSCACHE_WAYS) % TLSSCACHE_STRIPES, F_UNLCK);
+}
+
+struct tlsscache *tlsscache_open(path, slots)
+	const char *path;
+	int slots;
+{
+	struct tlsscache *c;
+	struct tlsscache_shm hdr;
+	struct stat stbuf;
+	int fd;
+
+	if (slots <= 0)
+	  slots = TLSSCACHE_SLOTS;
+	slots = (slots + TLSSCACHE_WAYS - 1) & ~(TLSSCACHE_WAYS - 1);
+
+	fd = open(path, O_RDWR|O_CREAT, 0600);
+	if (fd < 0) return NULL;
+#if defined(F_SETFD)
+	fcntl(fd, F_SETFD, 1); /* close-on-exec */
+#endif
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+	  close(fd);
+	  return NULL;
+	}
+	c->fd = fd;
+
+	/* The first one in makes the file; the others use the
+	   size that it has, whatever they asked for. */
+	if (scache_lock(c, TLSSCACHE_GLOBAL, F_WRLCK) < 0)
+	  goto fail;
+	if (fstat(fd, &stbuf) < 0)
+	  goto fail_unlock;
+	memset(&hdr, 0, sizeof(hdr));
+	if (stbuf.st_size >= TLSSCACHE_HDRSIZE &&
+	    lseek(fd, 0, SEEK_SET) == 0 &&
+	    read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+	    hdr.magic == TLSSCACHE_MAGIC && hdr.slots > 0 &&
+	    stbuf.st_size == (TLSSCACHE_HDRSIZE +
+			      (off_t)hdr.slots * TLSSCACHE_SLOTSIZE)) {
+	  slots = hdr.slots;
+	} else {
+	  memset(&hdr, 0, sizeof(hdr));
+	  hdr.magic = TLSSCACHE_MAGIC;
+	  hdr.slots = slots;
+	  if (ftruncate(fd, 0) < 0 ||
+	      ftruncate(fd, TLSSCACHE_HDRSIZE +
+			(off_t)slots * TLSSCACHE_SLOTSIZE) < 0 ||
+	      lseek(fd, 0, SEEK_SET) != 0 ||
+	      write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+	    goto fail_unlock;
+	}
+
+	c->nsets   = slots / TLSSCACHE_WAYS;
+	c->mapsize = TLSSCACHE_HDRSIZE + slots * TLSSCACHE_SLOTSIZE;
+	c->shm = (struct tlsscache_shm *) mmap(NULL, c->mapsize,
+					       PROT_READ|PROT_WRITE,
+					       MAP_SHARED, fd, 0);
+	if ((void *)c->shm == MAP_FAILED) {
+	  c->shm = NULL;
+	  goto fail_unlock;
+	}
+	scache_lock(c, TLSSCACHE_GLOBAL, F_UNLCK);
+	return c;
+
+ fail_unlock:
+	scache_lock(c, TLSSCACHE_GLOBAL, F_UNLCK);
+ fail:
+	close(fd);
+	free(c);
+	return NULL;
+}
+
+void tlsscache_close(c)
+	struct tlsscache *c;
+{
+	if (!c) return;
+	if (c->shm)
+	  munmap((void *)c->shm, c->mapsize);
+	close(c->fd);
+	free(c);
+}
+
+/*
+ *  Store the data, in place of the same key if it is there, or else
+ *  in a free slot of the set, or else in place of the oldest one.
+ */
+int tlsscache_store(c, id, idlen, data, datalen, expire)
+	struct tlsscache *c;
+	const void *id, *data;
+	int idlen, datalen;
+	time_t expire;
+{
+	struct tlsscache_slot *s, *victim = NULL;
+	time_t now = time(NULL);
+	int i, first;
+
+	if (!c || idlen <= 0 || idlen > TLSSCACHE_IDMAX ||
+	    datalen < 0 || datalen > TLSSCACHE_DATAMAX) {
+	  errno = EINVAL;
+	  return -1;
+	}
+	if ((first = scache_set(c, id, idlen, F_WRLCK)) < 0)
+	  return -1;
+
+	for (i = 0; i < TLSSCACHE_WAYS; ++i) {
+	  s = SLOT(c, first + i);
+	  if (s->idlen == idlen && memcmp(s->id, id, idlen) == 0) {
+	    victim = s;
+	    break;
+	  }
+	  if (victim == NULL || (victim->expire > now &&
+				 (s->expire <= now ||
+				  s->stored < victim->stored)))
+	    victim = s;
+	}
+
+	victim->stored  = now;
+	victim->expire  = expire;
+	victim->idlen   = idlen;
+	victim->datalen = datalen;
+	memcpy(victim->id, id, idlen);
+	memcpy((char *)(victim + 1), data, datalen);
+
+	scache_unlock(c, first);
+	return 0;
+}
+
+/*
+ *  Copy the data of the key into the buffer, and return its length,
+ *  or -1 when there is no such (live) key, or it does not fit in.
+ */
+int tlsscache_fetch(c, id, idlen, buf, bufsize)
+	struct tlsscache *c;
+	const void *id;
+	void *buf;
+	int idlen, bufsize;
+{
+	struct tlsscache_slot *s;
+	time_t now = time(NULL);
+	int i, first, len = -1;
+
+	if (!c || idlen <= 0 || idlen > TLSSCACHE_IDMAX) {
+	  errno = EINVAL;
+	  return -1;
+	}
+	if ((first = scache_set(c, id, idlen, F_RDLCK)) < 0)
+	  return -1;
+
+	errno = ENOENT;
+	for (i = 0; i < TLSSCACHE_WAYS; ++i) {
+	  s = SLOT(c, first + i);
+	  if (s->expire > now && s->idlen == idlen &&
+	      memcmp(s->id, id, idlen) == 0) {
+	    if (s->datalen <= bufsize) {
+	      len = s->datalen;
+	      memcpy(buf, (char *)(s + 1), len);
+	    } else
+	      errno = ENOSPC;
+	    break;
+	  }
+	}
+
+	scache_unlock(c, first);
+	return len;
+}
+
+void tlsscache_remove(c, id, idlen)
+	struct tlsscache *c;
+	const void *id;
+	int idlen;
+{
+	struct tlsscache_slot *s;
+	int i, first;
+
+	if (!c || idlen <= 0 || idlen > TLSSCACHE_IDMAX)
+	  return;
+	if ((first = scache_set(c, id, idlen, F_WRLCK)) < 0)
+	  return;
+
+	for (i = 0; i < TLSSCACHE_WAYS; ++i) {
+	  s = SLOT(c, first + i);
+	  if (s->idlen == idlen && memcmp(s->id, id, idlen) == 0)
+	    s->expire = 0;
+	}
+
+	scache_unlock(c, first);
+}
+
+/*
+ *  The session ticket keys: keys[0] makes the new tickets, and both
+ *  keys[0] and keys[1] are good for the decryption.  When the current
+ *  key is 'lifetime' seconds old, whoever asks first makes a new one
+ *  with the 'rand' function (e.g. RAND_bytes()), and the current one
+ *  becomes the previous one.
+ */
+int tlsscache_tkeys(c, lifetime, rand, keys)
+	struct tlsscache *c;
+	long lifetime;
+	int (*rand) __((unsigned char *, int));
+	struct tlsscache_tkey *keys;
+{
+	struct tlsscache_shm *shm;
+	struct tlsscache_tkey newkey;
+	time_t now = time(NULL);
+
+	if (!c) {
+	  errno = EINVAL;
+	  return -1;
+	}
+	shm = c->shm;
+	if (scache_lock(c, TLSSCACHE_GLOBAL, F_WRLCK) < 0)
+	  return -1;
+
+	if (shm->tkey_time == 0 || now - shm->tkey_time >= lifetime ||
+	    now < shm->tkey_time) {
+	  if ((*rand)((unsigned char *)&newkey, sizeof(newkey)) <= 0) {
+	    scache_lock(c, TLSSCACHE_GLOBAL, F_UNLCK);
+	    errno = EAGAIN;
+	    return -1;
+	  }
+	  /* The old tickets are of no use after two lifetimes */
+	  if (shm->tkey_time != 0 && now - shm->tkey_time < 2 * lifetime)
+	    shm->tkey[1] = shm->tkey[0];
+	  else
+	    shm->tkey[1] = newkey;
+	  shm->tkey[0]   = newkey;
+	  shm->tkey_time = now;
+	}
+	keys[0] = shm->tkey[0];
+	keys[1] = shm->tkey[1];
+
+	scache_lock(c, TLSSCACHE_GLOBAL, F_UNLCK);
+	return 0;
+}
+
+#else /* No mmap() */
+
+struct tlsscache *tlsscache_open(path, slots)
+	const char *path;
+	int slots;
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void tlsscache_close(c)
+	struct tlsscache *c;
+{
+}
+
+int tlsscache_store(c, id, idlen, data, datalen, expire)
+	struct tlsscache *c;
+	const void *id, *data;
+	int idlen, datalen;
+	time_t expire;
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int tlsscache_fetch(c, id, idlen, buf, bufsize)
+	struct tlsscache *c;
+	const void *id;
+	void *buf;
+	int idlen, bufsize;
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void tlsscache_remove(c, id, idlen)
+	struct tlsscache *c;
+	const void *id;
+	int idlen;
+{
+}
+
+int tlsscache_tkeys(c, lifetime, rand, keys)
+	struct tlsscache *c;
+	long lifetime;
+	int (*rand) __((unsigned char *, int));
+	struct tlsscache_tkey *keys;
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
@@ -151,3 +151,454 @@ int zmpoll_addfd(fdsp, nfdsp, rdfd, wrfd, backptr)
 
 	return 0; /* Hmm..  error indications ?  */
 }
+
+
+
+/*
+ *  Persistent event sets -- "zmpollset"
+ *
+ *  Every fd has a slot at  set->slots[fd]  telling its ZM_POLL* interest
+ *  mask, and the caller's cookie.  With epoll(7) the kernel keeps the
+ *  registrations, with poll(2) we keep a dense  struct pollfd  array of
+ *  those fds that have non-zero interest, so that a wait is just a
+ *  single  poll()  over it, without rebuilding anything.
+ */
+
+#ifdef HAVE_POLL
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+struct zmpollslot {
+  int   events;		/* ZM_POLL* interest mask, 0 = parked	*/
+  int   index;		/* poll(2): index at set->pfds[], or -1;
+			   epoll(7): 1 when known to the kernel	*/
+  int   inuse;
+  void *cookie;
+};
+
+struct zmpollset {
+  int    nslots;	/* size of slots[] -- indexed by fd	*/
+  struct zmpollslot *slots;
+  int    count;		/* fds in the set			*/
+
+  int    epfd;		/* >= 0 when running on epoll(7)	*/
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event *epevs;
+  int    epevspace;
+#endif
+
+  struct pollfd *pfds;	/* poll(2) array (+ transient fds)	*/
+  int    npfds;
+  int    pfdspace;
+
+  struct zmpollev *evs;	/* Results of the last wait		*/
+  int    nevs;
+  int    evspace;
+};
+
+
+static int zm2poll __((int));
+static int zm2poll(ev)
+	int ev;
+{
+	int r = 0;
+	if (ev & ZM_POLLIN)   r |= POLLIN;
+	if (ev & ZM_POLLPRI)  r |= POLLPRI;
+	if (ev & ZM_POLLOUT)  r |= POLLOUT;
+	return r;
+}
+
+static int poll2zm __((int));
+static int poll2zm(ev)
+	int ev;
+{
+	int r = 0;
+	if (ev & POLLIN)   r |= ZM_POLLIN;
+	if (ev & POLLPRI)  r |= ZM_POLLPRI;
+	if (ev & POLLOUT)  r |= ZM_POLLOUT;
+	if (ev & POLLERR)  r |= ZM_POLLERR;
+	if (ev & POLLHUP)  r |= ZM_POLLHUP;
+	if (ev & POLLNVAL) r |= ZM_POLLNVAL;
+	return r;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static int zm2epoll __((int));
+static int zm2epoll(ev)
+	int ev;
+{
+	int r = 0;
+	if (ev & ZM_POLLIN)   r |= EPOLLIN;
+	if (ev & ZM_POLLPRI)  r |= EPOLLPRI;
+	if (ev & ZM_POLLOUT)  r |= EPOLLOUT;
+	return r;
+}
+
+static int epoll2zm __((int));
+static int epoll2zm(ev)
+	int ev;
+{
+	int r = 0;
+	if (ev & EPOLLIN)   r |= ZM_POLLIN;
+	if (ev & EPOLLPRI)  r |= ZM_POLLPRI;
+	if (ev & EPOLLOUT)  r |= ZM_POLLOUT;
+	if (ev & EPOLLERR)  r |= ZM_POLLERR;
+	if (ev & EPOLLHUP)  r |= ZM_POLLHUP;
+	return r;
+}
+#endif
+
+
+struct zmpollset *zmpollset_new(sizehint)
+	int sizehint;
+{
+	struct zmpollset *set = calloc(1, sizeof(*set));
+
+	if (!set) return NULL;
+	if (sizehint < 16) sizehint = 16;
+
+	set->epfd = -1;
+#ifdef HAVE_SYS_EPOLL_H
+	/* Kernel may still say ENOSYS, then we run with poll(2) */
+	set->epfd = epoll_create(sizehint);
+#if defined(F_SETFD)
+	if (set->epfd >= 0)
+	  fcntl(set->epfd, F_SETFD, 1); /* close-on-exec */
+#endif
+#endif
+	return set;
+}
+
+void zmpollset_free(set)
+	struct zmpollset *set;
+{
+	if (!set) return;
+	if (set->epfd >= 0)
+	  close(set->epfd);
+#ifdef HAVE_SYS_EPOLL_H
+	if (set->epevs) free(set->epevs);
+#endif
+	if (set->slots) free(set->slots);
+	if (set->pfds)  free(set->pfds);
+	if (set->evs)   free(set->evs);
+	free(set);
+}
+
+int zmpollset_count(set)
+	struct zmpollset *set;
+{
+	return set->count;
+}
+
+static int zmpollset_growslots __((struct zmpollset *, int));
+static int zmpollset_growslots(set, fd)
+	struct zmpollset *set;
+	int fd;
+{
+	int n = set->nslots ? set->nslots : 64;
+	struct zmpollslot *s;
+
+	while (n <= fd) n <<= 1;
+	s = realloc(set->slots, sizeof(*s) * n);
+	if (!s) {
+	  errno = ENOMEM;
+	  return -1;
+	}
+	memset(s + set->nslots, 0, sizeof(*s) * (n - set->nslots));
+	set->slots  = s;
+	set->nslots = n;
+	return 0;
+}
+
+static int zmpollset_growpfds __((struct zmpollset *, int));
+static int zmpollset_growpfds(set, n)
+	struct zmpollset *set;
+	int n;
+{
+	struct pollfd *p;
+
+	if (n <= set->pfdspace) return 0;
+	n += 16;
+	p = realloc(set->pfds, sizeof(*p) * n);
+	if (!p) {
+	  errno = ENOMEM;
+	  return -1;
+	}
+	set->pfds     = p;
+	set->pfdspace = n;
+	return 0;
+}
+
+static int zmpollset_growevs __((struct zmpollset *, int));
+static int zmpollset_growevs(set, n)
+	struct zmpollset *set;
+	int n;
+{
+	struct zmpollev *e;
+
+	if (n <= set->evspace) return 0;
+	n += 16;
+	e = realloc(set->evs, sizeof(*e) * n);
+	if (!e) {
+	  errno = ENOMEM;
+	  return -1;
+	}
+	set->evs     = e;
+	set->evspace = n;
+	return 0;
+}
+
+
+/* Push the interest mask of  fd  into the backend.  */
+
+static int zmpollset_apply __((struct zmpollset *, int, int, int));
+static int zmpollset_apply(set, fd, events, force)
+	struct zmpollset *set;
+	int fd, events, force;
+{
+	struct zmpollslot *slot = &set->slots[fd];
+	int i;
+
+	if (!force && slot->events == events)
+	  return 0; /* The common case -- nothing changed */
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (set->epfd >= 0) {
+	  struct epoll_event ev;
+	  int rc;
+
+	  memset(&ev, 0, sizeof(ev));
+	  if (events == 0) {
+	    /* Park it; the fd may already be closed, ignore errors */
+	    if (slot->index > 0)
+	      epoll_ctl(set->epfd, EPOLL_CTL_DEL, fd, &ev);
+	    slot->index  = 0;
+	    slot->events = 0;
+	    return 0;
+	  }
+	  ev.events  = zm2epoll(events);
+	  ev.data.fd = fd;
+	  rc = epoll_ctl(set->epfd, slot->index > 0 ? EPOLL_CTL_MOD :
+			 EPOLL_CTL_ADD, fd, &ev);
+	  /* Our idea of the kernel state may be stale, if the fd
+	     was closed and reused behind our back. */
+	  if (rc < 0 && errno == ENOENT)
+	    rc = epoll_ctl(set->epfd, EPOLL_CTL_ADD, fd, &ev);
+	  else if (rc < 0 && errno == EEXIST)
+	    rc = epoll_ctl(set->epfd, EPOLL_CTL_MOD, fd, &ev);
+	  if (rc < 0)
+	    return -1;
+	  slot->index  = 1;
+	  slot->events = events;
+	  return 0;
+	}
+#endif
+
+	if (events == 0) {
+	  i = slot->index;
+	  if (i >= 0) {
+	    /* Move the last one into the hole */
+	    --set->npfds;
+	    if (i != set->npfds) {
+	      set->pfds[i] = set->pfds[set->npfds];
+	      set->slots[set->pfds[i].fd].index = i;
+	    }
+	  }
+	  slot->index  = -1;
+	  slot->events = 0;
+	  return 0;
+	}
+
+	i = slot->index;
+	if (i < 0) {
+	  if (zmpollset_growpfds(set, set->npfds + 1) < 0)
+	    return -1;
+	  i = set->npfds++;
+	  slot->index = i;
+	}
+	set->pfds[i].fd      = fd;
+	set->pfds[i].events  = zm2poll(events);
+	set->pfds[i].revents = 0;
+	slot->events = events;
+	return 0;
+}
+
+
+int zmpollset_add(set, fd, events, cookie)
+	struct zmpollset *set;
+	int fd, events;
+	void *cookie;
+{
+	struct zmpollslot *slot;
+
+	if (fd < 0) {
+	  errno = EBADF;
+	  return -1;
+	}
+	if (fd >= set->nslots && zmpollset_growslots(set, fd) < 0)
+	  return -1;
+
+	slot = &set->slots[fd];
+	if (!slot->inuse) {
+	  slot->inuse  = 1;
+	  slot->events = 0;
+	  slot->index  = (set->epfd >= 0) ? 0 : -1;
+	  ++set->count;
+	}
+	slot->cookie = cookie;
+
+	return zmpollset_apply(set, fd, events, 1);
+}
+
+int zmpollset_mod(set, fd, events)
+	struct zmpollset *set;
+	int fd, events;
+{
+	if (fd < 0 || fd >= set->nslots || !set->slots[fd].inuse) {
+	  errno = ENOENT;
+	  return -1;
+	}
+	return zmpollset_apply(set, fd, events, 0);
+}
+
+int zmpollset_del(set, fd)
+	struct zmpollset *set;
+	int fd;
+{
+	struct zmpollslot *slot;
+
+	if (fd < 0 || fd >= set->nslots || !set->slots[fd].inuse)
+	  return 0;
+
+	slot = &set->slots[fd];
+	zmpollset_apply(set, fd, 0, 0);
+	slot->inuse  = 0;
+	slot->cookie = NULL;
+	--set->count;
+	return 0;
+}
+
+
+static void zmpollset_addev __((struct zmpollset *, int, int));
+static void zmpollset_addev(set, fd, revents)
+	struct zmpollset *set;
+	int fd, revents;
+{
+	struct zmpollev *ev;
+
+	if (fd < 0 || fd >= set->nslots || !set->slots[fd].inuse)
+	  return; /* Deleted meanwhile */
+	ev = &set->evs[set->nevs++];
+	ev->fd      = fd;
+	ev->revents = revents;
+	ev->cookie  = set->slots[fd].cookie;
+}
+
+int zmpollset_wait(set, xfds, nxfds, timeout)
+	struct zmpollset *set;
+	struct zmpollfd  *xfds;
+	int  nxfds;
+	long timeout;
+{
+	int i, rc, n;
+
+	set->nevs = 0;
+	if (!xfds) nxfds = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (set->epfd >= 0) {
+	  int xready = 0, wantep = 1;
+
+	  if (set->epevspace < set->count || !set->epevs) {
+	    struct epoll_event *e;
+	    n = set->count + 16;
+	    e = realloc(set->epevs, sizeof(*e) * n);
+	    if (!e) {
+	      errno = ENOMEM;
+	      return -1;
+	    }
+	    set->epevs     = e;
+	    set->epevspace = n;
+	  }
+	  if (zmpollset_growevs(set, set->epevspace) < 0)
+	    return -1;
+
+	  if (nxfds > 0) {
+	    /* Wait for the transient ones along with the epoll fd */
+	    if (zmpollset_growpfds(set, nxfds + 1) < 0)
+	      return -1;
+	    for (i = 0; i < nxfds; ++i) {
+	      set->pfds[i].fd      = xfds[i].fd;
+	      set->pfds[i].events  = zm2poll(xfds[i].events);
+	      set->pfds[i].revents = 0;
+	    }
+	    set->pfds[nxfds].fd      = set->epfd;
+	    set->pfds[nxfds].events  = POLLIN;
+	    set->pfds[nxfds].revents = 0;
+
+	    rc = poll(set->pfds, nxfds + 1, timeout);
+	    if (rc < 0)
+	      return -1;
+	    for (i = 0; i < nxfds; ++i) {
+	      xfds[i].revents = poll2zm(set->pfds[i].revents);
+	      if (xfds[i].revents) ++xready;
+	    }
+	    wantep  = (set->pfds[nxfds].revents != 0);
+	    timeout = 0;
+	  }
+
+	  rc = 0;
+	  if (wantep) {
+	    rc = epoll_wait(set->epfd, set->epevs, set->epevspace, timeout);
+	    if (rc < 0) {
+	      if (xready > 0) return xready;
+	      return -1;
+	    }
+	  }
+	  for (i = 0; i < rc; ++i)
+	    zmpollset_addev(set, set->epevs[i].data.fd,
+			    epoll2zm(set->epevs[i].events));
+
+	  return set->nevs + xready;
+	}
+#endif
+
+	n = set->npfds;
+	if (zmpollset_growpfds(set, n + nxfds) < 0)
+	  return -1;
+	if (zmpollset_growevs(set, n) < 0)
+	  return -1;
+	for (i = 0; i < nxfds; ++i) {
+	  set->pfds[n+i].fd      = xfds[i].fd;
+	  set->pfds[n+i].events  = zm2poll(xfds[i].events);
+	  set->pfds[n+i].revents = 0;
+	}
+
+	rc = poll(set->pfds, n + nxfds, timeout);
+	if (rc <= 0)
+	  return rc;
+
+	for (i = 0; i < n; ++i)
+	  if (set->pfds[i].revents)
+	    zmpollset_addev(set, set->pfds[i].fd,
+			    poll2zm(set->pfds[i].revents));
+	for (i = 0; i < nxfds; ++i)
+	  xfds[i].revents = poll2zm(set->pfds[n+i].revents);
+
+	return rc;
+}
+
+struct zmpollev *zmpollset_events(set, nevp)
+	struct zmpollset *set;
+	int *nevp;
+{
+	*nevp = set->nevs;
+	return set->evs;
+}
+
+#endif /* HAVE_POLL */
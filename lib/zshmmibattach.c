@@ -13,6 +13,7 @@
 #include <sys/stat.h>
 
 #include <stdlib.h>
+#include <string.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -26,6 +27,10 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 
 #include "libc.h"
@@ -49,6 +54,10 @@ static struct MIB_MtaEntry MIBMtaEntryLocal /* = {{0,},{0,}} */;
 /* Public pointer to whatever datablock is at hand */
 struct MIB_MtaEntry *MIBMtaEntry = &MIBMtaEntryLocal;
 
+/* .. and to where this process does its counting */
+struct MIB_MtaEntry *MIBMtaCnt   = &MIBMtaEntryLocal;
+static struct MIB_MtaSlab *SHM_slab;
+
 
 /* static int      SHM_storage_fd = -1; */
 static const char *SHM_SNMPSHAREDFILE_NAME;
@@ -59,8 +68,25 @@ static void *      SHM_block_ptr;
 int SHM_file_mode = 0664;
 
 
+static void Z_SHM_lock   __((int rw, int storage_fd));
+static void Z_SHM_unlock __((int rw, int storage_fd));
+static void mib_fold     __((struct MIB_MtaSegment *seg, struct MIB_MtaSlab *s));
+
 void Z_SHM_MIB_Detach __((void))
 {
+	if (SHM_slab && SHM_storage_writable && SHM_slab->owner == getpid()) {
+	  /* Leave our counts behind in the 'retired' slab */
+	  int fd = open(SHM_SNMPSHAREDFILE_NAME, O_RDWR, 0);
+	  if (fd >= 0) {
+	    Z_SHM_lock(1, fd);
+	    mib_fold((struct MIB_MtaSegment *)SHM_block_ptr, SHM_slab);
+	    SHM_slab->owner = 0;
+	    Z_SHM_unlock(1, fd);
+	    close(fd);
+	  }
+	}
+	SHM_slab = NULL;
+
 	if (/* SHM_storage_fd >= 0 && */
 	    SHM_block_size && SHM_block_ptr) {
 	  /* int fd = SHM_storage_fd;
@@ -78,6 +104,9 @@ void Z_SHM_MIB_Detach __((void))
 	  SHM_block_size = 0;
 	  SHM_block_ptr  = NULL;
 
+	  MIBMtaEntry = &MIBMtaEntryLocal;
+	  MIBMtaCnt   = &MIBMtaEntryLocal;
+
 	  /* close (fd); */
 	}
 }
@@ -203,11 +232,176 @@ static void Z_SHM_unlock(rw, storage_fd)
 }
 
 
+/*
+ * Slab management.  These are done while holding the file lock;
+ * the counting itself does not need it.
+ */
+
+static void mib_add(dst, src)
+     struct MIB_MtaEntry *dst;
+     const struct MIB_MtaEntry *src;
+{
+	Vuint *d = (Vuint *)dst;
+	const Vuint *s = (const Vuint *)src;
+	int i;
+
+	/* Only the counters are ever non-zero in a slab, and those are
+	   all Vuint;  adding a zero word leaves anything else intact. */
+	for (i = sizeof(*dst) / sizeof(Vuint); i > 0; --i)
+	  *d++ += *s++;
+}
+
+static void mib_fold(seg, s)
+     struct MIB_MtaSegment *seg;
+     struct MIB_MtaSlab *s;
+{
+	mib_add(&seg->retired.c, &s->c);
+	memset((void *)&s->c, 0, sizeof(s->c));
+}
+
+static struct MIB_MtaSlab *mib_claim(seg)
+     struct MIB_MtaSegment *seg;
+{
+	struct MIB_MtaSlab *s;
+	int i;
+
+	for (i = 0, s = seg->slab; i < ZM_MIB_SLABS; ++i, ++s)
+	  if (s->owner == 0)
+	    break;
+
+	if (i == ZM_MIB_SLABS) {
+	  /* No free ones;  take over one of a process that died
+	     without  Z_SHM_MIB_Detach()  (a signal, or _exit()). */
+	  for (i = 0, s = seg->slab; i < ZM_MIB_SLABS; ++i, ++s)
+	    if (kill(s->owner, 0) < 0 && errno == ESRCH)
+	      break;
+	  if (i == ZM_MIB_SLABS)
+	    return NULL; /* Count into the common block then */
+	  mib_fold(seg, s);
+	}
+
+	s->owner = getpid();
+	return s;
+}
+
+
+/*
+ * A child of  fork()  that goes on with the parent's code (instead of
+ * exec()ing something) shall call this to stop counting into the
+ * slab of its parent.
+ */
+
+void Z_SHM_MIB_Forked __((void))
+{
+	struct MIB_MtaSegment *seg = SHM_block_ptr;
+	int fd, r = errno;
+
+	if (!seg || !SHM_storage_writable)
+	  return;
+	if (SHM_slab && SHM_slab->owner == getpid())
+	  return;
+
+	SHM_slab  = NULL;
+	MIBMtaCnt = MIBMtaEntry;
+
+	fd = open(SHM_SNMPSHAREDFILE_NAME, O_RDWR, 0);
+	if (fd < 0) {
+	  errno = r;
+	  return;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	Z_SHM_lock(1, fd);
+	SHM_slab = mib_claim(seg);
+	Z_SHM_unlock(1, fd);
+	close(fd);
+
+	if (SHM_slab)
+	  MIBMtaCnt = &SHM_slab->c;
+	errno = r;
+}
+
+
+/*
+ * The counters as the readers want to see them:  the common block
+ * with all the slabs added in.  The result is in a static buffer.
+ */
+
+struct MIB_MtaEntry *Z_SHM_MIB_Sum __((void))
+{
+	static struct MIB_MtaEntry sum;
+	struct MIB_MtaSegment *seg = SHM_block_ptr;
+	int i;
+
+	memcpy(&sum, (void *)MIBMtaEntry, sizeof(sum));
+	if (!seg)
+	  return &sum;
+
+	mib_add(&sum, &seg->retired.c);
+	for (i = 0; i < ZM_MIB_SLABS; ++i)
+	  mib_add(&sum, &seg->slab[i].c);
+
+	return &sum;
+}
+
+
+/*
+ * Latency histograms;  see  shmmib.h  for the buckets.
+ */
+
+void Z_SHM_MIB_Hist(h, ms)
+     struct MIB_Histogram *h;
+     unsigned long ms;
+{
+	int i = 0;
+
+	while (ms > 0 && i < ZM_MIB_HBUCKETS-1) {
+	  ms >>= 1;
+	  ++i;
+	}
+	h->bucket[i] += 1;
+	h->count     += 1;
+}
+
+void Z_SHM_MIB_Since(h, tv)
+     struct MIB_Histogram *h;
+     const struct timeval *tv;
+{
+	struct timeval now;
+	long ms;
+
+	gettimeofday(&now, NULL);
+	ms = (now.tv_sec - tv->tv_sec) * 1000L +
+	  (now.tv_usec - tv->tv_usec) / 1000L;
+	Z_SHM_MIB_Hist(h, ms < 0 ? 0 : (unsigned long)ms);
+}
+
+/* Upper bound (ms) of the bucket where the given percentile falls */
+
+unsigned long Z_SHM_MIB_Hist_pct(h, pct)
+     const struct MIB_Histogram *h;
+     int pct;
+{
+	unsigned long n = 0, want;
+	int i;
+
+	if (h->count == 0)
+	  return 0;
+
+	want = ((unsigned long)h->count * pct + 99) / 100;
+	for (i = 0; i < ZM_MIB_HBUCKETS-1; ++i) {
+	  n += h->bucket[i];
+	  if (n >= want)
+	    break;
+	}
+	return 1UL << i;
+}
+
+
 int Z_SHM_MIB_Attach(rw)
 	int rw;
 {
 	int storage_fd = -1;
-	int block_size = sizeof(* MIBMtaEntry);
+	int block_size = sizeof(struct MIB_MtaSegment);
 	struct stat stbuf;
 	int retrylimit = 5;
 
@@ -420,6 +614,13 @@ storage_fill_failure: ;
 	/* Ok, MAGIC matches, pointers have been set...
 	   Finalize:   */
 
+	MIBMtaCnt = MIBMtaEntry;
+	if (rw) {
+	  SHM_slab = mib_claim((struct MIB_MtaSegment *)p);
+	  if (SHM_slab)
+	    MIBMtaCnt = &SHM_slab->c;
+	}
+
 	Z_SHM_unlock(rw, storage_fd);
 
 	SHM_block_size       = block_size;
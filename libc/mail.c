@@ -167,7 +167,7 @@ _mail_fopen(filenamep)
 			      fcntl(fd, F_GETFD, 0) | FD_CLOEXEC);
 			fp = fdopen(fd, "w+");
 			if (fp) {
-			  setvbuf(fp, NULL, _IOFBF, 8192);
+			  setvbuf(fp, NULL, _IOFBF, mail_bufsize);
 			  mail_free(*filenamep);
 			  *filenamep = path;
 			}
@@ -466,6 +466,9 @@ _mail_close__(fp,inop, mtimep, mtimensp, async)
 	 * the fsync() between fflush() and fclose() may be mandatory
 	 * on NFS mounted postoffices if you want to guarantee not losing
 	 * data without being told about it.
+	 *
+	 * A program can set the  mail_sync_hook  to do the syncing
+	 * some other way; the smtpserver batches them (spoolsync.c).
 	 */
 
 	while (fflush(fp) != 0) {
@@ -478,7 +481,7 @@ _mail_close__(fp,inop, mtimep, mtimensp, async)
 	}
 #ifdef HAVE_FSYNC
 	if (!async) {
-	  while (fsync(fn) < 0) {
+	  while ((mail_sync_hook ? (*mail_sync_hook)(fn) : fsync(fn)) < 0) {
 	    if (errno == EINTR || errno == EAGAIN)
 	      continue;
 	    if (ftype) mail_free(ftype);
@@ -825,7 +828,7 @@ mail_close_alternate_(fp,where,suffix,async)
 	  return -1;
 	}
 #ifdef HAVE_FSYNC
-	while (fsync(fn) < 0) {
+	while ((mail_sync_hook ? (*mail_sync_hook)(fn) : fsync(fn)) < 0) {
 	  if (errno == EINTR || errno == EAGAIN)
 	    continue;
 	  if (ftype) mail_free(ftype);
@@ -4,5 +4,9 @@
  *
  */
 
+#include <stdio.h>
+
 const char *postoffice;	/* may be extern or local */
 int mail_priority;
+int mail_bufsize = 8192;	/* stdio buffer size of the message files */
+int (*mail_sync_hook)() = NULL;	/* Instead of the fsync(), when set */
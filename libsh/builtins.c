@@ -84,6 +84,7 @@ static int sh_type	CSARGV2;
 static int sh_sleep	CSARGV2;
 static int sh_true	CSARGV2;
 static int sh_false	CSARGV2;
+static int sh_gcstats	CSARGV2;
 
 
 struct shCmd builtins[] = {
@@ -126,6 +127,7 @@ struct shCmd builtins[] = {
 {	"sleep",	sh_sleep,	NULL,	NULL,	0		},
 {	"true",		sh_true,	NULL,	NULL,	0		},
 {	"false",	sh_false,	NULL,	NULL,	0		},
+{	"gcstats",	sh_gcstats,	NULL,	NULL,	0		},
 {	"lappend",	NULL,	sh_lappend,	NULL,	SH_ARGV		},
 {	"lreplace",	NULL,	sh_lreplace,	NULL,	SH_ARGV		},
 {	"glob",		NULL,	sh_glob,	NULL,	SH_ARGV		},
@@ -1355,3 +1357,16 @@ sh_false(argc, argv)
 {
 	return 1;
 }
+
+static int
+sh_gcstats(argc, argv)
+	int argc;
+	const char *argv[];
+{
+	if (argc > 1) {
+		fprintf(stderr, USAGE_GCSTATS, argv[0]);
+		return EX_USAGE;
+	}
+	cons_gc_stats();
+	return 0;
+}
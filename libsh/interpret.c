@@ -1614,11 +1614,12 @@ fprintf(stderr,"%s:%d &command->buffer = %p\n",__FILE__,__LINE__,&command->buffe
 			if (varmeter) {
 				if (variable && car(variable)) {
 					car(varmeter) = caar(variable);
-					varmeter->flags = car(variable)->flags;
+					varmeter->flags = (varmeter->flags & _DSW_MASK) |
+						(car(variable)->flags & ~_DSW_MASK);
 					varmeter->slen  = car(variable)->slen;
 				} else {
 					car(varmeter) = NULL;
-					varmeter->flags = 0;
+					varmeter->flags &= _DSW_MASK;
 				}
 			}
 			if (isset('I'))
@@ -1687,7 +1688,8 @@ fprintf(stderr,"%s:%d &command->buffer = %p\n",__FILE__,__LINE__,&command->buffe
 			varmeter = cdaar(envarlist);
 			if (variable != NULL) {
 				car(varmeter) = caar(variable);
-				varmeter->flags = car(variable)->flags;
+				varmeter->flags = (varmeter->flags & _DSW_MASK) |
+					(car(variable)->flags & ~_DSW_MASK);
 				varmeter->slen  = car(variable)->slen;
 			}
 			break;
@@ -1860,7 +1862,7 @@ fprintf(stderr,"%s:%d &command->buffer=%p\n",__FILE__,__LINE__,
 				while (variableIndex > loop[nloop].varindex) {
 					if (varmeter) {
 						car(varmeter) = NULL;
-						varmeter->flags = 0;
+						varmeter->flags &= _DSW_MASK;
 					}
 					if (--variableIndex < 0)
 					  break;
@@ -1878,7 +1880,7 @@ fprintf(stderr,"%s:%d &command->buffer=%p\n",__FILE__,__LINE__,
 				    && variableIndex >= 0
 				    && varmeter != NULL) {
 					car(varmeter) = NULL;
-					varmeter->flags = 0;
+					varmeter->flags &= _DSW_MASK;
 					variableIndex--;
 					if (varmchain)
 					  varmchain = cddr(varmchain);
@@ -2679,7 +2681,7 @@ getout:
 	while (variableIndex > -1) {
 		if (varmeter) {
 			car(varmeter) = NULL;
-			varmeter->flags = 0;
+			varmeter->flags &= _DSW_MASK;
 		}
 		if (varmchain) {
 		  variable = car(varmchain);
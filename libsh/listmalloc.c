@@ -8,8 +8,17 @@
  */
 
 #include "hostenv.h"
+#include <sys/time.h>
 #include "listutils.h"
 
+#ifdef HAVE_MMAP
+#include <signal.h>
+#include <sys/mman.h>
+#if defined(SA_SIGINFO) && (defined(_SC_PAGESIZE) || defined(HAVE_GETPAGESIZE))
+#define REGION_WRITEBARRIER
+#endif
+#endif
+
 #ifdef CELLDEBUG
 #define DEBUG
 #endif
@@ -100,6 +109,63 @@ int consblock_count = 0;	/* How many allocated ? */
 
 struct gcpro *gcprolist = NULL;	/* Dynamically growing list of protected
 				   items.. */
+/*
+ * The young generation, the "nursery":  the cells come from blocks of
+ * their own when it is in use -- always with  cons_generational, and
+ * otherwise inside the per-message regions (cons_region_begin() ..
+ * cons_region_end()).  A minor collection marks the young cells that
+ * are reachable from the roots and from the older cells, without
+ * descending into the older cells otherwise, and frees the rest of the
+ * young cells at once.  It runs when the nursery is full, and at the
+ * end of a region.
+ *
+ * The cells can not be moved, so the survivors are tenured in place
+ * (DSW_OLDGEN); a nursery block that is mostly tenured becomes an
+ * ordinary old block, and a full GC that finds such a block empty
+ * hands it back.  Values that are known to be kept (e.g. cached ones)
+ * can be copied to the old blocks with cons_promote() instead.
+ *
+ * The older cells that may point to the young ones are the tenured
+ * ones in the nursery, and those that were written after the previous
+ * collection: where possible the old blocks are write-protected, and
+ * the pages that take a write fault are recorded (and made writable);
+ * this is the remembered set.  Without it all of the old cells are
+ * looked at.
+ *
+ * The full GC marks everything, but sweeps the old blocks lazily: a
+ * block at the time, when the free chain runs out, or a few blocks at
+ * each minor collection.
+ */
+int cons_generational = 0;	/* Always allocate from the nursery */
+int cons_region_depth = 0;	/* > 0 when a region is active	*/
+int region_cellcount = 8000;	/* Smaller blocks than the old ones */
+int cons_region_maxblocks = 16;	/* The nursery size, in blocks	*/
+static int nursery_off = 0;	/* cons_promote() at work	*/
+
+#define NURSERY() ((cons_region_depth > 0 || cons_generational) && !nursery_off)
+
+consblock *region_root = NULL;	/* Nursery blocks, and the spare ones */
+conscell *region_freechain = NULL;
+int region_blockcount = 0;
+static consblock **region_index = NULL;	/* sorted by address */
+
+long old_cellcount = 0;		/* Cells in the old blocks	*/
+static long major_gc_cells = 0;	/* .. when to do a full GC again */
+static consblock *sweep_next = NULL, *sweep_last = NULL; /* lazy sweep */
+
+/* Statistics for the  gcstats  builtin */
+#define GC_HIST 7		/* <10us, <100us, .. <1s, more	*/
+long cons_region_count = 0;	/* regions ended		*/
+long cons_gc_minor_count = 0, cons_gc_major_count = 0;
+long cons_gc_minor_freed = 0;	/* young cells freed		*/
+long cons_gc_promoted = 0;	/* young cells tenured		*/
+long cons_gc_promoted_bytes = 0; /* .. with their strings	*/
+long cons_gc_copied = 0;	/* cells copied by cons_promote() */
+long cons_gc_minor_usec = 0, cons_gc_major_usec = 0;
+long cons_gc_minor_max = 0, cons_gc_major_max = 0;
+long cons_gc_minor_hist[GC_HIST], cons_gc_major_hist[GC_HIST];
+long cons_region_faults = 0;	/* write barrier hits		*/
+
 #ifndef NO_CONSVARS
 int consvars_cellcount = 4000;
 consvarptrs *consvars_root = NULL;
@@ -112,39 +178,426 @@ consvarptrs *consvars_markptr = NULL;	/* For speedier insert */
 int consvars_count = 0;		/* Allocation count */
 #endif
 
-static consblock *new_consblock __((void));
-static consblock *new_consblock()
+static consblock *alloc_consblock __((int, conscell **));
+static consblock *alloc_consblock(cellcount, freechainp)
+int cellcount;
+conscell **freechainp;
 {
     consblock *new;
     int i;
     int newsize = (sizeof(consblock) +
-		   sizeof(conscell) * (consblock_cellcount - 1));
+		   sizeof(conscell) * (cellcount - 1));
 
     if (D_conscell)
-      fprintf(stderr,"new_consblock(%d cells)\n", consblock_cellcount);
+      fprintf(stderr,"new_consblock(%d cells)\n", cellcount);
 
     new = (consblock *) calloc(1,newsize); /* clearing malloc */
     if (!new)
 	return NULL;
 
-    new->cellcount = consblock_cellcount;
+    new->cellcount = cellcount;
     new->nextblock = NULL;
-    if (consblock_root == NULL)
-	consblock_root = new;
-    else
-	consblock_tail->nextblock = new;
-    consblock_tail = new;
 
     /* chain them together, and prepend to the free chain via ``next'' */
-    new->cells[0].next = conscell_freechain;
+    new->cells[0].next = *freechainp;
     new->cells[0].flags = DSW_FREEMARK;
-    for (i = 1; i < consblock_cellcount; ++i) {
+    for (i = 1; i < cellcount; ++i) {
 	new->cells[i].next = &new->cells[i - 1];
 	new->cells[i].flags = DSW_FREEMARK;
     }
-    conscell_freechain = &new->cells[consblock_cellcount - 1];
+    *freechainp = &new->cells[cellcount - 1];
+    return new;
+}
+
+static consblock *new_consblock __((void));
+static consblock *new_consblock()
+{
+    consblock *new = alloc_consblock(consblock_cellcount,
+				     &conscell_freechain);
+
+    if (!new)
+	return NULL;
+
+    if (consblock_root == NULL)
+	consblock_root = new;
+    else
+	consblock_tail->nextblock = new;
+    consblock_tail = new;
 
     ++consblock_count;
+    old_cellcount += new->cellcount;
+    return new;
+}
+
+/* The region block index, for  in_region() */
+static int region_index_cmp __((const void *, const void *));
+static int region_index_cmp(a, b)
+const void *a, *b;
+{
+    const consblock *ba = *(const consblock * const *)a;
+    const consblock *bb = *(const consblock * const *)b;
+
+    return (ba < bb) ? -1 : (ba > bb);
+}
+
+static void region_reindex __((void));
+static void region_reindex()
+{
+    consblock *cb;
+    int i = 0;
+
+    if (region_index)
+	free(region_index);
+    region_index = NULL;
+    if (region_blockcount == 0)
+	return;
+    region_index = (consblock **) malloc(region_blockcount *
+					 sizeof(consblock *));
+    if (!region_index)
+	abort(); /* Can't tell the region cells apart any more! */
+    for (cb = region_root; cb != NULL; cb = cb->nextblock)
+	region_index[i++] = cb;
+    qsort(region_index, region_blockcount, sizeof(consblock *),
+	  region_index_cmp);
+}
+
+/* Is the cell in a nursery block ? */
+static int in_region __((const conscell *));
+static int in_region(cc)
+const conscell *cc;
+{
+    int lo = 0, hi = region_blockcount, mid;
+    consblock *cb;
+
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	cb = region_index[mid];
+	if (cc < cb->cells)
+	    hi = mid;
+	else if (cc >= cb->cells + cb->cellcount)
+	    lo = mid + 1;
+	else
+	    return 1;
+    }
+    return 0;
+}
+
+/* Mark what the (older) cells  from..to-1  of the block point to */
+static void region_scan_range __((consblock *, int, int, void (*)(conscell *)));
+static void region_scan_range(cb, from, to, markfunc)
+consblock *cb;
+int from, to;
+void (*markfunc) __((conscell *));
+{
+    conscell *cc = cb->cells + from;
+
+    for (; from < to; ++from, ++cc) {
+	if (cc->flags & DSW_FREEMARK)
+	    continue;
+	if (!STRING(cc) && car(cc) != NULL)
+	    markfunc(car(cc));
+	if (cdr(cc) != NULL)
+	    markfunc(cdr(cc));
+    }
+}
+
+#ifdef REGION_WRITEBARRIER
+/*
+ * The write barrier.  The old blocks are protected after each minor
+ * collection (and at a region start), except for the partial pages at
+ * their ends; those and the pages that get written to are scanned at
+ * the next one.  Should anything go wrong, the protections are removed,
+ * and all of the old cells scanned.  A full GC does the same, as its
+ * marking writes to all of the cells.
+ */
+struct protrange {
+    consblock *cb;
+    char *lo, *hi;		/* The protected pages of the block */
+};
+
+static struct protrange *prot_ranges = NULL;	/* sorted by address */
+static consblock *prot_lastblock = NULL;	/* .. the rest are new */
+static int prot_count = 0, prot_space = 0;
+static char **dirty_pages = NULL;
+static volatile int dirty_count = 0;
+static int dirty_space = 0;
+static volatile int region_alldirty = 1;
+static long region_pagesize = 0;
+static struct sigaction region_oldsegv, region_oldbus;
+
+static int protrange_cmp __((const void *, const void *));
+static int protrange_cmp(a, b)
+const void *a, *b;
+{
+    const struct protrange *pa = (const struct protrange *)a;
+    const struct protrange *pb = (const struct protrange *)b;
+
+    return (pa->lo < pb->lo) ? -1 : (pa->lo > pb->lo);
+}
+
+/* The index of the cell at (round_up: or the first one after) addr */
+static int cell_index __((consblock *, char *, int));
+static int cell_index(cb, addr, round_up)
+consblock *cb;
+char *addr;
+int round_up;
+{
+    long off = addr - (char *) cb->cells;
+    long idx = off / (long) sizeof(conscell);
+
+    if (round_up && idx * (long) sizeof(conscell) < off)
+	++idx;
+    if (idx < 0)
+	idx = 0;
+    if (idx > cb->cellcount)
+	idx = cb->cellcount;
+    return (int) idx;
+}
+
+static void region_unprotect __((void));
+static void region_unprotect()
+{
+    int i;
+
+    for (i = 0; i < prot_count; ++i)
+	mprotect(prot_ranges[i].lo, prot_ranges[i].hi - prot_ranges[i].lo,
+		 PROT_READ|PROT_WRITE);
+    prot_count = 0;
+}
+
+static void region_fault __((int, siginfo_t *, void *));
+static void region_fault(sig, info, ctx)
+int sig;
+siginfo_t *info;
+void *ctx;
+{
+    char *addr = (char *) info->si_addr;
+    char *page;
+    int lo = 0, hi = prot_count, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	if (addr < prot_ranges[mid].lo)
+	    hi = mid;
+	else if (addr >= prot_ranges[mid].hi)
+	    lo = mid + 1;
+	else
+	    break;
+    }
+    if (lo >= hi) {
+	/* Not ours; let the instruction fault again the old way */
+	sigaction(sig, (sig == SIGSEGV) ? &region_oldsegv : &region_oldbus,
+		  NULL);
+	return;
+    }
+
+    ++cons_region_faults;
+    if (dirty_count >= dirty_space) {
+	region_alldirty = 1;
+	region_unprotect();
+	return;
+    }
+    page = (char *)((unsigned long)addr & ~(region_pagesize - 1));
+    dirty_pages[dirty_count++] = page;
+    if (mprotect(page, region_pagesize, PROT_READ|PROT_WRITE) < 0) {
+	region_alldirty = 1;
+	region_unprotect();
+    }
+}
+
+/* Protect the pages of the blocks from  cb  on, and add them */
+static int region_protect_blocks __((consblock *));
+static int region_protect_blocks(cb)
+consblock *cb;
+{
+    struct protrange *pr;
+    char *lo, *hi;
+    int n;
+
+    if (consblock_count > prot_space) {
+	n = consblock_count + 8;
+	pr = (struct protrange *) realloc(prot_ranges, n * sizeof(*pr));
+	if (pr == NULL)
+	    return -1;
+	prot_ranges = pr;
+	prot_space = n;
+    }
+    for (; cb != NULL; cb = cb->nextblock) {
+	pr = &prot_ranges[prot_count];
+	lo = (char *) cb->cells;
+	hi = (char *) (cb->cells + cb->cellcount);
+	lo = (char *)(((unsigned long)lo + region_pagesize - 1) &
+		      ~(region_pagesize - 1));
+	hi = (char *)((unsigned long)hi & ~(region_pagesize - 1));
+	if (hi <= lo)
+	    lo = hi = (char *) (cb->cells + cb->cellcount); /* none */
+	else if (mprotect(lo, hi - lo, PROT_READ) < 0)
+	    return -1;
+	pr->cb = cb;
+	pr->lo = lo;
+	pr->hi = hi;
+	++prot_count;
+    }
+    prot_lastblock = consblock_tail;
+    /* For the fault handler */
+    qsort(prot_ranges, prot_count, sizeof(*prot_ranges), protrange_cmp);
+    return 0;
+}
+
+/*
+ * Start a new remembered set.  The protections stay on, only the pages
+ * written to (and the new blocks) need to be protected again.  After a
+ * full GC all of them do.
+ */
+static void region_protect __((void));
+static void region_protect()
+{
+    struct sigaction act;
+    static int installed = 0;
+    int i, n;
+
+    if (!region_alldirty) {
+	for (i = 0; i < dirty_count; ++i)
+	    if (mprotect(dirty_pages[i], region_pagesize, PROT_READ) < 0)
+		break;
+	if (i == dirty_count) {
+	    dirty_count = 0;
+	    if (prot_lastblock->nextblock == NULL ||
+		region_protect_blocks(prot_lastblock->nextblock) == 0)
+		return;
+	}
+	region_alldirty = 1;
+	region_unprotect();
+    }
+    dirty_count = 0;
+
+    if (region_pagesize == 0) {
+#ifdef _SC_PAGESIZE
+	region_pagesize = sysconf(_SC_PAGESIZE);
+#else
+	region_pagesize = getpagesize();
+#endif
+	if (region_pagesize <= 0)
+	    region_pagesize = -1;
+    }
+    if (region_pagesize < 0 || consblock_root == NULL)
+	return;
+
+    if (!installed) {
+	memset(&act, 0, sizeof(act));
+	act.sa_sigaction = region_fault;
+	act.sa_flags = SA_SIGINFO;
+	sigemptyset(&act.sa_mask);
+	if (sigaction(SIGSEGV, &act, &region_oldsegv) < 0 ||
+	    sigaction(SIGBUS,  &act, &region_oldbus)  < 0) {
+	    region_pagesize = -1;
+	    return;
+	}
+	installed = 1;
+    }
+
+    /* Room for the dirty pages of a few blocks; past that,
+       a whole scan is about as cheap anyway. */
+    n = 4 * (consblock_cellcount * sizeof(conscell)) / region_pagesize;
+    if (n > dirty_space) {
+	if (dirty_pages)
+	    free(dirty_pages);
+	dirty_pages = (char **) malloc(n * sizeof(char *));
+	if (dirty_pages == NULL) {
+	    dirty_space = 0;
+	    return;
+	}
+	dirty_space = n;
+    }
+
+    if (region_protect_blocks(consblock_root) < 0) {
+	region_unprotect();
+	return;
+    }
+    region_alldirty = 0;
+}
+
+/*
+ * Scan the old cells that may have been made to point to the young
+ * ones: the partial pages at the ends of the old blocks, the pages
+ * written to, and the blocks that were added since the protection.
+ */
+static void region_scan_dirty __((void (*)(conscell *)));
+static void region_scan_dirty(markfunc)
+void (*markfunc) __((conscell *));
+{
+    struct protrange *pr;
+    consblock *cb;
+    char *page;
+    int i, lo, hi, mid;
+
+    for (i = 0; i < prot_count; ++i) {
+	pr = &prot_ranges[i];
+	cb = pr->cb;
+	region_scan_range(cb, 0, cell_index(cb, pr->lo, 1), markfunc);
+	region_scan_range(cb, cell_index(cb, pr->hi, 0), cb->cellcount,
+			  markfunc);
+    }
+    for (i = 0; i < dirty_count; ++i) {
+	page = dirty_pages[i];
+	lo = 0; hi = prot_count;
+	while (lo < hi) {
+	    mid = (lo + hi) >> 1;
+	    if (page < prot_ranges[mid].lo)
+		hi = mid;
+	    else if (page >= prot_ranges[mid].hi)
+		lo = mid + 1;
+	    else
+		break;
+	}
+	if (lo >= hi)
+	    continue;	/* Can't happen */
+	cb = prot_ranges[mid].cb;
+	region_scan_range(cb, cell_index(cb, page, 0),
+			  cell_index(cb, page + region_pagesize, 1),
+			  markfunc);
+    }
+    if (prot_lastblock != NULL)
+	for (cb = prot_lastblock->nextblock; cb != NULL; cb = cb->nextblock)
+	    region_scan_range(cb, 0, cb->cellcount, markfunc);
+}
+
+/* Sweeping writes to the block; protect it again after that */
+static void region_reprotect __((consblock *, int));
+static void region_reprotect(cb, on)
+consblock *cb;
+int on;
+{
+    int i;
+
+    if (region_alldirty)
+	return;
+    for (i = 0; i < prot_count; ++i)
+	if (prot_ranges[i].cb == cb) {
+	    if (prot_ranges[i].hi > prot_ranges[i].lo &&
+		mprotect(prot_ranges[i].lo,
+			 prot_ranges[i].hi - prot_ranges[i].lo,
+			 on ? PROT_READ : PROT_READ|PROT_WRITE) < 0) {
+		region_alldirty = 1;
+		region_unprotect();
+	    }
+	    return;
+	}
+}
+#endif /* REGION_WRITEBARRIER */
+
+static consblock *new_regionblock __((void));
+static consblock *new_regionblock()
+{
+    consblock *new = alloc_consblock(region_cellcount, &region_freechain);
+
+    if (!new)
+	return NULL;
+
+    new->nextblock = region_root;
+    region_root = new;
+    ++region_blockcount;
+    region_reindex();
     return new;
 }
 
@@ -291,21 +744,225 @@ conscell *source;
   _cons_DSW(source,1);
 }
 
-int cons_garbage_collect()
+/* Free the unmarked cells of a block onto the chain at  *freepp  */
+static void cons_sweep __((consblock *, conscell ***, int *, int *, int *, int *));
+static void cons_sweep(cb, freepp, usecntp, strusecntp, freecntp, newfreecntp)
+consblock *cb;
+conscell ***freepp;
+int *usecntp, *strusecntp, *freecntp, *newfreecntp;
+{
+    conscell *cc = cb->cells, **freep = *freepp;
+    int i;
+
+    for (i = 0; i < cb->cellcount; ++i,++cc)
+	if (cc->flags & DSW_MARKER) {
+
+	    /* It was reachable, just clean the marker bit(s) */
+
+	    cc->flags &= ~(DSW_MARKER);
+	    ++*usecntp;
+	    if (ISNEW(cc))
+	      ++*strusecntp;
+
+	} else {
+
+	    /* This was not reachable, no marker was added.. */
+	    if (ISNEW(cc)) {   /* if (cc->flags & NEWSTRING) */
+#ifdef __GNUC__
+		if (D_conscell)
+		  fprintf(stderr,
+			  " freestr(%p) cell=%p called from %p s='%s'\n",
+			  cc->string, cc, __builtin_return_address(0),
+			  cc->string);
+#else
+		if (D_conscell)
+		  fprintf(stderr,
+			  " freestr(%p) cell=%p s='%s'\n",
+			  cc->cstring, cc, cc->cstring);
+#endif
+		freestr(cc->string,cc->slen);
+		cc->string = NULL;
+	    }
+	    if (!(cc->flags & DSW_FREEMARK)) {
+	      if (D_conscell)
+		fprintf(stderr," freecell(%p)\n",cc);
+	      ++*newfreecntp;
+	    }
+	    cc->flags = DSW_FREEMARK;
+
+	    /* Forward-linked free cell list */
+	    *freep = cc;
+	    freep = &cc->next;
+	    ++*freecntp;
+	}
+    *freepp = freep;
+}
+
+/*
+ * Move the old blocks of the nursery size that have no cells in use
+ * back to the nursery.  Their cells are unlinked from the old free
+ * chain, which is rebuilt.  Returns the number of blocks moved.
+ */
+static int region_recycle __((void));
+static int region_recycle()
+{
+    consblock *cb, *nextcb, **cbp, *tail;
+    conscell *cc, **freep;
+    int i, moved = 0;
+
+    tail = NULL;
+    cbp = &consblock_root;
+    for (cb = consblock_root; cb != NULL; cb = nextcb) {
+	nextcb = cb->nextblock;
+	if (cb->cellcount == region_cellcount) {
+	    cc = cb->cells;
+	    for (i = 0; i < cb->cellcount; ++i, ++cc)
+		if (!(cc->flags & DSW_FREEMARK))
+		    break;
+	    if (i == cb->cellcount) {
+		*cbp = nextcb;
+		cb->nextblock = region_root;
+		region_root = cb;
+		++region_blockcount;
+		--consblock_count;
+		old_cellcount -= cb->cellcount;
+		++moved;
+		continue;
+	    }
+	}
+	tail = cb;
+	cbp = &cb->nextblock;
+    }
+    consblock_tail = tail;
+    if (moved == 0)
+	return 0;
+
+    /* Rebuild both free chains */
+    freep = &conscell_freechain;
+    for (cb = consblock_root; cb != NULL; cb = cb->nextblock) {
+	cc = cb->cells;
+	for (i = 0; i < cb->cellcount; ++i, ++cc)
+	    if (cc->flags & DSW_FREEMARK) {
+		*freep = cc;
+		freep = &cc->next;
+	    }
+    }
+    *freep = NULL;
+    freep = &region_freechain;
+    for (cb = region_root; cb != NULL; cb = cb->nextblock) {
+	cc = cb->cells;
+	for (i = 0; i < cb->cellcount; ++i, ++cc)
+	    if (cc->flags & DSW_FREEMARK) {
+		*freep = cc;
+		freep = &cc->next;
+	    }
+    }
+    *freep = NULL;
+    return moved;
+}
+
+/* Pause time bookkeeping */
+static long gc_usec __((struct timeval *));
+static long gc_usec(t0)
+struct timeval *t0;
+{
+    struct timeval t1;
+
+    gettimeofday(&t1, NULL);
+    return ((t1.tv_sec - t0->tv_sec) * 1000000L +
+	    (t1.tv_usec - t0->tv_usec));
+}
+
+static void gc_pause __((long, long *, long *, long *));
+static void gc_pause(usec, hist, totalp, maxp)
+long usec, *hist, *totalp, *maxp;
+{
+    long lim = 10;
+    int i;
+
+    for (i = 0; i < GC_HIST-1 && usec >= lim; ++i)
+	lim *= 10;
+    ++hist[i];
+    *totalp += usec;
+    if (usec > *maxp)
+	*maxp = usec;
+}
+
+/*
+ * Sweep the old blocks that the last full GC left for later:
+ * 'want' of them, or until there is something in the free chain.
+ */
+static void cons_sweep_pending __((int));
+static void cons_sweep_pending(want)
+int want;
+{
+    int freecnt = 0, usecnt = 0, strusecnt = 0, newfreecnt = 0, n = 0;
+    conscell *head, **freep;
+    consblock *cb;
+
+    while (sweep_next != NULL &&
+	   (want > 0 ? n++ < want : conscell_freechain == NULL)) {
+	cb = sweep_next;
+	sweep_next = (cb == sweep_last) ? NULL : cb->nextblock;
+
+	head = NULL;
+	freep = &head;
+#ifdef REGION_WRITEBARRIER
+	region_reprotect(cb, 0);
+#endif
+	cons_sweep(cb, &freep, &usecnt, &strusecnt, &freecnt, &newfreecnt);
+	*freep = conscell_freechain;
+	conscell_freechain = head;
+#ifdef REGION_WRITEBARRIER
+	region_reprotect(cb, 1);
+#endif
+    }
+    newcell_gc_freecount += freecnt;
+
+    /* All swept; nursery blocks that became old, and are now
+       empty, can go back */
+    if (sweep_next == NULL && region_blockcount > 0 && region_recycle()) {
+	region_reindex();
+#ifdef REGION_WRITEBARRIER
+	region_alldirty = 1;	/* The blocks changed */
+	region_unprotect();
+	if (NURSERY())
+	    region_protect();
+#endif
+    }
+}
+
+/*
+ * The full GC.  With 'lazy' the old blocks are swept later, by
+ * cons_sweep_pending(), and the return value is only the count of
+ * the nursery cells freed.
+ */
+static int cons_gc_major __((int));
+static int cons_gc_major(lazy)
+int lazy;
 {
     int i, freecnt, usecnt, strusecnt, newfreecnt;
     consblock *cb = NULL;
     conscell *cc, **freep;
     struct gcpro *gcp;
+    struct timeval t0;
 #ifndef NO_CONSVARS
     int cursor;
     consvarptrs *vb = NULL;
 #endif
 
 
-    if (consblock_root == NULL)
+    if (consblock_root == NULL && region_root == NULL)
 	return 0;		/* Nothing to do! */
 
+    gettimeofday(&t0, NULL);
+
+#ifdef REGION_WRITEBARRIER
+    /* The marking writes everywhere */
+    region_alldirty = 1;
+    region_unprotect();
+#endif
+
     /* Start by clearing all DSW_MARKER bits */
     for (cb = consblock_root; cb != NULL; cb = cb->nextblock) {
 	cc = cb->cells;
@@ -315,6 +972,11 @@ int cons_garbage_collect()
 #endif
 	    cc->flags &= ~(DSW_MARKER);
     }
+    for (cb = region_root; cb != NULL; cb = cb->nextblock) {
+	cc = cb->cells;
+	for (i = 0; i < cb->cellcount; ++i, ++cc)
+	    cc->flags &= ~(DSW_MARKER);
+    }
 
     /* Hookay...  Now we run marking on all cells that are
        reachable from some (any) of our registered variables */
@@ -370,62 +1032,251 @@ int cons_garbage_collect()
        them to belong into free..   Oh yes, all  ISNEW(cellptr)  cells
        will do  free(cellptr->string)    */
 
-    freep = & conscell_freechain;
     strusecnt = usecnt = freecnt = newfreecnt = 0;
-    for (cb = consblock_root; cb != NULL; cb = cb->nextblock) {
+
+    /* The nursery now; the survivors are tenured, so that there are
+       no young cells for the old ones to point to.  The free cells
+       stay in the nursery. */
+    for (cb = region_root; cb != NULL; cb = cb->nextblock) {
 	cc = cb->cells;
-	for (i = 0; i < cb->cellcount; ++i,++cc)
-	    if (cc->flags & DSW_MARKER) {
+	for (i = 0; i < cb->cellcount; ++i, ++cc)
+	    if (cc->flags & DSW_MARKER)
+		cc->flags |= DSW_OLDGEN;
+    }
+    freep = & region_freechain;
+    for (cb = region_root; cb != NULL; cb = cb->nextblock)
+      cons_sweep(cb, &freep, &usecnt, &strusecnt, &freecnt, &newfreecnt);
+    *freep = NULL;
 
-		/* It was reachable, just clean the marker bit(s) */
+    sweep_next = NULL;
+    if (lazy) {
+      conscell_freechain = NULL;
+      sweep_next = consblock_root;
+      sweep_last = consblock_tail;
+    } else {
+      freep = & conscell_freechain;
+      for (cb = consblock_root; cb != NULL; cb = cb->nextblock)
+	cons_sweep(cb, &freep, &usecnt, &strusecnt, &freecnt, &newfreecnt);
+      *freep = NULL;
+
+      /* Nursery blocks that became old, and are now empty, go back */
+      if (region_blockcount + cons_gc_minor_count > 0 && region_recycle())
+	region_reindex();
+    }
 
-		cc->flags &= ~(DSW_MARKER);
-		++usecnt;
-		if (ISNEW(cc))
-		  ++strusecnt;
+    newcell_gc_freecount += freecnt;
+    newcell_gc_strusecnt = strusecnt;
 
-	    } else {
+    /* Next time when the old heap has doubled */
+    major_gc_cells = 2 * old_cellcount;
+    if (major_gc_cells < old_cellcount + consblock_cellcount)
+	major_gc_cells = old_cellcount + consblock_cellcount;
 
-		/* This was not reachable, no marker was added.. */
-		if (ISNEW(cc)) {   /* if (cc->flags & NEWSTRING) */
-#ifdef __GNUC__
-		    if (D_conscell)
-		      fprintf(stderr,
-			      " freestr(%p) cell=%p called from %p s='%s'\n",
-			      cc->string, cc, __builtin_return_address(0),
-			      cc->string);
-#else
-		    if (D_conscell)
-		      fprintf(stderr,
-			      " freestr(%p) cell=%p s='%s'\n",
-			      cc->cstring, cc, cc->cstring);
+#ifdef REGION_WRITEBARRIER
+    if (NURSERY())
+	region_protect();
+#endif
+
+    ++cons_gc_major_count;
+    gc_pause(gc_usec(&t0), cons_gc_major_hist, &cons_gc_major_usec,
+	     &cons_gc_major_max);
+
+    if (D_conscell)
+      fprintf(stderr,"cons_garbage_collect() freed %d, found %d free, and %d used cells\n",
+	      newfreecnt, freecnt-newfreecnt, usecnt);
+
+    return freecnt;
+}
+
+int cons_garbage_collect()
+{
+    return cons_gc_major(0);
+}
+
+/*
+ * The minor marker: marks the young cells reachable from the source,
+ * but does not go into the older cells.
+ */
+static void region_mark __((conscell *));
+static void region_mark(source)
+conscell *source;
+{
+	conscell *current = source;
+
+	while (current && in_region(current) &&
+	       !(current->flags & (DSW_MARKER|DSW_FREEMARK|DSW_OLDGEN))) {
+		current->flags |= DSW_MARKER;
+		if (!STRING(current))
+			region_mark(car(current));
+		current = cdr(current);
+	}
+}
+
+/*
+ * The minor collection: free the young cells that are not reachable,
+ * and tenure the rest.
+ */
+static void cons_gc_minor __((void));
+static void cons_gc_minor()
+{
+    int i, tenured, freecnt, promoted, migrated = 0;
+    long bytes;
+    consblock *cb, *nextcb, **cbp;
+    conscell *cc, *head, *bhead, **freep, **rfreep, **bfreep;
+    struct gcpro *gcp;
+    struct timeval t0;
+#ifndef NO_CONSVARS
+    int cursor;
+    consvarptrs *vb = NULL;
+#endif
+
+    if (region_root == NULL)
+	return;
+
+    gettimeofday(&t0, NULL);
+
+    for (cb = region_root; cb != NULL; cb = cb->nextblock) {
+	cc = cb->cells;
+	for (i = 0; i < cb->cellcount; ++i, ++cc)
+	    cc->flags &= ~(DSW_MARKER);
+    }
+
+    /* Mark from the roots, like the full GC does.. */
+    for (i = 0; i < staticidx; ++i)
+      if (*staticvec[i] != NULL)
+	region_mark(*staticvec[i]);
+    for (i = 0; i < functionidx; ++i)
+      if (functionvec[i] != NULL)
+	functionvec[i](region_mark);
+    for (gcp = gcprolist; gcp != NULL; gcp = gcp->next)
+      for (i = 0; i < gcp->nvars; ++i)
+	if (*(gcp->var[i]))
+	  region_mark(*(gcp->var[i]));
+#ifndef NO_CONSVARS
+    cursor = 0;
+    for (vb = consvars_root; vb != NULL; vb = vb->nextvars)
+      for (i = 0; i < vb->count && cursor < consvars_cursor; ++i,++cursor)
+	if (vb->vars[i] != NULL)
+	  region_mark(*(vb->vars[i]));
 #endif
-		    freestr(cc->string,cc->slen);
+
+    /* .. and from the older cells that may point to the young ones.
+       Those are not traced themselves: any old cell in use counts,
+       reachable or not. */
+#ifdef REGION_WRITEBARRIER
+    if (!region_alldirty)
+	region_scan_dirty(region_mark);
+    else
+#endif
+      for (cb = consblock_root; cb != NULL; cb = cb->nextblock)
+	region_scan_range(cb, 0, cb->cellcount, region_mark);
+    for (cb = region_root; cb != NULL; cb = cb->nextblock) {
+	cc = cb->cells;
+	for (i = 0; i < cb->cellcount; ++i, ++cc)
+	    if (cc->flags & DSW_OLDGEN) {
+		if (!STRING(cc) && car(cc) != NULL)
+		    region_mark(car(cc));
+		if (cdr(cc) != NULL)
+		    region_mark(cdr(cc));
+	    }
+    }
+
+    /* Sweep the nursery.  The blocks that are mostly tenured become
+       old blocks, their free cells go to the old free chain. */
+    head = NULL;
+    freep = &head;
+    region_freechain = NULL;
+    rfreep = &region_freechain;
+    freecnt = promoted = 0;
+    bytes = 0;
+    cbp = &region_root;
+    for (cb = region_root; cb != NULL; cb = nextcb) {
+	nextcb = cb->nextblock;
+	bhead = NULL;
+	bfreep = &bhead;
+	tenured = 0;
+	cc = cb->cells;
+	for (i = 0; i < cb->cellcount; ++i, ++cc) {
+	    if (cc->flags & DSW_MARKER) {
+		cc->flags = (cc->flags & ~DSW_MARKER) | DSW_OLDGEN;
+		++promoted;
+		bytes += sizeof(conscell);
+		if (ISNEW(cc))
+		    bytes += cc->slen + 1;
+	    }
+	    if (cc->flags & DSW_OLDGEN) {
+		++tenured;
+		continue;
+	    }
+	    if (!(cc->flags & DSW_FREEMARK)) {
+		if (ISNEW(cc)) {
+		    freestr(cc->string, cc->slen);
 		    cc->string = NULL;
 		}
-		if (!(cc->flags & DSW_FREEMARK)) {
-		  if (D_conscell)
-		    fprintf(stderr," freecell(%p)\n",cc);
-		  ++newfreecnt;
-		}
 		cc->flags = DSW_FREEMARK;
-
-		/* Forward-linked free cell list */
-		*freep = cc;
-		freep = &cc->next;
 		++freecnt;
 	    }
+	    *bfreep = cc;
+	    bfreep = &cc->next;
+	}
+
+	if (2 * tenured <= cb->cellcount) {
+	    *rfreep = bhead;
+	    if (bhead != NULL)
+		rfreep = bfreep;
+	    cbp = &cb->nextblock;
+	    continue;
+	}
+
+	/* Make it an old block */
+	cc = cb->cells;
+	for (i = 0; i < cb->cellcount; ++i, ++cc)
+	    cc->flags &= ~DSW_OLDGEN;
+	*freep = bhead;
+	if (bhead != NULL)
+	    freep = bfreep;
+	*cbp = nextcb;
+	--region_blockcount;
+	cb->nextblock = NULL;
+	if (consblock_root == NULL)
+	    consblock_root = cb;
+	else
+	    consblock_tail->nextblock = cb;
+	consblock_tail = cb;
+	++consblock_count;
+	old_cellcount += cb->cellcount;
+	++migrated;
     }
-    *freep = NULL;
+    *rfreep = NULL;
+    *freep = conscell_freechain;
+    conscell_freechain = head;
+    if (migrated)
+	region_reindex();
+
+    ++cons_gc_minor_count;
+    cons_gc_minor_freed += freecnt;
+    cons_gc_promoted += promoted;
+    cons_gc_promoted_bytes += bytes;
+
+    /* A bit more of the lazy sweep, if there is some left */
+    cons_sweep_pending(2);
+
+#ifdef REGION_WRITEBARRIER
+    /* No young cells now; start a new remembered set */
+    region_protect();
+#endif
 
-    newcell_gc_freecount += freecnt;
-    newcell_gc_strusecnt = strusecnt;
+    gc_pause(gc_usec(&t0), cons_gc_minor_hist, &cons_gc_minor_usec,
+	     &cons_gc_minor_max);
 
     if (D_conscell)
-      fprintf(stderr,"cons_garbage_collect() freed %d, found %d free, and %d used cells\n",
-	      newfreecnt, freecnt-newfreecnt, usecnt);
+      fprintf(stderr,"cons_gc_minor() freed %d, tenured %d cells\n",
+	      freecnt, promoted);
 
-    return freecnt;
+    if (major_gc_cells == 0)
+	major_gc_cells = old_cellcount + consblock_cellcount;
+    if (old_cellcount > major_gc_cells)
+	cons_gc_major(1);
 }
 
 
@@ -445,6 +1296,23 @@ conscell *
 
     ++newcell_callcount;
 
+    if (NURSERY()) {
+      if (region_freechain == NULL) {
+	/* Grow the nursery, or when it is big already, collect it */
+	if (region_blockcount >= cons_region_maxblocks)
+	  cons_gc_minor();
+	if (region_freechain == NULL)
+	  if (new_regionblock() == NULL)
+	    if (cons_gc_major(0) == 0 || region_freechain == NULL)
+	      return NULL;
+      }
+      new = region_freechain;
+      region_freechain = new->next;
+      if (D_conscell)
+	fprintf(stderr," newcell() returns young cell %p\n", new);
+      return new;
+    }
+
 #if 0
     if (newcell_gc_interval < consblock_cellcount)
       if (++newcell_gc_callcount >= newcell_gc_interval) {
@@ -457,7 +1325,9 @@ conscell *
 
       /* Free Conscell pool has emptied.. */
 
-      cons_garbage_collect();
+      if (sweep_next == NULL)
+	cons_gc_major(1);
+      cons_sweep_pending(0);
       /* if (++newcell_gc_callcount >= newcell_gc_interval)
 	 newcell_gc_callcount = 0; */
 
@@ -501,6 +1371,101 @@ conscell *
     return new;
 }
 
+void cons_region_begin()
+{
+    if (cons_region_depth++ > 0)
+	return;
+#ifdef REGION_WRITEBARRIER
+    region_protect();
+#endif
+}
+
+void cons_region_end()
+{
+    if (cons_region_depth <= 0 || --cons_region_depth > 0)
+	return;
+    ++cons_region_count;
+    cons_gc_minor();
+}
+
+/*
+ * Copy a value to the older cells, so that it can be kept beyond
+ * the end of the current region.  When the nursery is not in use
+ * this returns the argument as is.
+ */
+static conscell *promote_copy __((conscell *));
+static conscell *promote_copy(l)
+conscell *l;
+{
+    conscell *head = NULL, *new, **pp = &head;
+    GCVARS2;
+
+    GCPRO2(l, head);
+    for (; l != NULL; l = cdr(l)) {
+	new = newcell();
+	*new = *l;
+	new->flags &= ~(DSW_MARKER|DSW_OLDGEN);
+	new->next = NULL;
+	*pp = new;
+	pp = &new->next;
+	++cons_gc_copied;
+	if (STRING(l)) {
+	    if (ISNEW(l))
+		new->string = dupnstr(l->string, l->slen);
+	} else
+	    car(new) = promote_copy(car(l));
+    }
+    UNGCPRO2;
+    return head;
+}
+
+conscell *cons_promote(l)
+conscell *l;
+{
+    if (!NURSERY() || l == NULL)
+	return l;
+
+    nursery_off = 1;		/* newcell() from the old blocks */
+    l = promote_copy(l);
+    nursery_off = 0;
+    return l;
+}
+
+/* Print the statistics; the  gcstats  builtin */
+void cons_gc_stats()
+{
+    static const char *hname[GC_HIST] = {
+	"<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"
+    };
+    int i;
+
+    printf("heap: %d old blocks (%ld cells), %d nursery blocks (%d cells)%s\n",
+	   consblock_count, old_cellcount, region_blockcount,
+	   region_blockcount * region_cellcount,
+	   cons_generational ? ", generational" : "");
+    printf("minor: %ld collections, %ld cells freed, %ld tenured (%ld bytes), %ld regions\n",
+	   cons_gc_minor_count, cons_gc_minor_freed, cons_gc_promoted,
+	   cons_gc_promoted_bytes, cons_region_count);
+    printf("major: %ld collections, %ld cells freed%s\n",
+	   cons_gc_major_count, newcell_gc_freecount,
+	   sweep_next != NULL ? ", sweep in progress" : "");
+    printf("copied: %ld cells, barrier faults: %ld\n",
+	   cons_gc_copied, cons_region_faults);
+    printf("pause (us): minor total %ld max %ld, major total %ld max %ld\n",
+	   cons_gc_minor_usec, cons_gc_minor_max,
+	   cons_gc_major_usec, cons_gc_major_max);
+    printf("%-8s", "");
+    for (i = 0; i < GC_HIST; ++i)
+	printf(" %7s", hname[i]);
+    printf("\n%-8s", "minor");
+    for (i = 0; i < GC_HIST; ++i)
+	printf(" %7ld", cons_gc_minor_hist[i]);
+    printf("\n%-8s", "major");
+    for (i = 0; i < GC_HIST; ++i)
+	printf(" %7ld", cons_gc_major_hist[i]);
+    printf("\n");
+}
+
 #ifdef DEBUG_MAIN		/* We test the beast... */
 int main(argc, argv)
 int argc;
@@ -545,6 +1510,7 @@ conscell *copycell(X)
 {
   conscell *tmp = newcell();
   *tmp = *X;
+  tmp->flags &= ~_DSW_MASK;	/* Not the GC state of X */
   if (STRING(tmp)) {
     tmp->string = dupnstr(tmp->string, tmp->slen);
     /* Copycell does *NOT* preserve other string flags, caller
@@ -105,7 +105,8 @@ _s_copy_tree(list)
 	  if (STRING(list))
 	    /* copycell() generates always just NEWSTRING, we preserve
 	       some more flags... */
-	    new->flags = (list->flags & ~CONSTSTRING) | NEWSTRING;
+	    p->flags = (p->flags & _DSW_MASK) |
+	      (list->flags & ~(CONSTSTRING|_DSW_MASK)) | NEWSTRING;
 
 	  pav = &cdr(p);
 
@@ -167,7 +168,8 @@ _s_copy_chain(list)
 	  if (STRING(list))
 	    /* copycell() generates always just NEWSTRING, we preserve
 	       some more flags... */
-	    p->flags = (list->flags & ~CONSTSTRING) | NEWSTRING;
+	    p->flags = (p->flags & _DSW_MASK) |
+	      (list->flags & ~(CONSTSTRING|_DSW_MASK)) | NEWSTRING;
 
 	  pav = &cdr(p);
 
@@ -71,6 +71,7 @@ fi\n"
 #define	CORE_DUMPED		" - core dumped"
 #define	USAGE_WAIT		"Usage: %s [ pid ]\n"
 #define	USAGE_TIMES		"Usage: %s\n"
+#define	USAGE_GCSTATS		"Usage: %s\n"
 #define	USAGE_SLEEP		"Usage: %s #seconds\n"
 #define	NULL_NAME		"null name\n"
 #define	IS_A_SHELL_BUILTIN	"is a shell builtin"
@@ -17,6 +17,7 @@
 
 #include "zmpoll.h"  /* We have ZMPOLL -wrapper for preferrably real poll(2),
 			or as a backup, for select(2).  */
+#include "dirwatch.h"
 
 #ifdef HAVE_DIRENT_H
 # include <dirent.h>
@@ -127,22 +128,40 @@ struct dirqueue;
  * does its magic:  Children send log messages, and hunger announcements
  * to the master, and the master feeds jobs to the children.
  * Minimum number of child processes started is 1.
+ *
+ * The jobs wait in the queues of the router directories, which are
+ * the priority classes: "router" first, then each of $ROUTERDIRS in
+ * turn.  A hungry child is written a batch of a few jobs at once,
+ * and the child says "#hungry" after each of them.  A child that
+ * finds all queues empty steals the not yet started half of the
+ * longest batch of another child.  The file is then in two children's
+ * pipes.  The one that gets to it first claims it by renaming it to
+ * "inode-pid" before it does anything else (see rd_doit()); for the
+ * other one the old name is gone then, and it skips the file.  A file
+ * that was deferred, and is left in the directory, keeps its claimed
+ * name, and is not routed again by the other child.
  */
 
 #define MAXROUTERCHILDS 40
+#define ROUTERBATCHMAX	16	/* Max of ZENV ROUTERBATCH */
+
+struct rtrjob {
+  long  ino;
+  char *name;		/* The line written to the child	*/
+  int   stolen;		/* .. and also written to another one	*/
+};
+
 struct router_child {
   int   tochild;
   int   fromchild;
   int   childpid;
   int   hungry;
-  struct zmpollfd *fdpto;
-  struct zmpollfd *fdpfrom;
 
   char *linebuf;
   int   linespace;
   int   linelen;
 
-  char  childline[512];
+  char  childline[2048];
   int	childsize, childout;
 
   char  readbuf[512];
@@ -153,8 +172,18 @@ struct router_child {
   struct rusage r;
 #endif
 
-  struct dirqueue  *dq;
-  u_long task_ino;
+  struct dirqueue  *dq;	/* The home queue, NULL when no child here */
+
+  /* The jobs written to the child, oldest first: the first one is
+     in process, the others wait in the pipe. */
+  struct rtrjob jobs[ROUTERBATCHMAX];
+  int   jobhead, jobcount;
+
+  /* Statistics, see rtr_stats() */
+  struct timeval lastdone;	/* End of the previous job, or the feed */
+  long  jobsdone, jobsstolen, steals;
+  long  busyms, maxms;		/* .. since the last report */
+  struct MIB_Histogram jobtime;	/* .. likewise */
 };
 
 struct router_child routerchilds[MAXROUTERCHILDS];
@@ -163,11 +192,69 @@ static void child_server __((int tofd, int frmfd));
 static int  rd_doit __((const char *filename, const char *dirs));
 static int  parent_reader __((int waittime));
 static void notify_reader __((int sock));
+static void dirwatch_reader __((void));
 
 
 static int notifysocket = -1;
 static time_t notifysocket_reinit = 1;
 
+static int routerbatch = 4;	/* ZENV ROUTERBATCH, jobs per write */
+static int routerstats = 3600;	/* ZENV ROUTERSTATS, seconds */
+static time_t nextstats = 0;
+static struct timeval laststats;
+
+/* Spool directory watcher, see  dirwatch_init()  */
+static struct dirwatch *dirwatch = NULL;
+static int dirwatchfd = -1;
+static int dirwatch_broken = 0;
+static int dirwatch_sweep = 600; /* ZENV ROUTERDIRWATCH, seconds */
+static time_t nextdirsweep = 0;
+
+/* Children's fds are registered here at start_child(), and
+   removed before they are closed.  See parent_reader().  */
+static struct zmpollset *rtrpollset = NULL;
+
+static struct zmpollset *rtr_pollset __((void));
+static struct zmpollset *rtr_pollset()
+{
+	if (rtrpollset == NULL) {
+	  rtrpollset = zmpollset_new(2 * MAXROUTERCHILDS);
+	  if (rtrpollset == NULL) {
+	    fprintf(stderr, "router: rtr_pollset(): out of memory!\n");
+	    abort();
+	  }
+	}
+	return rtrpollset;
+}
+
+/* Want to write to the child, or not ? */
+static void rtr_pollupdate __((struct router_child *));
+static void rtr_pollupdate(rc)
+     struct router_child *rc;
+{
+	int wr = (rc->tochild >= 0 && rc->childout < rc->childsize) ?
+	  ZM_POLLOUT : 0;
+
+	if (rc->tochild < 0 || rc->tochild == rc->fromchild) {
+	  if (rc->fromchild >= 0)
+	    zmpollset_mod(rtr_pollset(), rc->fromchild, ZM_POLLIN | wr);
+	} else
+	  zmpollset_mod(rtr_pollset(), rc->tochild, wr);
+}
+
+/* With plain pipes the shutdown is a close(), leave the set first */
+static void rtr_shutdown_child __((struct router_child *));
+static void rtr_shutdown_child(rc)
+     struct router_child *rc;
+{
+	if (rc->tochild < 0) return;
+	if (rc->tochild != rc->fromchild)
+	  zmpollset_del(rtr_pollset(), rc->tochild);
+	pipes_shutdown_child(rc->tochild);
+	rc->tochild = -1;
+	rtr_pollupdate(rc);
+}
+
 
 static void notifysock_init()
 {
@@ -245,6 +332,8 @@ static int  start_child (i)
 
 	  int idx;
 
+	  Z_SHM_MIB_Forked();
+
 #if 0
 #if	defined(SA_NOCLDSTOP)||defined(SA_ONSTACK)||defined(SA_RESTART)
 	/* ================ POSIX.1 STUFF ================ */
@@ -292,6 +381,14 @@ static int  start_child (i)
 
 	fd_nonblockingmode(tofd[1]);
 	fd_nonblockingmode(frmfd[0]);
+
+	/* Previous incarnation may have left its reader side behind */
+	if (routerchilds[i].fromchild >= 0)
+	  zmpollset_del(rtr_pollset(), routerchilds[i].fromchild);
+
+	zmpollset_add(rtr_pollset(), frmfd[0], ZM_POLLIN, &routerchilds[i]);
+	if (tofd[1] != frmfd[0])
+	  zmpollset_add(rtr_pollset(), tofd[1], 0, &routerchilds[i]);
 	
 	routerchilds[i].tochild   = tofd[1];
 	routerchilds[i].fromchild = frmfd[0];
@@ -300,6 +397,13 @@ static int  start_child (i)
 	routerchilds[i].childsize = 0;
 	routerchilds[i].childout  = 0;
 
+	routerchilds[i].jobsdone   = 0;
+	routerchilds[i].jobsstolen = 0;
+	routerchilds[i].steals     = 0;
+	routerchilds[i].busyms     = 0;
+	routerchilds[i].maxms      = 0;
+	memset(&routerchilds[i].jobtime, 0, sizeof(routerchilds[i].jobtime));
+
 	return 0;
 }
 
@@ -367,6 +471,122 @@ int signum;
 #endif
 }
 
+/*
+ *  The child has finished the oldest job of its batch.  The time of
+ *  a job is from the end of the previous one, or from the feed.
+ */
+
+static void rtr_jobdone __((struct router_child *));
+static void rtr_jobdone(rc)
+     struct router_child *rc;
+{
+  struct rtrjob *jp = &rc->jobs[rc->jobhead];
+  struct timeval tv;
+  long ms;
+
+  gettimeofday(&tv, NULL);
+  ms = (tv.tv_sec  - rc->lastdone.tv_sec) * 1000L +
+       (tv.tv_usec - rc->lastdone.tv_usec) / 1000L;
+  if (ms < 0) ms = 0;
+  rc->lastdone = tv;
+
+  rc->busyms += ms;
+  if (jp->stolen) {
+    /* Another child has it too, and did it, or skipped it */
+    rc->jobsstolen += 1;
+  } else {
+    rc->jobsdone += 1;
+    if (ms > rc->maxms)
+      rc->maxms = ms;
+    Z_SHM_MIB_Hist(&rc->jobtime, (unsigned long)ms);
+  }
+
+  free(jp->name);
+  jp->name = NULL;
+  rc->jobhead = (rc->jobhead + 1) % ROUTERBATCHMAX;
+  rc->jobcount -= 1;
+}
+
+/* The child is gone, and its jobs with it; the files stay for
+   the next directory scan to find. */
+static void rtr_jobsclear __((struct router_child *));
+static void rtr_jobsclear(rc)
+     struct router_child *rc;
+{
+  for (; rc->jobcount > 0; --rc->jobcount) {
+    free(rc->jobs[rc->jobhead].name);
+    rc->jobs[rc->jobhead].name = NULL;
+    rc->jobhead = (rc->jobhead + 1) % ROUTERBATCHMAX;
+  }
+  rc->jobhead = 0;
+}
+
+/* Is the file in some child's batch ? */
+static int rtr_inprocess __((long));
+static int rtr_inprocess(ino)
+     long ino;
+{
+  struct router_child *rc;
+  int i, n;
+
+  for (i = 0; i < MAXROUTERCHILDS; ++i) {
+    rc = &routerchilds[i];
+    for (n = 0; n < rc->jobcount; ++n)
+      if (rc->jobs[(rc->jobhead + n) % ROUTERBATCHMAX].ino == ino)
+	return 1;
+  }
+  return 0;
+}
+
+/*
+ *  Per child statistics into the log: jobs done, jobs that were
+ *  also given to another child, jobs stolen from others, and over
+ *  the period the busy percentage and the job times.  The busy ratio
+ *  of the children tells if there are too few (or many) of them.
+ */
+static void rtr_stats __((struct router_child *, long));
+static void rtr_stats(rc, periodms)
+     struct router_child *rc;
+     long periodms;
+{
+  if (!logfn)
+    return;
+
+  loginit(SIGHUP); /* Reinit/rotate the log every at line .. */
+  fprintf(stdout, "[%d] ROUTER CHILD STATS: jobs=%ld stolen=%ld steals=%ld",
+	  rc->childpid, rc->jobsdone, rc->jobsstolen, rc->steals);
+  if (periodms > 0)
+    fprintf(stdout, " busy=%ld%%", (rc->busyms * 100) / periodms);
+  fprintf(stdout, " p50=%lums p90=%lums max=%ldms\n",
+	  Z_SHM_MIB_Hist_pct(&rc->jobtime, 50),
+	  Z_SHM_MIB_Hist_pct(&rc->jobtime, 90),
+	  rc->maxms);
+  fflush(stdout);
+}
+
+static void rtr_report_stats __((void));
+static void rtr_report_stats()
+{
+  struct timeval tv;
+  long periodms;
+  int i;
+
+  gettimeofday(&tv, NULL);
+  periodms = (tv.tv_sec  - laststats.tv_sec) * 1000L +
+	     (tv.tv_usec - laststats.tv_usec) / 1000L;
+  laststats = tv;
+
+  for (i = 0; i < MAXROUTERCHILDS; ++i) {
+    struct router_child *rc = &routerchilds[i];
+    if (rc->tochild < 0)
+      continue;
+    rtr_stats(rc, periodms);
+    rc->busyms = 0;
+    rc->maxms  = 0;
+    memset(&rc->jobtime, 0, sizeof(rc->jobtime));
+  }
+}
+
 /*
  *  Read whatever there is, detect "#hungry\n" line, and return
  *  status of the hunger flag..
@@ -380,8 +600,7 @@ static int reader_getc(rc)
 
   /* Child exited but 'tochild' still set ? close it! */
   if (rc->childpid < 0 && rc->tochild >= 0) {
-    pipes_shutdown_child(rc->tochild);
-    rc->tochild = -1;
+    rtr_shutdown_child(rc);
 
     /* Back to positive value */
     rc->childpid = - rc->childpid;
@@ -413,6 +632,8 @@ static int reader_getc(rc)
 
       fprintf(stdout,"\n");
       fflush(stdout);
+
+      rtr_stats(rc, 0);
     }
 
   }
@@ -460,15 +681,19 @@ static int _parent_reader(rc)
 	break;
 
       /* An EOF ? -- child existed ?? */
-      if (rc->tochild >= 0)
+      if (rc->tochild >= 0) {
+	zmpollset_del(rtr_pollset(), rc->tochild);
 	close(rc->tochild);
+      }
       rc->tochild   = -1;
-      if (rc->fromchild >= 0)
+      if (rc->fromchild >= 0) {
+	zmpollset_del(rtr_pollset(), rc->fromchild);
 	close(rc->fromchild);
+      }
       rc->fromchild = -1;
       rc->hungry    = 0;
-      rc->task_ino  = 0;
       rc->childpid  = 0;
+      rtr_jobsclear(rc);
       break;
 
     }
@@ -494,9 +719,12 @@ static int _parent_reader(rc)
 	continue;
       }
       if (rc->linelen == 8 && strcmp(rc->linebuf,"#hungry\n")==0) {
+	/* One of the batch done; hungry when all are */
 	rc->linelen  = 0;
-	rc->hungry   = 1;
-	rc->task_ino = 0;
+	if (rc->jobcount > 0)
+	  rtr_jobdone(rc);
+	if (rc->jobcount == 0)
+	  rc->hungry = 1;
 	continue;
       }
 
@@ -530,8 +758,7 @@ static void _parent_writer(rc)
     left = rc->childsize - rc->childout;
     c = write(rc->tochild, rc->childline + rc->childout, left);
     if (c < 0 && errno == EPIPE) {
-      pipes_shutdown_child(rc->tochild);
-      rc->tochild = -1;
+      rtr_shutdown_child(rc);
     }
     if (c <= 0) break;
     rc->childout += c;
@@ -539,6 +766,8 @@ static void _parent_writer(rc)
   /* All written ?? */
   if (rc->childout >= rc->childsize)
     rc->childout = rc->childsize = 0;
+
+  rtr_pollupdate(rc);
 }
 
 
@@ -547,50 +776,33 @@ static void _parent_writer(rc)
 static int parent_reader(waittime)
 	int waittime;
 {
-  int i, fd, rc, highfd;
-  struct zmpollfd *fds = NULL;
+  int i, rc, fdcount, nevs;
+  struct zmpollev *evs;
+  static struct zmpollfd *fds = NULL;
   struct zmpollfd *notifyfdp = NULL;
+  struct zmpollfd *dirwatchfdp = NULL;
 
   if (notifysocket_reinit && notifysocket_reinit < now)
     notifysock_init();
 
  redo_again:;
 
-  highfd = 0; /* actually counts polled fd's, does not track
-		 highest fd like with select(2) ! */
+  /* Children are in the persistent  rtr_pollset(),
+     only the notify socket is collected here.  */
+  fdcount = 0;
+  notifyfdp = NULL;
+  dirwatchfdp = NULL;
 
   if (notifysocket >= 0)
-    zmpoll_addfd(&fds, &highfd, notifysocket, -1, &notifyfdp);
+    zmpoll_addfd(&fds, &fdcount, notifysocket, -1, &notifyfdp);
 
-  for (i = 0; i < MAXROUTERCHILDS; ++i) {
-    /* Places to read from ?? */
-    fd = routerchilds[i].fromchild;
-    if (fd >= 0)
-      zmpoll_addfd(&fds, &highfd, fd, -1, &routerchilds[i].fdpfrom);
-    else
-      routerchilds[i].fdpfrom = NULL; /* Mark that we do NOT have dataset! */
-
-    /* Something wanting to write ?? */
-    fd = routerchilds[i].tochild;
-    if (fd >= 0 &&
-	routerchilds[i].childout < routerchilds[i].childsize)
-      /* Have fd, but nothing to write.. */
-      zmpoll_addfd(&fds, &highfd, -1, fd, &routerchilds[i].fdpto);
-    else
-      routerchilds[i].fdpto = NULL; /* Mark that we do NOT have dataset! */
-  }
+  if (dirwatchfd >= 0)
+    zmpoll_addfd(&fds, &fdcount, dirwatchfd, -1, &dirwatchfdp);
 
-#if 0
-  if (highfd < 0) {
-    if (fds) free(fds);
-    return 0; /* Nothing to do! */
-  }
-#endif
-
-  rc = zmpoll( fds, highfd, waittime*1000 /* millisecs */ );
+  rc = zmpollset_wait( rtr_pollset(), fds, fdcount,
+		       waittime*1000 /* millisecs */ );
 
   if (rc == 0) {
-    if (fds) free(fds);
     return 1; /* Nothing to do, leave..
 		 Did sleep for a waittime! */
   }
@@ -604,22 +816,25 @@ static int parent_reader(waittime)
       _parent_writer(&routerchilds[i]);
       _parent_reader(&routerchilds[i]);
     }
-    if (fds) free(fds);
     return 0;  /* Urgh, an error.. */
   }
 
-  /* Ok, zmpoll() gave indication of *something* being ready for read */
+  /* Ok, zmpollset_wait() gave indication of *something* being ready */
 
   if (notifyfdp  &&  (notifyfdp->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP)))
     notify_reader(notifysocket);
 
-  for (i = 0; i < MAXROUTERCHILDS; ++i) {
-    struct router_child *r = &routerchilds[i];
+  if (dirwatchfdp  &&  (dirwatchfdp->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP)))
+    dirwatch_reader();
 
-    if (r->fdpto && r->fdpto->revents & ZM_POLLOUT)
-      _parent_writer(&routerchilds[i]);
-    if (r->fdpfrom && r->fdpfrom->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))
-      _parent_reader(&routerchilds[i]);
+  evs = zmpollset_events(rtr_pollset(), &nevs);
+  for (i = 0; i < nevs; ++i) {
+    struct router_child *r = (struct router_child *) evs[i].cookie;
+
+    if (evs[i].revents & ZM_POLLOUT)
+      _parent_writer(r);
+    if (evs[i].revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))
+      _parent_reader(r);
   }
 
   return 1; /* Did some productive job, don't sleep at the caller.. */
@@ -628,29 +843,23 @@ static int parent_reader(waittime)
 
 
 /*
- * Actual child-process job feeder.  This just puts the thing
- * into the buffer, and writes (if it can)..
+ * Actual child-process job feeder.  The batch is in the buffer
+ * already, this just writes it (if it can)..
  *
- * Requires:  childsize == 0 (buffer is free),
+ * Requires:  childsize > 0 (batch in the buffer),
  *            tochild >= 0 (socket exists (and is ready to receive))
  */
 
-static int _parent_feed_child __(( struct router_child *rc,
-				   const char *fname, const char *dir ));
-static int _parent_feed_child(rc, fname, dir)
+static int _parent_feed_child __(( struct router_child *rc ));
+static int _parent_feed_child(rc)
      struct router_child *rc;
-     const char *fname, *dir;
 {
   int i;
 
   /* Ok, we are feeding him.. */
   rc->hungry = 0;
+  gettimeofday(&rc->lastdone, NULL);
 
-  /* What shall we feed ?? */
-  sprintf(rc->childline, "%s\n", fname);
-  /* DIR information is already included at the fname ! */
-
-  rc->childsize = strlen(rc->childline);
   rc->childout  = 0;
 
   /* Lets try to write it in one go.. */
@@ -660,94 +869,10 @@ static int _parent_feed_child(rc, fname, dir)
   if (rc->childout >= rc->childsize)
     rc->childout = rc->childsize = 0;
 
-  return 0;
-}
-
-#if 0 /* !!! NOT USED !!!! */
-/* -----------------------------------------------------------------
- *
- * Child-process job feeder - distributes jobs in even round-robin
- * manner to all children.  Might some day do resource control a'la
- * "Priority: xyz" -> process subset 2,3,4
- *
- * This looks for free child, and waits for successfull write.
- * ----------------------------------------------------------------- */
-
-static int parent_feed_child __((const char *fname, const char *dir));
-static int parent_feed_child(fname,dir)
-     const char *fname, *dir;
-{
-  static int rridx = -1;
-  struct router_child *rc = NULL;
-  int i;
-  char *s;
-
-  do {
-
-    /* Loop until can feed, our caller shall not need to
-       refeed message again! */
-    /* FIXME: Real proper way is needed, messages to be queued to sets
-       of server processes...  Compare with Scheduler's channels. */
-
-    s = strchr(fname,'-');
-    if (s && isdigit(*fname)) {
-      long thatpid = atoi(s+1);
-      if ((thatpid > 1) &&
-	  (thatpid != MYPID) &&
-	  (kill(thatpid,0)==0)) {
-	/* Process of that PID does exist, and possibly even something
-	   we can kick.. (we should be *root* here anyway!) */
-	for (i = 0; i < MAXROUTERCHILDS; ++i) {
-	  /* Is it one of ours children ?? */
-	  if (routerchilds[i].childpid == thatpid)
-	    return 0; /* Yes! No refeed! */
-	}
-      }
-      /* Hmm..  perhaps it is safe to feed to a subprocess */
-    }
-
-    parent_reader(0);
-
-    rridx = 0;
-    rc    = NULL;
-
-    if (rridx >= MAXROUTERCHILDS) rridx = 0;
-
-    for (i = 0; i < MAXROUTERCHILDS; ++i) {
-      rc = &routerchilds[rridx];
-
-      /* If no child at this slot, start one!
-	 (whatever has been the reason for its death..) */
-      if (rc->childpid == 0) {
-	start_child(rridx);
-	sleep(2); /* Allow a moment for child startup */
-	parent_reader(0);
-      }
-
-      /* If we have a hungry child with all faculties intact.. */
-      if (rc->tochild >= 0 && rc->fromchild >= 0 && rc->hungry)
-	break;
-
-      /* Next index.. */
-      ++rridx; if (rridx >= MAXROUTERCHILDS) rridx = 0;
-    }
-    /* Failed to find a hungry child!?
-       We should not have been called in the first place..  */
-
-  } while (!rc || !rc->hungry || rc->tochild < 0 || rc->fromchild < 0);
-
-
-  _parent_feed_child(rc, fname, dir);
+  rtr_pollupdate(rc);
 
-#if 0 /* NO sync waiting here! */
-  /* .. or if not, we wait here until it has been fed.. */
-  while (rc->childout < rc->childsize)
-    parent_reader(0);
-#endif
-
-  return 1; /* Did feed successfully ?? */
+  return 0;
 }
-#endif /* NOT USED!!! */
 
 
 /*
@@ -883,9 +1008,8 @@ dq_insert(DQ, ino, file, dir)
 	  return 1; /* It is! */
 	}
 
-	for (i = 0; i < MAXROUTERCHILDS; ++i)
-	  if (ino == routerchilds[i].task_ino)
-	    return 1; /* In active processing! */
+	if (rtr_inprocess(ino))
+	  return 1; /* In active processing! */
 
 	/* Now store the entry */
 	dsn = (struct dirstatname*)emalloc(sizeof(*dsn)+strlen(file)+1);
@@ -917,11 +1041,11 @@ dq_insert(DQ, ino, file, dir)
 	   rfc822.c::sequencer()  ! 
 	*/
 
-	MIBMtaEntry->rt.ReceivedMessages += 1;
+	MIBMtaCnt->rt.ReceivedMessages += 1;
 	MIBMtaEntry->rt.StoredMessages    = dq->wrkcount;
 
 	i = (stbuf.st_size + stbuf.st_blksize -1)/1024;
-	MIBMtaEntry->rt.ReceivedVolume += i;
+	MIBMtaCnt->rt.ReceivedVolume += i;
 	MIBMtaEntry->rt.StoredVolume   += i;
 
 	dsn->sizekb = i;
@@ -1045,26 +1169,19 @@ static int dirqueuescan(dir, dq, subdirs)
 }
 
 
-int syncweb(rc)
+/*
+ *  Move the next job of the queue into the child's batch.
+ *  Returns 0, when it does not fit into the child's buffer.
+ */
+static int rtr_take __((struct router_child *, struct dirqueue *));
+static int rtr_take(rc, dq)
 	struct router_child *rc;
+	struct dirqueue *dq;
 {
-	struct stat *stbuf;
-	char *file, *ddir;
 	struct dirstatname *dqstats;
 	struct spblk *spl;
-	int wrkcnt = 0;
-	long ino;
-	struct dirqueue *dq = rc->dq;
-	int wrkidx = dq->wrkcount -1;
-
-	/* Any work to do ? */
-	if (dq->wrksum == 0) {
-	  MIBMtaEntry->rt.StoredMessages   = 0;
-	  MIBMtaEntry->rt.StoredVolume     = 0;
-	  return 0;
-	}
-
-	time(&now);
+	struct rtrjob *jp;
+	int len;
 
 	if (stability && !dq->sorted && dq->wrkcount > 1) {
 
@@ -1080,39 +1197,155 @@ int syncweb(rc)
 
 	}
 
-	/* Ok some, decrement the count to change it to index */
+	dqstats = dq->stats[dq->wrkcount - 1];
+	len = strlen(dqstats->name);
+	if (rc->childsize + len + 2 > sizeof(rc->childline))
+	  return 0;
 
-	dqstats = dq->stats[wrkidx];
-	file  =   dqstats->name;
-	ddir  =   dqstats->dir;
-	stbuf = &(dqstats->st);
-	ino   =   dqstats->ino;
+	/* DIR information is already included at the name ! */
+	memcpy(rc->childline + rc->childsize, dqstats->name, len);
+	rc->childsize += len;
+	rc->childline[rc->childsize++] = '\n';
 
-	rc->task_ino = ino; /* Mark this INO into processing */
-	_parent_feed_child(rc, file, ddir);
+	jp = &rc->jobs[(rc->jobhead + rc->jobcount) % ROUTERBATCHMAX];
+	jp->ino    = dqstats->ino; /* Mark this INO into processing */
+	jp->name   = strdup(dqstats->name);
+	jp->stolen = 0;
+	rc->jobcount += 1;
 
 	dq->wrkcount -= 1;
 	dq->wrksum   -= 1;
-
-	if (dq->wrkcount > wrkidx) {
-	  /* Skipped some ! Compact the array ! */
-	  memcpy( &dq->stats[wrkidx], &dq->stats[wrkidx+1],
-		  sizeof(dq->stats[0]) * (dq->wrkcount - wrkidx));
-	}
 	dq->stats[dq->wrkcount] = NULL;
 
-	/* Now we have pointers */
-
 	/* Deletion from the  dq->mesh  should ALWAYS succeed.. */
-	spl = sp_lookup((u_long)ino, dq->mesh);
+	spl = sp_lookup((u_long)dqstats->ino, dq->mesh);
 	if (spl != NULL)
 	  sp_delete(spl, dq->mesh);
 
 	/* Free the pre-schedule queue entry */
+	free(dqstats->dir);
 	free(dqstats);
-	free(ddir);
 
-	return wrkcnt;
+	return 1;
+}
+
+/*
+ *  All queues are empty: take the tail half of the jobs that wait
+ *  behind the one in process at the child with the most of them.
+ *  They are left in the victim's batch too, as it has them in its
+ *  pipe already; which ever comes to a file first claims it with
+ *  a rename to "inode-pid" in rd_doit(), and the other one finds
+ *  nothing under the old name.
+ */
+static int rtr_steal __((struct router_child *));
+static int rtr_steal(rc)
+	struct router_child *rc;
+{
+	struct router_child *vc, *best = NULL;
+	struct rtrjob *jp, *tp;
+	int i, n, k, len, waiting, bestwaiting = 0;
+
+	for (i = 0; i < MAXROUTERCHILDS; ++i) {
+	  vc = &routerchilds[i];
+	  if (vc == rc || vc->tochild < 0)
+	    continue;
+	  /* The stolen ones are at the tail */
+	  for (n = 1; n < vc->jobcount; ++n)
+	    if (vc->jobs[(vc->jobhead + n) % ROUTERBATCHMAX].stolen)
+	      break;
+	  waiting = n - 1;
+	  if (waiting > bestwaiting) {
+	    best = vc;
+	    bestwaiting = waiting;
+	  }
+	}
+	if (best == NULL)
+	  return 0;
+
+	k = 0;
+	for (n = 1 + bestwaiting / 2; n <= bestwaiting; ++n) {
+	  jp = &best->jobs[(best->jobhead + n) % ROUTERBATCHMAX];
+	  len = strlen(jp->name);
+	  if (rc->childsize + len + 2 > sizeof(rc->childline))
+	    break;
+	  memcpy(rc->childline + rc->childsize, jp->name, len);
+	  rc->childsize += len;
+	  rc->childline[rc->childsize++] = '\n';
+
+	  tp = &rc->jobs[(rc->jobhead + rc->jobcount) % ROUTERBATCHMAX];
+	  tp->ino    = jp->ino;
+	  tp->name   = strdup(jp->name);
+	  tp->stolen = 0;
+	  rc->jobcount += 1;
+
+	  jp->stolen = 1;
+	  ++k;
+	}
+	rc->steals += k;
+	return k;
+}
+
+/*
+ *  Is there work for a child at this slot ?  The  nrouters  children
+ *  of the "router" directory serve all queues; the one child of each
+ *  of the $ROUTERDIRS is started for the jobs of its own directory,
+ *  and then helps the others, too.
+ */
+static int rtr_wantchild __((struct router_child *));
+static int rtr_wantchild(rc)
+	struct router_child *rc;
+{
+	int i;
+
+	if (rc->dq == NULL)
+	  return 0;
+	if (rc->dq != dirq[0])
+	  return (rc->dq->wrkcount > 0);
+	for (i = 0; i < ROUTERDIR_CNT; ++i)
+	  if (dirq[i]->wrkcount > 0)
+	    return 1;
+	return 0;
+}
+
+/*
+ *  Feed a hungry child: its fair share of the queued jobs, up to
+ *  ROUTERBATCH of them, from its home queue first, then from the
+ *  queues in the priority order.  Or steal, when nothing is queued.
+ *  Returns the number of jobs given.
+ */
+int syncweb(rc)
+	struct router_child *rc;
+{
+	int i, n, queued, kids, batch;
+
+	queued = kids = 0;
+	for (i = 0; i < ROUTERDIR_CNT; ++i)
+	  queued += dirq[i]->wrkcount;
+	for (i = 0; i < MAXROUTERCHILDS; ++i)
+	  if (routerchilds[i].tochild >= 0)
+	    ++kids;
+
+	batch = (queued + kids - 1) / (kids ? kids : 1);
+	if (batch > routerbatch)
+	  batch = routerbatch;
+
+	rc->childsize = rc->childout = 0;
+	n = 0;
+
+	while (n < batch && rc->dq->wrkcount > 0 && rtr_take(rc, rc->dq))
+	  ++n;
+	for (i = 0; i < ROUTERDIR_CNT && n < batch; ++i)
+	  while (n < batch && dirq[i]->wrkcount > 0 && rtr_take(rc, dirq[i]))
+	    ++n;
+
+	if (n == 0)
+	  n = rtr_steal(rc);
+	if (n == 0)
+	  return 0;
+
+	_parent_feed_child(rc);
+
+	return n;
 }
 
 /*
@@ -1205,6 +1438,120 @@ static void notify_reader(sock)
 }
 
 
+/*
+ *  The  dirwatch_reader()  gets the directory change notifications
+ *  of the router directories, and their "A" .. "Z" hash directories.
+ *  With it the  dirqueuescan()  is only a rare consistency sweep.
+ */
+
+static void dirwatch_init __((void));
+static void dirwatch_init()
+{
+	int i;
+
+	dirwatch = dirwatch_open();
+	if (!dirwatch) return; /* Periodic scans then */
+
+	for (i = 0; i < ROUTERDIR_CNT; ++i) {
+	  if (routerdirs2[i] && dirwatch_tree(dirwatch, routerdirs2[i], 0) < 0) {
+	    fprintf(stderr, "router: dirwatch_tree('%s') failed; errno=%d\n",
+		    routerdirs2[i], errno);
+	    /* Partial coverage is worse than none at all */
+	    dirwatch_close(dirwatch);
+	    dirwatch = NULL;
+	    return;
+	  }
+	}
+	dirwatchfd = dirwatch_fd(dirwatch);
+}
+
+/* Which of the router directories the 'dir' is, or is under ? */
+static int dirwatch_dirindex __((const char *dir, int *levelp));
+static int dirwatch_dirindex(dir, levelp)
+	const char *dir;
+	int *levelp;
+{
+	int i, len;
+	const char *s;
+
+	for (i = 0; i < ROUTERDIR_CNT; ++i) {
+	  if (!routerdirs2[i]) continue;
+	  if (strcmp(routerdirs2[i], ".") == 0) {
+	    if (strncmp(dir, "../", 3) == 0) continue;
+	    *levelp = (dir[0] == '.' && dir[1] == 0) ? 0 : 1;
+	    s = dir;
+	  } else {
+	    len = strlen(routerdirs2[i]);
+	    if (strncmp(dir, routerdirs2[i], len) != 0 ||
+		(dir[len] != 0 && dir[len] != '/'))
+	      continue;
+	    *levelp = 0;
+	    s = dir + len;
+	  }
+	  /* Count the hash levels below the router dir */
+	  for (; *s; ++s)
+	    if (*s == '/') ++*levelp;
+	  return i;
+	}
+	return -1;
+}
+
+static void dirwatch_event __((void *, const char *, const char *, int));
+static void dirwatch_event(ctx, dir, name, isdir)
+	void *ctx;
+	const char *dir, *name;
+	int isdir;
+{
+	char file[MAXNAMLEN+1];
+	int i, level;
+	long ino;
+
+	i = dirwatch_dirindex(dir, &level);
+	if (i < 0) return;
+
+	if (strlen(dir) + strlen(name) + 2 > sizeof(file))
+	  return;
+	if (dir[0] == '.' && dir[1] == 0)
+	  strcpy(file, name);
+	else
+	  snprintf(file, sizeof(file), "%s/%s", dir, name);
+
+	if (isdir) {
+	  /* A new hash directory, watch it and pick what got there
+	     before the watch did. */
+	  if (name[0] < 'A' || name[0] > 'Z' || name[1] != 0 || level >= 2)
+	    return;
+	  if (dirwatch_tree(dirwatch, file, level+1) == 0)
+	    dirqueuescan(file, dirq[i], 1);
+	  else
+	    dirwatch_broken = 1;
+	  return;
+	}
+
+	if (name[0] < '0' || name[0] > '9')
+	  return;
+	ino = atol(name);
+
+	dq_insert(dirq[i], ino, file, dir);
+}
+
+static void dirwatch_reader()
+{
+	if (dirwatch_read(dirwatch, dirwatch_event, NULL) < 0) {
+	  /* The kernel dropped events, go and look */
+	  nextdirsweep = 0;
+	}
+	if (dirwatch_broken) {
+	  /* Could not follow a new directory, back to periodic scans */
+	  dirwatch_close(dirwatch);
+	  dirwatch = NULL;
+	  dirwatchfd = -1;
+	  dirwatch_broken = 0;
+	  nextdirsweep = 0;
+	}
+}
+
+
 
 
 /* "rd_doit()" at the feeding parent server */
@@ -1252,8 +1599,14 @@ run_doit(argc, argv)
 	av[0] = "process"; /* I think this needs to be here */
 	av[1] = filename;
 	av[2] = NULL;
+	if (router_arena)
+	  cons_region_begin();
 	r = s_apply(2, av); /* "process" filename (within  rd_doit() ) */
 	free_gensym();
+	if (router_arena) {
+	  s_value = NULL;
+	  cons_region_end();
+	}
 
 	setlevel(MEM_SHCMD,sh_memlevel);
 
@@ -1386,7 +1739,7 @@ rd_doit(filename, dirs)
 	  ft.l_whence = SEEK_SET;
 	  ft.l_start  = 0;
 	  ft.l_len    = 0;
-	  fcntl(lockfd, F_GETLK, &ft); /* XXX: ERROR PROCESSING! */
+	  fcntl(lockfd, F_SETLKW, &ft); /* XXX: ERROR PROCESSING! */
 #endif	/* HAVE_FLOCK */
 #endif	/* HAVE_LOCKF */
 	}
@@ -1396,15 +1749,15 @@ rd_doit(filename, dirs)
 	  /* Not a core file, and ...
 	     not already in format of 'inode-pid' */
 	  /* If the pid did exist, we do not touch on that file,
-	     on the other hand, we need to rename the file now.. */
+	     on the other hand, we need to claim the file now.. */
 #ifdef	USE_ALLOCA
-	  buf = (char*)alloca(len+20);
+	  buf = (char*)alloca(len+48);
 #else
 	  if (blen == 0) {
-	    blen = len+20;
-	    buf = (char *)malloc(len+20);
+	    blen = len+48;
+	    buf = (char *)malloc(len+48);
 	  }
-	  while (len + 18 > blen) {
+	  while (len + 48 > blen) {
 	    blen = 2 * blen;
 	    buf = (char *)realloc(buf, blen);
 	  }
@@ -1422,21 +1775,22 @@ rd_doit(filename, dirs)
 
 	  if (!S_ISREG(stbuf.st_mode)) return 0; /* Not a regular file ?? */
 
+	  /* The rename is the claim: of the children that have this
+	     name in their pipes, only one succeeds, the others get
+	     ENOENT, now or at their lstat() above. */
 	  if (dirhash[0]) {
-	    sprintf(buf, "%s/%ld", dirhash, (long)stbuf.st_ino);
+	    sprintf(buf, "%s/%ld-%d", dirhash, (long)stbuf.st_ino, router_id);
 	  } else {
-	    sprintf(buf, "%ld", (long)stbuf.st_ino);
+	    sprintf(buf, "%ld-%d", (long)stbuf.st_ino, router_id);
 	  }
 
-	  if (strcmp(pathbuf, buf) != 0  &&
-	      eqrename(pathbuf, buf) < 0) {
+	  if (eqrename(pathbuf, buf) < 0) {
 	    if (lockfd >= 0) close(lockfd);
 #if defined(HAVE_FCHDIR)
 	    if (dir_fd_ >= 0) fchdir(dir_fd_);
 #endif
 	    if (dp) closedir(dp);
-	    return 0;		/* something is wrong, erename() complains.
-				   (some other process picked it ?) */
+	    return 0;		/* Some other process picked it */
 	  }
 	  filename = buf;
 	  /* message file is now "file-#" and belongs to this process */
@@ -1451,8 +1805,14 @@ rd_doit(filename, dirs)
 	av[0] = "process"; /* I think this needs to be here */
 	av[1] = filename;
 	av[2] = NULL;
+	if (router_arena)
+	  cons_region_begin();
 	s_apply(2, av); /* "process" filename (within  rd_doit() ) */
 	free_gensym();
+	if (router_arena) {
+	  s_value = NULL;
+	  cons_region_end();
+	}
 
 	if (lockfd >= 0) close(lockfd);
 #if defined(HAVE_FCHDIR)
@@ -1511,7 +1871,7 @@ run_daemon(argc, argv)
 
 	MIBMtaEntry->sys.RouterMasterPID        =  getpid();
 	MIBMtaEntry->sys.RouterMasterStartTime  = time(NULL);
-	MIBMtaEntry->sys.RouterMasterStarts    += 1;
+	MIBMtaCnt->sys.RouterMasterStarts    += 1;
 
 
 	/* Zero the gauges at our startup.. */
@@ -1593,16 +1953,38 @@ run_daemon(argc, argv)
 	setfreefd();
 	stickymem = oval;
 
+	/* Watch before the scan, so that nothing falls between them */
+	s = getzenv("ROUTERDIRWATCH");
+	if (s)
+	  dirwatch_sweep = atoi(s);
+	if (dirwatch_sweep > 0)
+	  dirwatch_init();
+
+	s = getzenv("ROUTERBATCH");
+	if (s)
+	  routerbatch = atoi(s);
+	if (routerbatch < 1)
+	  routerbatch = 1;
+	if (routerbatch > ROUTERBATCHMAX)
+	  routerbatch = ROUTERBATCHMAX;
+
+	s = getzenv("ROUTERSTATS");
+	if (s)
+	  routerstats = atoi(s);
+	gettimeofday(&laststats, NULL);
+	nextstats = laststats.tv_sec + routerstats;
+
 	/* Do initial synchronous queue scan now */
 
 	for (i = 0; i < ROUTERDIR_CNT; ++i) {
 	  if (routerdirs2[i])
 	    dirqueuescan(routerdirs2[i], dirq[i], 1);
 	}
+	if (dirwatchfd >= 0)
+	  nextdirsweep = time(NULL) + dirwatch_sweep;
 
 	for (i = 0; i < MAXROUTERCHILDS; ++i) {
-	  if ( routerchilds[i].dq &&
-	       routerchilds[i].dq->wrkcount )
+	  if (rtr_wantchild(&routerchilds[i]))
 	    if (start_child(i))
 	      break; /* fork failed.. */
 	}
@@ -1619,14 +2001,21 @@ run_daemon(argc, argv)
 	    if (now > nextdirscan) {
 	      long sizekbsum = 0;
 	      long msgcountsum = 0;
+	      int sweep = (now >= nextdirsweep);
 
 	      nextdirscan = now + 10;
 
+	      /* With the directory watcher the scan is a rare
+		 consistency sweep */
+	      if (sweep)
+		nextdirsweep = (dirwatchfd >= 0) ? now + dirwatch_sweep : 0;
+
 	      for (i = 0; i < ROUTERDIR_CNT; ++i) {
 		if (routerdirs2[i]) {
-		  dirqueuescan(routerdirs2[i], dirq[i], 1);
+		  if (sweep)
+		    dirqueuescan(routerdirs2[i], dirq[i], 1);
 		  msgcountsum += dirq[i]->wrkcount;
-		  for (ii = 0; ii < dirq[i]->wrkcount; ++i) {
+		  for (ii = 0; ii < dirq[i]->wrkcount; ++ii) {
 		    sizekbsum += dirq[i]->stats[ii]->sizekb;
 		  }
 		}
@@ -1645,19 +2034,22 @@ run_daemon(argc, argv)
 #endif
 	    }
 
+	    if (routerstats > 0 && now >= nextstats) {
+	      rtr_report_stats();
+	      nextstats = now + routerstats;
+	    }
+
 	    for (i = 0; i < MAXROUTERCHILDS; ++i) {
 	      if ( routerchilds[i].tochild < 0 &&
-		   routerchilds[i].dq &&
-		   routerchilds[i].dq->wrkcount ) {
+		   rtr_wantchild(&routerchilds[i]) ) {
 		start_child(i);
 	      }
 
 	      if ( routerchilds[i].tochild >= 0 &&
 		   routerchilds[i].childsize == 0 &&
 		   routerchilds[i].hungry &&
-		   routerchilds[i].dq &&
-		   routerchilds[i].dq->wrkcount > 0 ) {
-		/* Feed this ! */
+		   routerchilds[i].dq ) {
+		/* Feed this !  (Or let it steal.) */
 		syncweb(&routerchilds[i]);
 	      }
 	    }
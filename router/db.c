@@ -31,9 +31,10 @@ typedef enum { Nul, Boolean, Pathalias, Indirect, NonNull } postprocs;
 struct cache {
 	time_t		expiry;
 	unsigned long	keyhash;
-	char		*key;
-	struct cache	*next;
+	char		*key;			/* NULL on a free entry */
 	conscell	*value;
+	int		next;			/* Chain of free entries */
+	int		referenced;		/* For the CLOCK eviction */
 };
 
 #define DBFUNC(_fn_)  (* _fn_) __((search_info *))
@@ -59,8 +60,15 @@ struct db_info {
 	int		DBFUNC(modcheckp);	/* should we reopen database?*/
 	postprocs	postproc;		/* post-lookup applicator */
 	struct cache	*cache;			/* cache entry array */
-	struct cache	*cfirst;		/* LRU cache head entry */
-	struct cache	*cfree;			/* Chain of free entries */
+	int		*chash;			/* cache[] indices by keyhash,
+						   linear probing */
+	unsigned int	chashmask;
+	int		cfree;			/* Chain of free entries */
+	int		cinuse;
+	int		chand;			/* CLOCK hand into cache[] */
+	time_t		negttl;			/* time to live of not-founds */
+	unsigned long	chits, cmisses;		/* statistics */
+	unsigned long	cevictions, cexpiries;
 	void		*dbprivate;		/* DB specific private data;
 						   created by open, destroyed
 						   by close..  */
@@ -103,6 +111,9 @@ struct db_kind {
 		  NULL, NULL, print_seq, count_seq, owner_seq, modp_seq,
 		  Nul, NULL, NULL } },
 #endif
+{ "trie",	{ NULL, NULL, NULL, 0, 0, 0, NULL, search_trie, close_trie,
+		  NULL, NULL, print_seq, count_seq, owner_seq, modp_trie,
+		  Nul, NULL, NULL } },
 
 #ifdef	HAVE_RESOLVER
 { "hostsfile",	{ "/etc/hosts", NULL, NULL, 0, 0, 0, NULL, search_hosts, NULL,
@@ -161,6 +172,10 @@ static conscell	*find_nodot_domain __((conscell *DBFUNC(lookupfn), search_info *
 static conscell *find_longest_match __((conscell *DBFUNC(lookupfn), search_info *sip));
 /* others.. */
 static void      cacheflush __((struct db_info *dbip));
+static int       cachefind  __((struct db_info *dbip, const char *key,
+				unsigned long khash));
+static void      cachedrop  __((struct db_info *dbip, int ci));
+static int       cacheslot  __((struct db_info *dbip));
 static int	 iclistdbs  __((void *, struct spblk *spl));
 
 
@@ -172,14 +187,15 @@ iccachemarkup(p, spl)
 {
 	struct db_info *dbip = (struct db_info *)spl->data;
 	struct cache *cp;
+	int i;
 
 	if (dbip == NULL || dbip->cache_size == 0 || dbip->cache == NULL)
 		return 0;
 
 	/* markup cache */
 	
-	for (cp = dbip->cfirst; cp != NULL; cp = cp->next)
-	  if (cp->value) /* Unnecessary ? */
+	for (i = 0, cp = dbip->cache; i < dbip->cache_size; ++i, ++cp)
+	  if (cp->key && cp->value)
 	    cachemarkupfunc(cp->value);
 
 	return 0;
@@ -234,7 +250,7 @@ run_relation(argc, argv)
 	proto_config=db_kinds[sizeof(db_kinds)/(sizeof(db_kinds[0]))-1].config;
 
 	while (1) {
-		c = zgetopt(argc,(char*const*)argv,":%C:bilmnNpud:f:s:L:t:Te:");
+		c = zgetopt(argc,(char*const*)argv,":%C:bilmnNpud:f:s:L:t:Te:E:");
 		if (c == EOF)
 			break;
 		switch (c) {
@@ -305,6 +321,9 @@ run_relation(argc, argv)
 		case 'e':	/* expiry - cache data time to live */
 			proto_config.ttl = atol(zoptarg);
 			break;
+		case 'E':	/* expiry of the negative cache entries */
+			proto_config.negttl = atol(zoptarg);
+			break;
 		case 'u':	/* map all keys to uppercase */
 			proto_config.flags |= DB_MAPTOUPPER;
 			break;
@@ -323,7 +342,7 @@ run_relation(argc, argv)
 	}
 	if (errflg || zoptind != argc - 1 || dbtyp == NULL) {
 		int first = 1;
-		fprintf(stderr, "Usage: %s -t dbtype[,subtype] [-f file -e# -s# -bilmnNpu -d driver] name\n", argv[0]);
+		fprintf(stderr, "Usage: %s -t dbtype[,subtype] [-f file -e# -E# -s# -bilmnNpu -d driver] name\n", argv[0]);
 		fprintf(stderr, "       %s -T -t dbtype dummyname\n", argv[0]);
 		fprintf(stderr, "       dbtypes: ");
 		for (dbkp = &db_kinds[0];
@@ -432,10 +451,19 @@ run_relation(argc, argv)
 		int i = dbip->cache_size * sizeof(struct cache);
 		dbip->cache = (struct cache *) smalloc(MEM_PERM, (u_int)(i));;
 		memset(dbip->cache, 0, i);
-		dbip->cfirst = NULL;	/* Head init */
-		for (i = dbip->cache_size -2; i >= 0; --i)
-		  dbip->cache[i].next = &dbip->cache[i+1];
-		dbip->cfree  = &dbip->cache[0];
+		/* Hash index at most half full */
+		for (i = 16; i < 2 * dbip->cache_size; i <<= 1)
+		  ;
+		dbip->chashmask = i - 1;
+		dbip->chash = (int *) smalloc(MEM_PERM, (u_int)(i * sizeof(int)));
+		for (--i; i >= 0; --i)
+		  dbip->chash[i] = -1;
+		for (i = dbip->cache_size -1; i >= 0; --i)
+		  dbip->cache[i].next = i+1;
+		dbip->cache[dbip->cache_size -1].next = -1;
+		dbip->cfree  = 0;
+		dbip->cinuse = 0;
+		dbip->chand  = 0;
 	} else
 		dbip->cache = NULL;	/* superfluous, but why not ... */
 	dbip->dbprivate = NULL; /* also superfluous .. */
@@ -487,7 +515,6 @@ iclistdbs(p, spl)
 {
 	struct db_kind *dbkp;
 	struct db_info *dbip;
-	struct cache *cachep;
 	const char *cp;
 	int i;
 
@@ -516,10 +543,7 @@ iclistdbs(p, spl)
 
 	printf("%*s", i, " ");
 	
-	for (i = 0, cachep = dbip->cfirst ;
-	     cachep ; cachep = cachep->next) ++i;
-
-	printf("%4d/%-4d ", i, dbip->cache_size);
+	printf("%4d/%-4d ", dbip->cinuse, dbip->cache_size);
 	printf("%4d ", (int)dbip->ttl);
 
 	i = 0;
@@ -642,12 +666,13 @@ run_db(argc, argv)
 		case 'n':
 		case 'o':
 		case 'c':
+		case 's':
 		case 'p':	errflag = (argc != 3); break;
 		default:	errflag = 1; break;
 		}
 	if (errflag) {
 		fprintf(stderr,
-"Usage: %s { add|remove|flush|owner|print|count|toc } [ database [ key [ value ] ] ]\n",
+"Usage: %s { add|remove|flush|owner|print|count|stats|toc } [ database [ key [ value ] ] ]\n",
 			argv[0]);
 		return 1;
 	}
@@ -759,6 +784,15 @@ run_db(argc, argv)
 		}
 		(*dbip->count)(&si, stdout);
 		break;
+	case 's':	/* cache statistics */
+		printf("%s: cache %d/%d hits %lu misses %lu (%d%% hits) evictions %lu expiries %lu\n",
+		       argv[2], dbip->cinuse, dbip->cache_size,
+		       dbip->chits, dbip->cmisses,
+		       (dbip->chits + dbip->cmisses) ?
+		       (int)((100.0 * dbip->chits) /
+			     (dbip->chits + dbip->cmisses)) : 0,
+		       dbip->cevictions, dbip->cexpiries);
+		break;
 	default:
 		fprintf(stderr, "%s: unknown command '%s'\n", argv[0], argv[1]);
 		return 5;
@@ -892,53 +926,22 @@ dblookup(dbname, argc, argv30)
 	}
 	/* look for the desired result in the cache first */
 	if (dbip->cache_size > 0) {
-		struct cache **pcache = &dbip->cfirst;
-		struct cache *cnext;
-
-		cache   = *pcache;
-
-		for ( ; cache != NULL; cache = cnext) {
-			cnext = cache->next;
+		int ci = cachefind(dbip, key, khash);
 
+		if (ci >= 0) {
+			cache = &dbip->cache[ci];
 			if (cache->expiry > 0 && cache->expiry < now) {
 				if (D_db)
 					fprintf(stderr,
 						"... expiring %s from cache\n",
 						cache->key);
-				if (cache->key) free(cache->key);
-				cache->keyhash = 0UL;
-				cache->key   = NULL;
-				cache->value = NULL; /* conscell GC does it */
-
-				/* Unlink from active chain */
-				*pcache = cache->next;
-
-				/* Link into free chain */
-				cache->next = dbip->cfree;
-				dbip->cfree = cache;
-
-				continue;
-			}
-			if (D_db)
-			  fprintf(stderr,
-				  "... comparing '%s' and '%s' in cache\n",
-				  cache->key, key);
-
-			/* Match hashed key values, and in case they collide,
-			   match also strings in case sensitive manner. */
-
-			if (cache->keyhash == khash &&
-			    STREQ(cache->key, key)) { /* CACHE HIT! */
-
-				/* Move this entry to the head
-				   of the LRU list */
-
-				/* Unlink from current location */
-				*pcache = cache->next;
-
-				/* Link into head! */
-				cache->next = dbip->cfirst;
-				dbip->cfirst = cache;
+				cachedrop(dbip, ci);
+				++dbip->cexpiries;
+				MIBMtaCnt->rt.RouterDbCacheExpiries ++;
+			} else { /* CACHE HIT! */
+				cache->referenced = 1;
+				++dbip->chits;
+				MIBMtaCnt->rt.RouterDbCacheHits ++;
 
 				if (D_db)
 					fprintf(stderr, "... found in cache\n");
@@ -946,8 +949,10 @@ dblookup(dbname, argc, argv30)
 				ll = s_copy_chain(cache->value);
 				goto post_subst;
 			}
-			pcache = &cache->next;
 		}
+		++dbip->cmisses;
+		MIBMtaCnt->rt.RouterDbCacheMisses ++;
+
 		/* key gets clobbered somewhere, so save it here */
 		realkey = strdup(key);
 	}
@@ -1016,47 +1021,33 @@ dblookup(dbname, argc, argv30)
 		}
 	}
 	if (!deferit && dbip->cache_size > 0) {
-		/* insert new cache entry at head of cache */
-		if (! dbip->cfree ) {
-
-			/* No free slots */
-
-			struct cache **pcache = &dbip->cfirst;
-			cache   = *pcache;
-
-			/* Hunt for the last slot.. */
-
-			for (;cache && cache->next; cache = *pcache)
-			  pcache = &cache->next;
-
-			/* This *MUST* be a non-NULL thing! */
-
-			if (cache->key) free(cache->key);
-
-			*pcache = NULL;
-			cache->next  = dbip->cfirst;
-			dbip->cfirst = cache;
-
-		} else {
-			/* Pick entry from free slots chain */
-			cache        = dbip->cfree;
-			dbip->cfree  = cache->next;
-			cache->next  = dbip->cfirst;
-			dbip->cfirst = cache;
-		}
-
-		cache->key     = realkey;
-		cache->keyhash = khash;
-		cache->value   = l;
+		/* insert new cache entry */
+		int ci = cacheslot(dbip);
+		unsigned int i;
+		time_t ttl;
+
+		cache = &dbip->cache[ci];
+		cache->key        = realkey;
+		cache->keyhash    = khash;
+		cache->value      = cons_promote(l);
+		cache->referenced = 0;
+		for (i = khash & dbip->chashmask; dbip->chash[i] >= 0;
+		     i = (i + 1) & dbip->chashmask)
+			;
+		dbip->chash[i] = ci;
+		++dbip->cinuse;
 		if (D_db)
 			fprintf(stderr, "... added '%s' to cache", realkey);
 		/* The "realkey" went into cache. */
 		realkey = NULL;
 
-		if (si.ttl > 0) {
-			cache->expiry = now + si.ttl;
+		ttl = si.ttl;
+		if (l == NULL && dbip->negttl > 0)
+			ttl = dbip->negttl;
+		if (ttl > 0) {
+			cache->expiry = now + ttl;
 			if (D_db)
-				fprintf(stderr, " (ttl=%d)\n", (int)si.ttl);
+				fprintf(stderr, " (ttl=%d)\n", (int)ttl);
 		} else {
 			cache->expiry = 0;
 			if (D_db)
@@ -1205,25 +1196,124 @@ static void
 cacheflush(dbip)
 	struct db_info *dbip;
 {
-	struct cache *cache, *cnext;
+	struct cache *cache;
+	int i;
 
 	if (!dbip || (dbip->cache_size == 0) || (! dbip->cache) )
 		return;
 
 	/* flush cache */
 	
-	for (cache = dbip->cfirst; cache; cache = cnext) {
-		cnext = cache->next;
-
+	for (i = 0; i < dbip->cache_size; ++i) {
+		cache = &dbip->cache[i];
 		if (cache->key)   free(cache->key);
 		cache->key   = NULL;
 		cache->value = NULL; /* conscell pointer; garbage
 					collector will free it.. */
+		cache->next  = i+1;
+	}
+	dbip->cache[dbip->cache_size -1].next = -1;
+	dbip->cfree  = 0;
+	dbip->cinuse = 0;
+	for (i = dbip->chashmask; i >= 0; --i)
+		dbip->chash[i] = -1;
+}
+
+/*
+ * The cache entry of the key, or -1.
+ */
+
+static int
+cachefind(dbip, key, khash)
+	struct db_info *dbip;
+	const char *key;
+	unsigned long khash;
+{
+	struct cache *cache;
+	unsigned int i;
+	int ci;
+
+	for (i = khash & dbip->chashmask; (ci = dbip->chash[i]) >= 0;
+	     i = (i + 1) & dbip->chashmask) {
+		cache = &dbip->cache[ci];
 
-		cache->next = dbip->cfree;
-		dbip->cfree = cache;
+		/* Match hashed key values, and in case they collide,
+		   match also strings in case sensitive manner. */
+
+		if (cache->keyhash == khash && STREQ(cache->key, key))
+			return ci;
+	}
+	return -1;
+}
+
+/*
+ * Remove an entry from the cache.  The entries that follow it on the
+ * probe sequence are moved back, there are no deletion markers.
+ */
+
+static void
+cachedrop(dbip, ci)
+	struct db_info *dbip;
+	int ci;
+{
+	struct cache *cache = &dbip->cache[ci];
+	unsigned int i, j, home, mask = dbip->chashmask;
+
+	for (i = cache->keyhash & mask; dbip->chash[i] != ci; i = (i+1) & mask)
+		;
+	for (j = (i + 1) & mask; dbip->chash[j] >= 0; j = (j + 1) & mask) {
+		home = dbip->cache[dbip->chash[j]].keyhash & mask;
+		/* Can it move to the hole at 'i' ? */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			dbip->chash[i] = dbip->chash[j];
+			i = j;
+		}
+	}
+	dbip->chash[i] = -1;
+
+	if (cache->key) free(cache->key);
+	cache->key     = NULL;
+	cache->keyhash = 0UL;
+	cache->value   = NULL; /* conscell GC does it */
+	cache->next    = dbip->cfree;
+	dbip->cfree    = ci;
+	--dbip->cinuse;
+}
+
+/*
+ * A free cache entry; when there are none, the CLOCK hand goes round
+ * the entries, and takes the first one that has expired, or that has
+ * not been found since the hand passed it the last time.
+ */
+
+static int
+cacheslot(dbip)
+	struct db_info *dbip;
+{
+	struct cache *cache;
+	int ci;
+
+	while (dbip->cfree < 0) {
+		ci = dbip->chand;
+		cache = &dbip->cache[ci];
+		if (++dbip->chand >= dbip->cache_size)
+			dbip->chand = 0;
+
+		if (cache->expiry > 0 && cache->expiry < now) {
+			cachedrop(dbip, ci);
+			++dbip->cexpiries;
+			MIBMtaCnt->rt.RouterDbCacheExpiries ++;
+		} else if (cache->referenced) {
+			cache->referenced = 0;
+		} else {
+			cachedrop(dbip, ci);
+			++dbip->cevictions;
+			MIBMtaCnt->rt.RouterDbCacheEvictions ++;
+		}
 	}
-	dbip->cfirst = NULL;
+	ci = dbip->cfree;
+	dbip->cfree = dbip->cache[ci].next;
+	return ci;
 }
 
 
@@ -1305,15 +1395,25 @@ find_domain(lookupfn, sip)
 	conscell *l;
 	const char *realkey;
 	char *buf;
-	int keylen;
+	int keylen, done;
+
+	realkey = sip->key;
+	keylen  = strlen(realkey);
+
+	if (lookupfn == search_trie) {
+		/* All the probes below in one go */
+		l = match_trie(sip, TRIE_PATHALIAS, &done);
+		if (l != NULL)
+			return l;
+		if (done)
+			goto trydot;
+	}
 
 	/* check the key as given */
 	l = (*lookupfn)(sip);
 	if (l != NULL)
 		return l;
 
-	realkey = sip->key;
-	keylen  = strlen(realkey);
 #define PREDOT_TEST
 #ifdef PREDOT_TEST
 #ifdef HAVE_ALLOCA
@@ -1371,6 +1471,7 @@ find_domain(lookupfn, sip)
 			return l;
 	}
 #endif
+ trydot:
 	/* Still failed ?  Try to look for "." */
 	sip->key = ".";
 
@@ -1456,6 +1557,13 @@ find_nodot_domain(lookupfn, sip)
 	register const char *cp;
 	const char *realkey = sip->key;
 	conscell *l = NULL;
+	int done;
+
+	if (lookupfn == search_trie) {
+		l = match_trie(sip, TRIE_NODOT, &done);
+		if (l != NULL || done)
+			return l;
+	}
 
 	/* iterate over the subdomains of the key */
 	for (cp = sip->key; *cp;) {
@@ -1516,6 +1624,7 @@ find_longest_match(lookupfn, sip)
 	char buf[BUFSIZ]; 
 	char *realkey;
 	unsigned int oct1,oct2,oct3,oct4;
+	int done;
 
 	if (sscanf((char*)(sip->key[0]=='[' ? sip->key+1 : sip->key),
 	    "%3u.%3u.%3u.%3u",
@@ -1523,6 +1632,13 @@ find_longest_match(lookupfn, sip)
 		unsigned int h_addr,h_mask;
 		int prefix;
 
+		if (lookupfn == search_trie) {
+			/* The longest prefix in one go */
+			l = match_trie(sip, TRIE_LONGESTMATCH, &done);
+			if (done)
+				return l;
+		}
+
 		h_addr = (((oct1 & 255) << 24) |
 			  ((oct2 & 255) << 16) |
 			  ((oct3 & 255) <<  8) |
@@ -1544,11 +1660,21 @@ find_longest_match(lookupfn, sip)
 
 	} else {  /* domain name */
 
+		realkey = (char *) sip->key;
+
+		if (lookupfn == search_trie) {
+			/* All the probes below in one go */
+			l = match_trie(sip, TRIE_LONGESTMATCH, &done);
+			if (l != NULL)
+				return l;
+			if (done)
+				goto trydot;
+		}
+
 		/* check the key as given */
 		if ((l = (*lookupfn)(sip)) != NULL)
 			return l;
 
-		realkey = (char *) sip->key;
 		/* iterate over the superdomains of the key */
 		for (cp = realkey; *cp;) {
 			while (*cp && *cp != '.')
@@ -1566,6 +1692,7 @@ find_longest_match(lookupfn, sip)
 				}
 			}
 		}
+	trydot:
 		/* Still failed ?  Try to look for "." */
 		sip->key = ".";
 
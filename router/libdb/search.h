@@ -63,6 +63,7 @@ extern conscell	*search_seq	__((search_info	*sip));
 extern conscell	*search_yp	__((search_info	*sip));
 extern conscell	*search_selfmatch __((search_info *sip));
 extern conscell	*search_ldap    __((search_info *sip));
+extern conscell	*search_trie	__((search_info	*sip));
 /* closes	*/
 extern void	close_core	__((search_info	*sip, const char *cmt));
 extern void	close_seq	__((search_info	*sip, const char *cmt));
@@ -73,6 +74,7 @@ extern void	close_dbm	__((search_info	*sip, const char *cmt));
 extern void	close_gdbm	__((search_info	*sip, const char *cmt));
 extern void	close_header	__((search_info	*sip, const char *cmt));
 extern void	close_ldap	__((search_info	*sip, const char *cmt));
+extern void	close_trie	__((search_info	*sip, const char *cmt));
 /* adds	*/
 extern int	add_core	__((search_info *sip, const char *value));
 extern int	add_seq		__((search_info *sip, const char *value));
@@ -129,6 +131,13 @@ extern int	modp_btree	__((search_info	*sip));
 extern int	modp_bhash	__((search_info	*sip));
 extern int	modp_gdbm	__((search_info	*sip));
 extern int	modp_ldap	__((search_info	*sip));
+extern int	modp_trie	__((search_info	*sip));
+
+/* single-pass driver matching of the "trie" database */
+#define	TRIE_PATHALIAS		1
+#define	TRIE_NODOT		2
+#define	TRIE_LONGESTMATCH	3
+extern conscell	*match_trie	__((search_info *sip, int how, int *donep));
 
 /* misc stuff */
 extern void init_header __((void));
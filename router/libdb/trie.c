@@ -0,0 +1,802 @@
+/* LINTLIBRARY */
+
+/*
+ * The "trie" database:  a file of key-value pairs, like the "unordered"
+ * and "ordered" files are, but indexed in memory at the first lookup:
+ *
+ *  - all keys go into a hash table, for the plain lookups,
+ *
+ *  - the domain keys ("foo.bar.edu", ".bar.edu") go into a trie of
+ *    their labels, the rightmost label first; "foo.bar.edu" is the
+ *    'exact' of the node at the path edu,bar,foo, and ".foo.bar.edu"
+ *    is the 'wild' of that same node,
+ *
+ *  - the IPv4 prefix keys ("10.1.0.0/16", written like the
+ *    longestmatch driver makes them) go into a binary trie.
+ *
+ * With that, the pathalias, pathalias.nodot and longestmatch drivers
+ * (of db.c) can find the closest match of a key in a single walk thru
+ * the trie, instead of probing the database once per label, or once
+ * per prefix length.  The results are the same as those of the probes.
+ *
+ * The index refers to the file contents, which are mapped into memory,
+ * when possible.  The "-m" option of the relation rebuilds the index
+ * when the file has changed.
+ */
+
+#include "mailer.h"
+#include <stdio.h>
+#include <sys/file.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include "search.h"
+#include "io.h"
+#include "libz.h"
+#include "libc.h"
+#include "libsh.h"
+
+#ifdef	HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <errno.h>
+
+extern int deferit;
+extern char *skip821address __((char *));
+
+#define TRIE_NONE	(-1)
+
+struct trie_ent {		/* A line of the file			*/
+	int		key, klen;	/* Offsets in the file contents */
+	int		val, vlen;
+};
+
+struct trie_dom {
+	int		label, llen;	/* Offset in the file contents	*/
+	int		kids, nkids;	/* Children at dom[kids ...]	*/
+	int		exact, wild;	/* struct trie_ent indices	*/
+};
+
+struct trie_ip {
+	int		child[2];	/* struct trie_ip indices	*/
+	int		ent;		/* Entry of 'addr/width', or none */
+	unsigned int	addr;
+	int		width;
+};
+
+struct trie_db {
+	const char	*buf;		/* The file contents		*/
+	long		size;
+	int		mapped;
+	dev_t		dev;
+	ino_t		ino;
+	time_t		mtime;
+
+	struct trie_ent	*ents;
+	int		nents;
+	int		*hash;		/* struct trie_ent indices	*/
+	unsigned int	hashmask;
+
+	struct trie_dom	*dom;		/* dom[0] is the root		*/
+	int		ndom, domspace;
+
+	struct trie_ip	*ip;
+	int		nip, ipspace, iproot;
+};
+
+/* For sorting the keys of the tries */
+struct trie_sort {
+	int		ent;
+	const char	*key;		/* Without the leading dot	*/
+	int		klen;
+	int		wild;
+	unsigned int	addr;
+	int		width;
+};
+
+
+/* Case-insensitive compare of two counted strings, like cistrcmp() */
+static int trie_cmp __((const char *, int, const char *, int));
+static int
+trie_cmp(a, alen, b, blen)
+	const char *a, *b;
+	int alen, blen;
+{
+	int c1, c2;
+
+	for (; alen > 0 && blen > 0; --alen, --blen, ++a, ++b) {
+		c1 = *a & 0xFF;
+		c2 = *b & 0xFF;
+		if (isascii(c1) && isupper(c1)) c1 = tolower(c1);
+		if (isascii(c2) && isupper(c2)) c2 = tolower(c2);
+		if (c1 != c2)
+			return c1 - c2;
+	}
+	return alen - blen;
+}
+
+static unsigned int trie_hashkey __((const char *, int));
+static unsigned int
+trie_hashkey(s, len)
+	const char *s;
+	int len;
+{
+	unsigned int h = 2166136261U;
+	int c;
+
+	while (len-- > 0) {
+		c = *s++ & 0xFF;
+		if (isascii(c) && isupper(c)) c = tolower(c);
+		h = (h ^ c) * 16777619U;
+	}
+	return h;
+}
+
+/*
+ * The label 'depth' (0 = the rightmost one) of a domain name
+ * without empty labels.  Returns its length, or -1 when there are
+ * not that many labels.
+ */
+static int trie_label __((const char *, int, int, const char **));
+static int
+trie_label(name, len, depth, labelp)
+	const char *name;
+	int len, depth;
+	const char **labelp;
+{
+	const char *end = name + len, *s = end;
+
+	for (;;) {
+		while (s > name && *(s-1) != '.')
+			--s;
+		if (depth-- == 0) {
+			*labelp = s;
+			return end - s;
+		}
+		if (s == name)
+			return -1;
+		end = --s;
+	}
+}
+
+/* A domain name of non-empty labels ?  Nor any odd characters ? */
+static int trie_domainname __((const char *, int));
+static int
+trie_domainname(s, len)
+	const char *s;
+	int len;
+{
+	int i, c;
+
+	if (len <= 0 || s[0] == '.' || s[len-1] == '.')
+		return 0;
+	for (i = 0; i < len; ++i) {
+		c = s[i] & 0xFF;
+		if (c == '.' ? s[i+1] == '.' :
+		    (c == '@' || c == '/' || c == '[' || c == '"' ||
+		     c == '\\' || (isascii(c) && isspace(c))))
+			return 0;
+	}
+	return 1;
+}
+
+/* "a.b.c.d/n" exactly as the longestmatch driver writes it ? */
+static int trie_ipprefix __((const char *, int, unsigned int *, int *));
+static int
+trie_ipprefix(s, len, addrp, widthp)
+	const char *s;
+	int len;
+	unsigned int *addrp;
+	int *widthp;
+{
+	char buf[40], buf2[40];
+	unsigned int o1, o2, o3, o4, addr;
+	int w;
+
+	if (len < 9 || len >= sizeof(buf) || !isdigit(*s & 0xFF))
+		return 0;
+	memcpy(buf, s, len);
+	buf[len] = 0;
+	if (sscanf(buf, "%u.%u.%u.%u/%d", &o1, &o2, &o3, &o4, &w) != 5 ||
+	    o1 > 255 || o2 > 255 || o3 > 255 || o4 > 255 || w < 0 || w > 32)
+		return 0;
+	addr = (o1 << 24) | (o2 << 16) | (o3 << 8) | o4;
+	if (w < 32 && (addr & (0xffffffffU >> w)) != 0)
+		return 0;	/* Not masked; never probed for */
+	sprintf(buf2, "%u.%u.%u.%u/%d", o1, o2, o3, o4, w);
+	if (strcmp(buf, buf2) != 0)
+		return 0;
+	*addrp  = addr;
+	*widthp = w;
+	return 1;
+}
+
+
+/* Rightmost label first; the shorter names, and then 'exact' first */
+static int trie_domsortcmp __((const void *, const void *));
+static int
+trie_domsortcmp(a, b)
+	const void *a, *b;
+{
+	const struct trie_sort *sa = a, *sb = b;
+	const char *la, *lb;
+	int i, na, nb, rc;
+
+	for (i = 0; ; ++i) {
+		na = trie_label(sa->key, sa->klen, i, &la);
+		nb = trie_label(sb->key, sb->klen, i, &lb);
+		if (na < 0 || nb < 0) {
+			if (na >= 0) return 1;
+			if (nb >= 0) return -1;
+			break;
+		}
+		rc = trie_cmp(la, na, lb, nb);
+		if (rc)
+			return rc;
+	}
+	if (sa->wild != sb->wild)
+		return sa->wild - sb->wild;
+	return sa->ent - sb->ent;	/* The first one of the file wins */
+}
+
+static int trie_ipsortcmp __((const void *, const void *));
+static int
+trie_ipsortcmp(a, b)
+	const void *a, *b;
+{
+	const struct trie_sort *sa = a, *sb = b;
+
+	if (sa->addr != sb->addr)
+		return sa->addr < sb->addr ? -1 : 1;
+	if (sa->width != sb->width)
+		return sa->width - sb->width;
+	return sa->ent - sb->ent;
+}
+
+
+static int trie_domnode __((struct trie_db *));
+static int
+trie_domnode(db)
+	struct trie_db *db;
+{
+	struct trie_dom *d;
+
+	if (db->ndom >= db->domspace) {
+		db->domspace = db->domspace ? db->domspace * 2 : 64;
+		db->dom = (struct trie_dom *)
+		  erealloc(db->dom, db->domspace * sizeof(struct trie_dom));
+	}
+	d = &db->dom[db->ndom];
+	d->label = d->llen = 0;
+	d->kids  = d->nkids = 0;
+	d->exact = d->wild = TRIE_NONE;
+	return db->ndom++;
+}
+
+/*
+ * Build the node 'n' at 'depth' from the sorted keys [lo,hi), all of
+ * which have the labels of the path to 'n'.  The children of a node
+ * are allocated together, thus they are an array sorted by the label.
+ */
+static void trie_dombuild __((struct trie_db *, struct trie_sort *,
+			      int, int, int, int));
+static void
+trie_dombuild(db, ks, lo, hi, depth, n)
+	struct trie_db *db;
+	struct trie_sort *ks;
+	int lo, hi, depth, n;
+{
+	const char *l1, *l2;
+	int i, j, k, len, len2, kids, nkids;
+
+	/* Those that end here come first */
+	for (; lo < hi && trie_label(ks[lo].key, ks[lo].klen, depth, &l1) < 0;
+	     ++lo) {
+		if (ks[lo].wild) {
+			if (db->dom[n].wild == TRIE_NONE)
+				db->dom[n].wild = ks[lo].ent;
+		} else {
+			if (db->dom[n].exact == TRIE_NONE)
+				db->dom[n].exact = ks[lo].ent;
+		}
+	}
+	if (lo >= hi)
+		return;
+
+	nkids = 0;
+	for (i = lo; i < hi; i = j) {
+		len = trie_label(ks[i].key, ks[i].klen, depth, &l1);
+		for (j = i+1; j < hi; ++j) {
+			len2 = trie_label(ks[j].key, ks[j].klen, depth, &l2);
+			if (trie_cmp(l1, len, l2, len2) != 0)
+				break;
+		}
+		++nkids;
+	}
+	kids = db->ndom;
+	for (k = 0; k < nkids; ++k)
+		trie_domnode(db);
+	db->dom[n].kids  = kids;
+	db->dom[n].nkids = nkids;
+
+	for (i = lo, k = kids; i < hi; i = j, ++k) {
+		len = trie_label(ks[i].key, ks[i].klen, depth, &l1);
+		for (j = i+1; j < hi; ++j) {
+			len2 = trie_label(ks[j].key, ks[j].klen, depth, &l2);
+			if (trie_cmp(l1, len, l2, len2) != 0)
+				break;
+		}
+		db->dom[k].label = l1 - db->buf;
+		db->dom[k].llen  = len;
+		trie_dombuild(db, ks, i, j, depth+1, k);
+	}
+}
+
+static int trie_ipnode __((struct trie_db *, unsigned int, int));
+static int
+trie_ipnode(db, addr, width)
+	struct trie_db *db;
+	unsigned int addr;
+	int width;
+{
+	struct trie_ip *t;
+
+	if (db->nip >= db->ipspace) {
+		db->ipspace = db->ipspace ? db->ipspace * 2 : 64;
+		db->ip = (struct trie_ip *)
+		  erealloc(db->ip, db->ipspace * sizeof(struct trie_ip));
+	}
+	t = &db->ip[db->nip];
+	t->child[0] = t->child[1] = TRIE_NONE;
+	t->ent   = TRIE_NONE;
+	t->addr  = addr;
+	t->width = width;
+	return db->nip++;
+}
+
+/* The leading bits that all of [lo,hi) share, at most 'maxw' */
+static int trie_ipcommon __((struct trie_sort *, int, int, int));
+static int
+trie_ipcommon(ks, lo, hi, maxw)
+	struct trie_sort *ks;
+	int lo, hi, maxw;
+{
+	unsigned int diff = ks[lo].addr ^ ks[hi-1].addr;
+	int w = 0;
+
+	while (w < maxw && !(diff & (0x80000000U >> w)))
+		++w;
+	return w;
+}
+
+/*
+ * A path-compressed binary trie from the sorted prefixes [lo,hi):
+ * the node is the prefix that all of them share.
+ */
+static int trie_ipbuild __((struct trie_db *, struct trie_sort *, int, int));
+static int
+trie_ipbuild(db, ks, lo, hi)
+	struct trie_db *db;
+	struct trie_sort *ks;
+	int lo, hi;
+{
+	int i, n, w, mid, maxw;
+	unsigned int mask;
+
+	if (lo >= hi)
+		return TRIE_NONE;
+
+	maxw = 32;
+	for (i = lo; i < hi; ++i)
+		if (ks[i].width < maxw)
+			maxw = ks[i].width;
+	w = trie_ipcommon(ks, lo, hi, maxw);
+	mask = w ? (0xffffffffU << (32 - w)) : 0;
+
+	n = trie_ipnode(db, ks[lo].addr & mask, w);
+
+	/* The sort puts the shorter prefixes of an address first */
+	for (; lo < hi && ks[lo].width == w; ++lo)
+		if (db->ip[n].ent == TRIE_NONE)
+			db->ip[n].ent = ks[lo].ent;
+	if (lo >= hi)
+		return n;
+
+	/* The rest are wider; split them by the bit 'w' */
+	for (mid = lo; mid < hi; ++mid)
+		if (ks[mid].addr & (0x80000000U >> w))
+			break;
+	i = trie_ipbuild(db, ks, lo, mid);
+	db->ip[n].child[0] = i;
+	i = trie_ipbuild(db, ks, mid, hi);
+	db->ip[n].child[1] = i;
+	return n;
+}
+
+
+static void trie_free __((struct trie_db *));
+static void
+trie_free(db)
+	struct trie_db *db;
+{
+	if (db->buf != NULL) {
+#ifdef	HAVE_MMAP
+		if (db->mapped)
+			munmap((void*)db->buf, db->size);
+		else
+#endif
+			free((void*)db->buf);
+	}
+	if (db->ents) free(db->ents);
+	if (db->hash) free(db->hash);
+	if (db->dom)  free(db->dom);
+	if (db->ip)   free(db->ip);
+	free(db);
+}
+
+/*
+ * Read (map) the file, and index it.
+ */
+static struct trie_db *trie_load __((search_info *));
+static struct trie_db *
+trie_load(sip)
+	search_info *sip;
+{
+	struct trie_db *db;
+	struct trie_ent *e;
+	struct trie_sort *ks;
+	struct stat stbuf;
+	const char *s, *eol, *eof;
+	char line[BUFSIZ], *cp, *p;
+	int fd, i, n, nks, nip, spc;
+	unsigned int h;
+
+	fd = open(sip->file, O_RDONLY, 0);
+	if (fd < 0 || fstat(fd, &stbuf) < 0) {
+		++deferit;
+		v_set(DEFER, DEFER_IO_ERROR);
+		fprintf(stderr, "search_trie: cannot open %s!\n", sip->file);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	db = (struct trie_db *)emalloc(sizeof(struct trie_db));
+	memset(db, 0, sizeof(struct trie_db));
+	db->size  = stbuf.st_size;
+	db->dev   = stbuf.st_dev;
+	db->ino   = stbuf.st_ino;
+	db->mtime = stbuf.st_mtime;
+
+#ifdef	HAVE_MMAP
+	if (db->size > 0) {
+		db->buf = (const char *)mmap(NULL, db->size, PROT_READ,
+					     MAP_SHARED, fd, 0);
+		if ((void*)db->buf == (void*)MAP_FAILED)
+			db->buf = NULL;
+		else
+			db->mapped = 1;
+	}
+#endif
+	if (db->buf == NULL && db->size > 0) {
+		db->buf = p = (char *)emalloc(db->size);
+		for (i = 0; i < db->size; i += n) {
+			n = read(fd, p + i, db->size - i);
+			if (n <= 0)
+				break;
+		}
+		db->size = i;
+	}
+	close(fd);
+
+	/* The lines; the key and the value as search_seq() sees them */
+	eof = db->buf + db->size;
+	n = 0;
+	for (s = db->buf; s < eof; ++s)
+		if (*s == '\n')
+			++n;
+	db->ents = (struct trie_ent *)emalloc((n+1) * sizeof(struct trie_ent));
+	for (s = db->buf; s < eof; s = eol + 1) {
+		eol = memchr(s, '\n', eof - s);
+		if (eol == NULL)
+			eol = eof;
+		n = eol - s;
+		if (n > sizeof(line) - 1)
+			n = sizeof(line) - 1;
+		memcpy(line, s, n);
+		line[n] = 0;
+
+		cp = skip821address(line);
+		e = &db->ents[db->nents++];
+		e->key  = s - db->buf;
+		e->klen = cp - line;
+		if (*cp) ++cp;
+		while (*cp && isascii(*cp & 0xFF) && isspace(*cp & 0xFF))
+			++cp;
+		for (p = cp; *p; ++p)
+			if (!isascii(*p & 0xFF) || isspace(*p & 0xFF))
+				break;
+		e->val  = e->key + (cp - line);
+		e->vlen = p - cp;
+	}
+
+	/* The hash of all keys; the first one of the file wins */
+	for (i = 64; i < 2 * db->nents; i <<= 1)
+		;
+	db->hashmask = i - 1;
+	db->hash = (int *)emalloc(i * sizeof(int));
+	for (--i; i >= 0; --i)
+		db->hash[i] = TRIE_NONE;
+	for (i = 0; i < db->nents; ++i) {
+		e = &db->ents[i];
+		h = trie_hashkey(db->buf + e->key, e->klen) & db->hashmask;
+		for (; db->hash[h] != TRIE_NONE; h = (h + 1) & db->hashmask) {
+			n = db->hash[h];
+			if (trie_cmp(db->buf + db->ents[n].key, db->ents[n].klen,
+				     db->buf + e->key, e->klen) == 0)
+				break;
+		}
+		if (db->hash[h] == TRIE_NONE)
+			db->hash[h] = i;
+	}
+
+	/* The domains, and the IP prefixes */
+	ks = (struct trie_sort *)emalloc((db->nents+1) * sizeof(*ks));
+	nks = 0;
+	nip = db->nents;
+	for (i = 0; i < db->nents; ++i) {
+		e = &db->ents[i];
+		s = db->buf + e->key;
+		n = e->klen;
+		spc = (n > 1 && *s == '.');
+		if (trie_domainname(s + spc, n - spc)) {
+			ks[nks].ent  = i;
+			ks[nks].key  = s + spc;
+			ks[nks].klen = n - spc;
+			ks[nks].wild = spc;
+			++nks;
+		}
+		if (trie_ipprefix(s, n, &ks[nip-1].addr, &ks[nip-1].width)) {
+			--nip;
+			ks[nip].ent = i;
+		}
+	}
+
+	trie_domnode(db);
+	if (nks > 0) {
+		qsort(ks, nks, sizeof(*ks), trie_domsortcmp);
+		trie_dombuild(db, ks, 0, nks, 0, 0);
+	}
+	db->iproot = TRIE_NONE;
+	if (nip < db->nents) {
+		qsort(ks + nip, db->nents - nip, sizeof(*ks), trie_ipsortcmp);
+		db->iproot = trie_ipbuild(db, ks, nip, db->nents);
+	}
+	free(ks);
+
+	return db;
+}
+
+static struct trie_db *trie_open __((search_info *));
+static struct trie_db *
+trie_open(sip)
+	search_info *sip;
+{
+	if (sip->file == NULL)
+		return NULL;
+	if (*sip->dbprivate == NULL)
+		*sip->dbprivate = (void *)trie_load(sip);
+	return (struct trie_db *)*sip->dbprivate;
+}
+
+static conscell *trie_value __((struct trie_db *, int));
+static conscell *
+trie_value(db, ent)
+	struct trie_db *db;
+	int ent;
+{
+	struct trie_ent *e = &db->ents[ent];
+
+	return newstring(dupnstr(db->buf + e->val, e->vlen), e->vlen);
+}
+
+/*
+ * The plain lookup of the key.
+ */
+
+conscell *
+search_trie(sip)
+	search_info *sip;
+{
+	struct trie_db *db;
+	unsigned int h;
+	int n, len;
+
+	db = trie_open(sip);
+	if (db == NULL)
+		return NULL;
+
+	len = strlen(sip->key);
+	h = trie_hashkey(sip->key, len) & db->hashmask;
+	for (; (n = db->hash[h]) != TRIE_NONE; h = (h + 1) & db->hashmask)
+		if (trie_cmp(db->buf + db->ents[n].key, db->ents[n].klen,
+			     sip->key, len) == 0)
+			return trie_value(db, n);
+	return NULL;
+}
+
+/*
+ * The closest match of the key in one walk, for the drivers of db.c.
+ * Sets *donep to 0 when the key is one that the trie does not do
+ * (it has empty labels, or something), and the driver has to probe.
+ * Otherwise the result is what the probes of the 'how' driver would
+ * give, short of the "." and the default keys, which the driver tries
+ * afterwards, when there is no match here.
+ */
+
+conscell *
+match_trie(sip, how, donep)
+	search_info *sip;
+	int how, *donep;
+{
+	struct trie_db *db;
+	struct trie_dom *d;
+	struct trie_ip *t;
+	const char *key = sip->key, *label;
+	const char *end, *wildat;
+	static char ipkey[20];
+	char *p;
+	unsigned int o1, o2, o3, o4, addr, mask;
+	int n, len, lo, hi, mid, rc, best, exact, wild, ent;
+
+	*donep = 0;
+	db = trie_open(sip);
+	if (db == NULL)
+		return NULL;
+
+	if (how == TRIE_LONGESTMATCH &&
+	    sscanf(key[0] == '[' ? key+1 : key, "%3u.%3u.%3u.%3u",
+		   &o1, &o2, &o3, &o4) == 4) {
+		addr = (((o1 & 255) << 24) | ((o2 & 255) << 16) |
+			((o3 & 255) <<  8) | ((o4 & 255)));
+		*donep = 1;
+		best = TRIE_NONE;
+		for (n = db->iproot; n != TRIE_NONE; ) {
+			t = &db->ip[n];
+			mask = t->width ? (0xffffffffU << (32 - t->width)) : 0;
+			if ((addr & mask) != t->addr)
+				break;
+			if (t->ent != TRIE_NONE)
+				best = n;
+			if (t->width == 32)
+				break;
+			n = t->child[(addr >> (31 - t->width)) & 1];
+		}
+		if (best == TRIE_NONE)
+			return NULL;
+
+		/* The key that the probe would have found, for the "%0" */
+		t = &db->ip[best];
+		sprintf(ipkey, "%u.%u.%u.%u/%d",
+			(t->addr >> 24) & 255, (t->addr >> 16) & 255,
+			(t->addr >>  8) & 255, t->addr & 255, t->width);
+		sip->key = ipkey;
+		return trie_value(db, t->ent);
+	}
+
+	len = strlen(key);
+	if (!trie_domainname(key, len))
+		return NULL;
+	*donep = 1;
+
+	/* Down the trie from the rightmost label of the key */
+	exact = wild = TRIE_NONE;
+	wildat = NULL;
+	n = 0;
+	end = label = key + len;
+	for (;;) {
+		while (label > key && *(label-1) != '.')
+			--label;
+		lo = 0;
+		hi = db->dom[n].nkids;
+		while (lo < hi) {
+			mid = (lo + hi) >> 1;
+			d = &db->dom[db->dom[n].kids + mid];
+			rc = trie_cmp(label, end - label,
+				      db->buf + d->label, d->llen);
+			if (rc == 0)
+				break;
+			if (rc < 0)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		if (lo >= hi)
+			break;
+		n = db->dom[n].kids + mid;
+		d = &db->dom[n];
+
+		/* 'd' is the suffix of the key starting at 'label' */
+		if (label == key) {
+			if (how != TRIE_NODOT)
+				exact = d->exact;
+			if (how == TRIE_PATHALIAS && d->wild != TRIE_NONE) {
+				wild = d->wild;
+				wildat = label;
+			}
+			break;
+		}
+		ent = (how == TRIE_NODOT) ? d->exact : d->wild;
+		if (ent != TRIE_NONE) {
+			wild = ent;
+			wildat = label;
+		}
+		end = --label;
+	}
+
+	if (exact != TRIE_NONE)
+		return trie_value(db, exact);
+	if (wild == TRIE_NONE)
+		return NULL;
+
+	/* The wildcarded part of the key, as the probing drivers have it */
+	len = wildat - key;
+	if (sip->argv0) free((void*)sip->argv0);
+	switch (how) {
+	case TRIE_PATHALIAS:	/* "." + the part before the ".suffix" */
+		if (len == 0) {
+			sip->argv0 = dupnstr("", 0);
+			break;
+		}
+		p = (char *)emalloc(len + 1);
+		p[0] = '.';
+		memcpy(p + 1, key, len - 1);
+		p[len] = 0;
+		sip->argv0 = p;
+		break;
+	case TRIE_LONGESTMATCH:	/* The part before the ".suffix" */
+		sip->key = wildat - 1;
+		sip->argv0 = dupnstr(key, len - 1);
+		break;
+	default:		/* The part before the suffix, with the dot */
+		sip->key = wildat;
+		sip->argv0 = dupnstr(key, len);
+		break;
+	}
+	return trie_value(db, wild);
+}
+
+/*
+ * Forget the index; the next lookup builds a new one.
+ */
+
+void
+close_trie(sip, comment)
+	search_info *sip;
+	const char *comment;
+{
+	if (*sip->dbprivate == NULL)
+		return;
+	trie_free((struct trie_db *)*sip->dbprivate);
+	*sip->dbprivate = NULL;
+}
+
+/*
+ * Is the file other than the one that was indexed ?
+ */
+
+int
+modp_trie(sip)
+	search_info *sip;
+{
+	struct trie_db *db = (struct trie_db *)*sip->dbprivate;
+	struct stat stbuf;
+
+	if (db == NULL || sip->file == NULL)
+		return 0;
+	if (stat(sip->file, &stbuf) < 0)
+		return 0;	/* Keep the old one meanwhile */
+	return (stbuf.st_ino   != db->ino  ||
+		stbuf.st_dev   != db->dev  ||
+		stbuf.st_mtime != db->mtime ||
+		(long)stbuf.st_size != db->size);
+}
@@ -160,6 +160,7 @@ extern int   router_id;
 extern int   savefile;
 extern int   do_hdr_warning;
 extern int   no_logmessage;
+extern int   router_arena;
 extern int   I_mode;
 extern int   isInteractive;
 extern int   nrouters;
@@ -102,7 +102,9 @@ run_rfc822(argc, argv)
 	GCVARS2;
 	struct stat stbuf;
 	long infilesize_kb = 0;
+	struct timeval start_tv;
 
+	gettimeofday(&start_tv, NULL);
 	errflg = 0;
 #if 0
 	{
@@ -226,6 +228,8 @@ run_rfc822(argc, argv)
 	mal_contents(stdout);
 #endif	/* XMEM */
 	UNGCPRO2;
+
+	Z_SHM_MIB_Since(&MIBMtaCnt->rt.MessageTime, &start_tv);
 	return status;
 }
 
@@ -1239,6 +1243,7 @@ sequencer(e, file)
 	struct addr    *p = NULL;
 	char	       *ofpname, *path, *qpath;
 	const char     *pfile;
+	char		pfilebuf[40];
 	conscell       *l, *routed_addresses, *sender, *to;
 	conscell       *rwmchain;
 	struct rwmatrix *rwhead, *nsp, *rwp = NULL, *rcp = NULL;
@@ -1328,6 +1333,16 @@ sequencer(e, file)
 	  if ('A' <= *pfile && *pfile <= 'Z') ++pfile;
 	  if (*pfile == '/') ++pfile;
 	}
+	/* The daemon children claim the file as "inode-pid";
+	   the queues know it by the inode alone. */
+	{
+	  const char *s = strchr(pfile, '-');
+	  if (s != NULL && s - pfile < sizeof(pfilebuf)) {
+	    memcpy(pfilebuf, pfile, s - pfile);
+	    pfilebuf[s - pfile] = 0;
+	    pfile = pfilebuf;
+	  }
+	}
 
 	if (schedulersubdirhash) {
 	  long ino = e->e_statbuf.st_ino;
@@ -2651,12 +2666,12 @@ sequencer(e, file)
 		 fromaddr, smtprelay, (int) e->e_statbuf.st_size,
 		 onrcpts, msgidstr, start_now, worktimeu, worktimes);
 
-	MIBMtaEntry->rt.TransmittedMessages   += 1;
-	MIBMtaEntry->rt.ReceivedRecipients    += inrcpts;
-	MIBMtaEntry->rt.TransmittedRecipients += onrcpts;
+	MIBMtaCnt->rt.TransmittedMessages   += 1;
+	MIBMtaCnt->rt.ReceivedRecipients    += inrcpts;
+	MIBMtaCnt->rt.TransmittedRecipients += onrcpts;
 
-	MIBMtaEntry->rt.TransmittedVolume     += infilesize_kb;
-	MIBMtaEntry->rt.TransmittedVolume2    += taskfilesize_kb;
+	MIBMtaCnt->rt.TransmittedVolume     += infilesize_kb;
+	MIBMtaCnt->rt.TransmittedVolume2    += taskfilesize_kb;
 
 #ifdef AF_UNIX
 	do {
@@ -40,6 +40,7 @@ int	workermode;
 int	nrouters = 1;
 int	isInteractive;
 int	no_logmessage;
+int	router_arena;	/* ZENV ROUTERARENA: per-message cell region */
 
 #define IMODE_NONE 0
 #define IMODE_SMTPSERVER 1
@@ -240,6 +241,10 @@ main(argc, argv)
 	}
 
 	time(&now);
+	cp = getzenv("ROUTERARENA");
+	router_arena = (cp != NULL && *cp != '0' && *cp != 'n' && *cp != 'N');
+	cp = getzenv("ROUTERGENGC");
+	cons_generational = (cp != NULL && *cp != '0' && *cp != 'n' && *cp != 'N');
 	mailshare = getzenv("MAILSHARE");
 	if (mailshare == NULL)
 		mailshare = MAILSHARE;
@@ -411,7 +416,13 @@ main(argc, argv)
 #ifdef	XMEM
 write(30, "\n", 1);
 #endif	/* XMEM */
+	    if (router_arena)
+	      cons_region_begin();
 	    s_apply(2, &av[0]); /* "process" filename */
+	    if (router_arena) {
+	      s_value = NULL;
+	      cons_region_end();
+	    }
 	  } while (++c < argc);
 	} else if (daemonflg) {
 	  av[0] = "daemon";
@@ -16,39 +16,44 @@ int	/* return non-zero when there are some childs
 	   available for start				*/
 doagenda()
 {
-	struct thread *thr, *nthr;
-	int didsomething = 0;
+	struct thread *thr;
+	struct thrlist due;
+	int i, didsomething = 0;
 
 	timed_log_reinit(); /* 	internal: mytime(&now); */
 
 
-	thr = thread_head;
+	thr = thrheap_top();
 
 	if (verbose)
 	  sfprintf(sfstdout,"curitem %p curitem->wakeup %lu now %d\n",
 		   thr, thr ? thr->wakeup : 0, (int)now);
 
-	/* thread_head -chain should be in time order, thus
-	   the while-loop should be traversed only once, because
-	   thread_start kicks  right away (or reschedules) */
+	/* Those threads whose time has come, in time order.
+	   The thread_start kicks right away (or reschedules),
+	   thus each is visited only once. */
 
-	for ( ; thr  && thr->wakeup <= now ; thr = nthr ) {
-	  /* Object pointed by  thr  may disappear due to
+	thrheap_collect(&due, now);
+
+	for (i = 0; i < due.count; ++i) {
+	  /* Object pointed by  thr  may have disappeared due to
 	     expiration at thread_start() .. */
-	  nthr = thr->nexttr;
+	  thr = due.thrs[i];
+	  if (thr->zombie) continue;
 
 	  /* Not running, and wakeup in past ? */
 
 	  if (thr->proc == NULL && thr->wakeup <= now) {
 	    /* Try to start it! */
 
-	    while (thread_start(thr, 0))
+	    while (!thr->zombie && thread_start(thr, 0))
 	      ++ didsomething;
 
 	  }
 
 	  queryipccheck(); /* updates the 'now' variable too... */
 	}
+	thrlist_release(&due);
 
 	/* if (verbose)
 	   printf("alarmed %d\n", now);  */
@@ -60,28 +65,30 @@ doagenda()
 int	/* Return the number of messages expired this time around. */
 doexpiry2()
 {
-	struct thread *thr, *nthr;
-	int didsomething = 0, rc;
+	struct thread *thr;
+	struct thrlist due;
+	int i, didsomething = 0, rc;
 	time_t timelimit;
 
 	timed_log_reinit(); /* 	internal: mytime(&now); */
 
 	timelimit = now + expiry2_timelimit;
 
-	thr = thread_head;
+	thr = thrheap_top();
 
 	if (verbose)
 	  sfprintf(sfstdout,"curitem %p curitem->wakeup %lu now %d\n",
 		   thr, thr ? thr->wakeup : 0, (int)now);
 
-	/* thread_head -chain should be in time order, thus
-	   the while-loop should be traversed only once, because
-	   thread_start kicks right away (or reschedules) */
+	/* Those threads whose time has come, in time order. */
 
-	for ( ; thr  && thr->wakeup <= now ; thr = nthr ) {
-	  /* Object pointed by  thr  may disappear due to
-	     expiration at thread_start() .. */
-	  nthr = thr->nexttr;
+	thrheap_collect(&due, now);
+
+	for (i = 0; i < due.count; ++i) {
+	  /* Object pointed by  thr  may have disappeared due to
+	     expiration at thread_expire2() .. */
+	  thr = due.thrs[i];
+	  if (thr->zombie) continue;
 
 	  rc = thread_expire2(thr, timelimit, 0, NULL);
 	  if (rc)
@@ -91,6 +98,7 @@ doexpiry2()
 
 	  if (now > timelimit) break;
 	}
+	thrlist_release(&due);
 
 	/* if (verbose)
 	   printf("alarmed %d\n", now);  */
@@ -107,9 +115,10 @@ const char *turnarg;
 	struct spblk *spl;
 	struct web *wp;
 	char *cp = strchr(turnarg,' ');
-	struct thread *thr, *nthr;
+	struct thread *thr;
+	struct thrlist all;
 	spkey_t spk;
-	int rc = 0;
+	int i, rc = 0;
 
 	/* caller has done 'strlower()' to our input.. */
 	if (cp) *cp = 0;  /* Chop at the first SPACE or TAB */
@@ -124,18 +133,20 @@ const char *turnarg;
 	}
 	wp = (struct web *)spl->data;
 	
-	thr = thread_head;
-	while (thr != NULL) {
+	thrheap_collect_all(&all);
+	for (i = 0; i < all.count; ++i) {
 	  /* Object pointed by  thr  may disappear due to
 	     expiration at thread_start()	 */
-	  nthr = thr->nexttr;
+	  thr = all.thrs[i];
+	  if (thr->zombie) continue;
 
 	  if (wp == thr->whost && thr->proc == NULL) {
 	    thr->wakeup = 0; /* Force its starttime! */
+	    thrheap_update(thr);
 	    rc += thread_start(thr, 1);
 	    /* We MAY get multiple matches, though it is unlikely.. */
 	  }
-	  thr = nthr;
 	}
+	thrlist_release(&all);
 	return rc;
 }   
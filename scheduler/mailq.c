@@ -1212,7 +1212,7 @@ repscan_v1(p, spl)
 		printaddrs(v);	/* summary does not print a thing! */
 	      ++filecnt;	/* however it counts many things.. */
 	      if (summary < 2)
-		filesizesum += v->cfp->offset[0];
+		filesizesum += v->cfp->msgbodyoffset;
 	    }
 	    for (r_i = 0; r_i < SIZE_L; ++r_i) {
 	      if (v->next[r_i] != NULL)
@@ -1389,6 +1389,9 @@ void query2(fpi, fpo)
 	if (schedq) {
 
 	  switch (schedq) {
+	  case 5:
+	    strcpy(buf,"SHOW MEMORY\n");
+	    break;
 	  case 4:
 	    strcpy(buf,"SHOW COUNTERS\n");
 	    break;
@@ -1845,11 +1848,11 @@ printaddrs(v)
 	  if (verbose > 1 && status < 2) {
 	    sprintf(path, "%s/%s/%s", postoffice, QUEUEDIR, v->cfp->mid);
 	    if (stat(path, &stbuf) == 0) {
-	      /* overload offset[] to be size of message */
-	      v->cfp->offset[0] = stbuf.st_size;
+	      /* overload msgbodyoffset to be size of message */
+	      v->cfp->msgbodyoffset = stbuf.st_size;
 	      v->cfp->mtime     = stbuf.st_mtime;
 	    } else {
-	      v->cfp->offset[0] = 0;
+	      v->cfp->msgbodyoffset = 0;
 	      v->cfp->mtime     = 0;
 	    }
 	  }
@@ -1858,10 +1861,10 @@ printaddrs(v)
 	  return;
 	if (v->cfp->logident)
 	  fprintf(stdout,"\t  id\t%s", v->cfp->logident);
-	if (verbose > 1 && v->cfp->offset[0] > 0) {
+	if (verbose > 1 && v->cfp->msgbodyoffset > 0) {
 	  long dt = now - v->cfp->mtime;
 	  int fields = 3;
-	  fprintf(stdout,", %ld bytes, age ", (long)v->cfp->offset[0]);
+	  fprintf(stdout,", %ld bytes, age ", (long)v->cfp->msgbodyoffset);
 	  /* age (now-mtime) printout */
 	  if (dt > (24*3600)) {	/* Days */
 	    fprintf(stdout,"%dd", (int)(dt /(24*3600)));
@@ -1915,6 +1918,7 @@ printaddrs(v)
 static void print_shm __((void))
 {
   int r, i;
+  struct MIB_MtaEntry *MIBsum;
 
   r = Z_SHM_MIB_Attach (0); /* Attach read-only! */
 
@@ -1954,6 +1958,8 @@ static void print_shm __((void))
 #define sfprintf fprintf
 #define fp       stdout
 
+  MIBsum = Z_SHM_MIB_Sum(); /* The per process slabs added up */
+
 #include "mailq.inc"  /* shared stuff with  mq2.c  module */
 
 	exit(0);
@@ -145,6 +145,34 @@ int mq2_puts_(mq,s)
 }
 
 
+/* Append as is, without the dot duplication */
+static int mq2_putraw __((struct mailq *, const char *, int));
+static int mq2_putraw(mq,s,len)
+     struct mailq *mq;
+     const char *s;
+     int len;
+{
+  if (!mq->outbuf) {
+    mq->outbufspace = 500;
+    mq->outbuf = emalloc(mq->outbufspace);
+  }
+  if (mq->outbufsize + len + 2 >= mq->outbufspace) {
+    while (mq->outbufsize + len + 2 >= mq->outbufspace)
+      mq->outbufspace *= 2;
+    mq->outbuf = erealloc(mq->outbuf, mq->outbufspace);
+  }
+  if (mq->outbuf == NULL)
+    return -2; /* Out of memory :-/ */
+
+  memcpy(mq->outbuf + mq->outbufsize, s, len);
+  mq->outbufsize += len;
+  if (len > 0)
+    mq->outcol = (s[len-1] == '\n') ? 0 : mq->outcol + len;
+
+  return 0;
+}
+
+
 /*
  * mq2: wflush() - return <0: error detected,
  *                        >0: write pending,
@@ -177,7 +205,7 @@ int mq2_wflush(mq)
 	sfprintf(sfstderr, " -- failure; errno = %d\n", errno);
 
       mq2_discard(mq);
-      MIBMtaEntry->sc.MQ2sockWriteFails ++;
+      MIBMtaCnt->sc.MQ2sockWriteFails ++;
 
       return -1;
     }
@@ -274,7 +302,7 @@ static void mq2_read(mq)
 
   if (mq->fd < 0) {
     mq2_discard(mq);
-    MIBMtaEntry->sc.MQ2sockReadFails ++;
+    MIBMtaCnt->sc.MQ2sockReadFails ++;
     return;
     /* Zap! */
   }
@@ -304,7 +332,7 @@ static void mq2_read(mq)
 
   if (i == 0) {
     mq2_discard(mq);
-    MIBMtaEntry->sc.MQ2sockReadEOF ++;
+    MIBMtaCnt->sc.MQ2sockReadEOF ++;
     return; /* ZAP! */
   }
   if (i > 0) {
@@ -381,7 +409,7 @@ void mq2_register(fd, addr)
     mq2_puts(mq, "550 NO ACCESS FOR YOU\n");
     mq2_wflush(mq);
   mq2_abort:;
-    MIBMtaEntry->sc.MQ2sockAuthRej ++;
+    MIBMtaCnt->sc.MQ2sockAuthRej ++;
     mq2_discard(mq);
 
   } else {
@@ -404,6 +432,46 @@ void mq2_register(fd, addr)
   }
 }
 
+/* EXTERNAL */
+/* In a scheduler shard: the link from the coordinator, which has
+   done the authentication already, and relays the commands. */
+void mq2_register_relay(fd)
+     int fd;
+{
+  struct mailq *mq;
+
+  mq = emalloc(sizeof(*mq));
+  memset(mq, 0, sizeof(*mq));
+
+  ++mq2count;
+
+  mq->fd = fd;
+  mq->relay = 1;
+
+  mq->nextmailq = mq2root;
+  mq2root = mq;
+
+  fd_nonblockingmode(fd);
+}
+
+/* EXTERNAL */
+/* In a new scheduler shard: the sessions belong to the coordinator */
+void mq2_forget()
+{
+  struct mailq *mq;
+
+  while ((mq = mq2root) != NULL) {
+    mq2root = mq->nextmailq;
+    close(mq->fd);
+    if (mq->inbuf)	free(mq->inbuf);
+    if (mq->inpline)	free(mq->inpline);
+    if (mq->outbuf)	free(mq->outbuf);
+    if (mq->challenge)	free(mq->challenge);
+    free(mq);
+  }
+  mq2count = 0;
+}
+
 /* EXTERNAL */
 void mq2add_to_poll(fds, fdscountp)
      struct zmpollfd **fds;
@@ -451,8 +519,8 @@ void mq2_areinsets(fds)
       }
 
       /* Time of forced death ? */
-      if (now > mq->apoptosis) {
-	MIBMtaEntry->sc.MQ2sockTimedOut ++;
+      if (now > mq->apoptosis && !mq->relay) {
+	MIBMtaCnt->sc.MQ2sockTimedOut ++;
 	mq2_discard(mq);
       }
 
@@ -542,6 +610,104 @@ static void mq2_thread_report(mq, mode, channel, host)
 }
 
 
+/*
+ *  SHOW MEMORY -- what the queue takes in core.  The byte counts
+ *  are of the structures and their own strings; the malloc()
+ *  overhead is not counted.  Then the object slabs of slab.c:
+ *  the object size, objects in use, on the free list, and the
+ *  count of allocations.
+ */
+
+struct mq2memstat {
+	long	ctlfiles, cfbytes;
+	long	vertices, recipients, vxbytes;
+	long	webs, webbytes;
+};
+
+#define MQ2STRLEN(s) ((s) ? strlen(s) + 1 : 0)
+
+static int mq2_memcfp __((void *, struct spblk *));
+static int mq2_memcfp(p, spl)
+     void *p;
+     struct spblk *spl;
+{
+  struct mq2memstat *ms = p;
+  struct ctlfile *cfp = (struct ctlfile *)spl->data;
+  struct vertex *vp;
+
+  ms->ctlfiles += 1;
+  ms->cfbytes  += sizeof(*cfp);
+  ms->cfbytes  += MQ2STRLEN(cfp->mid) + MQ2STRLEN(cfp->logident);
+  ms->cfbytes  += MQ2STRLEN(cfp->erroraddr) + MQ2STRLEN(cfp->envid);
+  ms->cfbytes  += MQ2STRLEN(cfp->dsnretmode) + MQ2STRLEN(cfp->vfpfn);
+  ms->cfbytes  += MQ2STRLEN(cfp->spoolid);
+
+  for (vp = cfp->head; vp != NULL; vp = vp->next[L_CTLFILE]) {
+    ms->vertices   += 1;
+    ms->recipients += vp->ngroup;
+    ms->vxbytes    += sizeof(*vp) + sizeof(int) * (vp->ngroupmax - 1);
+    ms->vxbytes    += MQ2STRLEN(vp->notary);
+  }
+  return 0;
+}
+
+static int mq2_memweb __((void *, struct spblk *));
+static int mq2_memweb(p, spl)
+     void *p;
+     struct spblk *spl;
+{
+  struct mq2memstat *ms = p;
+  struct web *wp = (struct web *)spl->data;
+
+  ms->webs     += 1;
+  ms->webbytes += sizeof(*wp) + MQ2STRLEN(wp->name);
+  return 0;
+}
+
+static void mq2_show_memory(mq)
+     struct mailq *mq;
+{
+  struct mq2memstat ms;
+  char buf[100];
+  const char *name;
+  long size, inuse, nfree, allocs;
+  int i;
+
+  memset(&ms, 0, sizeof(ms));
+  sp_scan(mq2_memcfp, &ms, NULL, spt_mesh[L_CTLFILE]);
+  sp_scan(mq2_memweb, &ms, NULL, spt_mesh[L_CHANNEL]);
+  sp_scan(mq2_memweb, &ms, NULL, spt_mesh[L_HOST]);
+
+#define MQ2MEMLINE(name, val) \
+  sprintf(buf, "%-32s%10lu\n", name, (u_long)(val)); mq2_puts(mq, buf)
+
+  MQ2MEMLINE("ControlFiles",		ms.ctlfiles);
+  MQ2MEMLINE("ControlFileBytes",	ms.cfbytes);
+  MQ2MEMLINE("Vertices",		ms.vertices);
+  MQ2MEMLINE("Recipients",		ms.recipients);
+  MQ2MEMLINE("VertexBytes",		ms.vxbytes);
+  MQ2MEMLINE("Webs",			ms.webs);
+  MQ2MEMLINE("WebBytes",		ms.webbytes);
+  MQ2MEMLINE("SharedStrings",		strtab_count);
+  MQ2MEMLINE("SharedStringBytes",	strtab_bytes);
+  MQ2MEMLINE("SharedStringRefs",	strtab_refs);
+  MQ2MEMLINE("BytesPerRecipient",
+	     ms.recipients ? ((ms.cfbytes + ms.vxbytes + ms.webbytes +
+			       strtab_bytes) / ms.recipients) : 0);
+
+#undef MQ2MEMLINE
+
+  sprintf(buf, "%-16s%8s%10s%10s%12s\n",
+	  "Slab", "Size", "InUse", "Free", "Allocs");
+  mq2_puts(mq, buf);
+  for (i = 0; slab_stat(i, &name, &size, &inuse, &nfree, &allocs); ++i) {
+    sprintf(buf, "%-16s%8ld%10ld%10ld%12ld\n",
+	    name, size, inuse, nfree, allocs);
+    mq2_puts(mq, buf);
+  }
+}
+
+
 /* INTERNAL */
 static int mq2cmd_etrn(mq,s)
      struct mailq *mq;
@@ -641,6 +807,7 @@ static void mq2_show_snmp(mq)
   int r, i;
   Sfio_t *fp;
   struct mq2discipline mq2d;
+  struct MIB_MtaEntry *MIBsum;
 
   fp = sfnew(NULL, NULL, 0, 0, SF_LINE|SF_WRITE);
   if (!fp) {
@@ -656,7 +823,7 @@ static void mq2_show_snmp(mq)
 
 
   r = (Z_SHM_MIB_is_attached() > 0); /* Attached and WRITABLE ? */
-
+  MIBsum = Z_SHM_MIB_Sum(); /* The per process slabs added up */
 
 #define SCHEDULER_MAILQ_EXTRA scheduler_mailq_extra(fp);
 
@@ -743,7 +910,7 @@ static int mq2cmd_show(mq,s)
      was reserved for other use... */
   if (strcmp(s,"COUNTERS") == 0) {
 
-    MIBMtaEntry->sc.MQ2sockCommandShowCounters ++;
+    MIBMtaCnt->sc.MQ2sockCommandShowCounters ++;
 
     mq2_puts(mq, "+OK until LF.LF\n");
     mq2_show_snmp(mq);
@@ -751,12 +918,23 @@ static int mq2cmd_show(mq,s)
     return 0;
   }
 
+  if (strcmp(s,"MEMORY") == 0) {
+
+    if (! (MQ2MODE_SNMP & mq->auth)) /* If not allowed operation, exit! */
+      return -1;
+
+    mq2_puts(mq, "+OK until LF.LF\n");
+    mq2_show_memory(mq);
+    mq2_puts_(mq, ".\n");
+    return 0;
+  }
+
   if (strcmp(s,"SNMP") == 0) {
 
     if (! (MQ2MODE_SNMP & mq->auth)) /* If not allowed operation, exit! */
       return -1;
 
-    MIBMtaEntry->sc.MQ2sockCommandShowQueueVeryShort ++;
+    MIBMtaCnt->sc.MQ2sockCommandShowQueueVeryShort ++;
 
     mq2_puts(mq, "+OK until LF.LF\n");
     mq2_thread_report(mq, MQ2MODE_SNMP, NULL, NULL);
@@ -771,7 +949,7 @@ static int mq2cmd_show(mq,s)
       if (! (MQ2MODE_QQ & mq->auth)) /* If not allowed operation, exit! */
 	return -1;
 
-      MIBMtaEntry->sc.MQ2sockCommandShowQueueShort ++;
+      MIBMtaCnt->sc.MQ2sockCommandShowQueueShort ++;
 
       mq2_puts(mq, "+OK until LF.LF\n");
       mq2_thread_report(mq, MQ2MODE_QQ, NULL, NULL);
@@ -783,7 +961,7 @@ static int mq2cmd_show(mq,s)
       if (! (MQ2MODE_FULL & mq->auth)) /* If not allowed operation, exit! */
 	return -1;
 
-      MIBMtaEntry->sc.MQ2sockCommandShowQueueThreads2 ++;
+      MIBMtaCnt->sc.MQ2sockCommandShowQueueThreads2 ++;
 
       mq2_puts(mq, "+OK until LF.LF\n");
       mq2_thread_report(mq, MQ2MODE_FULL2, NULL, NULL);
@@ -795,7 +973,7 @@ static int mq2cmd_show(mq,s)
       if (! (MQ2MODE_FULL & mq->auth)) /* If not allowed operation, exit! */
 	return -1;
 
-      MIBMtaEntry->sc.MQ2sockCommandShowQueueThreads2 ++;
+      MIBMtaCnt->sc.MQ2sockCommandShowQueueThreads2 ++;
 
       mq2_puts(mq, "+OK until LF.LF\n");
       mq2_thread_report(mq, MQ2MODE_FULL, NULL, NULL);
@@ -815,7 +993,7 @@ static int mq2cmd_show(mq,s)
     if (! (MQ2MODE_FULL & mq->auth)) /* If not allowed operation, exit! */
       return -1;
 
-    MIBMtaEntry->sc.MQ2sockCommandShowThread ++;
+    MIBMtaCnt->sc.MQ2sockCommandShowThread ++;
 
     mq2_puts(mq, "+OK until LF.LF\n");
     mq2_thread_report(mq, MQ2MODE_FULL, channel, host);
@@ -828,6 +1006,96 @@ static int mq2cmd_show(mq,s)
 }
 
 
+/*
+ *  Sharded scheduler.  The coordinator sends each command as
+ *
+ *	AS <hex auth bits> <command line>
+ *
+ *  and the shard replies with a line carrying the length of the
+ *  reply, and then the reply as is.
+ */
+
+/* INTERNAL */
+static void mq2_relayed(mq,t)
+     struct mailq *mq;
+     char *t;
+{
+  char hdr[20];
+  int start, len, hlen;
+
+  mq->auth = strtol(t, &t, 16);
+  while (*t == ' ' || *t == '\t') ++t;
+
+  start = mq->outbufsize;
+  mq->relay = 0;
+  mq2interpret(mq, t);
+  mq->relay = 1;
+  mq->auth  = 0;
+
+  len = mq->outbufsize - start;
+  sprintf(hdr, "%d\n", len);
+  hlen = strlen(hdr);
+  mq2_putraw(mq, hdr, hlen);	/* Make room .. */
+  memmove(mq->outbuf + start + hlen, mq->outbuf + start, len);
+  memcpy(mq->outbuf + start, hdr, hlen);
+  mq->outcol = 0;
+}
+
+/* INTERNAL */
+static void mq2_relay(mq,s,t)
+     struct mailq *mq;
+     char *s, *t;
+{
+  static const char lflf[] = "+OK until LF.LF\n";
+  char *cmd, *r, *best = NULL;
+  int i, len, blen = 0, rank, bestrank = -1, lists = 0;
+
+  cmd = emalloc(strlen(s) + strlen(t) + 30);
+  sprintf(cmd, "AS %x %s %s\n", mq->auth, s, t);
+
+  for (i = 0; i < shard_count(); ++i) {
+    r = shard_relay(i, cmd, &len);
+    if (r == NULL)
+      continue;
+
+    if (len >= sizeof(lflf)-1 && memcmp(r, lflf, sizeof(lflf)-1) == 0) {
+      /* A listing: one header, the bodies, and one end mark */
+      if (lists++ == 0)
+	mq2_putraw(mq, lflf, sizeof(lflf)-1);
+      len -= sizeof(lflf)-1;
+      if (len >= 2 && r[sizeof(lflf)-1 + len-2] == '.' &&
+	  (len == 2 || r[sizeof(lflf)-1 + len-3] == '\n'))
+	len -= 2;
+      mq2_putraw(mq, r + sizeof(lflf)-1, len);
+      free(r);
+      continue;
+    }
+
+    /* Otherwise one of the replies: the first positive one,
+       for ETRN the first one that started something. */
+    rank = (r[0] == '+');
+    if (rank && strcmp(s,"ETRN") == 0 && strstr(r, "didn't") == NULL)
+      rank = 2;
+    if (rank > bestrank) {
+      if (best) free(best);
+      best = r;
+      blen = len;
+      bestrank = rank;
+    } else
+      free(r);
+  }
+  free(cmd);
+
+  if (lists)
+    mq2_putraw(mq, ".\n", 2);
+  else if (best)
+    mq2_putraw(mq, best, blen);
+  else
+    mq2_puts(mq, "-No scheduler shard replied\n");
+  if (best)
+    free(best);
+}
+
 /* INTERNAL */
 static void mq2interpret(mq,s)
      struct mailq *mq;
@@ -835,8 +1103,6 @@ static void mq2interpret(mq,s)
 {
   char *t = s;
 
-  MIBMtaEntry->sc.MQ2sockCommands ++;
-
   while (*t && (*t != ' ') && (*t != '\t')) ++t;
   if (*t) *t++ = '\000';
   while (*t == ' ' || *t == '\t') ++t;
@@ -844,25 +1110,39 @@ static void mq2interpret(mq,s)
   /* 's' points to the initial verb, 't' points to string after
      separating white-space has been skipped. */
 
+  if (mq->relay) {
+    if (strcmp(s,"AS") == 0)
+      mq2_relayed(mq, t);
+    return;
+  }
+
+  MIBMtaCnt->sc.MQ2sockCommands ++;
+
   if (cistrcmp(s,"QUIT")==0 || cistrcmp(s,"EXIT") == 0) {
     mq2_puts(mq, "+Bye bye\n");
     mq2_wflush(mq);
     mq2_discard(mq);
-    MIBMtaEntry->sc.MQ2sockCommandQUIT ++;
+    MIBMtaCnt->sc.MQ2sockCommandQUIT ++;
     return;
   }
 
   if (mq->auth == 0 && strcmp(s,"AUTH") == 0) {
-    MIBMtaEntry->sc.MQ2sockCommandAUTH ++;
+    MIBMtaCnt->sc.MQ2sockCommandAUTH ++;
     mq2auth(mq, mq2authfile, t);
     if (! mq->auth)
-      MIBMtaEntry->sc.MQ2sockAuthRej ++;
+      MIBMtaCnt->sc.MQ2sockAuthRej ++;
     return;
   }
 
   if (!mq->auth) {
     mq2_puts(mq,"-BAD; USER MUST AUTHENTICATE\n");
-    MIBMtaEntry->sc.MQ2sockCommandsRej ++;
+    MIBMtaCnt->sc.MQ2sockCommandsRej ++;
+    return;
+  }
+
+  /* In a sharded scheduler the shards have the queues */
+  if (shard_count() > 0) {
+    mq2_relay(mq, s, t);
     return;
   }
 
@@ -879,12 +1159,12 @@ static void mq2interpret(mq,s)
       return;
   }
   if (strcmp(s,"ETRN") == 0) {
-    MIBMtaEntry->sc.MQ2sockCommandETRN ++;
+    MIBMtaCnt->sc.MQ2sockCommandETRN ++;
     mq2cmd_etrn(mq,t);
     return;
   }
 
-  MIBMtaEntry->sc.MQ2sockCommandsRej ++;
+  MIBMtaCnt->sc.MQ2sockCommandsRej ++;
 
   mq2_puts(mq, "-MAILQ2 Unknown command, or refused by access control; VERB='");
   mq2_puts(mq, s);
@@ -1165,7 +1165,7 @@ static void delayaux(vp, index, notary, buf)
 	/* Mark the delay info in.. */
 	for (i = 0 ; i < vp->ngroup; ++i)
 	  if (vp->index[i] == index) {
-	    msgdelayed(vp, vp->cfp->offset[index], notary, buf);
+	    msgdelayed(vp, index, notary, buf);
 	    break;
 	  }
 }
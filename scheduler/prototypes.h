@@ -90,6 +90,7 @@ extern int  verbose;
 extern int  querysocket;
 extern int  querysocket6;
 extern int  notifysocket;
+extern int  dirwatchfd;
 extern char *mailqsock;
 extern char *notifysock;
 extern int  do_syslog;
@@ -109,11 +110,48 @@ extern int dq_insert __((void*, long, const char*, int));
 extern int in_dirscanqueue __((void *, long));
 extern const char *cfpdirname __((int));
 extern void timed_log_reinit __((void));
+extern void cfp_free __((struct ctlfile *cfp, struct spblk *spl));
+extern void vtxdo __((struct vertex *, struct config_entry *, const char *));
+extern void link_in __((int flag, struct vertex *vp, const char *s));
 
 extern struct MIB_MtaEntry *MIBMtaEntry;
 
+/* shard.c */
+extern int  sched_shard;
+extern int  sched_shards;
+extern int  shard_stale_config;
+extern void shard_coordinator __((void));
+extern int  shard_owns __((long));
+extern int  shard_orphaned __((void));
+extern int  shard_notify __((long, const char *));
+extern int  shard_count __((void));
+extern char *shard_relay __((int, const char *, int *));
+
+/* snapshot.c */
+extern int  snapshot_load __((struct config_entry *));
+extern int  snapshot_write __((void));
+extern void snapshot_fork __((void));
+extern int  snapshot_exit __((void));
+extern int  snapshot_verify __((struct ctlfile *));
+extern void snapshot_reconcile __((void));
+
+/* slab.c */
+extern struct vertex *vtx_alloc __((int ngroup));
+extern void  vtx_free __((struct vertex *));
+extern struct thread *thr_alloc __((void));
+extern void  thr_free __((struct thread *));
+extern struct threadgroup *thg_alloc __((void));
+extern void  thg_free __((struct threadgroup *));
+extern struct web *web_alloc __((void));
+extern void  web_free __((struct web *));
+extern int   slab_stat __((int, const char **, long *, long *, long *, long *));
+
+/* strtab.c */
+extern long  strtab_count, strtab_bytes, strtab_refs;
+extern char *str_intern __((const char *));
+extern void  str_release __((char *));
+
 /* threads.c */
-extern struct thread *thread_head, *thread_tail;
 extern void  delete_threadgroup __((struct threadgroup *thgp));
 extern int   delete_thread __((struct thread *));
 extern void  thread_linkin __((struct vertex *cp, struct config_entry *cep, int cfgid, void (*ce_fillin)(struct threadgroup *, struct config_entry *) ));
@@ -134,6 +172,18 @@ extern int   thread_reschedule __((struct thread *, time_t, int index));
 extern int   thread_expire2 __((struct thread *thr, time_t timelimit, int killall, const char *msgstr));
 extern int   thread_count_files __((void));
 
+/* thrheap.c */
+extern void  thrheap_insert __((struct thread *));
+extern void  thrheap_delete __((struct thread *));
+extern void  thrheap_update __((struct thread *));
+extern struct thread *thrheap_top __((void));
+extern int   thrheap_count __((void));
+extern struct thread *thrheap_at __((int));
+extern int   thrheap_collect __((struct thrlist *, time_t));
+extern int   thrheap_collect_all __((struct thrlist *));
+extern void  thrlist_release __((struct thrlist *));
+extern int   thrheap_zombie __((struct thread *));
+
 /* transport.c */
 extern struct procinfo *cpids;
 extern int  numkids;
@@ -142,15 +192,21 @@ extern int  start_child     __((struct vertex *vhead, struct web *channel, struc
 extern void shutdown_kids   __(( void ));
 extern RETSIGTYPE sig_chld __((int sig));
 extern int mux __((time_t timeout));
+struct zmpollset; /* forward definition */
+extern struct zmpollset *mux_pollset __((void));
+extern void mux_shutdown_child __((struct procinfo *proc));
+extern void mux_dropring __((struct procinfo *proc));
 extern void queryipccheck __((void));
 extern void queryipcinit __((void));
 #if defined(USE_BINMKDIR) || defined(USE_BINRMDIR)
 extern int system __((char*));
 #endif
 extern void receive_notify __((int fd));
+extern void receive_dirwatch __((void));
 
 /* update.c */
 extern void update __((int, char *));
+extern void update_diag __((struct procinfo *, long, long, const char *, const char *, const char *));
 extern void unctlfile __((struct ctlfile *cfp, int no_unlink));
 extern void unvertex __((struct vertex *, int justfree, int ok));
 extern void deletemsg __((const char *, struct ctlfile *));
@@ -178,6 +234,8 @@ extern void mq2_areinsets __((struct zmpollfd *fds));
 extern int  mq2_puts __((struct mailq *, char *s));
 extern int  mq2_putc __((struct mailq *, int c));
 extern int  mq2_active __((void));
+extern void mq2_register_relay __((int fd));
+extern void mq2_forget __((void));
 
 /* mq2auth.c */
 extern void mq2auth __((struct mailq *, const char *, char *));
@@ -131,7 +131,7 @@ static int qpctlfile(p, spl)
 		   vp->qid, cfpdirname(cfp->dirind), cfp->mid, vp->ngroup);
 	  qpch = ' ';
 	  for (i = 0; i < vp->ngroup; ++i) {
-	    sfprintf(qpfp, "%c%ld", qpch, (long)cfp->offset[vp->index[i]]);
+	    sfprintf(qpfp, "%c%ld", qpch, (long)vp->index[i]);
 	    qpch = ',';
 	  }
 	  if (vp->message != NULL)
@@ -54,6 +54,7 @@ static int rc_queueonly		RCKEYARGS;
 static int rc_wakeuprestartonly	RCKEYARGS;
 static int rc_deliveryform	RCKEYARGS;
 static int rc_overfeed		RCKEYARGS;
+static int rc_shmring		RCKEYARGS;
 static int rc_priority		RCKEYARGS;
 static int rc_nice		RCKEYARGS;
 static int rc_syspriority	RCKEYARGS;
@@ -95,6 +96,7 @@ static struct rckeyword {
 {	"queueonly",		rc_queueonly	},	/* boolean */
 {	"reporttimes",		rc_reporttimes	},	/* array of numbers */
 {	"retries",		rc_retries	},	/* array of numbers */
+{	"shmring",		rc_shmring	},	/* number */
 {	"skew",			rc_skew		},	/* number */
 {	"sysnice",		rc_sysnice	},	/* number */
 {	"syspriority",		rc_syspriority	},	/* number */
@@ -139,6 +141,7 @@ defaultconfigentry(ce,defaults)
 	  ce->skew		= defaults->skew;
 	  ce->deliveryform	= defaults->deliveryform;
 	  ce->overfeed		= defaults->overfeed;
+	  ce->shmring		= defaults->shmring;
 	  ce->priority		= defaults->priority;
 	} else if (defaults == NULL) {
 	  /* Compile these defaults in.. Only for the "*" / "* / *" entry.. */
@@ -170,6 +173,7 @@ defaultconfigentry(ce,defaults)
 	  ce->skew	= 5;
 	  ce->deliveryform = NULL;
 	  ce->overfeed	= 0;
+	  ce->shmring	= 0;
 	  ce->priority  = 0; /* nice(0) -- no change */
 	}
 }
@@ -212,6 +216,7 @@ vtxprint(vp)
 	sfprintf(sfstdout,"\tmaxkidThread  %d\n",	ce->maxkidThread);
 	sfprintf(sfstdout,"\tmaxkidThreads %d\n",	ce->maxkidThreads);
 	sfprintf(sfstdout,"\toverfeed %d\n",		ce->overfeed);
+	sfprintf(sfstdout,"\tshmring %d\n",		ce->shmring);
 
 	if (ce->priority >= 80)
 	  sfprintf(sfstdout,"\tpriority %d\n",	ce->priority - 100);
@@ -287,6 +292,7 @@ celink(ce, headp, tailp, copy)
 	    ce->nretries	= (*tailp)->nretries;
 	    ce->retries		= (*tailp)->retries;
 	    ce->overfeed	= (*tailp)->overfeed;
+	    ce->shmring		= (*tailp)->shmring;
 	    ce->priority	= (*tailp)->priority;
 	  }
 	}
@@ -657,6 +663,19 @@ static int rc_overfeed(key, arg, ce)
 	return 0;
 }
 
+static int rc_shmring(key, arg, ce)
+	char *key, *arg;
+	struct config_entry *ce;
+{
+	/* Kilobytes for each direction, 0 turns it off */
+	ce->shmring = atoi(arg);
+	if (ce->shmring < 0)
+	  ce->shmring = 0;
+	if (ce->shmring > 16384)
+	  ce->shmring = 16384;
+	return 0;
+}
+
 static int rc_priority(key, arg, ce)
 	char *key, *arg;
 	struct config_entry *ce;
@@ -54,6 +54,7 @@
 #include "prototypes.h"
 #include "zsyslog.h"
 #include "libz.h"
+#include "dirwatch.h"
 #include <grp.h>
 
 extern int optind;
@@ -95,6 +96,10 @@ static int dumpq    = 0;
 static int canexit  = 0;
 static int rereadcf = 0;
 static int dlyverbose = 0;
+static int snapshot_interval = 0; /* ZENV SCHEDULERSNAPSHOT, seconds */
+static int dirwatch_sweep = 600;  /* ZENV SCHEDULERDIRWATCH, seconds */
+static struct dirwatch *dirwatch;
+int	dirwatchfd = -1;	/* fd of the spool directory watcher */
 time_t	sched_starttime;
 int	do_syslog = 0;
 int	verbose = 0;
@@ -135,6 +140,7 @@ static int vtxprep_skip_lock;
 static time_t next_dirscan;
 static time_t next_idlecleanup;
 static time_t next_interim_report_time;
+static time_t next_snapshot;
 static time_t next_expiry2_scan;
 static struct sptree *dirscan_mesh;
 
@@ -149,10 +155,8 @@ extern memtypes stickymem;
 static struct ctlfile *schedule __((int fd, const char *file, long ino, const int));
 static struct ctlfile *vtxprep __((struct ctlfile *, const char *, const int));
 static int  vtxmatch __((struct vertex *, struct config_entry *));
-static void link_in __((int flag, struct vertex *vp, const char *s));
 static int  lockverify __((struct ctlfile *, const char *, const int));
 static int  globmatch   __((const char *, const char*));
-static void vtxdo   __((struct vertex *, struct config_entry *, const char *));
 
 extern void  cfp_mksubdirs __((const char *, const char*));
 
@@ -274,6 +278,7 @@ struct dirqueue {
 };
 
 static int dirqueuescan __((const char *dir,struct dirqueue *dq, int subdirs));
+static void dirwatch_init __((void));
 int syncweb __((struct dirqueue *dq));
 
 int global_maxkids = 1000;
@@ -303,7 +308,6 @@ Sfio_t * vfp_open(cfp)
 }
 
 
-static void cfp_free __((struct ctlfile *cfp, struct spblk *spl));
 static void cfp_free0 __((struct ctlfile *cfp));
 
 static void cfp_free0(cfp)
@@ -346,7 +350,7 @@ static void cfp_free0(cfp)
 	/* CFP freeup happens at last vertex's unvertex() */
 }
 
-static void cfp_free(cfp, spl)
+void cfp_free(cfp, spl)
 	struct ctlfile *cfp;
 	struct spblk   *spl;
 {
@@ -382,6 +386,7 @@ void free_cfp_memory(cfp)
 	struct ctlfile *cfp;
 {
 	if (cfp->contents)	free(cfp->contents);
+	if (cfp->offset)	free(cfp->offset);
 	if (cfp->vfpfn)		free(cfp->vfpfn);
 	if (cfp->spoolid)	free(cfp->spoolid);
 	if (cfp->mid)		free(cfp->mid);
@@ -729,6 +734,18 @@ main(argc, argv)
 	    hashlevels = cp[0] - '0';
 	}
 
+	cp = getzenv("SCHEDULERSNAPSHOT");
+	if (cp)
+	  snapshot_interval = atoi(cp);
+
+	cp = getzenv("SCHEDULERSHARDS");
+	if (cp)
+	  sched_shards = atoi(cp);
+
+	cp = getzenv("SCHEDULERDIRWATCH");
+	if (cp)
+	  dirwatch_sweep = atoi(cp);
+
 	mailshare = getzenv("MAILSHARE");
 	if (mailshare == NULL)
 	  mailshare = MAILSHARE;
@@ -872,7 +889,7 @@ main(argc, argv)
 
 	MIBMtaEntry->sys.SchedulerMasterPID        = getpid();
 	MIBMtaEntry->sys.SchedulerMasterStartTime  = time(NULL);
-	MIBMtaEntry->sys.SchedulerMasterStarts    += 1;
+	MIBMtaCnt->sys.SchedulerMasterStarts    += 1;
 
 	/* Zero the gauges at our startup.. */
 	MIBMtaEntry->sc.StoredMessagesSc		= 0;
@@ -936,8 +953,32 @@ main(argc, argv)
 	  exit(0);
 	}
 
+	/* With SCHEDULERSHARDS this process stays as the coordinator
+	   of the shards, and only the shards return from there. */
+	if (sched_shards > 1) {
+	  shard_coordinator();
+	  if (shard_stale_config)
+	    cehead = rereadconfig(cehead, config);
+	  sfprintf(sfstdout, "%s: scheduler shard %d/%d running\n",
+		   timestring(), sched_shard, sched_shards);
+	}
+
 	queryipcinit();
 
+	/* Restore the previous state, unless we want to be synchronous;
+	   the directory scan finds whatever is not in it. */
+	if (snapshot_interval > 0 && !syncstart) {
+	  i = snapshot_load(cehead);
+	  if (i >= 0)
+	    sfprintf(sfstdout, "%s: restored %d messages from the state snapshot\n",
+		     timestring(), i);
+	}
+	next_snapshot = time(NULL) + snapshot_interval;
+
+	/* Watch before the scan, so that nothing falls between them */
+	if (dirwatch_sweep > 0)
+	  dirwatch_init();
+
 	dirqueuescan(".", dirq, 1);
 
 	vtxprep_skip_lock = 0;
@@ -985,14 +1026,21 @@ main(argc, argv)
 	    /* Do it recursively every now and then,
 	       so that if we forget some jobs, they will
 	       become relearned soon enough.          */
+	    /* With the directory watcher this is just a consistency
+	       sweep, unless the scan had to stop at its limits.  */
 	    int wrk;
-	    i = dirqueuescan(".", dirq, (now >= next_idlecleanup));
+	    time_t then = now;
+	    i = dirqueuescan(".", dirq,
+			     (dirwatchfd >= 0 || now >= next_idlecleanup));
 	    mytime(&now);
 	    wrk = dirq->wrksum;
 	    wrk >>= 5; /* Divide by 32 -- just presume 32 msgs/sec.. */
 	    if (wrk > 10) wrk = 10; /* But limit to 10... */
 	    next_dirscan = now + sweepinterval + wrk; /* 10 .. 20 second
 							 sweep interval */
+	    if (dirwatchfd >= 0 && i <= newents_limit &&
+		now < then + newents_timelimit)
+	      next_dirscan = now + dirwatch_sweep;
 	  }
 
 	  if (now >= next_idlecleanup) {
@@ -1019,6 +1067,17 @@ main(argc, argv)
 	    interim_report_run();
 	  }
 
+	  if (shard_orphaned())
+	    mustexit = 1; /* The coordinator is gone */
+
+	  if (snapshot_interval > 0) {
+	    snapshot_reconcile();
+	    if (now >= next_snapshot) {
+	      snapshot_fork();
+	      next_snapshot = now + snapshot_interval;
+	    }
+	  }
+
 	  /* See when to timeout from mux() */
 	  timeout = next_dirscan;
 
@@ -1076,6 +1135,10 @@ main(argc, argv)
 	  }
 	} while (!mustexit);
 
+	if (snapshot_interval > 0 && snapshot_exit() < 0)
+	  sfprintf(sfstderr, "%s: writing the state snapshot failed, errno=%d\n",
+		   progname, errno);
+
 	/* Doing nicely we would kill the childs here, but we are not
 	   such a nice people -- we just discard incore data, and crash out.. */
 
@@ -1085,7 +1148,8 @@ main(argc, argv)
 	mal_dumpleaktrace(stderr);
 #endif	/* MALLOC_TRACE */
 
-	killpidfile(pidfile);
+	if (sched_shard == 0)
+	  killpidfile(pidfile);
 
 	if (mustexit)
 		die(0, "signal");
@@ -1151,6 +1215,7 @@ dq_insert(DQ, ino, file, delay)
 	struct dirqueue *dq = DQ;
 
 	if (!ino) return 1; /* Well, actually it isn't, but we "makebelieve" */
+	if (!shard_owns(ino)) return 1; /* Another shard's */
 
 	mytime(&now);
 
@@ -1216,7 +1281,7 @@ dq_insert(DQ, ino, file, delay)
 	  dq->wrkcount2 += 1;
 	  dq->wrksum    += 1;
 	}
-	++MIBMtaEntry->sc.ReceivedMessagesSc;
+	++MIBMtaCnt->sc.ReceivedMessagesSc;
 	return 0;
 }
 
@@ -1816,6 +1881,10 @@ void receive_notify(fd)
 	  if (in_dirscanqueue(dirq,stbuf.st_ino)) continue;
 #endif
 
+	  /* The coordinator of the shards only passes it on */
+	  if (shard_notify(ino, buf))
+	    continue;
+
 	  /* We may have this file in processing state...  */
 	  {
 	    struct spblk *spl;
@@ -1832,6 +1901,99 @@ void receive_notify(fd)
 } 
 
 
+/*
+ * Spool directory watcher: new transport files get into the dirq
+ * as they appear, and the periodic  dirqueuescan()  becomes a rare
+ * consistency sweep.  The hash directories ("A" .. "Z", two levels
+ * at most) are watched as well, and new ones join as they appear.
+ */
+
+static int dirwatch_broken;
+
+static void dirwatch_init()
+{
+	dirwatch = dirwatch_open();
+	if (!dirwatch) return; /* Periodic scans then */
+
+	if (dirwatch_tree(dirwatch, ".", 0) < 0) {
+	  sfprintf(sfstderr, "%s: dirwatch_tree('.') failed; errno=%d (%s)\n",
+		   timestring(), errno, strerror(errno));
+	  /* Partial coverage is worse than none at all */
+	  dirwatch_close(dirwatch);
+	  dirwatch = NULL;
+	  return;
+	}
+	dirwatchfd = dirwatch_fd(dirwatch);
+	sfprintf(sfstdout, "%s: watching %d spool directories\n",
+		 timestring(), dirwatch_count(dirwatch));
+}
+
+static void dirwatch_event __((void *, const char *, const char *, int));
+static void dirwatch_event(ctx, dir, name, isdir)
+	void *ctx;
+	const char *dir, *name;
+	int isdir;
+{
+	char file[MAXNAMLEN+1];
+	const char *s;
+	int level = 1;
+	long ino;
+
+	if (strlen(dir) + strlen(name) + 2 > sizeof(file))
+	  return;
+	if (dir[0] == '.' && dir[1] == 0)
+	  strcpy(file, name);
+	else
+	  snprintf(file, sizeof(file), "%s/%s", dir, name);
+
+	if (isdir) {
+	  /* A new hash directory, watch it and pick what got there
+	     before the watch did. */
+	  if (name[0] < 'A' || name[0] > 'Z' || name[1] != 0)
+	    return;
+	  for (s = file; *s; ++s)
+	    if (*s == '/') ++level;
+	  if (level > 2)
+	    return;
+	  if (dirwatch_tree(dirwatch, file, level) == 0)
+	    dirqueuescan(file, dirq, 1);
+	  else
+	    dirwatch_broken = 1;
+	  return;
+	}
+
+	if (name[0] < '0' || name[0] > '9')
+	  return;
+	ino = atol(name);
+
+	if (in_dirscanqueue(dirq, ino))
+	  return;
+
+	/* Our own updates, and those of the transport agents, are
+	   seen here as well -- files in processing stay untouched. */
+	if (sp_lookup((u_long)ino, spt_mesh[L_CTLFILE]) != NULL)
+	  return;
+
+	dq_insert(dirq, ino, file, -1);
+}
+
+void receive_dirwatch()
+{
+	if (dirwatch_read(dirwatch, dirwatch_event, NULL) < 0) {
+	  /* The kernel dropped events, go and look */
+	  next_dirscan = 0;
+	}
+	if (dirwatch_broken) {
+	  /* Could not follow a new directory, back to periodic scans */
+	  dirwatch_close(dirwatch);
+	  dirwatch = NULL;
+	  dirwatchfd = -1;
+	  dirwatch_broken = 0;
+	  next_dirscan = 0;
+	}
+}
+
+
 
 
 /*
@@ -1879,11 +2041,17 @@ static struct ctlfile *schedule(fd, file, ino, reread)
 	  }
 	}
 
-	/* Now we have no more need for the contents in core */
+	/* Now we have no more need for the contents in core;
+	   the rare ones who need it (error reports, mailq details)
+	   read the file again. */
 	if (cfp->contents != NULL) {
 	  free(cfp->contents);
 	  cfp->contents = NULL;
 	}
+	if (cfp->offset != NULL) {
+	  free(cfp->offset);
+	  cfp->offset = NULL;
+	}
 
 	return cfp;
 }
@@ -2008,32 +2176,24 @@ slurp(fd, ino)
 	}
 	cfp->nlines = i;
 	/* closing fd must be done in vtxprep(), so we can unlock stuff easy */
-	cfp = (struct ctlfile *)erealloc((void*)cfp,
-					 (u_int) (sizeof(struct ctlfile) +
-						  i * (sizeof offset[0])));
-	if (cfp) {
-	  /* copy over the offsets */
-	  memcpy(&(cfp->offset[0]), offset, sizeof(offset[0]) * i);
 
-	  cfp->id = ino;
-	  /* cfp->mid = NULL; */
+	/* The offsets go away with the contents, once the vertices
+	   have been made of them. */
+	cfp->offset = offset;
 
-	  /* INC there in every case! */
-	  ++global_wrkcnt;
-	  ++MIBMtaEntry->sc.StoredMessagesSc;
+	cfp->id = ino;
+	/* cfp->mid = NULL; */
 
-	} else {
-	  /* realloc() failed.. */
-	  free(contents);
-	}
+	/* INC there in every case! */
+	++global_wrkcnt;
+	++MIBMtaEntry->sc.StoredMessagesSc;
 
-	free(offset);	/* release the block */
 	return cfp;
 }
 
 struct offsort {
 	int	offset;
-	int	myidx;
+	int	lineoffset;	/* of the whole 'r' line */
 	int	headeroffset;
 	int	drptoffset;
 	int	delayslot;
@@ -2210,16 +2370,16 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 	    if (*cp == _CFTAG_NOTOK) {
 #if 0
 	      ++cfp->rcpnts_failed;
-	      ++MIBMtaEntry->sc.ReceivedRecipientsSc,
-	      ++MIBMtaEntry->sc.TransmittedRecipientsSc;
+	      ++MIBMtaCnt->sc.ReceivedRecipientsSc,
+	      ++MIBMtaCnt->sc.TransmittedRecipientsSc;
 #endif
 	      prevrcpt = -1;
 	    } else if (*cp != _CFTAG_OK) {
 	      ++cfp->rcpnts_work;
 	    } else { /* _CFTAG_OK */
 #if 0
-	      ++MIBMtaEntry->sc.ReceivedRecipientsSc,
-	      ++MIBMtaEntry->sc.TransmittedRecipientsSc;
+	      ++MIBMtaCnt->sc.ReceivedRecipientsSc,
+	      ++MIBMtaCnt->sc.TransmittedRecipientsSc;
 #endif
 	    }
 	  }
@@ -2290,7 +2450,7 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 	      } else
 		offarr[opcnt].delayslot = 0;
 	      offarr[opcnt].wakeup = wakeuptime;
-	      offarr[opcnt].myidx = i;
+	      offarr[opcnt].lineoffset = *lp;
 	      offarr[opcnt].headeroffset = -1;
 	      offarr[opcnt].drptoffset = -1;
 	      offarr[opcnt].sender = latest_sender;
@@ -2584,9 +2744,7 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 	  if (strcmp(channel, l_channel) || strcmp(host, l_host)) {
 	    /* wrap and tie the old vertex node */
 	    if (i != svn) {
-	      u_int alloc_size = (u_int) (sizeof (struct vertex) +
-					  (i - svn - 1) * sizeof (int));
-	      vp = (struct vertex *)emalloc(alloc_size);
+	      vp = vtx_alloc(i - svn);
 	      if (!vp) {
 		/* malloc() failure.. */
 		sfprintf(sfstderr,"malloc() failed, discarding job: '%s'\n", file);
@@ -2596,7 +2754,6 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 	      }
 	      MIBMtaEntry->sc.StoredVerticesSc += 1;
 
-	      memset((char*)vp, 0, alloc_size);
 	      vp->cfp             = cfp;
 	      vp->next[L_CTLFILE] = NULL;
 	      vp->prev[L_CTLFILE] = pvp;
@@ -2613,7 +2770,7 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 #endif
 	      vp->ngroup       = i - svn;
 	      MIBMtaEntry->sc.StoredRecipientsSc   += (i - svn);
-	      MIBMtaEntry->sc.ReceivedRecipientsSc += (i - svn);
+	      MIBMtaCnt->sc.ReceivedRecipientsSc += (i - svn);
 
 	      /* vp->sender       = strsave(offarr[svn].sender); */
 	      vp->wakeup       = offarr[svn].wakeup;
@@ -2621,7 +2778,7 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 	      vp->drptoffset   = offarr[svn].drptoffset;
 	      vp->notaryflg    = offarr[svn].notifyflg;
 	      while (svn < i) {
-		vp->index[i-svn-1] = offarr[svn].myidx;
+		vp->index[i-svn-1] = offarr[svn].lineoffset;
 		++svn;
 	      }
 	      *pvpp = vp;
@@ -2647,9 +2804,7 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 
 	/* wrap and tie the old vertex node (this is a copy of code above) */
 	if (i != svn) {
-	  u_int alloc_size = (u_int) (sizeof (struct vertex) +
-				      (i - svn - 1) * sizeof (int));
-	  vp = (struct vertex *)emalloc(alloc_size);
+	  vp = vtx_alloc(i - svn);
 	  if (!vp) {
 	    /* malloc() failure.. */
 	    sfprintf(sfstderr,"malloc() failed, discarding job: '%s'\n", file);
@@ -2659,7 +2814,6 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 	  }
 	  MIBMtaEntry->sc.StoredVerticesSc += 1;
 
-	  memset((void*)vp, 0, alloc_size);
 	  vp->cfp = cfp;
 	  vp->next[L_CTLFILE] = NULL;
 	  vp->prev[L_CTLFILE] = pvp;
@@ -2674,7 +2828,7 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 #endif
 	  vp->ngroup = i - svn;
 	  MIBMtaEntry->sc.StoredRecipientsSc   += (i - svn);
-	  MIBMtaEntry->sc.ReceivedRecipientsSc += (i - svn);
+	  MIBMtaCnt->sc.ReceivedRecipientsSc += (i - svn);
 
 	  /* vp->sender = strsave(offarr[snv].sender); */
 	  vp->wakeup       = offarr[svn].wakeup;
@@ -2682,7 +2836,7 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 	  vp->drptoffset = offarr[svn].drptoffset;
 	  vp->notaryflg  = offarr[svn].notifyflg;
 	  while (svn < i) {
-	    vp->index[i-svn-1] = offarr[svn].myidx;
+	    vp->index[i-svn-1] = offarr[svn].lineoffset;
 	    ++svn;
 	  }
 	  *pvpp = vp;
@@ -2699,7 +2853,7 @@ static struct ctlfile *vtxprep(cfp, file, rereading)
 	   for (vp = head; vp != NULL; vp = vp->next[L_CTLFILE]) {
 	     sfprintf(sfstdout,"--\n");
 	     for (i = 0; i < vp->ngroup; ++i)
-	       sfprintf(sfstdout,"\t%s\n", cfp->contents+cfp->offset[vp->index[i]]);
+	       sfprintf(sfstdout,"\t%s\n", cfp->contents+vp->index[i]);
 	   }
 	*/
 
@@ -2812,7 +2966,7 @@ static void ce_fillin(thg,cep)
  *
  */
 
-static void vtxdo(vp, cehdr, path)
+void vtxdo(vp, cehdr, path)
 	struct vertex *vp;
 	struct config_entry *cehdr;
 	const char *path;
@@ -3010,7 +3164,7 @@ static int globmatch(pattern, string)
  * happens we need 2 (host and channel names), and we don't care what
  * they are as long as they are in separate spaces.
  */
-static void link_in(flag, vp, s)
+void link_in(flag, vp, s)
 	int flag;
 	struct vertex *vp;
 	const char *s;
@@ -3170,7 +3324,7 @@ static void init_timeserver()
 	  char *p;
 
 	  MIBMtaEntry->sc.schedulerTimeserverStartTime = time(NULL);
-	  MIBMtaEntry->sc.schedulerTimeserverStarts ++;
+	  MIBMtaCnt->sc.schedulerTimeserverStarts ++;
 
 
 	  close(0); close(1); close(2);
@@ -22,6 +22,7 @@ struct web;
 struct thread;
 struct threadgroup;
 struct vertex;
+struct taring;
 
 struct config_entry {
 	struct config_entry *next;
@@ -58,6 +59,7 @@ struct config_entry {
 	int	priority;	/* Scheduling priority			     */
 	int	overfeed;	/* How much overfeeding instead of
 				   sync processing ? */
+	int	shmring;	/* KB of shared memory job ring, or 0	     */
 	char	**argv;		/* execv parameters for the command	     */
 	int	nretries;	/* number of retry factors known	     */
 	int	*retries;	/* list of nretries retry factors	     */
@@ -109,7 +111,12 @@ struct ctlfile {
 	int	msgheadsize;	/* header size (from within transport file)  */
 	int	msgfilesizekb;	/* Sum of both, round up to nearest kB, div  */
 	int	format;		/* Message format version -- _CF_FORMAT data */
-	int	offset[1];	/* array of nlines byte offsets into the file*/
+	int	snapstate;	/* Restored from the state snapshot ?	     */
+#define CFP_SNAP_NONE	    0	/* Read from the file, or verified	     */
+#define CFP_SNAP_UNVERIFIED 1	/* From snapshot, not checked yet	     */
+#define CFP_SNAP_STALE	    2	/* From snapshot, doesn't match the file     */
+	int	*offset;	/* nlines byte offsets into the contents;
+				   both are in core only while parsing it   */
 };
 
 struct threadgroup {
@@ -130,28 +137,39 @@ struct threadgroup {
 	struct config_entry ce;		/* consed scheduler config file entry*/
 };
 
+/* The fields that thread_start() and the feeding look at
+   come first, to share the first cache line(s).  Threads come
+   from slab.c */
 struct thread {
-	long		threadid;	/* Unique id */
+	struct vertex	*thvertices;	/* First one of the thread vertices */
+	struct vertex   *nextfeed;	/* vertex within that thread	    */
+					/* feed_child() forwards nextfeed   */
+	struct procinfo	*proc;		/* NULL or ptr to xport proc	    */
+	struct threadgroup *thgrp;	/* our group-leader		    */
+	int		thrkids;	/* Number of procs at this thread   */
+	int		jobs;		/* How many items in this thread    */
+	int		unfed;		/* How many not yet fed to TAs	    */
+	int		zombie;		/* deleted, free() is pending	    */
 	time_t		wakeup;		/* When to wake up ?		    */
+	char		*pending;	/* reason for pending		    */
+
+	long		threadid;	/* Unique id */
 	int		attempts;	/* How many times activated ?	    */
 	int		retryindex;	/* when, what ?			    */
 	char		*channel, *host; /* documenting */
-	char		*pending;	/* reason for pending		    */
 	struct web	*wchan;		/* Web of CHANNELs		    */
 	struct web	*whost;		/* Web of HOSTs			    */
-	struct thread	*nexttr;	/* Next one in threads queue	    */
-	struct thread	*prevtr;	/* previous one ...		    */
+	int		heapidx;	/* Position in the wakeup heap	    */
 	struct thread	*nextthg;	/* Next one in thread GROUP	    */
 	struct thread	*prevthg;	/* previous one..		    */
-	struct threadgroup *thgrp;	/* our group-leader		    */
-	struct vertex	*thvertices;	/* First one of the thread vertices */
 	struct vertex	*lastthvertex;	/* Last one of the thread vertices  */
-	struct procinfo	*proc;		/* NULL or ptr to xport proc	    */
-	int		thrkids;	/* Number of procs at this thread   */
-	int		jobs;		/* How many items in this thread    */
-	int		unfed;		/* How many not yet fed to TAs	    */
-	struct vertex   *nextfeed;	/* vertex within that thread	    */
-					/* feed_child() forwards nextfeed   */
+};
+
+/* A collected list of threads, see thrheap.c */
+struct thrlist {
+	struct thread	**thrs;
+	int		count;
+	int		space;
 };
 
 
@@ -211,23 +229,32 @@ struct procinfo {
 	char	*cmdline;	/* Approximation of the execl() params	*/
 	int	cmdlspc;	/* cmdline buffer size			*/
 
-	struct zmpollfd *fdpfrom;
-	struct zmpollfd *fdpto;
-};
+	int	revents;	/* ZM_POLL* events seen at last mux()	*/
+	int	onready;	/* .. and thus on the mux() ready list	*/
 
-/* Stores the offset indices of all addresses that have same channel and host*/
+	struct taring *ring;	/* Shared memory job ring, if any	*/
+	int	ringon;		/* .. and the TA talks thru it		*/
+};
 
+/* Stores the offset indices of all addresses that have same channel and host.
+   As with the threads, the fields of the feeding are first.  The vertices
+   come from slab.c by the size of their index[] */
 struct vertex {		
+	struct vertex	*nextitem;	/* next in list of scheduled vertices*/
+	struct web	*orig[SIZE_L];	/* original names (channel,host,etc) */
 	struct ctlfile	*cfp;		/* control file containing this group*/
+	int		ce_pending;	/* pending on what ?		     */
+	int		ngroup;		/* number of addresses in group      */
+	time_t		wakeup;		/* time to wake up and run this      */
+	struct thread	*thread;	/* the thread we are in		     */
+
+	struct vertex	*previtem;	/* prev in list of scheduled vertices*/
 	int		qid;		/* mailq report id - filled at qprint*/
-	struct web	*orig[SIZE_L];	/* original names (channel,host,etc) */
 	struct vertex	*next[SIZE_L];	/* next group with same L_?	     */
 	struct vertex	*prev[SIZE_L];	/* previous group with same L_?      */
-	struct thread	*thread;	/* the thread we are in		     */
 	struct threadgroup *thgrp;	/* the group we are in		     */
-	struct vertex	*nextitem;	/* next in list of scheduled vertices*/
-	struct vertex	*previtem;	/* prev in list of scheduled vertices*/
-	char		*message;	/* some text associated with node    */
+	char		*message;	/* some text associated with node;
+					   shared, see str_intern()	     */
 	int		headeroffset;	/* Message headers for this rcpt     */
 	int		drptoffset;	/* IETF-NOTARY DRPT  data	     */
 	char		*notary;	/* IETF Notary report data	     */
@@ -237,20 +264,19 @@ struct vertex {
 #define NOT_SUCCESS 004
 #define NOT_FAILURE 010
 #define NOT_TRACE   020 /* RFC 2852 */
-	int		ce_pending;	/* pending on what ?		     */
 	time_t		ce_expiry;	/* when this vertex expires ?        */
 	time_t		ce_expiry2;	/* when this vertex expires ? w/o attempts */
 	int		attempts;	/* count of number of TA invocations */
 	int		retryindex;	/* cur index into ce->retries array  */
-	time_t		wakeup;		/* time to wake up and run this      */
 	time_t		lastfeed;	/* When the last feed was ?	     */
 	time_t		nextrprttime;	/* next time after which collected
 					   reports of this message will be
 					   produced.                         */
 	time_t		nextdlyrprttime;
 	char		*sender;	/* Message Sender/error recipient    */
-	int		ngroup;		/* number of addresses in group      */
-	int		index[1];	/* index of cfp->offset for group    */
+	int		ngroupmax;	/* room in index[], see vtx_alloc()  */
+	int		index[1];	/* byte offsets of the group's
+					   recipient lines in the file	     */
 };
 
 
@@ -307,6 +333,8 @@ struct mailq {
 	int		outbufcount;
 	int		outcol;
 	char		*outbuf;
+
+	int		relay;		/* Coordinator link of a shard */
 };
 
 #define MQ2MODE_SNMP	0x0001
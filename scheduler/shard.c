@@ -0,0 +1,471 @@
+/*
+ *	ZMailer scheduler shards
+ *
+ *	With ZENV variable  SCHEDULERSHARDS  set to N > 1, the scheduler
+ *	process becomes a coordinator which forks N shards.  Each shard
+ *	is a complete scheduler with its own  mux()  and transporters,
+ *	and owns the transport files whose inode number modulo N is its
+ *	index.  A file is never split between shards, because only one
+ *	process may update the recipient tags of a transport file.
+ *
+ *	The coordinator keeps the notify socket, and passes each "NEW"
+ *	notify on to the shard owning the file.  It also keeps the
+ *	MAILQ-v2 service: authentication is done in the coordinator,
+ *	and the commands are relayed to every shard over a socketpair,
+ *	with the replies merged into one (see  mq2_relay()).
+ *
+ *	The coordinator restarts shards that die, and forwards the
+ *	TERM, QUIT, USR1, USR2 and HUP signals to them.
+ */
+
+#include "hostenv.h"
+#include <sfio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "scheduler.h"
+#include "prototypes.h"
+#include "zmsignal.h"
+#include "zmpoll.h"
+#include "libz.h"
+#include "libc.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+int sched_shard  = 0;	/* 0: coordinator (or not sharded); 1..N: shard */
+int sched_shards = 0;	/* ZENV SCHEDULERSHARDS */
+int shard_stale_config = 0; /* SIGUSR1 seen; new shards re-read it */
+
+extern int mailqmode;
+
+struct shardinfo {
+	pid_t	pid;		/* 0 when not running			*/
+	int	notifyfd;	/* DGRAM socketpair, "NEW .." notifies	*/
+	int	relayfd;	/* STREAM socketpair, MAILQ-v2 relay	*/
+	time_t	started;
+	struct zmpollfd *pfd;
+};
+
+static struct shardinfo *shards = NULL;
+static pid_t shard_ppid = 0;
+
+static volatile int shard_exiting = 0;	/* 1: TERM, 2: QUIT */
+static time_t shard_exittime;
+
+#define SHARD_RESPAWN	 10	/* Seconds between restarts of one shard */
+#define SHARD_RELAYTIME	 30	/* Seconds to wait for a relayed reply   */
+#define SHARD_EXITTIME	 60	/* Seconds for the shards to go at TERM  */
+
+static RETSIGTYPE (*oldterm) __((int));
+static RETSIGTYPE (*oldquit) __((int));
+static RETSIGTYPE (*oldusr1) __((int));
+static RETSIGTYPE (*oldusr2) __((int));
+static RETSIGTYPE (*oldhup)  __((int));
+static RETSIGTYPE (*oldchld) __((int));
+
+
+static void shard_kill __((int));
+static void
+shard_kill(sig)
+     int sig;
+{
+	int i;
+
+	for (i = 0; i < sched_shards; ++i)
+	  if (shards[i].pid > 0)
+	    kill(shards[i].pid, sig);
+}
+
+static RETSIGTYPE shard_sigforward __((int));
+static RETSIGTYPE
+shard_sigforward(sig)
+     int sig;
+{
+	shard_kill(sig);
+
+	if (sig == SIGTERM)
+	  shard_exiting = 1;
+	else if (sig == SIGQUIT && !shard_exiting)
+	  shard_exiting = 2;
+#ifdef SIGUSR1
+	else if (sig == SIGUSR1)
+	  shard_stale_config = 1;
+#endif
+	else if (sig == SIGHUP && oldhup != SIG_DFL && oldhup != SIG_IGN)
+	  (*oldhup)(sig); /* Reopen our own log, too */
+
+	SIGNAL_HANDLE(sig, shard_sigforward);
+}
+
+static void shard_signals __((void));
+static void
+shard_signals()
+{
+	SIGNAL_HANDLESAVE(SIGTERM, shard_sigforward, oldterm);
+	SIGNAL_HANDLESAVE(SIGQUIT, shard_sigforward, oldquit);
+#ifdef SIGUSR1
+	SIGNAL_HANDLESAVE(SIGUSR1, shard_sigforward, oldusr1);
+#endif
+#ifdef SIGUSR2
+	SIGNAL_HANDLESAVE(SIGUSR2, shard_sigforward, oldusr2);
+#endif
+	SIGNAL_HANDLESAVE(SIGHUP,  shard_sigforward, oldhup);
+	/* We reap our shards ourselves */
+	SIGNAL_HANDLESAVE(SIGCHLD, SIG_DFL, oldchld);
+}
+
+/* In a new shard: back to what the scheduler had */
+static void shard_unsignals __((void));
+static void
+shard_unsignals()
+{
+	SIGNAL_HANDLE(SIGTERM, oldterm);
+	SIGNAL_HANDLE(SIGQUIT, oldquit);
+#ifdef SIGUSR1
+	SIGNAL_HANDLE(SIGUSR1, oldusr1);
+#endif
+#ifdef SIGUSR2
+	SIGNAL_HANDLE(SIGUSR2, oldusr2);
+#endif
+	SIGNAL_HANDLE(SIGHUP,  oldhup);
+	SIGNAL_HANDLE(SIGCHLD, oldchld);
+}
+
+
+/*
+ *  Start shard  i  (0..N-1).  Returns 0 in the new shard process,
+ *  1 in the coordinator, and -1 when it could not be started.
+ */
+static int shard_spawn __((int));
+static int
+shard_spawn(i)
+     int i;
+{
+	int nfds[2], rfds[2], j;
+	pid_t pid;
+	char *s;
+
+	if (socketpair(PF_UNIX, SOCK_DGRAM, 0, nfds) < 0)
+	  return -1;
+	if (socketpair(PF_UNIX, SOCK_STREAM, 0, rfds) < 0) {
+	  close(nfds[0]); close(nfds[1]);
+	  return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+	  close(nfds[0]); close(nfds[1]);
+	  close(rfds[0]); close(rfds[1]);
+	  return -1;
+	}
+
+	if (pid == 0) {
+	  /* The new shard: drop everything of the coordinator */
+	  Z_SHM_MIB_Forked();
+	  for (j = 0; j < sched_shards; ++j) {
+	    if (shards[j].notifyfd >= 0) close(shards[j].notifyfd);
+	    if (shards[j].relayfd  >= 0) close(shards[j].relayfd);
+	  }
+	  close(nfds[0]);
+	  close(rfds[0]);
+	  if (querysocket  >= 0) close(querysocket);
+	  if (querysocket6 >= 0) close(querysocket6);
+	  if (notifysocket >= 0) close(notifysocket);
+	  querysocket = querysocket6 = -1;
+	  mq2_forget();
+
+	  sched_shard = i + 1;
+	  shard_unsignals();
+
+	  fcntl(nfds[1], F_SETFL, fcntl(nfds[1], F_GETFL, 0)|O_NONBLOCK);
+#if defined(F_SETFD)
+	  fcntl(nfds[1], F_SETFD, 1); /* close-on-exec */
+	  fcntl(rfds[1], F_SETFD, 1);
+#endif
+	  notifysocket = nfds[1];
+	  mq2_register_relay(rfds[1]);
+
+	  if (rendezvous) {
+	    s = emalloc(strlen(rendezvous) + 12);
+	    sprintf(s, "%s.%d", rendezvous, sched_shard);
+	    rendezvous = s;
+	  }
+	  return 0;
+	}
+
+	close(nfds[1]);
+	close(rfds[1]);
+	fcntl(nfds[0], F_SETFL, fcntl(nfds[0], F_GETFL, 0)|O_NONBLOCK);
+#if defined(F_SETFD)
+	fcntl(nfds[0], F_SETFD, 1); /* close-on-exec */
+	fcntl(rfds[0], F_SETFD, 1);
+#endif
+	shards[i].pid	   = pid;
+	shards[i].notifyfd = nfds[0];
+	shards[i].relayfd  = rfds[0];
+	shards[i].started  = now;
+
+	sfprintf(sfstdout, "%s: started scheduler shard %d/%d, pid %d\n",
+		 timestring(), i+1, sched_shards, (int)pid);
+	return 1;
+}
+
+static void shard_lost __((int));
+static void
+shard_lost(i)
+     int i;
+{
+	int statloc = 0;
+
+	if (shards[i].notifyfd >= 0) close(shards[i].notifyfd);
+	if (shards[i].relayfd  >= 0) close(shards[i].relayfd);
+	shards[i].notifyfd = shards[i].relayfd = -1;
+
+	if (shards[i].pid > 0) {
+	  /* Its socket closed, thus it should be going */
+	  if (waitpid(shards[i].pid, &statloc, WNOHANG) == 0) {
+	    kill(shards[i].pid, SIGTERM);
+	    while (waitpid(shards[i].pid, &statloc, 0) < 0 && errno == EINTR)
+	      ;
+	  }
+	  if (!shard_exiting)
+	    sfprintf(sfstdout, "%s: scheduler shard %d/%d, pid %d, exited with status 0x%x\n",
+		     timestring(), i+1, sched_shards, (int)shards[i].pid,
+		     statloc);
+	}
+	shards[i].pid = 0;
+}
+
+/*
+ *  With more than one shard configured, become the coordinator.
+ *  Only the shards return from here, with  sched_shard  set;
+ *  the coordinator exits at the end.
+ */
+void
+shard_coordinator()
+{
+	static struct zmpollfd *fds = NULL;
+	struct zmpollfd *notifyfds, *queryfds, *query6fds;
+	int i, n, fdscount, alive;
+	char c;
+
+	if (sched_shards <= 1)
+	  return;
+
+	shards = (struct shardinfo *)emalloc(sizeof(*shards) * sched_shards);
+	memset(shards, 0, sizeof(*shards) * sched_shards);
+	for (i = 0; i < sched_shards; ++i)
+	  shards[i].notifyfd = shards[i].relayfd = -1;
+
+	/* The replies of the shards can be merged only in v2 mode */
+	mailqmode = 2;
+	shard_ppid = getpid();
+
+	shard_signals();
+	mytime(&now);
+
+	for (i = 0; i < sched_shards; ++i)
+	  if (shard_spawn(i) == 0)
+	    return;
+
+	queryipcinit();
+
+	for (;;) {
+	  mytime(&now);
+
+	  alive = 0;
+	  for (i = 0; i < sched_shards; ++i) {
+	    if (shards[i].pid > 0) {
+	      ++alive;
+	      continue;
+	    }
+	    if (shard_exiting || shards[i].started + SHARD_RESPAWN > now)
+	      continue;
+	    if (shard_spawn(i) == 0)
+	      return;
+	    if (shards[i].pid > 0)
+	      ++alive;
+	  }
+
+	  if (shard_exiting) {
+	    if (shard_exittime == 0)
+	      shard_exittime = now + SHARD_EXITTIME;
+	    if (alive == 0 ||
+		(shard_exiting == 1 && now > shard_exittime))
+	      break;
+	  }
+
+	  fdscount = 0;
+	  notifyfds = queryfds = query6fds = NULL;
+	  if (notifysocket >= 0)
+	    zmpoll_addfd(&fds, &fdscount, notifysocket, -1, &notifyfds);
+	  if (querysocket >= 0)
+	    zmpoll_addfd(&fds, &fdscount, querysocket, -1, &queryfds);
+	  if (querysocket6 >= 0)
+	    zmpoll_addfd(&fds, &fdscount, querysocket6, -1, &query6fds);
+	  mq2add_to_poll(&fds, &fdscount);
+	  for (i = 0; i < sched_shards; ++i) {
+	    shards[i].pfd = NULL;
+	    if (shards[i].relayfd >= 0)
+	      zmpoll_addfd(&fds, &fdscount, shards[i].relayfd, -1,
+			   &shards[i].pfd);
+	  }
+
+	  n = zmpoll(fds, fdscount, 1000);
+	  if (n < 0 && errno != EINTR)
+	    sleep(1);
+	  mytime(&now);
+	  if (n <= 0)
+	    continue;
+
+	  if (notifyfds &&
+	      (notifyfds->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP)))
+	    receive_notify(notifysocket);
+
+	  /* Nothing is expected from the shards unasked for, thus
+	     this is either a late reply to drop, or the end of it. */
+	  for (i = 0; i < sched_shards; ++i)
+	    if (shards[i].pfd &&
+		(shards[i].pfd->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))) {
+	      shards[i].pfd = NULL;
+	      if (read(shards[i].relayfd, &c, 1) <= 0 && errno != EAGAIN)
+		shard_lost(i);
+	    }
+
+	  queryipccheck();
+	}
+
+	if (shard_exiting == 1)
+	  shard_kill(SIGKILL);
+	for (i = 0; i < sched_shards; ++i)
+	  if (shards[i].pid > 0)
+	    shard_lost(i);
+
+	killpidfile(pidfile);
+	die(0, "signal");
+}
+
+/* Does this process handle the transport file  ino ? */
+int
+shard_owns(ino)
+     long ino;
+{
+	if (sched_shards <= 1 || sched_shard == 0)
+	  return 1;
+	return ((u_long)ino % sched_shards) == (sched_shard - 1);
+}
+
+/* In a shard: has the coordinator gone ? */
+int
+shard_orphaned()
+{
+	return (sched_shard > 0 && getppid() != shard_ppid);
+}
+
+/*
+ *  In the coordinator, pass a "NEW .." notify on to the owner of
+ *  the file, and return 1.  Elsewhere return 0 to process it.
+ */
+int
+shard_notify(ino, buf)
+     long ino;
+     const char *buf;
+{
+	int i;
+
+	if (sched_shards <= 1 || sched_shard != 0)
+	  return 0;
+
+	i = (u_long)ino % sched_shards;
+	/* A lost notify is picked up by the directory scan */
+	if (shards[i].notifyfd >= 0)
+	  send(shards[i].notifyfd, buf, strlen(buf), 0);
+	return 1;
+}
+
+int
+shard_count()
+{
+	return (sched_shards > 1 && sched_shard == 0) ? sched_shards : 0;
+}
+
+static int shard_readwait __((int, time_t));
+static int
+shard_readwait(fd, until)
+     int fd;
+     time_t until;
+{
+	struct zmpollfd pfd;
+	time_t t;
+
+	for (;;) {
+	  t = time(NULL);
+	  if (t >= until)
+	    return 0;
+	  memset(&pfd, 0, sizeof(pfd));
+	  pfd.fd = fd;
+	  pfd.events = ZM_POLLIN;
+	  if (zmpoll(&pfd, 1, (until - t) * 1000) > 0)
+	    return 1;
+	  if (errno != EINTR)
+	    return 0;
+	}
+}
+
+/*
+ *  Send a relayed MAILQ-v2 command to shard  i,  and return its
+ *  reply in a malloc()ed buffer, or NULL if there was none.  The
+ *  reply comes as a line with its length, and then the reply.
+ */
+char *
+shard_relay(i, cmd, lenp)
+     int i;
+     const char *cmd;
+     int *lenp;
+{
+	int fd = shards[i].relayfd;
+	char hdr[20], *buf, junk[256];
+	int len, got, r;
+	time_t until;
+
+	if (fd < 0)
+	  return NULL;
+
+	/* Some leftovers from an earlier timed out reply ? */
+	fd_nonblockingmode(fd);
+	while (read(fd, junk, sizeof(junk)) > 0)
+	  ;
+	fd_blockingmode(fd);
+
+	len = strlen(cmd);
+	if (write(fd, cmd, len) != len)
+	  return NULL;
+
+	until = time(NULL) + SHARD_RELAYTIME;
+	for (got = 0; got < sizeof(hdr)-1; ++got) {
+	  if (!shard_readwait(fd, until) || read(fd, hdr+got, 1) != 1)
+	    return NULL;
+	  if (hdr[got] == '\n')
+	    break;
+	}
+	hdr[got] = 0;
+	len = atoi(hdr);
+	if (len < 0)
+	  return NULL;
+
+	buf = emalloc(len + 1);
+	for (got = 0; got < len; got += r) {
+	  r = 0;
+	  if (!shard_readwait(fd, until) ||
+	      (r = read(fd, buf + got, len - got)) <= 0) {
+	    free(buf);
+	    return NULL;
+	  }
+	}
+	buf[len] = 0;
+	*lenp = len;
+	return buf;
+}
@@ -0,0 +1,243 @@
+/*
+ *	ZMailer Scheduler object slabs
+ *
+ *	The vertices, threads, thread groups, and webs come and go by
+ *	the thousands when a big destination defers everything.  They
+ *	are not malloc()ed one by one, but carved out of larger chunks,
+ *	one set of chunks for each type, and the vertices by the room
+ *	they have for the recipient indices.  Freed objects go to the
+ *	free list of their slab for the next taker, so a churning queue
+ *	reuses the same memory, and the objects of a kind sit together.
+ *	The chunks are never given back to malloc().
+ *
+ *	The allocators return zeroed objects.  The freed ones are
+ *	filled with 0x55 as before, to make the use of a dead object
+ *	show up.
+ */
+
+#include "hostenv.h"
+#include <sfio.h>
+#include "scheduler.h"
+#include "prototypes.h"
+#include "libz.h"
+
+struct slabobj {
+	struct slabobj	*next;		/* Free list link		*/
+};
+
+struct slab {
+	const char	*name;
+	int		objsize;	/* 0 for the malloc()ed big ones */
+	int		perchunk;
+	struct slabobj	*freelist;
+	long		inuse;		/* Objects given out		*/
+	long		nfree;		/* .. and on the free list	*/
+	long		chunks;
+	long		allocs;		/* Total count of allocations	*/
+};
+
+#define SLAB_CHUNK	(32*1024)	/* Bytes per chunk, roughly	*/
+#define SLAB_MINCHUNK	8		/* .. but at least this many	*/
+#define SLAB_ROUND(x)	(((x) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+#define VTXSIZE(n)	(sizeof(struct vertex) + ((n) - 1) * sizeof(int))
+
+/* The vertices have room for 1, 2, 4, 8, or 16 recipients,
+   bigger groups are malloc()ed as they are. */
+#define VTX_CLASSES	5
+#define VTX_SLABMAX	(1 << (VTX_CLASSES-1))
+
+#define SLAB_THREAD	(VTX_CLASSES)
+#define SLAB_THRGRP	(VTX_CLASSES+1)
+#define SLAB_WEB	(VTX_CLASSES+2)
+#define SLAB_VTXBIG	(VTX_CLASSES+3)
+
+static struct slab slabs[] = {
+	{ "vertex/1",	SLAB_ROUND(VTXSIZE(1))  },
+	{ "vertex/2",	SLAB_ROUND(VTXSIZE(2))  },
+	{ "vertex/4",	SLAB_ROUND(VTXSIZE(4))  },
+	{ "vertex/8",	SLAB_ROUND(VTXSIZE(8))  },
+	{ "vertex/16",	SLAB_ROUND(VTXSIZE(16)) },
+	{ "thread",	SLAB_ROUND(sizeof(struct thread))      },
+	{ "threadgroup",SLAB_ROUND(sizeof(struct threadgroup)) },
+	{ "web",	SLAB_ROUND(sizeof(struct web))         },
+	{ "vertex/big",	0 },
+	{ NULL }
+};
+
+
+static int slab_grow __((struct slab *));
+static int
+slab_grow(sp)
+	struct slab *sp;
+{
+	char *chunk;
+	struct slabobj *op;
+	int i;
+
+	if (sp->perchunk == 0) {
+	  sp->perchunk = SLAB_CHUNK / sp->objsize;
+	  if (sp->perchunk < SLAB_MINCHUNK)
+	    sp->perchunk = SLAB_MINCHUNK;
+	}
+
+	chunk = emalloc(sp->perchunk * sp->objsize);
+	if (chunk == NULL)
+	  return -1;
+
+	/* Thread them in the address order */
+	for (i = sp->perchunk - 1; i >= 0; --i) {
+	  op = (struct slabobj *)(chunk + i * sp->objsize);
+	  op->next = sp->freelist;
+	  sp->freelist = op;
+	}
+	sp->nfree  += sp->perchunk;
+	sp->chunks += 1;
+	return 0;
+}
+
+static void *slab_alloc __((struct slab *));
+static void *
+slab_alloc(sp)
+	struct slab *sp;
+{
+	struct slabobj *op;
+
+	if (sp->freelist == NULL && slab_grow(sp) < 0)
+	  return NULL;
+
+	op = sp->freelist;
+	sp->freelist = op->next;
+	sp->nfree  -= 1;
+	sp->inuse  += 1;
+	sp->allocs += 1;
+
+	memset((void*)op, 0, sp->objsize);
+	return (void*)op;
+}
+
+static void slab_free __((struct slab *, void *));
+static void
+slab_free(sp, p)
+	struct slab *sp;
+	void *p;
+{
+	struct slabobj *op = p;
+
+	memset(p, 0x55, sp->objsize);
+
+	op->next = sp->freelist;
+	sp->freelist = op;
+	sp->nfree += 1;
+	sp->inuse -= 1;
+}
+
+
+struct vertex *
+vtx_alloc(ngroup)
+	int ngroup;
+{
+	struct vertex *vp;
+	struct slab *sp;
+	int c;
+
+	for (c = 0; c < VTX_CLASSES && (1 << c) < ngroup; ++c)
+	  ;
+	if (c < VTX_CLASSES) {
+	  vp = (struct vertex *)slab_alloc(&slabs[c]);
+	  if (vp != NULL)
+	    vp->ngroupmax = 1 << c;
+	  return vp;
+	}
+
+	sp = &slabs[SLAB_VTXBIG];
+	vp = (struct vertex *)emalloc(VTXSIZE(ngroup));
+	if (vp == NULL)
+	  return NULL;
+	memset((void*)vp, 0, VTXSIZE(ngroup));
+	vp->ngroupmax = ngroup;
+	sp->inuse  += 1;
+	sp->allocs += 1;
+	return vp;
+}
+
+void
+vtx_free(vp)
+	struct vertex *vp;
+{
+	int c;
+
+	if (vp->ngroupmax > VTX_SLABMAX) {
+	  slabs[SLAB_VTXBIG].inuse -= 1;
+	  memset((void*)vp, 0x55, VTXSIZE(vp->ngroupmax));
+	  free((void*)vp);
+	  return;
+	}
+	for (c = 0; (1 << c) < vp->ngroupmax; ++c)
+	  ;
+	slab_free(&slabs[c], vp);
+}
+
+struct thread *
+thr_alloc()
+{
+	return (struct thread *)slab_alloc(&slabs[SLAB_THREAD]);
+}
+
+void
+thr_free(thr)
+	struct thread *thr;
+{
+	slab_free(&slabs[SLAB_THREAD], thr);
+}
+
+struct threadgroup *
+thg_alloc()
+{
+	return (struct threadgroup *)slab_alloc(&slabs[SLAB_THRGRP]);
+}
+
+void
+thg_free(thgp)
+	struct threadgroup *thgp;
+{
+	slab_free(&slabs[SLAB_THRGRP], thgp);
+}
+
+struct web *
+web_alloc()
+{
+	return (struct web *)slab_alloc(&slabs[SLAB_WEB]);
+}
+
+void
+web_free(wp)
+	struct web *wp;
+{
+	slab_free(&slabs[SLAB_WEB], wp);
+}
+
+
+/*
+ *  The statistics of the i:th slab, for the  mq2  "SHOW MEMORY".
+ *  Returns 0 past the last one.
+ */
+int
+slab_stat(i, namep, sizep, inusep, freep, allocsp)
+	int i;
+	const char **namep;
+	long *sizep, *inusep, *freep, *allocsp;
+{
+	struct slab *sp;
+
+	if (i < 0 || slabs[i].name == NULL)
+	  return 0;
+	sp = &slabs[i];
+
+	*namep   = sp->name;
+	*sizep   = sp->objsize;
+	*inusep  = sp->inuse;
+	*freep   = sp->nfree;
+	*allocsp = sp->allocs;
+	return 1;
+}
@@ -0,0 +1,770 @@
+/*
+ *	ZMailer scheduler state snapshot
+ *
+ *	With ZENV variable  SCHEDULERSNAPSHOT  set to an interval in
+ *	seconds, a forked child writes the in-core control file and
+ *	vertex state into a binary file every so often, and the
+ *	scheduler writes it once more when it exits normally.
+ *
+ *	At the startup that file is mapped in, and messages in it are
+ *	put into the schedules without reading and parsing their
+ *	transport files.  Such messages are "unverified": before one of
+ *	them is fed to a transport agent, or is expired, the message
+ *	file mtime and the recipient line tags in the transport file
+ *	are checked with  snapshot_verify(),  and  snapshot_reconcile()
+ *	does the same to the rest of them in small batches.  The stale
+ *	ones are dropped from the memory and put into the directory
+ *	queue for normal processing.
+ *
+ *	Anything not in the snapshot is found by the directory scan.
+ */
+
+#include "hostenv.h"
+#include <sfio.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+#include "mail.h"
+#include "ta.h"
+#include "scheduler.h"
+#include "prototypes.h"
+#include "libz.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+extern int global_wrkcnt;
+
+#define SNAPFILE	snap_path(0)
+#define SNAPTMPFILE	snap_path(1)
+
+#define SNAP_MAGIC	"ZMSCHSNP"
+#define SNAP_VERSION	2
+#define SNAP_ENDIAN	0x01020304
+#define SNAP_SIZES	(sizeof(int) | (sizeof(long) << 8) | (sizeof(time_t) << 16))
+
+#define SNAP_ALIGN(x)	(((x) + 7) & ~7)
+
+struct snaphdr {
+	char	magic[8];
+	int	version;
+	int	endian;		/* SNAP_ENDIAN in writer byte order	*/
+	int	sizes;		/* SNAP_SIZES of the writer		*/
+	int	pad;
+	time_t	created;
+	long	count;		/* Number of control file records	*/
+	long	length;		/* Length of the whole file		*/
+};
+
+#define SNAP_CFSTRINGS	7	/* mid, logident, erroraddr, envid,
+				   dsnretmode, vfpfn, spoolid		*/
+struct snapcfp {
+	long	reclen;		/* Aligned length of the whole record	*/
+	u_long	id;
+	time_t	mtime, envctime;
+	long	mtimens, envctimens;
+	int	uid, dirind, haderror, iserrmesg, format;
+	int	msgbodyoffset, msgbodysize, msgheadsize, msgfilesizekb;
+	int	rcpnts_total, rcpnts_failed, rcpnts_work;
+	int	nlines, nvertices;
+	int	slen[SNAP_CFSTRINGS];
+	/* strings, then the vertices */
+};
+
+#define SNAP_VXSTRINGS	4	/* channel, host, message, notary	*/
+struct snapvtx {
+	time_t	wakeup, nextrprttime, nextdlyrprttime;
+	int	ngroup, headeroffset, drptoffset, notaryflg;
+	int	attempts, retryindex;
+	int	slen[SNAP_VXSTRINGS];
+	int	pad;
+	/* int index[ngroup], strings */
+};
+
+/* Record build buffer of the writer */
+static char *snapbuf = NULL;
+static long  snapbuflen = 0, snapbufspace = 0;
+
+/* Ids of messages loaded, and of those found stale */
+static u_long *snapids = NULL;
+static int     snapidcnt = 0, snapidpos = 0;
+static u_long *staleids = NULL;
+static int     stalecnt = 0, stalespace = 0;
+static int     snapstalesum = 0;
+
+static pid_t   snapwriter = 0;
+
+
+/* Every scheduler shard has a snapshot of its own */
+static const char *snap_path __((int));
+static const char *
+snap_path(tmp)
+     int tmp;
+{
+	static char path[2][60];
+
+	if (path[0][0] == '\0') {
+	  if (sched_shard > 0)
+	    sprintf(path[0], "../.scheduler.snapshot.%d", sched_shard);
+	  else
+	    strcpy(path[0], "../.scheduler.snapshot");
+	  sprintf(path[1], "%s.tmp", path[0]);
+	}
+	return path[tmp];
+}
+
+
+static long snapbuf_put __((const void *, long));
+static long
+snapbuf_put(p, len)
+     const void *p;
+     long len;
+{
+	long pos = snapbuflen;
+
+	if (snapbuflen + len > snapbufspace) {
+	  while (snapbuflen + len > snapbufspace)
+	    snapbufspace = snapbufspace ? snapbufspace * 2 : 8192;
+	  snapbuf = erealloc(snapbuf, snapbufspace);
+	}
+	if (p)
+	  memcpy(snapbuf + pos, p, len);
+	else
+	  memset(snapbuf + pos, 0, len);
+	snapbuflen += len;
+	return pos;
+}
+
+/* Store a string with its NUL, return its length, or -1 for NULL */
+static int snapbuf_str __((const char *));
+static int
+snapbuf_str(s)
+     const char *s;
+{
+	long len;
+
+	if (s == NULL)
+	  return -1;
+	len = strlen(s);
+	snapbuf_put(s, len + 1);
+	return (int) len;
+}
+
+static int snapbuf_cfp __((struct ctlfile *));
+static int
+snapbuf_cfp(cfp)
+     struct ctlfile *cfp;
+{
+	struct snapcfp sc;
+	struct snapvtx sv;
+	struct vertex *vp;
+	long cpos, vpos;
+
+	snapbuflen = 0;
+	memset(&sc, 0, sizeof(sc));
+	cpos = snapbuf_put(NULL, sizeof(sc));
+
+	sc.id		 = cfp->id;
+	sc.mtime	 = cfp->mtime;
+	sc.mtimens	 = cfp->mtimens;
+	sc.envctime	 = cfp->envctime;
+	sc.envctimens	 = cfp->envctimens;
+	sc.uid		 = cfp->uid;
+	sc.dirind	 = cfp->dirind;
+	sc.haderror	 = cfp->haderror;
+	sc.iserrmesg	 = cfp->iserrmesg;
+	sc.format	 = cfp->format;
+	sc.msgbodyoffset = cfp->msgbodyoffset;
+	sc.msgbodysize	 = cfp->msgbodysize;
+	sc.msgheadsize	 = cfp->msgheadsize;
+	sc.msgfilesizekb = cfp->msgfilesizekb;
+	sc.rcpnts_total	 = cfp->rcpnts_total;
+	sc.rcpnts_failed = cfp->rcpnts_failed;
+	sc.rcpnts_work	 = cfp->rcpnts_work;
+	sc.nlines	 = cfp->nlines;
+
+	sc.slen[0] = snapbuf_str(cfp->mid);
+	sc.slen[1] = snapbuf_str(cfp->logident);
+	sc.slen[2] = snapbuf_str(cfp->erroraddr);
+	sc.slen[3] = snapbuf_str(cfp->envid);
+	sc.slen[4] = snapbuf_str(cfp->dsnretmode);
+	sc.slen[5] = snapbuf_str(cfp->vfpfn);
+	sc.slen[6] = snapbuf_str(cfp->spoolid);
+	snapbuf_put(NULL, SNAP_ALIGN(snapbuflen) - snapbuflen);
+
+	for (vp = cfp->head; vp != NULL; vp = vp->next[L_CTLFILE]) {
+	  if (vp->ngroup <= 0 ||
+	      vp->orig[L_CHANNEL] == NULL || vp->orig[L_HOST] == NULL)
+	    continue;
+
+	  memset(&sv, 0, sizeof(sv));
+	  vpos = snapbuf_put(NULL, sizeof(sv));
+
+	  sv.wakeup	     = vp->wakeup;
+	  sv.nextrprttime    = vp->nextrprttime;
+	  sv.nextdlyrprttime = vp->nextdlyrprttime;
+	  sv.ngroup	     = vp->ngroup;
+	  sv.headeroffset    = vp->headeroffset;
+	  sv.drptoffset	     = vp->drptoffset;
+	  sv.notaryflg	     = vp->notaryflg;
+	  sv.attempts	     = vp->attempts;
+	  sv.retryindex	     = vp->retryindex;
+
+	  snapbuf_put(vp->index, sizeof(int) * vp->ngroup);
+
+	  sv.slen[0] = snapbuf_str(vp->orig[L_CHANNEL]->name);
+	  sv.slen[1] = snapbuf_str(vp->orig[L_HOST]->name);
+	  sv.slen[2] = snapbuf_str(vp->message);
+	  sv.slen[3] = snapbuf_str(vp->notary);
+	  snapbuf_put(NULL, SNAP_ALIGN(snapbuflen) - snapbuflen);
+
+	  memcpy(snapbuf + vpos, &sv, sizeof(sv));
+	  ++sc.nvertices;
+	}
+
+	sc.reclen = snapbuflen;
+	memcpy(snapbuf + cpos, &sc, sizeof(sc));
+
+	return sc.nvertices;
+}
+
+
+struct snapwctx {
+	Sfio_t	*fp;
+	long	count;
+	long	length;
+	int	err;
+};
+
+static int snap_writecfp __((void *, struct spblk *));
+static int
+snap_writecfp(p, spl)
+     void *p;
+     struct spblk *spl;
+{
+	struct snapwctx *ctx = p;
+	struct ctlfile *cfp = (struct ctlfile *)spl->data;
+
+	if (ctx->err || cfp == NULL)
+	  return 0;
+	/* Stale ones are going to be re-read anyway */
+	if (cfp->head == NULL || cfp->snapstate == CFP_SNAP_STALE)
+	  return 0;
+
+	if (snapbuf_cfp(cfp) == 0)
+	  return 0;
+	if (sfwrite(ctx->fp, snapbuf, snapbuflen) != snapbuflen) {
+	  ctx->err = 1;
+	  return 0;
+	}
+	ctx->count  += 1;
+	ctx->length += snapbuflen;
+	return 0;
+}
+
+/*
+ *  Write the snapshot, return the number of messages written,
+ *  or -1 for an error.  The file is written under a temporary
+ *  name, and renamed only when complete.
+ */
+int
+snapshot_write()
+{
+	struct snapwctx ctx;
+	struct snaphdr hdr;
+	int fd;
+
+	fd = open(SNAPTMPFILE, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if (fd < 0)
+	  return -1;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fp = sfnew(NULL, NULL, 64*1024, fd, SF_WRITE);
+	if (ctx.fp == NULL) {
+	  close(fd);
+	  unlink(SNAPTMPFILE);
+	  return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.endian  = SNAP_ENDIAN;
+	hdr.sizes   = SNAP_SIZES;
+	hdr.created = time(NULL);
+	if (sfwrite(ctx.fp, &hdr, sizeof(hdr)) != sizeof(hdr))
+	  ctx.err = 1;
+	ctx.length = sizeof(hdr);
+
+	sp_scan(snap_writecfp, &ctx, NULL, spt_mesh[L_CTLFILE]);
+
+	/* Count and length go into the header when all is written */
+	hdr.count  = ctx.count;
+	hdr.length = ctx.length;
+	if (!ctx.err &&
+	    (sfseek(ctx.fp, (Sfoff_t)0, SEEK_SET) != 0 ||
+	     sfwrite(ctx.fp, &hdr, sizeof(hdr)) != sizeof(hdr)))
+	  ctx.err = 1;
+	if (sfsync(ctx.fp) < 0 || fsync(fd) < 0)
+	  ctx.err = 1;
+	if (sfclose(ctx.fp) < 0)
+	  ctx.err = 1;
+
+	if (ctx.err || rename(SNAPTMPFILE, SNAPFILE) < 0) {
+	  unlink(SNAPTMPFILE);
+	  return -1;
+	}
+	return (int) ctx.count;
+}
+
+/*
+ *  Periodic snapshot; the child has a copy of the whole state,
+ *  thus the parent does not wait for the writing.
+ */
+void
+snapshot_fork()
+{
+	pid_t pid;
+
+	if (snapwriter > 0 && kill(snapwriter, 0) == 0)
+	  return; /* The previous one is still at it */
+
+	pid = fork();
+	if (pid == 0) {
+	  _exit(snapshot_write() < 0 ? 1 : 0);
+	}
+	if (pid < 0)
+	  sfprintf(sfstderr, "%s: snapshot fork() failed, errno=%d\n",
+		   progname, errno);
+	snapwriter = pid;
+}
+
+/*
+ *  The last snapshot, at the exit.  A periodic writer that is still
+ *  at it would be writing the same temporary file, so it is stopped,
+ *  and waited for, first.  (It has the scheduler's signal handlers,
+ *  thus a SIGKILL.)
+ */
+int
+snapshot_exit()
+{
+	int status;
+
+	if (snapwriter > 0) {
+	  kill(snapwriter, SIGKILL);
+	  while (waitpid(snapwriter, &status, 0) < 0 && errno == EINTR)
+	    ;
+	  snapwriter = 0;
+	}
+	return snapshot_write();
+}
+
+
+
+
+/* Pick the next string of a record, advancing *pp; NULL for
+   a NULL string, and  end  when the record is corrupt.  */
+static const char *snap_str __((const char **, const char *, int));
+static const char *
+snap_str(pp, end, len)
+     const char **pp, *end;
+     int len;
+{
+	const char *s = *pp;
+
+	if (len < 0)
+	  return NULL;
+	if (len >= end - s || s[len] != '\0')
+	  return end;
+	*pp = s + len + 1;
+	return s;
+}
+
+#define SNAP_STRSAVE(s) ((s) ? (char *)strsave(s) : NULL)
+
+/*
+ *  Rebuild one control file with its vertices from the record at
+ *  base+pos.  Returns 1 when it was put into the schedules, 0 when
+ *  it was skipped, and -1 when the record is corrupt.  The record
+ *  is checked all through before anything gets built.
+ */
+static int snap_loadcfp __((const char *, long, long, struct config_entry *));
+static int
+snap_loadcfp(base, pos, end, cehdr)
+     const char *base;
+     long pos, end;
+     struct config_entry *cehdr;
+{
+	struct snapcfp sc;
+	struct snapvtx sv;
+	struct ctlfile *cfp;
+	struct vertex *vp, *pvp, **pvpp;
+	const char *p, *ep, *s[SNAP_CFSTRINGS], *vs[SNAP_VXSTRINGS];
+	const char **vrecs;
+	char path[MAXPATHLEN+1];
+	int i, n, idx;
+
+	ep = base + end;
+	p  = base + pos;
+	memcpy(&sc, p, sizeof(sc));
+	p += sizeof(sc);
+
+	if (sc.nlines < 0 || sc.nvertices <= 0 ||
+	    sc.nvertices > (ep - p) / (long)sizeof(sv))
+	  return -1;
+	for (i = 0; i < SNAP_CFSTRINGS; ++i)
+	  if ((s[i] = snap_str(&p, ep, sc.slen[i])) == ep)
+	    return -1;
+	if (s[0] == NULL || s[1] == NULL)
+	  return -1;
+
+	/* Check the vertices, and note where they are */
+	vrecs = (const char **)emalloc(sizeof(char *) * sc.nvertices);
+	for (n = 0; n < sc.nvertices; ++n) {
+	  p = base + SNAP_ALIGN(p - base);
+	  if ((long)sizeof(sv) > ep - p)
+	    break;
+	  vrecs[n] = p;
+	  memcpy(&sv, p, sizeof(sv));
+	  p += sizeof(sv);
+	  if (sv.ngroup <= 0 || sv.ngroup > (ep - p) / (long)sizeof(int))
+	    break;
+	  for (i = 0; i < sv.ngroup; ++i) {
+	    memcpy(&idx, p + i * sizeof(int), sizeof(int));
+	    if (idx <= 0)	/* Offsets of the 'r' lines */
+	      break;
+	  }
+	  if (i < sv.ngroup)
+	    break;
+	  p += sizeof(int) * sv.ngroup;
+	  for (i = 0; i < SNAP_VXSTRINGS; ++i)
+	    if ((vs[i] = snap_str(&p, ep, sv.slen[i])) == ep)
+	      break;
+	  if (i < SNAP_VXSTRINGS || vs[0] == NULL || vs[1] == NULL)
+	    break;
+	}
+	if (n < sc.nvertices) {
+	  free(vrecs);
+	  return -1;
+	}
+
+	if (sp_lookup(sc.id, spt_mesh[L_CTLFILE]) != NULL) {
+	  free(vrecs);
+	  return 0; /* Already known ?! */
+	}
+
+	cfp = (struct ctlfile *)emalloc(sizeof(struct ctlfile));
+	memset((void*)cfp, 0, sizeof(struct ctlfile));
+
+	cfp->fd		   = -1;
+	cfp->id		   = sc.id;
+	cfp->mtime	   = sc.mtime;
+	cfp->mtimens	   = sc.mtimens;
+	cfp->envctime	   = sc.envctime;
+	cfp->envctimens	   = sc.envctimens;
+	cfp->uid	   = sc.uid;
+	cfp->dirind	   = sc.dirind;
+	cfp->haderror	   = sc.haderror;
+	cfp->iserrmesg	   = sc.iserrmesg;
+	cfp->format	   = sc.format;
+	cfp->msgbodyoffset = sc.msgbodyoffset;
+	cfp->msgbodysize   = sc.msgbodysize;
+	cfp->msgheadsize   = sc.msgheadsize;
+	cfp->msgfilesizekb = sc.msgfilesizekb;
+	cfp->rcpnts_total  = sc.rcpnts_total;
+	cfp->rcpnts_failed = sc.rcpnts_failed;
+	cfp->rcpnts_work   = sc.rcpnts_work;
+	cfp->nlines	   = sc.nlines;
+	cfp->mid	   = SNAP_STRSAVE(s[0]);
+	cfp->logident	   = SNAP_STRSAVE(s[1]);
+	cfp->erroraddr	   = SNAP_STRSAVE(s[2]);
+	cfp->envid	   = SNAP_STRSAVE(s[3]);
+	cfp->dsnretmode	   = SNAP_STRSAVE(s[4]);
+	cfp->vfpfn	   = SNAP_STRSAVE(s[5]);
+	cfp->spoolid	   = SNAP_STRSAVE(s[6]);
+	cfp->snapstate	   = CFP_SNAP_UNVERIFIED;
+
+	++global_wrkcnt;
+	++MIBMtaEntry->sc.StoredMessagesSc;
+
+	pvp  = NULL;
+	pvpp = &cfp->head;
+	for (n = 0; n < sc.nvertices; ++n) {
+	  p = vrecs[n];
+	  memcpy(&sv, p, sizeof(sv));
+	  p += sizeof(sv);
+
+	  vp = vtx_alloc(sv.ngroup);
+	  memcpy(vp->index, p, sizeof(int) * sv.ngroup);
+	  p += sizeof(int) * sv.ngroup;
+	  for (i = 0; i < SNAP_VXSTRINGS; ++i)
+	    vs[i] = snap_str(&p, ep, sv.slen[i]);
+
+	  MIBMtaEntry->sc.StoredVerticesSc   += 1;
+	  MIBMtaEntry->sc.StoredRecipientsSc += sv.ngroup;
+
+	  vp->cfp	      = cfp;
+	  vp->prev[L_CTLFILE] = pvp;
+	  vp->ngroup	      = sv.ngroup;
+	  vp->wakeup	      = sv.wakeup;
+	  vp->headeroffset    = sv.headeroffset;
+	  vp->drptoffset      = sv.drptoffset;
+	  vp->notaryflg	      = sv.notaryflg;
+	  vp->attempts	      = sv.attempts;
+	  vp->retryindex      = sv.retryindex;
+	  vp->nextdlyrprttime = sv.nextdlyrprttime;
+	  vp->message	      = str_intern(vs[2]);
+	  vp->notary	      = SNAP_STRSAVE(vs[3]);
+	  *pvpp = vp;
+	  pvpp  = &vp->next[L_CTLFILE];
+	  pvp   = vp;
+	  link_in(L_HOST,    vp, vs[1]);
+	  link_in(L_CHANNEL, vp, vs[0]);
+	}
+
+	sp_install(cfp->id, (void *)cfp, 0, spt_mesh[L_CTLFILE]);
+
+	sprintf(path, "%s%s", cfpdirname(cfp->dirind), cfp->mid);
+	for (n = 0, vp = cfp->head; vp != NULL; vp = vp->next[L_CTLFILE], ++n) {
+	  /* Put into the schedules; the report time is restored over
+	     the one that vtxdo() sets. */
+	  vtxdo(vp, cehdr, path);
+	  memcpy(&sv, vrecs[n], sizeof(sv));
+	  if (sv.nextrprttime)
+	    vp->nextrprttime = sv.nextrprttime;
+	}
+	free(vrecs);
+
+	return 1;
+}
+
+/*
+ *  Load the snapshot into the schedules, return the number of
+ *  messages restored, or -1 when there was nothing usable.
+ *  The file is removed, so that a crash before the next write
+ *  does not bring back an outdated one.
+ */
+int
+snapshot_load(cehdr)
+     struct config_entry *cehdr;
+{
+	struct snaphdr hdr;
+	struct stat stbuf;
+	char *base;
+	long pos, len, count, i;
+	int fd, rc, restored = 0, bad = 0;
+
+	fd = open(SNAPFILE, O_RDONLY, 0);
+	if (fd < 0)
+	  return -1;
+	if (fstat(fd, &stbuf) < 0 || stbuf.st_size < sizeof(hdr)) {
+	  close(fd);
+	  unlink(SNAPFILE);
+	  return -1;
+	}
+	len = stbuf.st_size;
+#ifdef HAVE_MMAP
+	base = (char *)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == (char *)MAP_FAILED) {
+	  close(fd);
+	  return -1;
+	}
+#else
+	base = emalloc(len);
+	if (read(fd, base, len) != len) {
+	  free(base);
+	  close(fd);
+	  return -1;
+	}
+#endif
+	close(fd);
+	unlink(SNAPFILE);
+
+	memcpy(&hdr, base, sizeof(hdr));
+	if (memcmp(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != SNAP_VERSION || hdr.endian != SNAP_ENDIAN ||
+	    hdr.sizes != SNAP_SIZES || hdr.length != len) {
+	  sfprintf(sfstderr, "%s: state snapshot rejected: bad header\n",
+		   progname);
+	  restored = -1;
+	  goto done;
+	}
+
+	count = hdr.count;
+	snapids = (u_long *)emalloc(sizeof(u_long) * (count + 1));
+	snapidcnt = snapidpos = 0;
+
+	pos = sizeof(hdr);
+	for (i = 0; i < count; ++i) {
+	  struct snapcfp sc;
+	  if (pos + (long)sizeof(sc) > len) {
+	    ++bad;
+	    break;
+	  }
+	  memcpy(&sc, base + pos, sizeof(sc));
+	  if (sc.reclen < (long)sizeof(sc) || sc.reclen > len - pos ||
+	      (sc.reclen & 7) != 0) {
+	    ++bad;
+	    break;
+	  }
+	  rc = snap_loadcfp(base, pos, pos + sc.reclen, cehdr);
+	  if (rc > 0) {
+	    snapids[snapidcnt++] = sc.id;
+	    ++restored;
+	  } else if (rc < 0)
+	    ++bad;
+	  pos += sc.reclen;
+	}
+	if (bad)
+	  sfprintf(sfstderr, "%s: state snapshot had %d bad records\n",
+		   progname, bad);
+	snapstalesum = 0;
+
+ done:
+#ifdef HAVE_MMAP
+	munmap(base, len);
+#else
+	free(base);
+#endif
+	return restored;
+}
+
+
+static void snap_stale __((struct ctlfile *));
+static void
+snap_stale(cfp)
+     struct ctlfile *cfp;
+{
+	cfp->snapstate = CFP_SNAP_STALE;
+	if (stalecnt >= stalespace) {
+	  stalespace = stalespace ? stalespace * 2 : 64;
+	  staleids = (u_long *)erealloc(staleids, sizeof(u_long) * stalespace);
+	}
+	staleids[stalecnt++] = cfp->id;
+	++snapstalesum;
+}
+
+/*
+ *  Check a message restored from the snapshot against the files.
+ *  Returns 0 when it can be acted on, and -1 when it is stale,
+ *  in which case  snapshot_reconcile()  will take it away.
+ */
+int
+snapshot_verify(cfp)
+     struct ctlfile *cfp;
+{
+	char path[MAXPATHLEN+1];
+	struct stat stbuf;
+	struct vertex *vp;
+	char tag[2];
+	long mtimens;
+	int fd, i, ok = 0;
+
+	if (cfp->snapstate == CFP_SNAP_NONE)
+	  return 0;
+	if (cfp->snapstate == CFP_SNAP_STALE)
+	  return -1;
+
+	sprintf(path, "../%s/%s%s", QUEUEDIR, cfpdirname(cfp->dirind), cfp->mid);
+	if (lstat(path, &stbuf) == 0 && stbuf.st_mtime == cfp->mtime) {
+#ifdef HAVE_STRUCT_STAT_ST_ATIM_TV_NSEC
+	  mtimens = stbuf.st_mtim.tv_nsec;
+#else
+#ifdef HAVE_STRUCT_STAT_ST_ATIM___TV_NSEC
+	  mtimens = stbuf.st_mtim.__tv_nsec;
+#else
+#ifdef HAVE_STRUCT_STAT_ST_ATIMENSEC
+	  mtimens = stbuf.st_mtimensec;
+#else
+	  mtimens = 0;
+#endif
+#endif
+#endif
+	  if (mtimens == cfp->mtimens) {
+	    sprintf(path, "%s%s", cfpdirname(cfp->dirind), cfp->mid);
+	    fd = open(path, O_RDONLY, 0);
+	    if (fd >= 0) {
+	      /* Every recipient of ours must still be there, and
+		 be neither done, nor locked by somebody. */
+	      ok = 1;
+	      for (vp = cfp->head; ok && vp != NULL; vp = vp->next[L_CTLFILE])
+		for (i = 0; ok && i < vp->ngroup; ++i)
+		  if (lseek(fd, (off_t)vp->index[i], SEEK_SET) < 0 ||
+		      read(fd, tag, 2) != 2 ||
+		      tag[0] != _CF_RECIPIENT || tag[1] != _CFTAG_NORMAL)
+		    ok = 0;
+	      close(fd);
+	    }
+	  }
+	}
+
+	if (!ok) {
+	  snap_stale(cfp);
+	  return -1;
+	}
+	cfp->snapstate = CFP_SNAP_NONE;
+	return 0;
+}
+
+/*
+ *  Called from the main loop: take away the stale messages, putting
+ *  them into the directory queue, and verify the rest of those that
+ *  were restored, for at most about a second at the time.
+ */
+void
+snapshot_reconcile()
+{
+	struct spblk *spl;
+	struct ctlfile *cfp;
+	char path[MAXPATHLEN+1];
+	u_long id;
+	time_t then;
+
+	if (stalecnt == 0 && snapids == NULL)
+	  return;
+
+	mytime(&then);
+
+	for (;;) {
+	  while (stalecnt > 0) {
+	    id  = staleids[--stalecnt];
+	    spl = sp_lookup(id, spt_mesh[L_CTLFILE]);
+	    if (spl == NULL || spl->data == NULL)
+	      continue;
+	    cfp = (struct ctlfile *)spl->data;
+	    if (cfp->snapstate != CFP_SNAP_STALE)
+	      continue;
+	    sprintf(path, "%s%s", cfpdirname(cfp->dirind), cfp->mid);
+	    cfp_free(cfp, spl);
+	    dq_insert(NULL, id, path, 0);
+	  }
+
+	  if (snapids == NULL || snapidpos >= snapidcnt)
+	    break;
+
+	  spl = sp_lookup(snapids[snapidpos++], spt_mesh[L_CTLFILE]);
+	  if (spl != NULL && spl->data != NULL) {
+	    cfp = (struct ctlfile *)spl->data;
+	    if (cfp->snapstate == CFP_SNAP_UNVERIFIED)
+	      snapshot_verify(cfp);
+	  }
+
+	  if ((snapidpos & 63) == 0 && mytime(&now) > then)
+	    return;
+	}
+
+	if (snapids != NULL) {
+	  sfprintf(sfstdout, "%s: state snapshot reconciled, %d messages, %d stale\n",
+		   timestring(), snapidcnt, snapstalesum);
+	  free(snapids);
+	  snapids = NULL;
+	  snapidcnt = snapidpos = 0;
+	}
+}
@@ -0,0 +1,133 @@
+/*
+ *	ZMailer Scheduler shared strings
+ *
+ *	The diagnostic texts of the vertices are mostly the same ones
+ *	over and over ("deferred; connection refused" for every message
+ *	to some dead host), thus they are kept once in a hashed table,
+ *	with a reference count, instead of a copy at every vertex.
+ *
+ *	str_intern()  gives a shared copy of the string, and
+ *	str_release() drops the reference to it.  The copies must
+ *	not be modified, nor free()d by their users.
+ */
+
+#include "hostenv.h"
+#include <sfio.h>
+#include "scheduler.h"
+#include "prototypes.h"
+#include "libz.h"
+
+struct strent {
+	struct strent	*next;		/* Hash chain			*/
+	u_int		hash;
+	int		refcnt;
+	char		str[1];		/* The string follows		*/
+};
+
+#define STRENT(s) ((struct strent *)((s) - (long)&((struct strent *)0)->str[0]))
+
+static struct strent **strtab = NULL;
+static u_int strtabsize  = 0;		/* A power of two, or 0 */
+
+long strtab_count = 0;		/* Strings in the table		*/
+long strtab_bytes = 0;		/* .. their memory		*/
+long strtab_refs  = 0;		/* .. references to them	*/
+
+static u_int str_hash __((const char *));
+static u_int
+str_hash(s)
+	const char *s;
+{
+	register u_int h = 5381;
+
+	while (*s)
+	  h = (h * 33) ^ (u_char)*s++;
+	return h;
+}
+
+static void strtab_grow __((void));
+static void
+strtab_grow()
+{
+	struct strent **ntab, *se, *next;
+	u_int nsize = strtabsize ? strtabsize * 2 : 256;
+	u_int i;
+
+	ntab = (struct strent **)emalloc(nsize * sizeof(*ntab));
+	memset((void*)ntab, 0, nsize * sizeof(*ntab));
+
+	for (i = 0; i < strtabsize; ++i)
+	  for (se = strtab[i]; se != NULL; se = next) {
+	    next = se->next;
+	    se->next = ntab[se->hash & (nsize-1)];
+	    ntab[se->hash & (nsize-1)] = se;
+	  }
+
+	if (strtab) free(strtab);
+	strtab     = ntab;
+	strtabsize = nsize;
+}
+
+char *
+str_intern(s)
+	const char *s;
+{
+	struct strent *se;
+	u_int h;
+	int len;
+
+	if (s == NULL)
+	  return NULL;
+
+	h = str_hash(s);
+	if (strtabsize)
+	  for (se = strtab[h & (strtabsize-1)]; se != NULL; se = se->next)
+	    if (se->hash == h && strcmp(se->str, s) == 0) {
+	      se->refcnt += 1;
+	      ++strtab_refs;
+	      return se->str;
+	    }
+
+	if (strtab_count >= strtabsize)
+	  strtab_grow();
+
+	len = strlen(s);
+	se = (struct strent *)emalloc(sizeof(*se) + len);
+	se->hash   = h;
+	se->refcnt = 1;
+	memcpy(se->str, s, len+1);
+	se->next   = strtab[h & (strtabsize-1)];
+	strtab[h & (strtabsize-1)] = se;
+
+	++strtab_count;
+	++strtab_refs;
+	strtab_bytes += sizeof(*se) + len;
+
+	return se->str;
+}
+
+void
+str_release(s)
+	char *s;
+{
+	struct strent *se, **sep;
+
+	if (s == NULL)
+	  return;
+
+	se = STRENT(s);
+	--strtab_refs;
+	if (--se->refcnt > 0)
+	  return;
+
+	for (sep = &strtab[se->hash & (strtabsize-1)];
+	     *sep != NULL; sep = &(*sep)->next)
+	  if (*sep == se) {
+	    *sep = se->next;
+	    break;
+	  }
+
+	--strtab_count;
+	strtab_bytes -= sizeof(*se) + strlen(se->str);
+	free(se);
+}
@@ -30,9 +30,6 @@
 
 extern char *proc_state_names[];
 
-struct thread      *thread_head = NULL;
-struct thread      *thread_tail = NULL;
-
 static struct threadgroup *thrg_root   = NULL;
 int idleprocs = 0;
 extern int global_wrkcnt;
@@ -63,9 +60,8 @@ void (*ce_fillin) __((struct threadgroup*, struct config_entry *));
 
 	/* Create a thread-group and link it into group-ring */
 
-	thgp = (struct threadgroup*)malloc(sizeof(*thgp));
+	thgp = thg_alloc();
 	if (!thgp) return NULL;
-	memset(thgp,0,sizeof(*thgp));
 
 	++groupid;
 	thgp->groupid  = groupid;
@@ -138,9 +134,7 @@ if (verbose) sfprintf(sfstderr,"delete_threadgroup(%s/%d/%s)\n",
 	  thrg_root = NULL;
 	}
 
-memset(thgp, 0x55, sizeof(*thgp));
-
-	free(thgp);
+	thg_free(thgp);
 }
 
 static void _thread_timechain_unlink __((struct thread *));
@@ -149,20 +143,9 @@ struct thread *thr;
 {
 	struct threadgroup *thg = thr->thgrp;
 
-	/* Doubly linked linear list */
-
-	if (thr->prevtr != NULL)
-	  thr->prevtr->nexttr = thr->nexttr;
-	if (thr->nexttr != NULL)
-	  thr->nexttr->prevtr = thr->prevtr;
-
-	if (thread_head == thr)
-	  thread_head = thr->nexttr;
-	if (thread_tail == thr)
-	  thread_tail = thr->prevtr;
+	/* The wakeup heap */
 
-	thr->nexttr = NULL;
-	thr->prevtr = NULL;
+	thrheap_delete(thr);
 
 	/* Doubly linked circullar list */
 
@@ -192,23 +175,9 @@ struct thread *thr;
 {
 	struct threadgroup *thg = thr->thgrp;
 
-	/* Doubly linked linear list */
+	/* The wakeup heap, ordered by  thr->wakeup  */
 
-	if (thread_head == NULL) {
-
-	  thread_head = thr;
-	  thread_tail = thr;
-	  thr->nexttr = NULL;
-	  thr->prevtr = NULL;
-
-	} else {
-
-	  thread_tail->nexttr = thr;
-	  thr->nexttr = NULL;
-	  thr->prevtr = thread_tail;
-	  thread_tail = thr;
-
-	}
+	thrheap_insert(thr);
 
 	/* Doubly linked circullar list */
 
@@ -250,17 +219,16 @@ struct config_entry *cep;
 	   to the thread time-chain				*/
 
 	struct thread *thr;
-	thr = (struct thread *)emalloc(sizeof(*thr));
+	thr = thr_alloc();
 	if (!thr) return NULL;
 
-	memset(thr,0,sizeof(*thr));
-
 	++threadid;
 	thr->threadid = threadid;
 
 	/* thr->attempts = 0;
 	   thr->nextthg = NULL;
 	   thr->prevthg = NULL; */
+	thr->heapidx = -1;
 
 	thr->thgrp   = thgrp;
 	thr->wchan   = vtx->orig[L_CHANNEL];
@@ -414,9 +382,11 @@ delete_thread(thr)
 	/* ... and thread-group-ring */
 	_thread_timechain_unlink(thr);
 
-memset(thr, 0x55, sizeof(*thr));
+	/* Somebody is walking a list of threads, free() it later */
+	if (thrheap_zombie(thr))
+	  return 1;
 
-	free(thr);
+	thr_free(thr);
 	return 1;
 }
 
@@ -593,8 +563,7 @@ const char *s;
 	spl = sp_lookup(spk, spt_mesh[flag]);
 	if (spl == NULL || (wp = (struct web *)spl->data) == NULL) {
 	  /* Not found, create it */
-	  wp = (struct web *)emalloc(sizeof (struct web));
-	  memset((void*)wp, 0, sizeof (struct web));
+	  wp = web_alloc();
 	  sp_install(spk, (void *)wp, 0, spt_mesh[flag]);
 	  wp->name     = strsave(s);
 	  wp->kids     = 0;
@@ -638,9 +607,7 @@ if (verbose)
 	symbol_free_db((u_char *)wp->name, spt_mesh[flag]->symbols);
 	free(wp->name);
 
-memset(wp, 0x55, sizeof(*wp));
-
-	free((char *)wp);
+	web_free(wp);
 }
 
 
@@ -1120,6 +1087,9 @@ thread_expire2(thr, timelimit, killall, msgstr)
 	  if (vtx->ce_expiry2 > 0 && vtx->ce_expiry2 <= now) {
 	    expire_this = 1;
 	  }
+	  /* Not on the word of an unverified state snapshot */
+	  if (expire_this && snapshot_verify(vtx->cfp) < 0)
+	    expire_this = 0;
 	  if (expire_this) {
 	    /* ... and now expire it! */
 	    /* this MAY invalidate also the THREAD object! */
@@ -1244,6 +1214,9 @@ thread_reschedule(thr, retrytime, index)
 	  if (vtx->ce_expiry2 > 0 && vtx->ce_expiry2 <= now) {
 	    expire_this = 1;
 	  }
+	  /* Not on the word of an unverified state snapshot */
+	  if (expire_this && snapshot_verify(vtx->cfp) < 0)
+	    expire_this = 0;
 	  if (expire_this) {
 	    /* ... and now expire it! */
 	    /* this MAY invalidate also the THREAD object! */
@@ -1270,7 +1243,8 @@ thread_reschedule(thr, retrytime, index)
 
  timechain_handling:
 	/* In every case the rescheduling means we move this thread
-	   to the end of the thread_head chain.. */
+	   to its new place in the wakeup heap, and to the end of
+	   its thread-group ring.. */
 
 	if (thr != NULL) {
 	  _thread_timechain_unlink(thr);
@@ -1366,7 +1340,8 @@ reschedule(vp, factor, index)
 
 	if (vp->ce_expiry > 0
 	    && vp->ce_expiry <= vp->wakeup
-	    && vp->attempts > 0) {
+	    && vp->attempts > 0
+	    && snapshot_verify(vp->cfp) == 0) {
 	  if (verbose)
 	    sfprintf(sfstderr,"ce_expiry = %d, %d attempts\n",
 		     (int)(vp->ce_expiry), vp->attempts);
@@ -1434,11 +1409,11 @@ idle_cleanup()
 			 p->tofd, (int)p->pid);
 
 		thr->wakeup = now-1; /* reschedule immediately! */
+		thrheap_update(thr);
 
 		write(p->tofd,"\n",1); /* XXXX: should this be removed ?? */
 
-		pipes_shutdown_child(p->tofd);
-		p->tofd = -1;
+		mux_shutdown_child(p);
 
 		++freecount;
 
@@ -1468,8 +1443,7 @@ idle_cleanup()
 		  sfprintf(sfstderr,"idle_cleanup() killing TA on tofd=%d pid=%d\n",
 			   p->tofd, (int)p->pid);
 		write(p->tofd,"\n",1);
-		pipes_shutdown_child(p->tofd);
-		p->tofd       = -1;
+		mux_shutdown_child(p);
 		++freecount;
 	      }
 
@@ -1553,12 +1527,11 @@ void thread_report(fp,mqmode)
 	       thr && (thr_once || (thr != thg->thread));
 	       thr = thr->nextthg, thr_once = 0)
 #else
-	  /* We scan there in start order from the  thread_head
-	     chain! */
+	  /* We scan there in the wakeup heap order! */
 
-	  for (thr = thread_head;
-	       thr != NULL;
-	       thr = thr->nexttr)
+	  for (i = 0;
+	       (thr = thrheap_at(i)) != NULL;
+	       ++i)
 #endif
 	  {
 	    if (thr->thgrp != thg) /* Not of this group ? */
@@ -1734,6 +1707,7 @@ void thread_report(fp,mqmode)
 
 	if (mqmode & (MQ2MODE_FULL | MQ2MODE_QQ | MQ2MODE_SNMP)) {
 	  long files;
+	  struct MIB_MtaEntry *MIBsum;
 	  *timebuf = 0;
 	  saytime((long)(now - sched_starttime), timebuf, 1);
 	  sfprintf(fp,"Kids: %d  Idle: %2d  Msgs: %3d  Thrds: %3d  Rcpnts: %4d  Uptime: ",
@@ -1743,9 +1717,10 @@ void thread_report(fp,mqmode)
 	  else
 	    sfprintf(fp, "%s\n",timebuf);
 
+	  MIBsum = Z_SHM_MIB_Sum();
 	  sfprintf(fp, "Msgs in %lu out %lu stored %ld ",
-		   (u_long)MIBMtaEntry->sc.ReceivedMessagesSc,
-		   (u_long)MIBMtaEntry->sc.TransmittedMessagesSc,
+		   (u_long)MIBsum->sc.ReceivedMessagesSc,
+		   (u_long)MIBsum->sc.TransmittedMessagesSc,
 		   (long)MIBMtaEntry->sc.StoredMessagesSc);
 
 	  files = thread_count_files();
@@ -1753,8 +1728,8 @@ void thread_report(fp,mqmode)
 	    sfprintf(fp, "(%ld) ", files);
 
 	  sfprintf(fp, "Rcpnts in %lu out %lu stored %ld",
-		   (u_long)MIBMtaEntry->sc.ReceivedRecipientsSc,
-		   (u_long)MIBMtaEntry->sc.TransmittedRecipientsSc,
+		   (u_long)MIBsum->sc.ReceivedRecipientsSc,
+		   (u_long)MIBsum->sc.TransmittedRecipientsSc,
 		   (long)MIBMtaEntry->sc.StoredRecipientsSc);
 
 	  if (rcptsum != MIBMtaEntry->sc.StoredRecipientsSc)
@@ -1797,7 +1772,7 @@ void thread_detail_report(fp,mqmode,channel,host)
 	}
 	wh = (struct web *)spl->data;
 
-	for (th = thread_head; th; th = th->nexttr) {
+	for (i = 0; (th = thrheap_at(i)) != NULL; ++i) {
 	  if (wh == th->whost && wc == th->wchan) {
 	    break;
 	  }
@@ -1815,7 +1790,7 @@ void thread_detail_report(fp,mqmode,channel,host)
 	      /* Sender index -- or sender address */
 	      sfprintf(fp, "\t%s", cfp->erroraddr);
 	      /* Recipient offset */
-	      sfprintf(fp,"\t%d", cfp->offset[vp->index[i]]);
+	      sfprintf(fp,"\t%d", vp->index[i]);
 	      /* Expiry stamp */
 	      sfprintf(fp,"\t%ld", (long)vp->ce_expiry);
 	      /* next wakeup */
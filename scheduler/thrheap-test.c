@@ -0,0 +1,128 @@
+/*
+ *  thrheap-test -- micro-benchmark of the scheduler thread wakeup heap
+ *
+ *  Loads a number of synthetic threads with random wakeup times,
+ *  and then:
+ *    - reschedules random threads to random new times
+ *    - simulates mass deferrals: collects all due threads, and
+ *      moves each of them into the future
+ *  and reports the rates, and verifies the heap order at the end.
+ *
+ *  Usage:  thrheap-test [threads [reschedules]]
+ */
+
+#include "hostenv.h"
+#include <sfio.h>
+#include "scheduler.h"
+#include "prototypes.h"
+#include <sys/time.h>
+
+const char *progname = "thrheap-test";
+int embytes, emcalls;
+int D_alloc = 0;	/* For tmalloc() from libz.a ... */
+
+static double
+tvsecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+heapcheck()
+{
+	int i, n = thrheap_count();
+	struct thread *thr, *parent;
+
+	for (i = 1; i < n; ++i) {
+	  thr    = thrheap_at(i);
+	  parent = thrheap_at((i - 1) / 4);
+	  if (parent->wakeup > thr->wakeup || thr->heapidx != i)
+	    return i;
+	}
+	return 0;
+}
+
+int
+main(argc, argv)
+     int argc;
+     char *argv[];
+{
+	int nthreads = 100000, nresched = 1000000;
+	int i, n, rounds;
+	long moved;
+	struct thread *thrs, *thr;
+	struct thrlist due;
+	time_t t0 = 1000000000;
+	double t1, t2;
+
+	if (argc > 1) nthreads = atoi(argv[1]);
+	if (argc > 2) nresched = atoi(argv[2]);
+	if (nthreads < 1 || nresched < 0) {
+	  fprintf(stderr, "Usage: %s [threads [reschedules]]\n", progname);
+	  exit(64);
+	}
+
+	thrs = (struct thread *) calloc(nthreads, sizeof(*thrs));
+	if (!thrs) {
+	  perror("calloc");
+	  exit(1);
+	}
+	srandom(4711);
+
+	t1 = tvsecs();
+	for (i = 0; i < nthreads; ++i) {
+	  thrs[i].threadid = i + 1;
+	  thrs[i].heapidx  = -1;
+	  thrs[i].wakeup   = t0 + (random() % 86400);
+	  thrheap_insert(&thrs[i]);
+	}
+	t2 = tvsecs();
+	printf("insert:     %9d threads   %10.0f /sec\n",
+	       nthreads, nthreads / (t2 - t1 + 1e-9));
+
+	t1 = tvsecs();
+	for (i = 0; i < nresched; ++i) {
+	  thr = &thrs[random() % nthreads];
+	  thr->wakeup = t0 + (random() % 86400);
+	  thrheap_update(thr);
+	}
+	t2 = tvsecs();
+	printf("reschedule: %9d times     %10.0f /sec\n",
+	       nresched, nresched / (t2 - t1 + 1e-9));
+
+	/* Mass deferral: every 10 minutes everything due gets
+	   pushed 1-4 hours ahead, like after a destination outage. */
+	moved = 0;
+	rounds = 0;
+	t1 = tvsecs();
+	for (; rounds < 144; ++rounds) {
+	  n = thrheap_collect(&due, t0 + rounds * 600);
+	  for (i = 0; i < n; ++i) {
+	    thr = due.thrs[i];
+	    thr->wakeup += 3600 + (random() % 10800);
+	    thrheap_update(thr);
+	  }
+	  moved += n;
+	  thrlist_release(&due);
+	}
+	t2 = tvsecs();
+	printf("deferral:   %9ld moves     %10.0f /sec  (%d rounds)\n",
+	       moved, moved / (t2 - t1 + 1e-9), rounds);
+
+	t1 = tvsecs();
+	for (i = 0; i < nthreads; i += 2)
+	  thrheap_delete(&thrs[i]);
+	t2 = tvsecs();
+	printf("delete:     %9d threads   %10.0f /sec\n",
+	       (nthreads+1)/2, ((nthreads+1)/2) / (t2 - t1 + 1e-9));
+
+	i = heapcheck();
+	if (i) {
+	  printf("HEAP ORDER BROKEN at index %d!\n", i);
+	  return 1;
+	}
+	printf("heap order ok, %d threads left\n", thrheap_count());
+	return 0;
+}
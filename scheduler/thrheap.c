@@ -0,0 +1,277 @@
+/*
+ *	ZMailer Scheduler thread wakeup queue
+ *
+ *	All threads are kept in a 4-ary min-heap keyed on their
+ *	wakeup time, each thread knowing its own position in it.
+ *	Insert, delete and rescheduling are thus O(log n), and
+ *	finding the threads that are due costs only as much as
+ *	there are due threads.
+ *
+ *	Those who walk a collected list of threads (doagenda() et.al.)
+ *	call thread_start() and friends, which may delete threads.
+ *	While such a list is held, delete_thread() hands the dead
+ *	thread to  thrheap_zombie()  instead of freeing it.
+ */
+
+#include "hostenv.h"
+#include <sfio.h>
+#include "scheduler.h"
+#include "prototypes.h"
+#include "libz.h"
+
+#define THRHEAP_D 4		/* Children per node */
+
+static struct thread **thrheap = NULL;
+static int thrheapcnt   = 0;
+static int thrheapspace = 0;
+
+static int thrheap_pins = 0;	/* Number of thrlists being held */
+static struct thread *thrzombies = NULL;
+
+
+static void thrheap_set __((int, struct thread *));
+static void
+thrheap_set(i, thr)
+     int i;
+     struct thread *thr;
+{
+	thrheap[i]   = thr;
+	thr->heapidx = i;
+}
+
+static void thrheap_up __((int));
+static void
+thrheap_up(i)
+     int i;
+{
+	struct thread *thr = thrheap[i];
+	int parent;
+
+	while (i > 0) {
+	  parent = (i - 1) / THRHEAP_D;
+	  if (thrheap[parent]->wakeup <= thr->wakeup)
+	    break;
+	  thrheap_set(i, thrheap[parent]);
+	  i = parent;
+	}
+	thrheap_set(i, thr);
+}
+
+static void thrheap_down __((int));
+static void
+thrheap_down(i)
+     int i;
+{
+	struct thread *thr = thrheap[i];
+	int child, best, last;
+
+	for (;;) {
+	  child = i * THRHEAP_D + 1;
+	  if (child >= thrheapcnt)
+	    break;
+	  last = child + THRHEAP_D;
+	  if (last > thrheapcnt)
+	    last = thrheapcnt;
+	  for (best = child++; child < last; ++child)
+	    if (thrheap[child]->wakeup < thrheap[best]->wakeup)
+	      best = child;
+	  if (thr->wakeup <= thrheap[best]->wakeup)
+	    break;
+	  thrheap_set(i, thrheap[best]);
+	  i = best;
+	}
+	thrheap_set(i, thr);
+}
+
+
+void
+thrheap_insert(thr)
+     struct thread *thr;
+{
+	if (thrheapcnt >= thrheapspace) {
+	  thrheapspace = thrheapspace ? thrheapspace * 2 : 1024;
+	  thrheap = (struct thread **)
+	    erealloc(thrheap, thrheapspace * sizeof(struct thread *));
+	}
+	thrheap_set(thrheapcnt, thr);
+	++thrheapcnt;
+	thrheap_up(thrheapcnt-1);
+}
+
+void
+thrheap_delete(thr)
+     struct thread *thr;
+{
+	int i = thr->heapidx;
+
+	if (i < 0 || i >= thrheapcnt || thrheap[i] != thr)
+	  return; /* Not in the heap */
+
+	thr->heapidx = -1;
+	--thrheapcnt;
+	if (i == thrheapcnt)
+	  return; /* Was the last one */
+
+	thrheap_set(i, thrheap[thrheapcnt]);
+	thrheap_up(i);
+	thrheap_down(thrheap[i]->heapidx);
+}
+
+/* The  thr->wakeup  has changed, move the thread accordingly. */
+void
+thrheap_update(thr)
+     struct thread *thr;
+{
+	int i = thr->heapidx;
+
+	if (i < 0 || i >= thrheapcnt || thrheap[i] != thr) {
+	  thrheap_insert(thr);
+	  return;
+	}
+	thrheap_up(i);
+	thrheap_down(thr->heapidx);
+}
+
+struct thread *
+thrheap_top()
+{
+	return thrheapcnt > 0 ? thrheap[0] : NULL;
+}
+
+int
+thrheap_count()
+{
+	return thrheapcnt;
+}
+
+/* Heap order, not time order! */
+struct thread *
+thrheap_at(i)
+     int i;
+{
+	if (i < 0 || i >= thrheapcnt) return NULL;
+	return thrheap[i];
+}
+
+
+static void thrlist_add __((struct thrlist *, struct thread *));
+static void
+thrlist_add(list, thr)
+     struct thrlist *list;
+     struct thread *thr;
+{
+	if (list->count >= list->space) {
+	  list->space = list->space ? list->space * 2 : 64;
+	  list->thrs  = (struct thread **)
+	    erealloc(list->thrs, list->space * sizeof(struct thread *));
+	}
+	list->thrs[list->count++] = thr;
+}
+
+static int thrlist_cmp __((const void *, const void *));
+static int
+thrlist_cmp(a, b)
+     const void *a, *b;
+{
+	const struct thread *ta = *(const struct thread **)a;
+	const struct thread *tb = *(const struct thread **)b;
+
+	if (ta->wakeup != tb->wakeup)
+	  return (ta->wakeup < tb->wakeup) ? -1 : 1;
+	/* Older threads first */
+	return (ta->threadid < tb->threadid) ? -1 : (ta->threadid > tb->threadid);
+}
+
+/*
+ *  Collect all threads with  wakeup <= when  in time order.
+ *  Only the due part of the heap is visited: a node that is not
+ *  due has no due descendants.  The list must be given back with
+ *  thrlist_release(), entries with  thr->zombie  set are dead.
+ */
+int
+thrheap_collect(list, when)
+     struct thrlist *list;
+     time_t when;
+{
+	int i, child, top;
+	int *stack;
+
+	memset(list, 0, sizeof(*list));
+	++thrheap_pins;
+
+	if (thrheapcnt == 0 || thrheap[0]->wakeup > when)
+	  return 0;
+
+	/* Depth-first; at most (D-1) pending siblings per level */
+	stack = (int *) emalloc(sizeof(int) * (THRHEAP_D * 32 + 1));
+	top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+	  i = stack[--top];
+	  thrlist_add(list, thrheap[i]);
+	  for (child = i * THRHEAP_D + 1;
+	       child <= i * THRHEAP_D + THRHEAP_D && child < thrheapcnt;
+	       ++child)
+	    if (thrheap[child]->wakeup <= when)
+	      stack[top++] = child;
+	}
+	free(stack);
+
+	if (list->count > 1)
+	  qsort(list->thrs, list->count, sizeof(struct thread *), thrlist_cmp);
+
+	return list->count;
+}
+
+/* Like above, but all threads, in no particular order */
+int
+thrheap_collect_all(list)
+     struct thrlist *list;
+{
+	int i;
+
+	memset(list, 0, sizeof(*list));
+	++thrheap_pins;
+
+	for (i = 0; i < thrheapcnt; ++i)
+	  thrlist_add(list, thrheap[i]);
+
+	return list->count;
+}
+
+void
+thrlist_release(list)
+     struct thrlist *list;
+{
+	struct thread *thr;
+
+	if (list->thrs)
+	  free(list->thrs);
+	memset(list, 0, sizeof(*list));
+
+	if (--thrheap_pins > 0)
+	  return;
+	thrheap_pins = 0;
+
+	while ((thr = thrzombies) != NULL) {
+	  thrzombies = thr->nextthg;
+	  thr_free(thr);
+	}
+}
+
+/*
+ *  Called by  delete_thread()  after it has unlinked the thread.
+ *  Returns 1 when the thread was taken for a deferred free().
+ */
+int
+thrheap_zombie(thr)
+     struct thread *thr;
+{
+	if (thrheap_pins <= 0)
+	  return 0;
+
+	thr->zombie  = 1;
+	thr->nextthg = thrzombies;
+	thrzombies   = thr;
+	return 1;
+}
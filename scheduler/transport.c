@@ -40,6 +40,7 @@
 
 #include "libc.h"
 #include "zmpoll.h"
+#include "taring.h"
 
 extern int forkrate_limit;
 extern int freeze;
@@ -47,10 +48,11 @@ extern int mailqmode;
 
 static int  scheduler_nofiles = -1; /* Will be filled below */
 static int  runcommand   __((char * const argv[], char * const env[], struct vertex *, struct web *, struct web*));
-static void stashprocess __((int, int, int, struct web*, struct web*, struct vertex *, char * const argv[]));
+static void stashprocess __((int, int, int, struct taring *, struct web*, struct web*, struct vertex *, char * const argv[]));
 static void reclaim      __((int, int));
 static void waitandclose __((int));
 static void readfrom     __((int));
+static void ringfrom     __((struct procinfo *));
 
 /* These two are *not* exactly proper ones, but at least at most
    systems it links properly without wider exportation of related
@@ -85,6 +87,10 @@ int	readsockcnt;		/* Count how many childs to read there are;
 
 int	notifysocket = -1;	/* fd of UDP/AF_UNIX socket to listen for notifies */
 
+static struct zmpollset *muxset = NULL; /* Transporter fds, registered
+					   at stashprocess(), removed at
+					   reclaim()			*/
+
 
 static void cmdbufalloc __((int, char **, int *));
 
@@ -108,6 +114,151 @@ extern int errno;
 extern int slow_shutdown;
 
 
+/*
+ *  mux() services only the transporters that had events, and those
+ *  that the SIGCHLD handler has flagged as reaped.  The reaped ones
+ *  are looked for in  cpids[0..mux_topfd-1]  only.
+ */
+static struct procinfo **muxready = NULL;
+static int muxreadycnt = 0;
+static int mux_topfd = 0;
+static volatile int mux_sawreaped = 0;
+
+static void mux_ready __((struct procinfo *));
+static void
+mux_ready(proc)
+     struct procinfo *proc;
+{
+	if (proc->onready)
+	  return;
+	if (muxready == NULL)
+	  muxready = (struct procinfo **)
+	    emalloc(scheduler_nofiles * sizeof(struct procinfo *));
+	proc->onready = 1;
+	muxready[muxreadycnt++] = proc;
+}
+
+/*
+ *  The persistent poll-set of mux(); created on first use.
+ */
+struct zmpollset *
+mux_pollset()
+{
+	if (muxset == NULL) {
+	  if (scheduler_nofiles < 1)
+	    scheduler_nofiles = resources_query_nofiles();
+	  muxset = zmpollset_new(scheduler_nofiles);
+	  if (muxset == NULL) {
+	    sfprintf(sfstderr, "%s: mux_pollset(): out of memory!\n", progname);
+	    abort();
+	  }
+	}
+	return muxset;
+}
+
+/*
+ *  Tell the poll-set, if we want to write to the child or not.
+ *  The 'fromfd' is the index of the procinfo slot.
+ */
+static void mux_pollupdate __((struct procinfo *));
+
+static void
+mux_pollupdate(proc)
+     struct procinfo *proc;
+{
+	int fromfd = proc - cpids;
+	int wr = (proc->tofd >= 0 && proc->cmdlen > 0) ? ZM_POLLOUT : 0;
+
+	if (proc->tofd < 0 || proc->tofd == fromfd)
+	  zmpollset_mod(mux_pollset(), fromfd, ZM_POLLIN | wr);
+	else
+	  zmpollset_mod(mux_pollset(), proc->tofd, wr);
+}
+
+/*
+ *  Shut down the command channel towards the child.  With plain
+ *  pipes that is a close(), thus it must leave the poll-set first.
+ */
+void
+mux_shutdown_child(proc)
+     struct procinfo *proc;
+{
+	if (proc->tofd < 0)
+	  return;
+	if (proc->tofd != (proc - cpids))
+	  zmpollset_del(mux_pollset(), proc->tofd);
+	pipes_shutdown_child(proc->tofd);
+	proc->tofd = -1;
+	mux_pollupdate(proc);
+}
+
+/*
+ *  Forget the shared memory job ring of the child; either it did
+ *  not want it, or the child is gone.
+ */
+void
+mux_dropring(proc)
+     struct procinfo *proc;
+{
+	if (proc->ring == NULL)
+	  return;
+	zmpollset_del(mux_pollset(), taring_fd(proc->ring));
+	taring_free(proc->ring);
+	proc->ring   = NULL;
+	proc->ringon = 0;
+}
+
+/*
+ *  Put one line of the text protocol into the job ring as a record;
+ *  return -1 for failures, 1 when the ring is full, 0 for success.
+ */
+static int  ring_putline    __((struct procinfo *, const char *));
+
+static int
+ring_putline(proc, line)
+     struct procinfo *proc;
+     const char *line;
+{
+	static char *buf = NULL;
+	static int bufspc = 0;
+	const char *str[2];
+	char *s;
+	int len = strlen(line), type, nstr = 0;
+
+	if (strcmp(line, "#idle\n") == 0)
+	  type = TARING_IDLE;
+	else if (*line == '\n')
+	  type = TARING_END;
+	else {
+	  type = TARING_JOB;
+	  nstr = 2;
+	}
+
+	cmdbufalloc(len, &buf, &bufspc);
+	memcpy(buf, line, len+1);
+	if (len > 0 && buf[len-1] == '\n')
+	  buf[len-1] = '\0';
+	str[0] = buf;
+	str[1] = "";
+	if ((s = strchr(buf, '\t')) != NULL) {
+	  *s++ = '\0';
+	  str[1] = s;
+	}
+
+	if (taring_put(proc->ring, type, 0, 0, nstr, str) < 0) {
+	  if (errno == EAGAIN)
+	    return 1;
+	  if (verbose)
+	    sfprintf(sfstderr,
+		     "%% ring_putline(proc=%p pid=%d) errno=%d\n",
+		     proc, proc->pid, errno);
+	  return -1;
+	}
+	proc->feedtime = now;
+	return 0;
+}
+
+
 
 /* 
  * Flush to child;
@@ -121,8 +272,7 @@ flush_child(proc)
 {
 
 	if (proc->pid < 0 && proc->tofd >= 0) {
-	  pipes_shutdown_child(proc->tofd);
-	  proc->tofd = -1;
+	  mux_shutdown_child(proc);
 
 	  if (verbose)
 	    sfprintf(sfstderr,
@@ -164,9 +314,8 @@ flush_child(proc)
 			 errno != EWOULDBLOCK)) {
 	    int e = errno;
 	    /* Some real failure :-( */
-	    pipes_shutdown_child(proc->tofd);
-	    proc->tofd = -1;
 	    proc->cmdlen = 0;
+	    mux_shutdown_child(proc);
 	    proc->state = CFSTATE_ERROR;
 
 	    if (verbose)
@@ -184,6 +333,9 @@ flush_child(proc)
 		      proceed later... */
 	  proc->cmdlen -= rc;
 	}
+	/* Leftovers ?  Want to know when we can write more */
+	mux_pollupdate(proc);
+
 	if (proc->cmdlen) return 1; /* Incomplete write */
 	return 0;
 }
@@ -208,8 +360,7 @@ feed_child(proc)
 
 	if (proc->pthread == NULL) {
 	  proc->state = CFSTATE_ERROR;
-	  pipes_shutdown_child(proc->tofd);
-	  proc->tofd = -1;
+	  mux_shutdown_child(proc);
 
 	  if (verbose)
 	    sfprintf(sfstderr,
@@ -240,6 +391,15 @@ feed_child(proc)
 
 	vtx = proc->pthread->nextfeed;
 
+	/* Restored from the state snapshot, but no longer matching
+	   the files ?  Skip it, snapshot_reconcile() requeues it. */
+	while (snapshot_verify(vtx->cfp) < 0) {
+	  proc->pthread->unfed -= 1;
+	  if (!pick_next_vertex(proc))
+	    return -1;
+	  vtx = proc->pthread->nextfeed;
+	}
+
 	mytime(&now);
 #if 0
 	if (vtx->lastfeed + 10 >= now)
@@ -268,12 +428,23 @@ feed_child(proc)
 
 	}
 
-	if ((proc->cmdlen + cmdlen) >= proc->cmdspc)
-	  cmdbufalloc(proc->cmdlen + cmdlen + 1, &proc->cmdbuf, &proc->cmdspc);
+	if (proc->ringon) {
 
-	/* Ok, copy it there.. */
-	memcpy(proc->cmdbuf + proc->cmdlen, cmdbuf, cmdlen+1);
-	proc->cmdlen += cmdlen;
+	  /* Straight into the shared memory; when it is full, this
+	     vertex stays as the 'nextfeed' for the next "#hungry". */
+	  int rc = ring_putline(proc, cmdbuf);
+	  if (rc != 0)
+	    return rc;
+
+	} else {
+
+	  if ((proc->cmdlen + cmdlen) >= proc->cmdspc)
+	    cmdbufalloc(proc->cmdlen + cmdlen + 1, &proc->cmdbuf, &proc->cmdspc);
+
+	  /* Ok, copy it there.. */
+	  memcpy(proc->cmdbuf + proc->cmdlen, cmdbuf, cmdlen+1);
+	  proc->cmdlen += cmdlen;
+	}
 
 	if (verbose) {
 	  sfprintf(sfstdout,
@@ -404,7 +575,7 @@ ta_hungry(proc)
 	      if (i < 0)
 		goto feed_error_handler; /* Outch! */
 
-	      if (proc->tofd >= 0 && proc->cmdlen != 0)
+	      if (i > 0 || (proc->tofd >= 0 && proc->cmdlen != 0))
 		break; /* Incomplete feed -- stop feeding here */
 
 	      if (proc->overfed > proc->thg->ce.overfeed)
@@ -498,15 +669,21 @@ ta_hungry(proc)
 	    thr0->proc = proc;
 	  }
 
-	  if ((proc->cmdlen + 7) >= proc->cmdspc) {
-	    cmdbufalloc(proc->cmdlen+7, &proc->cmdbuf, &proc->cmdspc);
-	  }
-	  if (slow_shutdown) {
-	    proc->cmdbuf[ proc->cmdlen ] = '\n';
-	    proc->cmdlen += 1;
-	  } else {
-	    memcpy(proc->cmdbuf + proc->cmdlen, "#idle\n", 6);
-	    proc->cmdlen += 6;
+	  /* A full ring is not an error, the pipe takes it then */
+	  i = proc->ringon ? ring_putline(proc, slow_shutdown ? "\n" : "#idle\n") : 1;
+	  if (i < 0)
+	    goto feed_error_handler;
+	  if (i > 0) {
+	    if ((proc->cmdlen + 7) >= proc->cmdspc) {
+	      cmdbufalloc(proc->cmdlen+7, &proc->cmdbuf, &proc->cmdspc);
+	    }
+	    if (slow_shutdown) {
+	      proc->cmdbuf[ proc->cmdlen ] = '\n';
+	      proc->cmdlen += 1;
+	    } else {
+	      memcpy(proc->cmdbuf + proc->cmdlen, "#idle\n", 6);
+	      proc->cmdlen += 6;
+	    }
 	  }
 	  proc->state = CFSTATE_IDLE;
 	  proc->overfed += 1;
@@ -572,8 +749,7 @@ ta_hungry(proc)
 	  proc->state = CFSTATE_ERROR;
 
 	  /* We shut-down the child feed pipe */
-	  pipes_shutdown_child(proc->tofd);
-	  proc->tofd = -1;
+	  mux_shutdown_child(proc);
 	  break;
 	}
 	return;
@@ -737,6 +913,7 @@ static int runcommand(argv, env, vhead, chwp, howp)
 	int	i, pid, to[2], from[2], uid, gid, prio;
 	char	*cmd;
 	static int pipesize = 0;
+	struct taring *ring = NULL;
 
 
 	uid = vhead->thgrp->ce.uid;
@@ -752,11 +929,31 @@ static int runcommand(argv, env, vhead, chwp, howp)
 	  sfprintf(sfstderr, "to %d/%d from %d/%d\n",
 		  to[0],to[1],from[0],from[1]);
 
+	/* Failing to get one is not fatal, we just talk thru the pipes */
+	if (vhead->thgrp->ce.shmring > 0)
+	  ring = taring_create(vhead->thgrp->ce.shmring * 1024);
+
 	pid = fork();
 	if (pid == 0) {	/* child */
 
 	  pipes_to_child_fds(to,from);
 
+	  if (ring) {
+	    /* Into fds 3,4,5 and tell about it in the environment */
+	    char **nenv, tarenv[40];
+	    int n;
+
+	    taring_child(ring);
+	    for (n = 0; env[n] != NULL; ++n)
+	      ;
+	    nenv = (char **)emalloc((n + 2) * sizeof(char *));
+	    memcpy(nenv, env, n * sizeof(char *));
+	    sprintf(tarenv, "%s=%d", TARING_ENV, TARING_FD);
+	    nenv[n]   = tarenv;
+	    nenv[n+1] = NULL;
+	    env = nenv;
+	  }
+
 	  /* keep current stderr for child stderr */
 	  /* close all other open filedescriptors */
 
@@ -764,7 +961,7 @@ static int runcommand(argv, env, vhead, chwp, howp)
 	  /* ... no, the 'querysock' is there somewhere!   */
 	  if (scheduler_nofiles < 1)
 	    scheduler_nofiles = resources_query_nofiles();
-	  for (i = 3; i < scheduler_nofiles; ++i)
+	  for (i = ring ? TARING_FD+3 : 3; i < scheduler_nofiles; ++i)
 	    close(i);
 
 #if defined(HAVE_SETPRIORITY) && defined(HAVE_SYS_RESOURCE_H)
@@ -785,6 +982,7 @@ static int runcommand(argv, env, vhead, chwp, howp)
 	} else if (pid < 0) {	/* fork failed - yell and forget it */
 	  close(to[0]); close(to[1]);
 	  close(from[0]); close(from[1]);
+	  taring_free(ring);
 	  sfprintf(sfstderr, "Fork failed!\n");
 	  vhead->thread->pending = "System:ForkFailure!";
 	  return 0;
@@ -793,16 +991,19 @@ static int runcommand(argv, env, vhead, chwp, howp)
 	/* parent */
 
 	pipes_close_parent(to,from);
+	if (ring)
+	  taring_parent(ring);
 
 	/* save from[0] away as a descriptor to watch */
-	stashprocess(pid, from[0], to[1], chwp, howp, vhead, argv);
+	stashprocess(pid, from[0], to[1], ring, chwp, howp, vhead, argv);
 	/* We wait for the child to report "#hungry", then we feed it.. */
 	return 1;
 }
 
 
-static void stashprocess(pid, fromfd, tofd, chwp, howp, vhead, argv)
+static void stashprocess(pid, fromfd, tofd, ring, chwp, howp, vhead, argv)
 	int pid, fromfd, tofd;
+	struct taring *ring;
 	struct web *chwp, *howp;
 	struct vertex *vhead;
 	char * const argv[];
@@ -851,8 +1052,9 @@ static void stashprocess(pid, fromfd, tofd, chwp, howp, vhead, argv)
 	proc->pthread->thrkids  += 1;
 
 	++numkids;
+	++readsockcnt;
 	MIBMtaEntry->sc.TransportAgentProcessesSc += 1;
-	MIBMtaEntry->sc.TransportAgentForksSc     += 1;
+	MIBMtaCnt->sc.TransportAgentForksSc     += 1;
 	MIBMtaEntry->sc.TransportAgentsActiveSc   += 1;
 
 
@@ -872,6 +1074,18 @@ static void stashprocess(pid, fromfd, tofd, chwp, howp, vhead, argv)
 	if (fromfd != tofd)
 	  fd_nonblockingmode(tofd);
 
+	/* Register once, mux() won't rebuild these every time */
+	zmpollset_add(mux_pollset(), fromfd, ZM_POLLIN, proc);
+	if (fromfd >= mux_topfd)
+	  mux_topfd = fromfd + 1;
+	if (fromfd != tofd)
+	  zmpollset_add(mux_pollset(), tofd, 0, proc);
+
+	/* The ring is on once the child says "#hungry" thru it */
+	proc->ring = ring;
+	if (ring)
+	  zmpollset_add(mux_pollset(), taring_fd(ring), ZM_POLLIN, proc);
+
 	/* Construct a faximille of the argv[] in a single string.
 	   This is entirely for debug porposes in some rare cases
 	   where transport subprocess returns EX_SOFTWARE, and we
@@ -911,8 +1125,7 @@ shutdown_kids()
 	    /* Send the death-marker to the kid, and
 	       then close the command channel */
 	    write(proc->tofd,"\n\n",2);
-	    pipes_shutdown_child(proc->tofd);
-	    proc->tofd = -1;
+	    mux_shutdown_child(proc);
 	    /* Signals may happen... */
 	    if (proc->pid > 1)
 	      kill(proc->pid, SIGQUIT);
@@ -953,6 +1166,7 @@ static void reclaim(fromfd, tofd)
 
 	proc->pid = 0;
 	proc->reaped = 0;
+	--readsockcnt;
 	if (proc->carryover != NULL) {
 	  sfprintf(sfstderr, "%s: HELP! Lost %d bytes: '%s'\n",
 		  progname, (int)strlen(proc->carryover), proc->carryover);
@@ -969,9 +1183,14 @@ static void reclaim(fromfd, tofd)
 	  unweb(L_HOST, proc->ho);
 	  proc->ho = NULL;
 	}
+	if (tofd >= 0 && tofd != fromfd)
+	  zmpollset_del(mux_pollset(), tofd);
+	zmpollset_del(mux_pollset(), fromfd);
+	mux_dropring(proc);
 	if (tofd >= 0)
 	  pipes_shutdown_child(tofd);
 	close(fromfd);
+	proc->tofd = -1;
 
 	/* Reschedule the vertices that are left
 	   (that were not reported on).		*/
@@ -1047,16 +1266,21 @@ int
 mux(timeout)
 time_t timeout;
 {
-	int	i, n;
+	int	i, n, nevs, revents;
 	int wait_secs;
 	struct procinfo *proc = cpids;
+	struct zmpollev *evs;
+	static time_t lasttick;
 
+	/* Transporters live in the persistent  mux_pollset(),
+	   these few IPC sockets are collected at every pass */
 	int fdscount = 0;
 	static struct zmpollfd *fds = NULL;
 
 	struct zmpollfd *queryfds  = NULL;
 	struct zmpollfd *query6fds = NULL;
 	struct zmpollfd *notifyfds = NULL;
+	struct zmpollfd *dirwatchfds = NULL;
 
 	timed_log_reinit();
 
@@ -1072,27 +1296,6 @@ time_t timeout;
 	  wait_secs = 0;
 
 	fdscount = 0;
-	readsockcnt = 0;
-	if (cpids != NULL)
-	  for (proc = cpids,i = 0; i < scheduler_nofiles ; ++i,++proc) {
-	    proc->fdpfrom = proc->fdpto = NULL;
-
-	    if (proc->pid != 0) {
-	      /* Something can be read ? */
-	      zmpoll_addfd(&fds, &fdscount, i, -1, &(proc->fdpfrom));
-	      /* sfprintf(sfstderr,"**** QX zmpoll_addfd(fds, %d, %d, %d, fdpfrom) QX ***\n", fdscount, i, -1); */
-
-	      ++readsockcnt;
-	      /* Something to write ? */
-	      if (proc->cmdlen > 0 && proc->tofd >= 0) {
-	        zmpoll_addfd(&fds, &fdscount, -1,  proc->tofd, &(proc->fdpto));
-	        /* sfprintf(sfstderr,"**** QX zmpoll_addfd(fds, %d, %d, %d, fdpto) QX ***\n", fdscount, -1, proc->tofd); */
-	      } else {
-		proc->fdpto = NULL;
-	      }
-
-	    }
-	  }
 
 	if (querysocket >= 0)
 	  zmpoll_addfd(&fds, &fdscount, querysocket,  -1, &queryfds);
@@ -1103,6 +1306,9 @@ time_t timeout;
 	if (notifysocket >= 0)
 	  zmpoll_addfd(&fds, &fdscount, notifysocket, -1, &notifyfds);
 
+	if (dirwatchfd >= 0)
+	  zmpoll_addfd(&fds, &fdscount, dirwatchfd, -1, &dirwatchfds);
+
 	/* Although we don't react on the results of these MQ2 fd's
 	   here in main loop, getting them to break timeouts is
 	   important for MAILQv2 responsiveness. ! */
@@ -1110,19 +1316,15 @@ time_t timeout;
 	if (mailqmode == 2)
 	  mq2add_to_poll(&fds, &fdscount);
 
-	if (fdscount == 0) {
+	if (fdscount == 0 && zmpollset_count(mux_pollset()) == 0) {
 	  return -1;
 	}
 
-	/* sfprintf(sfstderr, "about to select on %x [%d]\n",
-	   mask.fds_bits[0], maxf); */
-
 	in_poll = 1;
 
-	/* n = select(maxf, &rdmask, &wrmask, NULL, &tv); */
-	n = zmpoll(fds, fdscount, wait_secs * 1000);
+	n = zmpollset_wait(mux_pollset(), fds, fdscount, wait_secs * 1000);
 	if (verbose)
-	  sfprintf(sfstderr,"**** QX zmpoll(fds, %d, %d * 1000) = %d; QX ***\n", fdscount, wait_secs, n);
+	  sfprintf(sfstderr,"**** QX zmpollset_wait(set, %d+%d, %d * 1000) = %d; QX ***\n", zmpollset_count(mux_pollset()), fdscount, wait_secs, n);
 
 
 	if (n < 0) {
@@ -1173,36 +1375,65 @@ time_t timeout;
 	      notifyfds->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))
 	    receive_notify(notifysocket);
 
-	  if (cpids != NULL) {
+	  if (dirwatchfd >= 0 && dirwatchfds &&
+	      dirwatchfds->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))
+	    receive_dirwatch();
+
+	  /* Collect the transporters that had something happening;
+	     each only once, even if both of its fds fired. */
+	  muxreadycnt = 0;
+	  evs = zmpollset_events(mux_pollset(), &nevs);
+	  for (i = 0; i < nevs; ++i) {
+	    proc = (struct procinfo *) evs[i].cookie;
+	    if (proc) {
+	      proc->revents |= evs[i].revents;
+	      mux_ready(proc);
+	    }
+	  }
+
+	  /* .. and those that have died since the last visit */
+	  if (mux_sawreaped && cpids != NULL) {
+	    mux_sawreaped = 0;
+	    for (i = 0; i < mux_topfd; ++i)
+	      if (cpids[i].pid < 0)
+		mux_ready(&cpids[i]);
+	  }
 
-	    for (proc = cpids, i = 0; i < scheduler_nofiles; ++i, ++proc) {
-	      /* sfprintf(sfstderr,"**** QX i = %d QX ***\n", i); */
-	      
-	      timed_log_reinit();
+	  for (i = 0; i < muxreadycnt; ++i) {
+	    proc = muxready[i];
+	    revents = proc->revents;
+	    proc->revents = 0;
+	    proc->onready = 0;
 
-	      if (proc->pid < 0 ||
-	          (proc->pid > 0 && proc->fdpfrom &&
-		   proc->fdpfrom->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))) {
+	    timed_log_reinit();
 
-		/* _Z_FD_CLR(i, rdmask); */
-		/*sfprintf(sfstderr,"that is fd %d\n",i);*/
-		/* do non-blocking reads from this fd */
-		readfrom(i);
-	      }
+	    /* The ring first, it may have the last words of a dead TA */
+	    if (proc->ring != NULL && proc->pid != 0)
+	      ringfrom(proc);
 
-	      /* In case we have non-completed 'feeds', try feeding them */
-	      if (proc->pid > 0    &&  proc->tofd >= 0   &&
-		  proc->cmdlen > 0 &&
-		  proc->fdpto && proc->fdpto->revents & ZM_POLLOUT)
-		flush_child(proc);
+	    if (proc->pid < 0 ||
+		(proc->pid > 0 &&
+		 revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))) {
 
-	      /* Because this loop might take a while ... */
-	      queryipccheck();
+	      /* do non-blocking reads from this fd */
+	      readfrom(proc - cpids);
+	    }
 
-	      syncweb(dirq);
+	    /* In case we have non-completed 'feeds', try feeding them */
+	    if (proc->pid > 0    &&  proc->tofd >= 0   &&
+		proc->cmdlen > 0 &&  (revents & ZM_POLLOUT))
+	      flush_child(proc);
 
+	    /* Because this loop might take a while, keep the MAILQ
+	       service and the queue intake going -- at most once
+	       a second, not once per transporter. */
+	    if (lasttick != now) {
+	      lasttick = now;
+	      queryipccheck();
+	      syncweb(dirq);
 	    }
 	  }
+	  muxreadycnt = 0;
 
 	  in_poll = 0;
 	}
@@ -1285,11 +1516,13 @@ queryipccheck()
 	      if (mailqmode == 1) {
 		int pid;
 
-		MIBMtaEntry->sc.MQ1sockConnects ++;
+		MIBMtaCnt->sc.MQ1sockConnects ++;
 		MIBMtaEntry->sc.MQ1sockParallel ++;
 
 		pid = fork();
 		if (pid == 0) {
+		  /* Not into the counter slab of the scheduler */
+		  Z_SHM_MIB_Forked();
 #if defined(F_SETFD)
 		  fcntl(n, F_SETFD, 1); /* close-on-exec */
 #endif
@@ -1300,7 +1533,8 @@ queryipccheck()
 		    int   len = strlen(msg);
 		    write(n,msg,len);
 		    MIBMtaEntry->sc.MQ1sockParallel --;
-		    MIBMtaEntry->sc.MQ1sockTcpWrapRej ++;
+		    MIBMtaCnt->sc.MQ1sockTcpWrapRej ++;
+		    Z_SHM_MIB_Detach();
 		    _exit(0);
 		  }
 #endif
@@ -1308,6 +1542,7 @@ queryipccheck()
 		  qprint(n);
 		  close(n);
 		  MIBMtaEntry->sc.MQ1sockParallel --;
+		  Z_SHM_MIB_Detach(); /* _exit() skips the atexit() one */
 		  /* Silence memory debuggers about this child's
 		     activities by doing exec() on the process.. */
 		  /* execl("/bin/false","false",NULL); */
@@ -1319,7 +1554,7 @@ queryipccheck()
 	      } else {
 		/* mailqmode == 2 */
 
-		MIBMtaEntry->sc.MQ2sockConnects ++;
+		MIBMtaCnt->sc.MQ2sockConnects ++;
 
 #if 0  /* NOT IN MAILQ-V2 MODE ! */
 #ifdef USE_TCPWRAPPER
@@ -1328,7 +1563,7 @@ queryipccheck()
 		  char *msg = "500 TCP-WRAPPER refusing 'mailq' query from your whereabouts\r\n";
 		  int   len = strlen(msg);
 		  write(n,msg,len);
-		  MIBMtaEntry->sc.MQ2sockTcpWrapRej ++;
+		  MIBMtaCnt->sc.MQ2sockTcpWrapRej ++;
 		  close(n);
 		}
 		else
@@ -1352,11 +1587,13 @@ queryipccheck()
 	      if (mailqmode == 1) {
 		int pid;
 
-		MIBMtaEntry->sc.MQ1sockConnects ++;
+		MIBMtaCnt->sc.MQ1sockConnects ++;
 		MIBMtaEntry->sc.MQ1sockParallel ++;
 
 		pid = fork();
 		if (pid == 0) {
+		  /* Not into the counter slab of the scheduler */
+		  Z_SHM_MIB_Forked();
 #if defined(F_SETFD)
 		  fcntl(n, F_SETFD, 1); /* close-on-exec */
 #endif
@@ -1367,7 +1604,8 @@ queryipccheck()
 		    int   len = strlen(msg);
 		    write(n,msg,len);
 		    MIBMtaEntry->sc.MQ1sockParallel --;
-		    MIBMtaEntry->sc.MQ1sockTcpWrapRej ++;
+		    MIBMtaCnt->sc.MQ1sockTcpWrapRej ++;
+		    Z_SHM_MIB_Detach();
 		    _exit(0);
 		  }
 #endif
@@ -1375,6 +1613,7 @@ queryipccheck()
 		  qprint(n);
 		  close(n);
 		  MIBMtaEntry->sc.MQ1sockParallel --;
+		  Z_SHM_MIB_Detach(); /* _exit() skips the atexit() one */
 		  /* Silence memory debuggers about this child's
 		     activities by doing exec() on the process.. */
 		  /* execl("/bin/false","false",NULL); */
@@ -1386,7 +1625,7 @@ queryipccheck()
 	      } else {
 		/* mailqmode == 2 */
 
-		MIBMtaEntry->sc.MQ2sockConnects ++;
+		MIBMtaCnt->sc.MQ2sockConnects ++;
 
 		mq2_register(n, &raddr);
 	      }
@@ -1403,6 +1642,9 @@ queryipcinit()
 	int modecode = 1; /* Modes: 1=TCP, 2=UNIX, default=TCP */
 	char *modedata = NULL;
 
+	if (sched_shard > 0)
+	  return; /* The coordinator has these */
+
 	while (notifysocket < 0) {
 
 	  if (!notifysock) {
@@ -1789,9 +2031,7 @@ static void readfrom(fd)
 	  /*sfprintf(sfstdout,
 	    "about to call waitandclose(), n=%d, errno=%d\n",n,e);*/
 
-	  if (proc->tofd >= 0)
-	    pipes_shutdown_child(proc->tofd);
-	  proc->tofd = -1;
+	  mux_shutdown_child(proc);
 	  waitandclose(fd);
 	}
 
@@ -1814,6 +2054,51 @@ static void readfrom(fd)
 	free(buf);
 }
 
+/*
+ *  Records from the shared memory ring of the child; the same
+ *  things as readfrom() gets as lines.
+ */
+static void ringfrom(proc)
+	struct procinfo *proc;
+{
+	static struct taring_msg msg;
+	int fd = proc - cpids;
+	int rc;
+
+	while (proc->ring != NULL) {
+	  rc = taring_get(proc->ring, &msg);
+	  if (rc == 0) {
+	    /* Drained; if more came meanwhile, go again */
+	    if (!taring_sleep(proc->ring))
+	      break;
+	    continue;
+	  }
+	  if (rc < 0) {
+	    sfprintf(sfstderr, "%s ringfrom(pid=%d): corrupted ring!\n",
+		     timestring(), (int)proc->pid);
+	    mux_dropring(proc);
+	    mux_shutdown_child(proc);
+	    break;
+	  }
+
+	  switch (msg.type) {
+	  case TARING_HUNGRY:
+	    proc->ringon = 1;
+	    ta_hungry(proc);
+	    break;
+	  case TARING_DIAG:
+	    update_diag(proc, (long)msg.id[0], (long)msg.id[1],
+			msg.str[0], msg.str[1], msg.str[2]);
+	    break;
+	  case TARING_TEXT:
+	    update(fd, (char *)msg.str[0]);
+	    break;
+	  default:
+	    break;
+	  }
+	}
+}
+
 #if 0 /* System does not use MKDIR/RMDIR anymore.. */
 #if defined(USE_BINMKDIR) || defined(USE_BINRMDIR)
 
@@ -1862,6 +2147,7 @@ system(name)
 		    for(i = 0; i < scheduler_nofiles; i++) {
 		      if (cpids[i].pid == r) {
 			cpids[i].pid = -r;
+			mux_sawreaped = 1;
 			break;
 		      }
 		    }
@@ -1930,6 +2216,7 @@ int signum;
 		cpids[i].pid = -pid; /* Mark it as reaped.. */
 		cpids[i].reaped = 1;
 		cpids[i].waitstat = statloc;
+		mux_sawreaped = 1;
 		ok = 0;
 		if (WSIGNALSTATUS(statloc) == 0 &&
 		    WEXITSTATUS(statloc)   == EX_SOFTWARE) {
@@ -1943,6 +2230,7 @@ int signum;
 		cpids[i].pid = -pid; /* Mark it as reaped.. */
 		cpids[i].reaped = 1;
 		cpids[i].waitstat = statloc;
+		mux_sawreaped = 1;
 		ok = 0;
 		break;
 	      }
@@ -81,9 +81,7 @@ update(fd, diagnostic)
 	const char	*type, *message, *notary;
 	long	offset;
 	long	inum;
-	int	index, c;
-	struct vertex *vp;
-	struct diagcodes *dcp;
+	int	c;
 	struct procinfo *proc = &cpids[fd];
 
 	timed_log_reinit();
@@ -101,6 +99,9 @@ update(fd, diagnostic)
 	  /* Now (*diagnostic == '#') */
 
 	  if (strncmp(diagnostic,"#hungry",7)==0) {
+	    if (proc->ring && !proc->ringon)
+	      /* Talks text, does not know of the shared memory ring */
+	      mux_dropring(proc);
 	    ta_hungry(proc);
 	    return;
 	  } /* end of '#hungry' processing */
@@ -153,6 +154,24 @@ update(fd, diagnostic)
 	  *cp++ = '\0';
 	  message = cp;
 	}
+	update_diag(proc, inum, offset, notary, type, message);
+}
+
+/*
+ * The parsed diagnostic, from the line above, or from the shared
+ * memory ring of the transport agent.
+ */
+
+void
+update_diag(proc, inum, offset, notary, type, message)
+	struct procinfo *proc;
+	long	inum, offset;
+	const char *notary, *type, *message;
+{
+	int	index;
+	struct vertex *vp;
+	struct diagcodes *dcp;
+
 	if (verbose)
 	  sfprintf(sfstdout,"diagnostic: %ld/%ld\t%s\t%s\n",
 		   inum, offset, notary, type);
@@ -208,7 +227,7 @@ unctlfile(cfp, no_unlink)
 	    zsyslog((LOG_INFO, "%s: complete (total %d recipients, %d failed)",
 		     cfp->spoolid, cfp->rcpnts_total, cfp->rcpnts_failed));
 
-	  ++MIBMtaEntry->sc.TransmittedMessagesSc;
+	  ++MIBMtaCnt->sc.TransmittedMessagesSc;
 
 	  eunlink(path,"sch-unctl-1");
 	  if (verbose)
@@ -301,13 +320,11 @@ void unvertex(vp, justfree, ok)
 
 	web_detangle(vp, ok); /* does also unthread() */
 
-	if (vp->message != NULL) free(vp->message);
+	str_release(vp->message);
 	if (vp->notary  != NULL) free(vp->notary);
 	/* if (vp->sender != NULL) free(vp->sender); */ /* XX: cache !! ?? */
 
-memset(vp, 0x55, sizeof(*vp));
-
-	free((char *)vp);
+	vtx_free(vp);
 	MIBMtaEntry->sc.StoredVerticesSc -= 1;
 
 
@@ -334,25 +351,15 @@ static struct vertex *findvertex(proc, inum, offset, idx)
 		     progname, inum);
 	  return NULL;
 	}
-	for (i = 0; i < cfp->nlines; ++i) {
-	  if (cfp->offset[i] == offset) {
-	    *idx = i;
-	    break;
-	  }
-	}
-	if (i >= cfp->nlines) {
-	  sfprintf(sfstderr,
-		   "%s: unknown address offset %ld in control file %ld!\n",
-		   progname, offset, inum);
-	  return NULL;
-	}
+	/* The vertices know their recipients by the line offsets */
+	*idx = offset;
 	for (vp = cfp->head; vp != NULL; vp = vp->next[L_CTLFILE])
 	  for (i = 0; i < vp->ngroup; ++i)
-	    if (vp->index[i] == *idx)
+	    if (vp->index[i] == offset)
 	      return vp;
 
 	sfprintf(sfstderr,
-		 "%s: multiple processing of address at %ld in control file %s%s of thread %s/%s ?\n",
+		 "%s: unknown, or multiple processing of address at %ld in control file %s%s of thread %s/%s ?\n",
 		 progname, offset, cfpdirname(cfp->dirind), cfp->mid,
 		 proc->ch->name, proc->ho->name );
 
@@ -591,7 +598,7 @@ static void expaux(vp, index, buf)
 	/* Report expiry */
 	for (i = 0 ; i < vp->ngroup; ++i)
 	  if (vp->index[i] == index) {
-	    msgerror(vp, vp->cfp->offset[index], buf);
+	    msgerror(vp, index, buf);
 	    break;
 	  }
 #if 0
@@ -605,7 +612,7 @@ static void expaux(vp, index, buf)
 
 	/* Delete this vertex from scheduling datasets */
 	vtxupdate(vp, index, 0);
-	++MIBMtaEntry->sc.TransmittedRecipientsSc;
+	++MIBMtaCnt->sc.TransmittedRecipientsSc;
 }
 
 void
@@ -683,7 +690,7 @@ static int u_ok(proc, vp, index, inum, offset, notary, message)
 
 	/* Delete this vertex from scheduling datasets */
 	vtxupdate(vp, index, 1);
-	++MIBMtaEntry->sc.TransmittedRecipientsSc;
+	++MIBMtaCnt->sc.TransmittedRecipientsSc;
 	return 1;
 }
 
@@ -716,7 +723,7 @@ static int u_ok2(proc, vp, index, inum, offset, notary, message)
 
 	/* Delete this vertex from scheduling datasets */
 	vtxupdate(vp, index, 1);
-	++MIBMtaEntry->sc.TransmittedRecipientsSc;
+	++MIBMtaCnt->sc.TransmittedRecipientsSc;
 	return 1;
 }
 
@@ -748,7 +755,7 @@ static int u_ok3(proc, vp, index, inum, offset, notary, message)
 
 	/* Delete this vertex from scheduling datasets */
 	vtxupdate(vp, index, 1);
-	++MIBMtaEntry->sc.TransmittedRecipientsSc;
+	++MIBMtaCnt->sc.TransmittedRecipientsSc;
 	return 1;
 }
 
@@ -763,12 +770,11 @@ static int u_deferred(proc, vp, index, inum, offset, notary, message)
 	/* sfprintf(sfstderr,"%s: %ld/%ld/%s/deferred %s\n", vp->cfp->spoolid,
 	   inum, offset, notary, message ? message : "-"); */
 	if (message != NULL) {
-	  if (vp->message != NULL)
-	    free(vp->message);
+	  str_release(vp->message);
 	  /* sfprintf(sfstderr, "add message '%s' to node %s/%s\n",
 	     message, vp->orig[L_CHANNEL]->name,
 	     vp->orig[L_HOST]->name); */
-	  vp->message = strsave(message);
+	  vp->message = str_intern(message);
 	}
 #if 0
 	if (vp->cfp->contents != NULL) {
@@ -839,12 +845,11 @@ static int u_deferall(proc, vp, index, inum, offset, notary, message)
 	     message ? message : "-"); */
 
 	  if (message != NULL) {
-	    if (vp->message != NULL)
-	      free(vp->message);
+	    str_release(vp->message);
 	    /* sfprintf(sfstderr, "add message '%s' to node %s/%s\n",
 	       message, vp->orig[L_CHANNEL]->name,
 	       vp->orig[L_HOST]->name); */
-	    vp->message = strsave(message);
+	    vp->message = str_intern(message);
 	  }
 
 #if 0
@@ -902,7 +907,7 @@ static int u_error(proc, vp, index, inum, offset, notary, message)
 
 	/* Delete this vertex from scheduling datasets */
 	vtxupdate(vp, index, 0);
-	++MIBMtaEntry->sc.TransmittedRecipientsSc;
+	++MIBMtaCnt->sc.TransmittedRecipientsSc;
 	return 1;
 }
 
@@ -940,7 +945,7 @@ static int u_error2(proc, vp, index, inum, offset, notary, message)
 
 	/* Delete this vertex from scheduling datasets */
 	vtxupdate(vp, index, 0);
-	++MIBMtaEntry->sc.TransmittedRecipientsSc;
+	++MIBMtaCnt->sc.TransmittedRecipientsSc;
 	return 1;
 }
 
@@ -1006,12 +1011,11 @@ static int u_retryat(proc, vp, index, inum, offset, notary, message)
 	  message = NULL;
 	
 	if (message != NULL) {
-	  if (vp->message != NULL)
-	    free(vp->message);
+	  str_release(vp->message);
 	  /* sfprintf(sfstderr, "add message '%s' to node %s/%s\n",
 	     message, vp->orig[L_CHANNEL]->name,
 	     vp->orig[L_HOST]->name); */
-	  vp->message = strsave(message);
+	  vp->message = str_intern(message);
 	}
 #if 0
 	if (vp->cfp->contents != NULL) {
@@ -331,6 +331,46 @@ static void cfparam(str, size, cfgfilename, linenum)
 	sscanf(param1, "%d", &MaxParallelConnections);
     }
 
+    /* Pre-forked workers instead of a fork per connection */
+
+    else if (cistrcmp(name, "PreforkWorkers") == 0 && param1) {
+	sscanf(param1, "%d", &PreforkWorkers);
+    } else if (cistrcmp(name, "prefork-workers") == 0 && param1) {
+	sscanf(param1, "%d", &PreforkWorkers);
+    } else if (cistrcmp(name, "PreforkSessions") == 0 && param1) {
+	sscanf(param1, "%d", &PreforkSessions);
+    } else if (cistrcmp(name, "prefork-sessions") == 0 && param1) {
+	sscanf(param1, "%d", &PreforkSessions);
+    }
+
+    /* Rejected sessions to the event-driven multiplexer */
+
+    else if (cistrcmp(name, "MuxSessions") == 0 && param1) {
+	sscanf(param1, "%d", &MuxSessions);
+    } else if (cistrcmp(name, "mux-sessions") == 0 && param1) {
+	sscanf(param1, "%d", &MuxSessions);
+    }
+
+    /* Group commit of the spool file syncs */
+
+    else if (cistrcmp(name, "SpoolGroupCommit") == 0) {
+	SpoolGroupCommit = 1;
+    } else if (cistrcmp(name, "spool-group-commit") == 0) {
+	SpoolGroupCommit = 1;
+    }
+
+    /* DNS RBL lookups */
+
+    else if (cistrcmp(name, "RblCacheSize") == 0 && param1) {
+	sscanf(param1, "%d", &RblCacheSize);
+    } else if (cistrcmp(name, "rbl-cache-size") == 0 && param1) {
+	sscanf(param1, "%d", &RblCacheSize);
+    } else if (cistrcmp(name, "RblTimeout") == 0 && param1) {
+	sscanf(param1, "%d", &RblTimeout);
+    } else if (cistrcmp(name, "rbl-timeout") == 0 && param1) {
+	sscanf(param1, "%d", &RblTimeout);
+    }
+
     /* TCP related parameters */
 
     else if   (cistrcmp(name, "ListenQueueSize") == 0   && param1) {
@@ -666,6 +706,14 @@ static void cfparam(str, size, cfgfilename, linenum)
     } else if (cistrcmp(name, "tls-scache-timeout") == 0 && param1) {
       sscanf(param1,"%d", & CP->tls_scache_timeout);
 
+    } else if (cistrcmp(name, "tls-scache-file") == 0 && param1) {
+      CP->tls_scache_file = strdup(param1);
+      if (param2)
+	sscanf(param2,"%d", & CP->tls_scache_slots);
+
+    } else if (cistrcmp(name, "tls-ticket-lifetime") == 0 && param1) {
+      sscanf(param1,"%d", & CP->tls_ticket_lifetime);
+
     } else if (cistrcmp(name, "report-auth-file")   == 0 && param1) {
       CP->reportauthfile = strdup(param1);
 
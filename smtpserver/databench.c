@@ -0,0 +1,320 @@
+/*
+ *  databench -- replay captured SMTP DATA/BDAT streams thru the
+ *  classic per-character body copy of mvdata()/mvbdata(), and thru
+ *  the block copy of datacopy.c, compare the results, and tell how
+ *  fast each of them went.
+ *
+ *	databench [-b] [-r rounds] [-c chunksize] [-s synthsize] [file ...]
+ *
+ *  A file is the raw input as it came after the "354" reply, up to
+ *  and including the "\r\n.\r\n" (with -b: the BDAT chunk data).
+ *  Without files, a synthetic message of 'synthsize' bytes is used.
+ *  The input is fed in 'chunksize' pieces, like the smtpserver input
+ *  buffer does (default: 64 kB).
+ *
+ *  Built with:  make databench
+ */
+
+#include "smtpserver.h"
+#include <sys/time.h>
+
+const char *progname = "databench";
+
+/* A copy of the mvdata() states[] table of smtpdata.c */
+#define	O_	(0200 << 8)
+#define N_	('\r' << 8)
+#define X_	~0
+
+static int states[] =
+{
+/*      *       '\r'    '\n'    '.'     EOF        states */
+    0, O_ | 15, 10, 0, X_,	/* 0: during line */
+    0, O_ | 20, X_, 0, X_,	/* 5: "^." */
+    0, O_ | 15, 10, O_ | 5, X_,	/* 10: "^" (start state) */
+    N_ | 0, 15, 10, N_ | 0, X_,	/* 15: seen a \r */
+    N_ | 0, 15, X_, N_ | 0, X_,	/* 20: "^.\r" */
+};
+
+static int column __((int));
+static int
+column(c)
+	int c;
+{
+	switch (c) {
+	case '\r': return 1;
+	case '\n': return 2;
+	case '.':  return 3;
+	}
+	return 0;
+}
+
+/* The body loop of mvdata(), with the s_getc() replaced */
+static int classic_data __((const char *, int, int, FILE *));
+static int
+classic_data(buf, len, chunk, fp)
+	const char *buf;
+	int len, chunk;
+	FILE *fp;
+{
+	int i, c, state = 10, cnt = 0;
+
+	for (i = 0; i < len; ++i) {
+	  c = buf[i] & 0xFF;
+	  ++cnt;
+	  state = states[state + column(c)];
+	  if (state & ~0xff) {
+	    if (state & O_) {
+	      if (state == X_)
+		break;
+	      state = (char) state;
+	      continue;
+	    }
+	    if (!ferror(fp))
+	      fputc((state >> 8), fp);
+	    state = state & 0xFF;
+	  }
+	  if (!ferror(fp))
+	    fputc(c, fp);
+	}
+	return cnt;
+}
+
+static int bulk_data __((const char *, int, int, FILE *));
+static int
+bulk_data(buf, len, chunk, fp)
+	const char *buf;
+	int len, chunk;
+	FILE *fp;
+{
+	int n, state = 10, cnt = 0;
+
+	while (cnt < len && state != -1) {
+	  n = len - cnt;
+	  if (n > chunk)
+	    n = chunk;
+	  cnt += data_copybulk(&state, buf + cnt, n, fp);
+	}
+	return cnt;
+}
+
+/* The loop of mvbdata() */
+static int classic_bdat __((const char *, int, int, FILE *));
+static int
+classic_bdat(buf, len, chunk, fp)
+	const char *buf;
+	int len, chunk;
+	FILE *fp;
+{
+	int i, c, mvbstate = -1;
+
+	for (i = 0; i < len; ++i) {
+	  c = buf[i] & 0xFF;
+	  if (c == '\r') {
+	  } else if (mvbstate == '\r') {
+	    if (c != '\n') {
+	      if (!ferror(fp))
+		fputc(mvbstate, fp);
+	      if (!ferror(fp))
+		fputc(c, fp);
+	    } else if (!ferror(fp))
+	      fputc(c, fp);
+	  } else if (!ferror(fp))
+	    fputc(c, fp);
+	  mvbstate = c;
+	}
+	return len;
+}
+
+static int bulk_bdat __((const char *, int, int, FILE *));
+static int
+bulk_bdat(buf, len, chunk, fp)
+	const char *buf;
+	int len, chunk;
+	FILE *fp;
+{
+	int n, cnt = 0, mvbstate = -1;
+
+	while (cnt < len) {
+	  n = len - cnt;
+	  if (n > chunk)
+	    n = chunk;
+	  cnt += bdat_copybulk(&mvbstate, buf + cnt, n, fp);
+	}
+	return cnt;
+}
+
+/* Something like a mail with a base64 attachment, and some dots */
+static char *synthesize __((int, int *));
+static char *
+synthesize(size, lenp)
+	int size, *lenp;
+{
+	static const char b64[] =
+	  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char *buf = malloc(size + 100);
+	int len = 0, col;
+	unsigned int r = 1;
+
+	while (len < size) {
+	  r = r * 1103515245 + 12345;
+	  if ((r >> 16) % 50 == 0)
+	    buf[len++] = '.';		/* A stuffed dot */
+	  for (col = 0; col < 76 && len < size; ++col) {
+	    r = r * 1103515245 + 12345;
+	    buf[len++] = b64[(r >> 16) & 63];
+	  }
+	  buf[len++] = '\r';
+	  buf[len++] = '\n';
+	}
+	memcpy(buf + len, ".\r\n", 3);
+	*lenp = len + 3;
+	return buf;
+}
+
+static char *readfile __((const char *, int *));
+static char *
+readfile(fn, lenp)
+	const char *fn;
+	int *lenp;
+{
+	struct stat stbuf;
+	char *buf;
+	int fd, rc;
+
+	fd = open(fn, O_RDONLY, 0);
+	if (fd < 0 || fstat(fd, &stbuf) < 0) {
+	  perror(fn);
+	  exit(1);
+	}
+	buf = malloc(stbuf.st_size + 1);
+	rc = read(fd, buf, stbuf.st_size);
+	close(fd);
+	if (rc != stbuf.st_size) {
+	  fprintf(stderr, "%s: short read\n", fn);
+	  exit(1);
+	}
+	*lenp = rc;
+	return buf;
+}
+
+typedef int (*copyfn) __((const char *, int, int, FILE *));
+
+/* Run it 'rounds' times; the output of the last round stays in 'fp' */
+static double timeit __((copyfn, const char *, int, int, int, FILE *, int *));
+static double
+timeit(fn, buf, len, chunk, rounds, fp, cntp)
+	copyfn fn;
+	const char *buf;
+	int len, chunk, rounds, *cntp;
+	FILE *fp;
+{
+	struct timeval t0, t1;
+	int i;
+
+	gettimeofday(&t0, NULL);
+	for (i = 0; i < rounds; ++i) {
+	  rewind(fp);
+	  *cntp = (*fn)(buf, len, chunk, fp);
+	  fflush(fp);
+	}
+	gettimeofday(&t1, NULL);
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+}
+
+static int samefile __((FILE *, FILE *));
+static int
+samefile(a, b)
+	FILE *a, *b;
+{
+	long la = ftell(a), lb = ftell(b);
+	int ca, cb;
+
+	if (la != lb)
+	  return 0;
+	rewind(a);
+	rewind(b);
+	while (la-- > 0) {
+	  ca = getc(a);
+	  cb = getc(b);
+	  if (ca != cb)
+	    return 0;
+	}
+	return 1;
+}
+
+int
+main(argc, argv)
+	int argc;
+	char *argv[];
+{
+	int c, i, bdat = 0, rounds = 10, chunk = 64*1024, synth = 20*1024*1024;
+	int len, cnt1, cnt2, errs = 0;
+	double t1, t2, mb;
+	char *buf;
+	const char *name;
+	FILE *fp1, *fp2;
+
+	while ((c = getopt(argc, argv, "bc:r:s:")) != EOF) {
+	  switch (c) {
+	  case 'b':
+	    bdat = 1;
+	    break;
+	  case 'c':
+	    chunk = atoi(optarg);
+	    break;
+	  case 'r':
+	    rounds = atoi(optarg);
+	    break;
+	  case 's':
+	    synth = atoi(optarg);
+	    break;
+	  default:
+	    fprintf(stderr,
+		    "Usage: %s [-b] [-r rounds] [-c chunksize] [-s synthsize] [file ...]\n",
+		    progname);
+	    exit(64);
+	  }
+	}
+	if (chunk <= 0 || rounds <= 0) {
+	  fprintf(stderr, "%s: bad -c or -r value\n", progname);
+	  exit(64);
+	}
+
+	fp1 = tmpfile();
+	fp2 = tmpfile();
+	if (!fp1 || !fp2) {
+	  perror("tmpfile");
+	  exit(1);
+	}
+
+	for (i = optind; i < argc || i == optind; ++i) {
+	  if (i < argc) {
+	    name = argv[i];
+	    buf  = readfile(name, &len);
+	  } else {
+	    name = "(synthetic)";
+	    buf  = synthesize(synth, &len);
+	  }
+	  if (buf == NULL) {
+	    fprintf(stderr, "%s: out of memory\n", progname);
+	    exit(1);
+	  }
+
+	  t1 = timeit(bdat ? classic_bdat : classic_data,
+		      buf, len, chunk, rounds, fp1, &cnt1);
+	  t2 = timeit(bdat ? bulk_bdat : bulk_data,
+		      buf, len, chunk, rounds, fp2, &cnt2);
+
+	  mb = (double)len * rounds / (1024.0 * 1024.0);
+	  printf("%s: %d bytes, %d rounds: per-char %.1f MB/s, bulk %.1f MB/s",
+		 name, len, rounds,
+		 t1 > 0 ? mb / t1 : 0.0, t2 > 0 ? mb / t2 : 0.0);
+	  if (cnt1 != cnt2 || !samefile(fp1, fp2)) {
+	    printf("  -- OUTPUT DIFFERS (consumed %d vs %d)", cnt1, cnt2);
+	    ++errs;
+	  }
+	  printf("\n");
+	  free(buf);
+	}
+	return errs ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+/*
+ *  Block-at-a-time copying of the SMTP DATA/BDAT message body
+ *
+ *  The mvdata() of smtpdata.c runs every character of the input
+ *  thru its  states[]  table, and writes each with a fputc().
+ *  For the message body the table does but two things: the CRLF
+ *  becomes a LF, and a dot at the start of a line is dropped (or
+ *  ends the DATA, when it is alone on its line).  All of the text
+ *  in between the line ends goes thru unchanged, thus we look for
+ *  the next CR or LF with memchr() -- which is what the C library
+ *  has the vectorized versions for -- and write the whole span out
+ *  with one fwrite().  Only the line ends, and the dots just after
+ *  them, go thru the state machine a character at the time.
+ *
+ *  The state numbers are those of the  states[]  table; these
+ *  routines can take over in the middle of a line, and give the
+ *  state back for the mvdata() to carry on with.
+ */
+
+#include "hostenv.h"
+#include <stdio.h>
+#include <string.h>
+#include "smtpserver.h"
+
+/* See the  states[]  table in smtpdata.c */
+#define DS_LINE		0	/* during line			*/
+#define DS_DOT		5	/* "^."				*/
+#define DS_START	10	/* "^" (start state)		*/
+#define DS_CR		15	/* seen a \r			*/
+#define DS_DOTCR	20	/* "^.\r"			*/
+
+/* Where is the next CR or LF ?  'end' if none. */
+static const char *data_lineend __((const char *, const char *));
+static const char *
+data_lineend(p, end)
+	const char *p, *end;
+{
+	const char *lf, *cr;
+
+	lf = memchr(p, '\n', end - p);
+	if (lf == NULL)
+	  lf = end;
+	cr = memchr(p, '\r', lf - p);
+	return cr ? cr : lf;
+}
+
+/*
+ *  Copy the DATA body from  buf[0..len-1]  to the 'fp'.
+ *  Returns the count of the bytes consumed; *statep is -1 when
+ *  the end of the DATA ("\r\n.\r\n") was consumed, and the rest
+ *  of the buffer is not ours.
+ */
+int
+data_copybulk(statep, buf, len, fp)
+	int *statep;
+	const char *buf;
+	int len;
+	FILE *fp;
+{
+	const char *p = buf, *end = buf + len, *s;
+	int state = *statep, c;
+
+	while (p < end) {
+
+	  if (state == DS_LINE) {
+	    /* The bulk of it */
+	    s = data_lineend(p, end);
+	    if (s > p && !ferror(fp))
+	      fwrite(p, 1, s - p, fp);
+	    p = s;
+	    if (p >= end)
+	      break;
+	  }
+
+	  c = *p++;
+	  switch (state) {
+	  case DS_LINE:
+	  case DS_START:
+	    if (c == '\r')
+	      state = DS_CR;
+	    else if (c == '.' && state == DS_START)
+	      state = DS_DOT;	/* Drop it, for now */
+	    else {
+	      if (!ferror(fp))
+		putc(c, fp);
+	      state = (c == '\n') ? DS_START : DS_LINE;
+	    }
+	    break;
+
+	  case DS_DOT:
+	    if (c == '\r')
+	      state = DS_DOTCR;
+	    else if (c == '\n') {
+	      *statep = -1;	/* "^.\n" -- tolerated as the end */
+	      return p - buf;
+	    } else {
+	      if (!ferror(fp))
+		putc(c, fp);
+	      state = DS_LINE;
+	    }
+	    break;
+
+	  case DS_CR:
+	  case DS_DOTCR:
+	    if (c == '\n' && state == DS_DOTCR) {
+	      *statep = -1;
+	      return p - buf;
+	    }
+	    if (c == '\n') {
+	      if (!ferror(fp))
+		putc(c, fp);
+	      state = DS_START;
+	    } else if (c == '\r') {
+	      /* The previous CR was a lone one */
+	      if (!ferror(fp))
+		putc('\r', fp);
+	      state = DS_CR;
+	    } else {
+	      if (!ferror(fp)) {
+		putc('\r', fp);
+		putc(c, fp);
+	      }
+	      state = DS_LINE;
+	    }
+	    break;
+	  }
+	}
+
+	*statep = state;
+	return p - buf;
+}
+
+/*
+ *  Copy the BDAT chunk data from  buf[0..len-1]  to the 'fp', turning
+ *  CRLF into LF.  A CR at the end of the buffer is held in *crp (the
+ *  SS->mvbstate), until we know what comes after it.  The 'fp' can be
+ *  NULL, when the data is just to be eaten.  Returns 'len'.
+ */
+int
+bdat_copybulk(crp, buf, len, fp)
+	int *crp;
+	const char *buf;
+	int len;
+	FILE *fp;
+{
+	const char *p = buf, *end = buf + len, *s;
+
+	while (p < end) {
+	  if (*crp == '\r') {
+	    /* The suspended CR, and whatever is after it; another CR
+	       replaces it (the classic mvbdata() does the same) */
+	    if (*p != '\r' && fp && !ferror(fp)) {
+	      if (*p != '\n')
+		putc('\r', fp);
+	      putc(*p, fp);
+	    }
+	    *crp = *p++;
+	    continue;
+	  }
+
+	  s = memchr(p, '\r', end - p);
+	  if (s == NULL)
+	    s = end;
+	  if (s > p) {
+	    if (fp && !ferror(fp))
+	      fwrite(p, 1, s - p, fp);
+	    *crp = s[-1];
+	  }
+	  p = s;
+	  if (p < end)
+	    *crp = *p++;	/* Suspend it */
+	}
+	return len;
+}
@@ -840,122 +840,3 @@ int client_dns_verify(state, retmode, domain, alen)
 {
 	return sender_dns_verify(state,retmode, domain, alen);
 }
-
-int rbl_dns_test(state, ipaf, ipaddr, rbldomain, msgp)
-     struct policystate *state;
-     const int ipaf;
-     const u_char *ipaddr;
-     char *rbldomain;
-     char **msgp;
-{
-	char hbuf[2000], *s, *suf;
-	int hspc;
-	struct hostent *hp;
-	int has_ok = 0;
-
-	if (ipaf == P_K_IPv4) {
-	  sprintf(hbuf, "%d.%d.%d.%d.",
-		  ipaddr[3], ipaddr[2], ipaddr[1], ipaddr[0]);
-
-	} else { /* Ok, the other variant is IPv6 ... */
-
-	  int i;
-	  for (i = 15; i >= 0; --i) {
-	    sprintf(hbuf + ((15-i) << 2),
-		    "%x.%x.", ipaddr[i] & 0x0F, (ipaddr[i] >> 4) & 0x0F);
-	  }
-	  strcpy(hbuf+64,"ip6."); /* Fixed length of hex nybbles */
-	}
-
-	suf = hbuf + strlen(hbuf);
-	hspc = sizeof(hbuf) - strlen(hbuf) - 2;
-
-	while (*rbldomain) {
-	  /* "rbldomain" is possibly a COLON-demarked set of
-	     domain names:  rbl.maps.vix.com:dul.maps.vix.com
-	     which isn't so easy to read, but ... */
-	  /* The 2000 char buffer should be way oversized
-	     for this routine's needs..  And it is managerial
-	     input at the policy database, which has the "unpredictable"
-	     size...  */
-	  s = strchr(rbldomain, ':');
-	  if (s) *s = 0;
-#if 0 /* Remove the old hard-coded "+" macro ... */
-	  if (strcmp(rbldomain,"+") == 0)
-	    strncpy (suf, "rbl.maps.vix.com", hspc);
-	  else
-#endif
-	    strncpy (suf, rbldomain, hspc);
-	  suf[hspc] = '\0';
-
-	  if (s) {
-	    *s = ':';
-	    rbldomain = s+1;
-	  } else {
-	    rbldomain += strlen(rbldomain);
-	  }
-
-	  /* Add explicite DOT into the tail of the lookup object.
-	     That way the lookup should never use resolver's  SEARCH
-	     suffix set. */
-
-	  s = suf + strlen(suf) - 1;
-	  if (*s != '.') {
-	    *(++s) = '.';
-	    *(++s) = 0;
-	  }
-
-
-	  if (debug)
-	    printf("000- looking up DNS A object: %s\n", hbuf);
-
-
-	  hp = gethostbyname(hbuf);
-	  if (hp != NULL) {
-	    /* XX: Should verify that the named object has A record: 127.0.0.2
-	       D'uh.. alternate dataset has A record: 127.0.0.3 */
-	    char abuf[30];
-
-	    inet_ntop(AF_INET, (void*) hp->h_addr, abuf, sizeof(abuf));
-
-	    type(NULL,0,NULL, "Looked up DNS A object: %s -> %s", hbuf, abuf);
-
-	    if (strncmp("127.0.0.",abuf,8) != 0) {
-	      has_ok = 1;
-	      continue; /* Isn't  127.0.0.* */
-	    }
-#if 0
-	    if (strcmp("127.0.0.4",abuf) == 0) {
-	      /* ORBS NETBLOCK */
-	      if (has_ok) continue;
-	    }
-#endif
-	    /* Ok, then lookup for the TXT entry too! */
-	    if (debug)
-	      printf("000- looking up DNS TXT object: %s\n", hbuf);
-
-	    if (dnsmxlookup(state, hbuf, 0, 0, T_TXT) == 1) {
-	      if (*msgp != NULL)
-		free(*msgp);
-	      *msgp = strdup(txt_buf);
-	      s = *msgp;
-	      if (s) {
-		for ( ;*s; ++s) {
-		  int c = ((*s) & 0xFF);
-		  /* Characters not printable in ISO-8859-*
-		     are masked with space. */
-		  if (c < ' ' || (c >= 127 && c < 128+32) || c == 255)
-		    *s = ' ';
-		}
-	      }
-	      type(NULL,0,NULL,"Found DNS TXT object: %s\n",
-		   (*msgp ? *msgp : "<nil>"));
-	    }
-	    return -1;
-	  }
-	  /* Didn't find A record */
-	  type(NULL,0,NULL, "Didn't find DNS A object: %s", hbuf);
-	}
-
-	return 0;
-}
@@ -0,0 +1,387 @@
+/*
+ *  The "mmap" policy database of the smtpserver
+ *
+ *  The  makedb -p mmap  compiles the policy source into one read-only
+ *  image (see "policy.h" for its layout), which we map into memory
+ *  with  mmap(MAP_SHARED).  All smtpserver processes thus share the
+ *  same pages of the page cache, and a query just walks the image:
+ *  no copying, no memory allocation, no database library.
+ *
+ *  The IP addresses are in prefix tries, and the domain names in
+ *  a trie of their labels, thus the checkaddr() and check_domain()
+ *  of policytest.c can find the longest matching prefix, or the
+ *  closest matching domain, with one walk, instead of probing each
+ *  of the prefix widths, and each of the domain suffixes in turn.
+ *
+ *  When the policy-builder replaces the file, the next policyinit()
+ *  notices it, and maps the new one.
+ */
+
+#include "smtpserver.h"
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_MMAP
+
+struct pmdb {
+	const char	*base;	/* The mapped image	*/
+	size_t		size;
+	dev_t		dev;	/* Of the file mapped	*/
+	ino_t		ino;
+	time_t		mtime;
+};
+
+#define PMDB_AT(db, off, type)	((const type *)((db)->base + (off)))
+
+/* Does the  [off, off+len)  fit inside the image ? */
+static int pmdb_inside __((const struct pmdb *, unsigned int, unsigned int));
+static int
+pmdb_inside(db, off, len)
+	const struct pmdb *db;
+	unsigned int off, len;
+{
+	return (off <= db->size && len <= db->size - off);
+}
+
+struct pmdb *
+pmdb_open(path)
+	const char *path;
+{
+	struct pmdb *db;
+	const struct pmdb_head *head;
+	struct stat stbuf;
+	void *p;
+	int fd;
+
+	fd = open(path, O_RDONLY, 0);
+	if (fd < 0)
+	  return NULL;
+	if (fstat(fd, &stbuf) < 0 || stbuf.st_size < sizeof(*head)) {
+	  close(fd);
+	  errno = EINVAL;
+	  return NULL;
+	}
+	p = mmap(NULL, stbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	  return NULL;
+
+	head = (const struct pmdb_head *)p;
+	if (memcmp(head->magic, PMDB_MAGIC, sizeof(head->magic)) != 0 ||
+	    head->byteorder != PMDB_BYTEORDER ||
+	    head->size != stbuf.st_size) {
+	  /* Not ours, made at a host of other byte order, or truncated */
+	  munmap(p, stbuf.st_size);
+	  errno = EINVAL;
+	  return NULL;
+	}
+
+	db = (struct pmdb *) emalloc(sizeof(*db));
+	db->base  = (const char *)p;
+	db->size  = stbuf.st_size;
+	db->dev   = stbuf.st_dev;
+	db->ino   = stbuf.st_ino;
+	db->mtime = stbuf.st_mtime;
+	return db;
+}
+
+void
+pmdb_close(db)
+	struct pmdb *db;
+{
+	munmap((void *)db->base, db->size);
+	free(db);
+}
+
+/* Has the file been replaced since it was mapped ? */
+int
+pmdb_changed(db, path)
+	struct pmdb *db;
+	const char *path;
+{
+	struct stat stbuf;
+
+	if (stat(path, &stbuf) < 0)
+	  return 0;	/* Keep the old one, then */
+	return (stbuf.st_dev != db->dev || stbuf.st_ino != db->ino ||
+		stbuf.st_mtime != db->mtime || stbuf.st_size != db->size);
+}
+
+
+/* Do the first 'width' bits of 'a' and 'b' match ? */
+static int pmdb_prefixeq __((const unsigned char *, const unsigned char *, int));
+static int
+pmdb_prefixeq(a, b, width)
+	const unsigned char *a, *b;
+	int width;
+{
+	int n = width >> 3, rest = width & 7;
+
+	if (memcmp(a, b, n) != 0)
+	  return 0;
+	if (rest && ((a[n] ^ b[n]) & (0xFF << (8 - rest)) & 0xFF))
+	  return 0;
+	return 1;
+}
+
+/*
+ *  Walk the IP trie along the 'addr/width'; returns the deepest node
+ *  with attributes (the longest matching prefix), or with 'exact',
+ *  only one of exactly that width.
+ */
+static const struct pmdb_ipnode *pmdb_ipwalk __((const struct pmdb *, int, const unsigned char *, int, int));
+static const struct pmdb_ipnode *
+pmdb_ipwalk(db, type, addr, width, exact)
+	const struct pmdb *db;
+	int type, width, exact;
+	const unsigned char *addr;
+{
+	const struct pmdb_head *head = PMDB_AT(db, 0, struct pmdb_head);
+	const struct pmdb_ipnode *n, *best = NULL;
+	unsigned int off;
+	int bit, depth = 0;
+
+	off = (type == P_K_IPv4) ? head->ip4root : head->ip6root;
+
+	while (off != 0 && pmdb_inside(db, off, sizeof(*n))) {
+	  n = PMDB_AT(db, off, struct pmdb_ipnode);
+	  /* The width is always growing, thus the walk ends */
+	  if (n->width < depth || n->width > width ||
+	      !pmdb_prefixeq(n->addr, addr, n->width))
+	    break;
+	  if (n->data != 0 && (!exact || n->width == width))
+	    best = n;
+	  if (n->width == width)
+	    break;
+	  depth = n->width + 1;
+	  bit = (addr[n->width >> 3] >> (7 - (n->width & 7))) & 1;
+	  off = n->child[bit];
+	}
+	return best;
+}
+
+/* Find the label of 'len' bytes amongst the children of 'n' */
+static const struct pmdb_domnode *pmdb_domchild __((const struct pmdb *, const struct pmdb_domnode *, const char *, int));
+static const struct pmdb_domnode *
+pmdb_domchild(db, n, label, len)
+	const struct pmdb *db;
+	const struct pmdb_domnode *n;
+	const char *label;
+	int len;
+{
+	const struct pmdb_domnode *c;
+	const char *s;
+	int lo = 0, hi = n->nchildren, mid, rc;
+
+	if (!pmdb_inside(db, n->children, hi * sizeof(*c)))
+	  return NULL;
+	while (lo < hi) {
+	  mid = (lo + hi) >> 1;
+	  c = PMDB_AT(db, n->children + mid * sizeof(*c), struct pmdb_domnode);
+	  if (c->label >= db->size)
+	    return NULL;
+	  s = db->base + c->label;
+	  rc = strncmp(s, label, len);
+	  if (rc == 0)
+	    rc = (s[len] != 0);
+	  if (rc == 0)
+	    return c;
+	  if (rc < 0)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+	return NULL;
+}
+
+/*
+ *  Walk the domain trie for the 'name', rightmost label first.
+ *  The 'want' tells which of the 'exact', or 'wild' entries is
+ *  wanted at the end of the name: 1 = exact, 2 = wild, 3 = either.
+ *  With 'closest' the wild entries of the shorter suffixes are
+ *  fine too.  Returns the node, the kind found in *wildp, and
+ *  in *suffixp where in the 'name' the suffix of the node starts.
+ */
+static const struct pmdb_domnode *pmdb_domwalk __((const struct pmdb *, const char *, int, int, int *, const char **));
+static const struct pmdb_domnode *
+pmdb_domwalk(db, name, want, closest, wildp, suffixp)
+	const struct pmdb *db;
+	const char *name, **suffixp;
+	int want, closest, *wildp;
+{
+	const struct pmdb_head *head = PMDB_AT(db, 0, struct pmdb_head);
+	const struct pmdb_domnode *n, *best = NULL;
+	const char *end, *s;
+
+	if (head->domroot == 0 || !pmdb_inside(db, head->domroot, sizeof(*n)))
+	  return NULL;
+	n = PMDB_AT(db, head->domroot, struct pmdb_domnode);
+
+	end = s = name + strlen(name);
+	if (end > name) {
+	  for (;;) {
+	    if (closest && n->wild != 0) {
+	      best = n;
+	      *wildp = 1;
+	      *suffixp = s;
+	    }
+	    for (s = end; s > name && s[-1] != '.'; --s)
+	      ;
+	    n = pmdb_domchild(db, n, s, end - s);
+	    if (n == NULL)
+	      return best;
+	    if (s == name)
+	      break;
+	    end = s - 1;
+	  }
+	}
+	if ((want & 1) && n->exact != 0) {
+	  *wildp = 0;
+	  *suffixp = s;
+	  return n;
+	}
+	if ((want & 2) && n->wild != 0) {
+	  *wildp = 1;
+	  *suffixp = s;
+	  return n;
+	}
+	return best;
+}
+
+/*
+ *  Fetch the attributes of the policy 'key' (len, type, data[]).
+ *  Returns a pointer into the image -- which the caller must not
+ *  free, nor modify -- and the length in *rlenp, or NULL.
+ */
+const void *
+pmdb_get(db, key, rlenp)
+	struct pmdb *db;
+	const unsigned char *key;
+	int *rlenp;
+{
+	const struct pmdb_head *head = PMDB_AT(db, 0, struct pmdb_head);
+	const struct pmdb_ipnode *ipn;
+	const struct pmdb_domnode *dn;
+	const struct pmdb_key *k;
+	const unsigned char *s;
+	const char *suffix;
+	unsigned int off = 0, len = 0;
+	int lo, hi, mid, rc, wild;
+
+	switch (key[1]) {
+	case P_K_IPv4:
+	case P_K_IPv6:
+	  ipn = pmdb_ipwalk(db, key[1], key + 2,
+			    key[(key[1] == P_K_IPv4) ? 6 : 18], 1);
+	  if (ipn) {
+	    off = ipn->data;
+	    len = ipn->dlen;
+	  }
+	  break;
+
+	case P_K_DOMAIN:
+	  if (key[2] == '.')
+	    dn = pmdb_domwalk(db, (const char *)key + 3, 2, 0, &wild, &suffix);
+	  else
+	    dn = pmdb_domwalk(db, (const char *)key + 2, 1, 0, &wild, &suffix);
+	  if (dn) {
+	    off = wild ? dn->wild    : dn->exact;
+	    len = wild ? dn->wildlen : dn->exactlen;
+	  }
+	  break;
+
+	default:
+	  if (!pmdb_inside(db, head->keytab, head->nkeys * sizeof(*k)))
+	    return NULL;
+	  lo = 0;
+	  hi = head->nkeys;
+	  while (lo < hi) {
+	    mid = (lo + hi) >> 1;
+	    k = PMDB_AT(db, head->keytab + mid * sizeof(*k), struct pmdb_key);
+	    if (!pmdb_inside(db, k->key, 1))
+	      return NULL;
+	    s = (const unsigned char *)db->base + k->key;
+	    rc = memcmp(s, key, (s[0] < key[0]) ? s[0] : key[0]);
+	    if (rc == 0)
+	      rc = s[0] - key[0];
+	    if (rc == 0) {
+	      off = k->data;
+	      len = k->dlen;
+	      break;
+	    }
+	    if (rc < 0)
+	      lo = mid + 1;
+	    else
+	      hi = mid;
+	  }
+	  break;
+	}
+
+	if (off == 0 || !pmdb_inside(db, off, len))
+	  return NULL;
+	*rlenp = len;
+	return db->base + off;
+}
+
+/*
+ *  The longest prefix of the IP address key 'pbuf' that is in the
+ *  database; the 'pbuf' is changed into that key.  Returns 0 when
+ *  found, -1 when not.
+ */
+int
+pmdb_ipmatch(db, pbuf)
+	struct pmdb *db;
+	unsigned char *pbuf;
+{
+	const struct pmdb_ipnode *n;
+	int widthpos = (pbuf[1] == P_K_IPv4) ? 6 : 18;
+	int i;
+
+	n = pmdb_ipwalk(db, pbuf[1], pbuf + 2, pbuf[widthpos], 0);
+	if (n == NULL)
+	  return -1;
+
+	for (i = n->width; i < (widthpos - 2) * 8; ++i)
+	  pbuf[2 + (i >> 3)] &= ~(0x80 >> (i & 7));
+	pbuf[widthpos] = n->width;
+	return 0;
+}
+
+/*
+ *  The closest domain key for the P_K_DOMAIN key in 'pbuf', in the
+ *  same order as the check_domain() would probe them:  "foo.bar",
+ *  ".foo.bar", ".bar", ".";  the 'pbuf' (of 'size' bytes) is changed
+ *  into that key.  Returns 0 when found, -1 when not.
+ */
+int
+pmdb_dommatch(db, pbuf, size)
+	struct pmdb *db;
+	unsigned char *pbuf;
+	int size;
+{
+	const struct pmdb_domnode *n;
+	const char *name = (const char *)pbuf + 2, *suffix;
+	int wild = 0, len;
+
+	if (*name == '.')
+	  n = pmdb_domwalk(db, name + 1, 2, 1, &wild, &suffix);
+	else
+	  n = pmdb_domwalk(db, name, 3, 1, &wild, &suffix);
+	if (n == NULL)
+	  return -1;
+	if (!wild)
+	  return 0;	/* The name as is */
+
+	/* "." + the suffix; it is never longer than "." + the name */
+	len = strlen(suffix);
+	if (len + 4 > size)
+	  return -1;
+	memmove(pbuf + 3, suffix, len + 1);
+	pbuf[2] = '.';
+	pbuf[0] = len + 1 + 1 + 2;
+	return 0;
+}
+
+#endif /* HAVE_MMAP */
@@ -241,18 +241,41 @@ int policyinit(state, rel, submission_mode_flags, valid_whoson)
     if (cistrcmp(rel->dbtype, "sleepyrpc") == 0)
 	rel->dbt = _dbt_sleepyrpc;
 #endif
+#endif
+#ifdef HAVE_MMAP
+    if (cistrcmp(rel->dbtype, "mmap") == 0)
+	rel->dbt = _dbt_mmap;
 #endif
     if (rel->dbt == _dbt_none) {
 	/* XX: ERROR! Unknown/unsupported dbtype! */
       state->PT = NULL;
       return 1;
     }
-    openok = 0;
 #ifdef HAVE_ALLOCA
     dbname = (char*)alloca(strlen(rel->dbpath) + 8);
 #else
     dbname = (char*)emalloc(strlen(rel->dbpath) + 8);
 #endif
+#ifdef HAVE_MMAP
+    /* The compiled image is cheap to map again, when it was replaced */
+    if (rel->dbopen && rel->dbt == _dbt_mmap) {
+      sprintf(dbname, "%s%s", rel->dbpath, PMDB_SUFFIX);
+      if (pmdb_changed(rel->mmapdb, dbname)) {
+	pmdb_close(rel->mmapdb);
+	rel->mmapdb = NULL;
+	rel->dbopen = 0;
+      }
+    }
+#endif
+    /* A pre-forked worker runs many sessions, the database stays open */
+    if (rel->dbopen) {
+#ifndef HAVE_ALLOCA
+      free(dbname);
+#endif
+      goto opened;
+    }
+
+    openok = 0;
     switch (rel->dbt) {
 #ifdef HAVE_NDBM
     case _dbt_ndbm:
@@ -391,6 +414,14 @@ int policyinit(state, rel, submission_mode_flags, valid_whoson)
 #endif
 #endif
 	break;
+#endif
+#ifdef HAVE_MMAP
+    case _dbt_mmap:
+	/* Append '.zmdb' to the name */
+	sprintf(dbname, "%s%s", rel->dbpath, PMDB_SUFFIX);
+	rel->mmapdb = pmdb_open(dbname);
+	openok = (rel->mmapdb != NULL);
+	break;
 #endif
     default:
 	break;
@@ -412,7 +443,9 @@ int policyinit(state, rel, submission_mode_flags, valid_whoson)
 #ifndef HAVE_ALLOCA
     free(dbname);
 #endif
+    rel->dbopen = 1;
 
+ opened:
 #ifdef HAVE_WHOSON_H
     state->valid_whoson = valid_whoson;
 #endif
@@ -606,6 +639,15 @@ static void *dbquery(rel, qptr, qlen, rlenp)
 	break; /* some compilers complain, some produce bad code
 		  without this... */
 #endif
+#ifdef HAVE_MMAP
+    case _dbt_mmap:
+
+	/* Straight from the mapped image, NOT to be freed! */
+	return (void *) pmdb_get(rel->mmapdb, qptr, rlenp);
+
+	break; /* some compilers complain, some produce bad code
+		  without this... */
+#endif
     default:
 	break;
     }
@@ -807,7 +849,7 @@ static int resolveattributes(rel, recursions, state, key, init)
     }				/* End of while. */
 
     /* Free memory from attribute list. Allocated in dbquery. */
-    if (str_base)
+    if (str_base && rel->dbt != _dbt_mmap)
 	free(str_base);
 
     if (msgstr) free(msgstr);
@@ -852,6 +894,15 @@ static int checkaddr(state, pbuf)
     result = 1;
     count = 0;
 
+#ifdef HAVE_MMAP
+    /* The longest matching prefix with one walk of the trie */
+    if (rel->dbt == _dbt_mmap) {
+      if (pmdb_ipmatch(rel->mmapdb, (u_char*)pbuf) == 0)
+	result = resolveattributes(rel, maxrecursions, state, pbuf, 1);
+      count = countmax + 1;	/* Skip the probing */
+    }
+#endif
+
     while (result != 0 && count <= countmax) {
 
 	count++;
@@ -1387,6 +1438,18 @@ static int check_domain(state, input, inlen)
     pbuf[0] = plen;
     pbuf[1] = P_K_DOMAIN;
 
+#ifdef HAVE_MMAP
+    /* The closest of the names below with one walk of the trie */
+    if (state->PT->dbt == _dbt_mmap) {
+      if (pmdb_dommatch(state->PT->mmapdb, pbuf, sizeof(pbuf)) == 0) {
+	if (debug)
+	  type(NULL,0,NULL," DEBUG: %s", showkey(pbuf));
+	checkaddr(state, pbuf);
+      }
+      return 0;
+    }
+#endif
+
     result = 1;
 
     while (result != 0) {
@@ -96,7 +96,8 @@ typedef union {
 #ifdef _POLICYTEST_INTERNAL_
 
 typedef enum {
-    _dbt_none, _dbt_btree, _dbt_bhash, _dbt_ndbm, _dbt_gdbm, _dbt_sleepyrpc
+    _dbt_none, _dbt_btree, _dbt_bhash, _dbt_ndbm, _dbt_gdbm, _dbt_sleepyrpc,
+    _dbt_mmap
 } dbtypes;
 
 
@@ -104,6 +105,7 @@ struct policytest {
     char *dbtype;
     char *dbpath;
     dbtypes dbt;
+    int dbopen;		/* Kept open from one session to the next */
     struct {
 #ifdef HAVE_NDBM
 	DBM *_ndbm;
@@ -116,6 +118,9 @@ struct policytest {
 #if defined(HAVE_DB3) || defined(HAVE_DB4)
         DB_ENV *_db_env;
 #endif
+#endif
+#ifdef HAVE_MMAP
+	struct pmdb *_pmdb;
 #endif
     } db_;
 #define btree     db_._db
@@ -123,6 +128,7 @@ struct policytest {
 #define sleepyrpc db_._db
 #define gdbm      db_._gdbm
 #define ndbm      db_._ndbm
+#define mmapdb    db_._pmdb
 };
 
 #else				/* This is the external interface -- doesn't tell a thing ;-) */
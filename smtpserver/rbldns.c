@@ -0,0 +1,645 @@
+/*
+ *   rbl_dns_test() -- subroutine for ZMailer smtpserver
+ *
+ *   The address is looked up at all of the RBL zones at once: the
+ *   queries are sent out in parallel over one UDP socket, and the
+ *   answers are collected with one common timeout.  The results go
+ *   into a cache shared by all smtpserver processes (a MAP_SHARED
+ *   segment set up by the master before it forks anything), with
+ *   the TTL the DNS gave them, thus the next connection from the
+ *   same address doesn't repeat the same lookups.
+ *
+ *   The cache entries are guarded with a generation counter:
+ *   a writer makes it odd for the duration of the update, and
+ *   a reader retries (or rather: treats it as a miss) when the
+ *   counter was odd, or changed under it.
+ *
+ *   The routine was moved here from  mxverify.c.
+ */
+
+#include "smtpserver.h"
+#include "zresolv.h"
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+extern int debug;
+
+int RblCacheSize = 2048;	/* Entries in the shared cache; 0: none	*/
+int RblTimeout   = 10;		/* Seconds for the whole set of lookups	*/
+
+#define RBL_NAMELEN	256
+#define RBL_TXTLEN	256
+#define RBL_NEGTTL	300	/* NXDOMAIN without SOA in the answer	*/
+#define RBL_MAXTTL	3600	/* Don't keep anything longer than this	*/
+#define RBL_RETRANS	2000	/* msec in between the resends		*/
+#define RBL_WAYS	4	/* Cache set associativity		*/
+
+#define RBL_TEMPFAIL	0	/* No answer, or SERVFAIL	*/
+#define RBL_NOTFOUND	1	/* NXDOMAIN, or no such data	*/
+#define RBL_FOUND	2
+
+struct rblquery {
+	char	name[RBL_NAMELEN];
+	int	qtype;
+	int	done;		/* Answered, or from the cache	*/
+	int	cached;
+	int	result;
+	int	ttl;
+	u_char	a[4];
+	char	txt[RBL_TXTLEN];
+	int	pktlen;
+	u_char	pkt[PACKETSZ];
+};
+
+struct rblcache_ent {
+	volatile unsigned int gen;	/* Odd while being written	*/
+	int	qtype;
+	time_t	expires;
+	int	result;
+	u_char	a[4];
+	char	name[RBL_NAMELEN];
+	char	txt[RBL_TXTLEN];
+};
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define rbl_barrier() __sync_synchronize()
+#endif
+
+static struct rblcache_ent *rblcache = NULL;
+static int rblcache_slots = 0;
+
+
+/*
+ *  Called at the master before the forks; the children
+ *  inherit the segment.  Without it, there is no caching.
+ */
+void rbl_cache_init()
+{
+#if defined(HAVE_MMAP) && defined(rbl_barrier)
+	int slots = (RblCacheSize + RBL_WAYS-1) & ~(RBL_WAYS-1);
+	size_t size = slots * sizeof(struct rblcache_ent);
+	void *p;
+
+	if (rblcache != NULL || slots <= 0)
+	  return;
+
+#ifdef MAP_ANONYMOUS
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		 MAP_ANONYMOUS|MAP_SHARED, -1, 0);
+#else
+	{
+	  /* Must have a file ? (SunOS 4.1, et.al.) */
+	  FILE *fp = tmpfile();
+	  p = MAP_FAILED;
+	  if (fp && ftruncate(fileno(fp), size) == 0)
+	    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED,
+		     fileno(fp), 0);
+	  if (fp) fclose(fp);
+	}
+#endif
+	if (p == MAP_FAILED) {
+	  type(NULL,0,NULL, "RBL cache mmap() of %ld bytes failed; errno=%d",
+	       (long)size, errno);
+	  return;
+	}
+	memset(p, 0, size);
+	rblcache = (struct rblcache_ent *)p;
+	rblcache_slots = slots;
+#endif
+}
+
+#if defined(HAVE_MMAP) && defined(rbl_barrier)
+
+static struct rblcache_ent *rbl_cache_set __((const struct rblquery *));
+static struct rblcache_ent *
+rbl_cache_set(q)
+	const struct rblquery *q;
+{
+	unsigned long h = pjwhash32(q->name) + q->qtype;
+
+	return &rblcache[(h % (rblcache_slots / RBL_WAYS)) * RBL_WAYS];
+}
+
+/* Returns 0 and fills in the query from the cache, -1 on a miss */
+static int rbl_cache_get __((struct rblquery *));
+static int
+rbl_cache_get(q)
+	struct rblquery *q;
+{
+	struct rblcache_ent *e, ent;
+	unsigned int gen;
+	time_t now_;
+	int i;
+
+	if (rblcache == NULL)
+	  return -1;
+
+	time(&now_);
+	e = rbl_cache_set(q);
+	for (i = 0; i < RBL_WAYS; ++i, ++e) {
+	  gen = e->gen;
+	  if (gen & 1)
+	    continue;
+	  rbl_barrier();
+	  memcpy(&ent, e, sizeof(ent));
+	  rbl_barrier();
+	  if (e->gen != gen)
+	    continue;	/* Changed while we looked */
+
+	  if (ent.qtype != q->qtype || ent.expires < now_ ||
+	      strcmp(ent.name, q->name) != 0)
+	    continue;
+
+	  q->result = ent.result;
+	  q->ttl    = ent.expires - now_;
+	  memcpy(q->a, ent.a, sizeof(q->a));
+	  memcpy(q->txt, ent.txt, sizeof(q->txt));
+	  q->txt[sizeof(q->txt)-1] = 0;
+	  q->done   = 1;
+	  q->cached = 1;
+	  MIBMtaCnt->ss.IncomingSMTP_RBL_cachehits ++;
+	  return 0;
+	}
+	return -1;
+}
+
+static void rbl_cache_put __((const struct rblquery *));
+static void
+rbl_cache_put(q)
+	const struct rblquery *q;
+{
+	struct rblcache_ent *e, *victim = NULL;
+	unsigned int gen;
+	time_t now_;
+	int i;
+
+	if (rblcache == NULL || q->result == RBL_TEMPFAIL || q->ttl <= 0)
+	  return;
+
+	time(&now_);
+	e = rbl_cache_set(q);
+	for (i = 0; i < RBL_WAYS; ++i, ++e) {
+	  if (e->qtype == q->qtype && strcmp(e->name, q->name) == 0) {
+	    victim = e;	/* Refresh of our own */
+	    break;
+	  }
+	  if (victim == NULL || e->expires < victim->expires)
+	    victim = e;	/* The one expiring first */
+	}
+
+	gen = victim->gen;
+	if ((gen & 1) || !__sync_bool_compare_and_swap(&victim->gen, gen, gen+1))
+	  return;	/* Someone else is at it, let them be */
+	rbl_barrier();
+
+	victim->qtype   = q->qtype;
+	victim->expires = now_ + q->ttl;
+	victim->result  = q->result;
+	memcpy(victim->a, q->a, sizeof(victim->a));
+	memcpy(victim->name, q->name, sizeof(victim->name));
+	memcpy(victim->txt, q->txt, sizeof(victim->txt));
+
+	rbl_barrier();
+	victim->gen = gen + 2;
+}
+
+#else /* No shared memory cache */
+
+#define rbl_cache_get(q) (-1)
+#define rbl_cache_put(q) do { } while (0)
+
+#endif
+
+
+/* Pick the result out of the DNS answer */
+static void rbl_parse __((struct rblquery *, const u_char *, int));
+static void
+rbl_parse(q, answer, len)
+	struct rblquery *q;
+	const u_char *answer;
+	int len;
+{
+	const HEADER *hp = (const HEADER *) answer;
+	const u_char *eom = answer + len, *cp, *cpnext;
+	int qdcount, ancount, nscount, n, ttl, minttl;
+	u_short type, class;
+
+	q->done   = 1;
+	q->result = RBL_TEMPFAIL;
+	q->ttl    = RBL_NEGTTL;
+
+	if (len < HFIXEDSZ)
+	  return;
+
+	qdcount = ntohs(hp->qdcount);
+	ancount = ntohs(hp->ancount);
+	nscount = ntohs(hp->nscount);
+
+	if (hp->rcode != NOERROR && hp->rcode != NXDOMAIN)
+	  return;	/* SERVFAIL, et.al. */
+
+	cp = answer + HFIXEDSZ;
+	for (; qdcount > 0 && cp < eom; --qdcount) {
+	  n = dn_skipname(cp, eom);
+	  if (n < 0)
+	    return;
+	  cp += n + QFIXEDSZ;
+	}
+
+	q->result = RBL_NOTFOUND;
+
+	/* The answer section; we want the first of our type */
+	for ( ; ancount > 0 && cp < eom; --ancount, cp = cpnext) {
+	  n = dn_skipname(cp, eom);
+	  if (n < 0 || cp + n + 10 > eom)
+	    goto bad;
+	  cp += n;
+	  NS_GET16(type,  cp);
+	  NS_GET16(class, cp);
+	  NS_GET32(ttl,   cp);
+	  NS_GET16(n,     cp);
+	  cpnext = cp + n;
+	  if (cpnext > eom)
+	    goto bad;
+
+	  if (class != C_IN || type != q->qtype)
+	    continue;	/* CNAME, and such.. */
+
+	  if (type == T_A && n == 4) {
+	    memcpy(q->a, cp, 4);
+	  } else if (type == T_TXT && n > 0) {
+	    int l = (*cp) & 0xFF;	/* 0..255 chars */
+	    if (l > n - 1)
+	      l = n - 1;
+	    if (l > sizeof(q->txt) - 1)
+	      l = sizeof(q->txt) - 1;
+	    memcpy(q->txt, cp+1, l);
+	    q->txt[l] = '\0';
+	  } else
+	    continue;
+
+	  q->result = RBL_FOUND;
+	  q->ttl    = ttl;
+	  if (q->ttl > RBL_MAXTTL)
+	    q->ttl = RBL_MAXTTL;
+	  return;
+	}
+
+	/* Nothing; the negative caching time is at the SOA of
+	   the authority section: min(SOA TTL, SOA MINIMUM) */
+	for ( ; nscount > 0 && cp < eom; --nscount, cp = cpnext) {
+	  n = dn_skipname(cp, eom);
+	  if (n < 0 || cp + n + 10 > eom)
+	    goto bad;
+	  cp += n;
+	  NS_GET16(type,  cp);
+	  NS_GET16(class, cp);
+	  NS_GET32(ttl,   cp);
+	  NS_GET16(n,     cp);
+	  cpnext = cp + n;
+	  if (cpnext > eom)
+	    goto bad;
+	  if (type != T_SOA)
+	    continue;
+
+	  n = dn_skipname(cp, cpnext);		/* MNAME */
+	  if (n < 0) goto bad;
+	  cp += n;
+	  n = dn_skipname(cp, cpnext);		/* RNAME */
+	  if (n < 0) goto bad;
+	  cp += n;
+	  if (cp + 5*NS_INT32SZ > cpnext)
+	    goto bad;
+	  cp += 4*NS_INT32SZ;	/* serial, refresh, retry, expire */
+	  NS_GET32(minttl, cp);
+	  q->ttl = (ttl < minttl) ? ttl : minttl;
+	  if (q->ttl > RBL_MAXTTL)
+	    q->ttl = RBL_MAXTTL;
+	  return;
+	}
+	return;
+
+ bad:	/* Malformed; don't believe (nor cache) any of it */
+	q->result = RBL_TEMPFAIL;
+}
+
+/* The classic way, one at the time; for a truncated answer, et.al. */
+static void rbl_send1 __((struct rblquery *));
+static void
+rbl_send1(q)
+	struct rblquery *q;
+{
+	querybuf answer;
+	int n;
+
+	n = res_send(q->pkt, q->pktlen, (void*)&answer, sizeof(answer));
+	if (n < 0) {
+	  q->done   = 1;
+	  q->result = RBL_TEMPFAIL;
+	  return;
+	}
+	rbl_parse(q, (u_char *)&answer, n);
+}
+
+static long rbl_msecs __((void));
+static long
+rbl_msecs()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000L) + (tv.tv_usec / 1000);
+}
+
+/* Which of the queries this answer is for ?  NULL if none. */
+static struct rblquery *rbl_match __((struct rblquery *, int,
+				      const u_char *, int));
+static struct rblquery *
+rbl_match(qs, nq, answer, len)
+	struct rblquery *qs;
+	int nq;
+	const u_char *answer;
+	int len;
+{
+	const HEADER *hp = (const HEADER *) answer;
+	char name[MAXDNAME];
+	int i, n, l;
+
+	if (len < HFIXEDSZ || !hp->qr || ntohs(hp->qdcount) != 1)
+	  return NULL;
+
+	n = dn_expand(answer, answer + len, answer + HFIXEDSZ,
+		      name, sizeof(name));
+	if (n < 0)
+	  return NULL;
+	n = strlen(name);
+
+	for (i = 0; i < nq; ++i) {
+	  if (qs[i].done || ((const HEADER *)qs[i].pkt)->id != hp->id)
+	    continue;
+	  /* Our names have the explicit tail dot, dn_expand() gives none */
+	  l = strlen(qs[i].name);
+	  if (l > 0 && qs[i].name[l-1] == '.')
+	    --l;
+	  if (l == n && cistrncmp(qs[i].name, name, n) == 0)
+	    return &qs[i];
+	}
+	return NULL;
+}
+
+/*
+ *  Resolve all of the not-yet-done queries in parallel.
+ *  Whatever has no answer at the end of RblTimeout is a TEMPFAIL.
+ */
+static void rbl_resolve __((struct rblquery *, int));
+static void
+rbl_resolve(qs, nq)
+	struct rblquery *qs;
+	int nq;
+{
+	static struct zmpollfd *fds = NULL;
+	int fdscount;
+	int sock, i, n, ns, pending;
+	long deadline, resend, now_;
+	u_char answer[PACKETSZ];
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	struct rblquery *q;
+
+	if (!(_res.options & RES_INIT))
+	  res_init();
+
+	pending = 0;
+	for (i = 0; i < nq; ++i) {
+	  if (qs[i].done) continue;
+	  qs[i].pktlen = res_mkquery(QUERY, qs[i].name, C_IN, qs[i].qtype,
+				     NULL, 0, NULL, qs[i].pkt,
+				     sizeof(qs[i].pkt));
+	  if (qs[i].pktlen < 0) {
+	    qs[i].done   = 1;
+	    qs[i].result = RBL_TEMPFAIL;
+	    continue;
+	  }
+	  MIBMtaCnt->ss.IncomingSMTP_RBL_queries ++;
+	  ++pending;
+	}
+	if (pending == 0)
+	  return;
+
+	sock = -1;
+	if (_res.nscount > 0 && _res.nsaddr_list[0].sin_family == AF_INET)
+	  sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (sock < 0 || pending == 1) {
+	  /* Nothing to parallelize, or can't */
+	  if (sock >= 0) close(sock);
+	  for (i = 0; i < nq; ++i)
+	    if (!qs[i].done)
+	      rbl_send1(&qs[i]);
+	  return;
+	}
+	fd_nonblockingmode(sock);
+
+	now_     = rbl_msecs();
+	deadline = now_ + RblTimeout * 1000L;
+	ns = 0;
+
+	while (pending > 0 && now_ < deadline) {
+
+	  /* (Re)send the outstanding ones to the next nameserver */
+	  for (i = 0; i < nq; ++i) {
+	    if (qs[i].done) continue;
+	    sendto(sock, qs[i].pkt, qs[i].pktlen, 0,
+		   (struct sockaddr *)&_res.nsaddr_list[ns],
+		   sizeof(_res.nsaddr_list[ns]));
+	  }
+	  if (debug)
+	    printf("000- sent %d RBL queries to nameserver #%d\n", pending, ns);
+	  do {
+	    ns = (ns + 1) % _res.nscount;
+	  } while (ns && _res.nsaddr_list[ns].sin_family != AF_INET);
+
+	  resend = now_ + RBL_RETRANS;
+	  if (resend > deadline)
+	    resend = deadline;
+
+	  while (pending > 0 && now_ < resend) {
+	    fdscount = 0;
+	    zmpoll_addfd(&fds, &fdscount, sock, -1, NULL);
+	    if (zmpoll(fds, fdscount, resend - now_) < 0 && errno != EINTR)
+	      break;
+
+	    for (;;) {
+	      fromlen = sizeof(from);
+	      n = recvfrom(sock, answer, sizeof(answer), 0,
+			   (struct sockaddr *)&from, &fromlen);
+	      if (n < 0)
+		break;
+
+	      for (i = 0; i < _res.nscount; ++i)
+		if (_res.nsaddr_list[i].sin_addr.s_addr == from.sin_addr.s_addr &&
+		    _res.nsaddr_list[i].sin_port == from.sin_port)
+		  break;
+	      if (i >= _res.nscount)
+		continue;	/* Not from our nameservers */
+
+	      q = rbl_match(qs, nq, answer, n);
+	      if (q == NULL)
+		continue;	/* Late duplicate, or junk */
+
+	      if (((HEADER *)answer)->tc)
+		rbl_send1(q);	/* Over TCP, then */
+	      else
+		rbl_parse(q, answer, n);
+	      --pending;
+	    }
+	    now_ = rbl_msecs();
+	  }
+	  now_ = rbl_msecs();
+	}
+	close(sock);
+
+	for (i = 0; i < nq; ++i)
+	  if (!qs[i].done) {
+	    qs[i].done   = 1;
+	    qs[i].result = RBL_TEMPFAIL;
+	  }
+}
+
+
+int rbl_dns_test(state, ipaf, ipaddr, rbldomain, msgp)
+     struct policystate *state;
+     const int ipaf;
+     const u_char *ipaddr;
+     char *rbldomain;
+     char **msgp;
+{
+	char hbuf[RBL_NAMELEN], *s, *suf;
+	struct rblquery *qs, *q, tq;
+	int i, hspc, nq, nzones;
+
+	if (ipaf == P_K_IPv4) {
+	  sprintf(hbuf, "%d.%d.%d.%d.",
+		  ipaddr[3], ipaddr[2], ipaddr[1], ipaddr[0]);
+
+	} else { /* Ok, the other variant is IPv6 ... */
+
+	  for (i = 15; i >= 0; --i) {
+	    sprintf(hbuf + ((15-i) << 2),
+		    "%x.%x.", ipaddr[i] & 0x0F, (ipaddr[i] >> 4) & 0x0F);
+	  }
+	  strcpy(hbuf+64,"ip6."); /* Fixed length of hex nybbles */
+	}
+
+	suf = hbuf + strlen(hbuf);
+	hspc = sizeof(hbuf) - strlen(hbuf) - 2;
+
+	/* "rbldomain" is possibly a COLON-demarked set of
+	   domain names:  rbl.maps.vix.com:dul.maps.vix.com  */
+
+	nzones = 1;
+	for (s = rbldomain; *s; ++s)
+	  if (*s == ':') ++nzones;
+	qs = (struct rblquery *) emalloc(nzones * sizeof(*qs));
+
+	for (nq = 0; *rbldomain; ++nq) {
+	  s = strchr(rbldomain, ':');
+	  if (s) *s = 0;
+	  strncpy (suf, rbldomain, hspc);
+	  suf[hspc] = '\0';
+
+	  if (s) {
+	    *s = ':';
+	    rbldomain = s+1;
+	  } else {
+	    rbldomain += strlen(rbldomain);
+	  }
+
+	  /* Add explicite DOT into the tail of the lookup object.
+	     That way the lookup should never use resolver's  SEARCH
+	     suffix set. */
+
+	  s = suf + strlen(suf) - 1;
+	  if (*s != '.') {
+	    *(++s) = '.';
+	    *(++s) = 0;
+	  }
+
+	  q = &qs[nq];
+	  memset(q, 0, sizeof(*q));
+	  strcpy(q->name, hbuf);
+	  strlower(q->name);
+	  q->qtype = T_A;
+
+	  if (rbl_cache_get(q) == 0 && debug)
+	    printf("000- cached DNS A object: %s\n", q->name);
+	}
+
+	if (debug)
+	  printf("000- looking up %d RBL zones in parallel\n", nq);
+
+	rbl_resolve(qs, nq);
+
+	for (i = 0; i < nq; ++i)
+	  if (!qs[i].cached)
+	    rbl_cache_put(&qs[i]);
+
+	/* The results in the order of the zones */
+
+	for (i = 0; i < nq; ++i) {
+	  char abuf[30];
+
+	  q = &qs[i];
+	  if (q->result != RBL_FOUND) {
+	    type(NULL,0,NULL, "Didn't find DNS A object: %s", q->name);
+	    continue;
+	  }
+
+	  /* XX: Should verify that the named object has A record: 127.0.0.2
+	     D'uh.. alternate dataset has A record: 127.0.0.3 */
+
+	  inet_ntop(AF_INET, (void*) q->a, abuf, sizeof(abuf));
+
+	  type(NULL,0,NULL, "Looked up DNS A object: %s -> %s", q->name, abuf);
+
+	  if (strncmp("127.0.0.",abuf,8) != 0)
+	    continue; /* Isn't  127.0.0.* */
+
+	  /* Ok, then lookup for the TXT entry too! */
+	  if (debug)
+	    printf("000- looking up DNS TXT object: %s\n", q->name);
+
+	  memset(&tq, 0, sizeof(tq));
+	  strcpy(tq.name, q->name);
+	  tq.qtype = T_TXT;
+	  if (rbl_cache_get(&tq) < 0) {
+	    rbl_resolve(&tq, 1);
+	    rbl_cache_put(&tq);
+	  }
+
+	  if (tq.result == RBL_FOUND) {
+	    if (*msgp != NULL)
+	      free(*msgp);
+	    *msgp = strdup(tq.txt);
+	    s = *msgp;
+	    if (s) {
+	      for ( ;*s; ++s) {
+		int c = ((*s) & 0xFF);
+		/* Characters not printable in ISO-8859-*
+		   are masked with space. */
+		if (c < ' ' || (c >= 127 && c < 128+32) || c == 255)
+		  *s = ' ';
+	      }
+	    }
+	    type(NULL,0,NULL,"Found DNS TXT object: %s\n",
+		 (*msgp ? *msgp : "<nil>"));
+	  }
+	  free(qs);
+	  return -1;
+	}
+
+	free(qs);
+	return 0;
+}
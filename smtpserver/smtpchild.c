@@ -17,6 +17,7 @@ static int child_top   = 0;
 static struct {
   int pid;	/* PID of the working smtpserver (subprocess) */
   int tag;	/* 0: smtp, 1: smtps, 2: submit, 3: lmtp, ... */
+  int muxid;	/* Non-zero: a session in the smtpmux process */
   time_t when;	/* When to next check on this child */
   Usockaddr addr; /* Address the connection comes from */
 } *childs = NULL;
@@ -76,28 +77,13 @@ int childsameip(addr, socktag, childcntp)
     return cnt;
 }
 
-void childregister(cpid, addr, socktag)
-     int cpid, socktag;
+static void childslot __((int, int, Usockaddr *, int));
+static void childslot(cpid, muxid, addr, socktag)
+     int cpid, muxid, socktag;
      Usockaddr *addr;
 {
 	int i;
 
-	/* Called with SIGCHLD held ! */
-
-	if (kill(cpid, 0) < 0) {
-	  /* When there is no subprocess with this PID, DON'T
-	     register anything!  The subprocess is already
-	     gone for some reason... */
-	  return;
-	}
-
-	/* Now count those processes.. */
-
-	MIBMtaEntry->ss.IncomingSMTPSERVERprocesses += 1;
-	MIBMtaEntry->ss.IncomingSMTPSERVERforks     += 1;
-
-	/* And do registering!         */
-
 	time(&child_now);
 
 	if (child_top == child_space) {
@@ -133,6 +119,7 @@ void childregister(cpid, addr, socktag)
 	  }
 	  if (childs[i].pid == 0) { /* Free slot! */
 	    childs[i].pid  = cpid;
+	    childs[i].muxid = muxid;
 	    childs[i].when = child_now + child_poll_interval;
 	    childs[i].tag  = socktag;
 	    if (addr->v4.sin_family == AF_INET) {
@@ -153,6 +140,59 @@ void childregister(cpid, addr, socktag)
 	}
 }
 
+void childregister(cpid, addr, socktag)
+     int cpid, socktag;
+     Usockaddr *addr;
+{
+	/* Called with SIGCHLD held ! */
+
+	if (kill(cpid, 0) < 0) {
+	  /* When there is no subprocess with this PID, DON'T
+	     register anything!  The subprocess is already
+	     gone for some reason... */
+	  return;
+	}
+
+	/* Now count those processes.. */
+
+	MIBMtaEntry->ss.IncomingSMTPSERVERprocesses += 1;
+	MIBMtaCnt->ss.IncomingSMTPSERVERforks     += 1;
+
+	/* And do registering!         */
+
+	childslot(cpid, 0, addr, socktag);
+}
+
+/*
+ *  The sessions that the smtpmux keeps are registered under its pid,
+ *  one slot per session, so that childsameip() counts them.  They are
+ *  not processes, thus they do not touch the process gauges.
+ */
+void childregister_mux(muxpid, id, addr, socktag)
+     int muxpid, id, socktag;
+     Usockaddr *addr;
+{
+	/* Called with SIGCHLD held ! */
+
+	if (muxpid <= 0 || id == 0)
+	  return;
+	childslot(muxpid, id, addr, socktag);
+}
+
+void childreap_mux(muxpid, id)
+     int muxpid, id;
+{
+	int i;
+
+	if (childs == NULL) return;
+
+	for (i = 0; i < child_top; ++i)
+	  if (childs[i].pid == muxpid && childs[i].muxid == id) {
+	    memset(&childs[i], 0, sizeof(childs[i]));
+	    break;
+	  }
+}
+
 /* Started children call this to disable this tracking code */
 void disable_childreap()
 {
@@ -170,6 +210,12 @@ int cpid;
 	for (i = 0; i < child_top; ++i)
 	  if (childs[i].pid == cpid) {
 
+	    if (childs[i].muxid != 0) {
+	      /* The smtpmux is gone, and its sessions with it */
+	      memset(&childs[i], 0, sizeof(childs[i]));
+	      continue;
+	    }
+
 	    MIBMtaEntry->ss.IncomingSMTPSERVERprocesses -= 1;
 
 	    /* Drop the class-full counts; the main loop does
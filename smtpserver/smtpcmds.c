@@ -150,10 +150,10 @@ const char *buf, *cp;
 
     switch (SS->carp->cmd) {
     case Hello2:
-      MIBMtaEntry->ss.IncomingSMTP_EHLO += 1;
+      MIBMtaCnt->ss.IncomingSMTP_EHLO += 1;
       break;
     case Hello:
-      MIBMtaEntry->ss.IncomingSMTP_HELO += 1;
+      MIBMtaCnt->ss.IncomingSMTP_HELO += 1;
       break;
     default: /* Should not happen... */
       break;
@@ -671,7 +671,7 @@ int insecure;
 		return -1;
 	    }
 	    drptret_len = (s - drpt_ret);
-	    MIBMtaEntry->ss.IncomingSMTP_OPT_RET ++;
+	    MIBMtaCnt->ss.IncomingSMTP_OPT_RET ++;
 	    continue;
 	}
 	if (OCP->mime8bitok && CISTREQN("BODY=", s, 5)) {
@@ -686,15 +686,15 @@ int insecure;
 	    if (CISTREQN(s, "8BITMIME", 8)) {
 		bodytype = "8BITMIME";
 		s += 8;
-		MIBMtaEntry->ss.IncomingSMTP_OPT_BODY_8BITMIME ++;
+		MIBMtaCnt->ss.IncomingSMTP_OPT_BODY_8BITMIME ++;
 	    } else if (CISTREQN(s, "BINARYMIME", 10)) {
 		bodytype = "BINARYMIME";
 		s += 10;
-		MIBMtaEntry->ss.IncomingSMTP_OPT_BODY_BINARYMIME ++;
+		MIBMtaCnt->ss.IncomingSMTP_OPT_BODY_BINARYMIME ++;
 	    } else if (CISTREQN(s, "7BIT", 4)) {
 		bodytype = "7BIT";
 		s += 4;
-		MIBMtaEntry->ss.IncomingSMTP_OPT_BODY_7BIT ++;
+		MIBMtaCnt->ss.IncomingSMTP_OPT_BODY_7BIT ++;
 	    }
 	    if (*s && *s != ' ' && *s != '\t') {
 		smtp_tarpit(SS);
@@ -728,7 +728,7 @@ int insecure;
 		rc = 1;
 		break;
 	    }
-	    MIBMtaEntry->ss.IncomingSMTP_OPT_SIZE ++;
+	    MIBMtaCnt->ss.IncomingSMTP_OPT_SIZE ++;
 	    continue;
 	}
 	/* IETF-NOTARY  SMTP-DSN extensions */
@@ -757,7 +757,7 @@ int insecure;
 		rc = 1;
 		break;
 	    }
-	    MIBMtaEntry->ss.IncomingSMTP_OPT_ENVID ++;
+	    MIBMtaCnt->ss.IncomingSMTP_OPT_ENVID ++;
 	    continue;
 	}
 	if (OCP->auth_ok && CISTREQN("AUTH=", s, 5)) {
@@ -780,7 +780,7 @@ int insecure;
 		rc = 1;
 		break;
 	    }
-	    MIBMtaEntry->ss.IncomingSMTP_OPT_AUTH ++;
+	    MIBMtaCnt->ss.IncomingSMTP_OPT_AUTH ++;
 	    continue;
 	}
 	if (OCP->deliverby_ok >= 0 && CISTREQN("BY=", s, 3)) {
@@ -847,7 +847,7 @@ int insecure;
 	    SS->deliverby_time  = time(NULL) + val;
 	    SS->deliverby_flags = neg;
 	    s = p;
-	    MIBMtaEntry->ss.IncomingSMTP_OPT_DELIVERBY ++;
+	    MIBMtaCnt->ss.IncomingSMTP_OPT_DELIVERBY ++;
 	    continue;
 	}
 
@@ -1536,7 +1536,7 @@ const char *buf, *cp;
 		return -1;
 	    }
 	    notifylen = s - drpt_notify;
-	    MIBMtaEntry->ss.IncomingSMTP_OPT_NOTIFY ++;
+	    MIBMtaCnt->ss.IncomingSMTP_OPT_NOTIFY ++;
 	    continue;
 	}
 	if (OCP->dsn_ok && CISTREQN("ORCPT=", s, 6)) {
@@ -1554,7 +1554,7 @@ const char *buf, *cp;
 		return -1;
 	    }
 	    orcptlen = s - drpt_orcpt;
-	    MIBMtaEntry->ss.IncomingSMTP_OPT_ORCPT ++;
+	    MIBMtaCnt->ss.IncomingSMTP_OPT_ORCPT ++;
 	    continue;
 	}
 	smtp_tarpit(SS);
@@ -1861,7 +1861,7 @@ const char *buf, *cp;
     const char *newcp = NULL;
     int addrlen;
 
-    MIBMtaEntry->ss.IncomingSMTP_VRFY ++;
+    MIBMtaCnt->ss.IncomingSMTP_VRFY ++;
 
     if (SS->state == Hello) {
 	smtp_tarpit(SS);
@@ -1929,7 +1929,7 @@ const char *buf, *cp;
     int cfi, addrlen;
     char *newcp = NULL;
 
-    MIBMtaEntry->ss.IncomingSMTP_EXPN ++;
+    MIBMtaCnt->ss.IncomingSMTP_EXPN ++;
 
     if (SS->state == Hello) {
 	smtp_tarpit(SS);
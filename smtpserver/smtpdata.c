@@ -83,13 +83,13 @@ const char *buf, *cp;
     char *fname;
     char taspid[30];
 
-    MIBMtaEntry->ss.ReceivedMessagesSs  += 1;
-    MIBMtaEntry->ss.ReceivedRecipientsSs += SS->ok_rcpt_count;
-    MIBMtaEntry->ss.IncomingSMTP_DATA   += 1;
+    MIBMtaCnt->ss.ReceivedMessagesSs  += 1;
+    MIBMtaCnt->ss.ReceivedRecipientsSs += SS->ok_rcpt_count;
+    MIBMtaCnt->ss.IncomingSMTP_DATA   += 1;
 
     while ((strict_protocol < 1) && (*cp == ' ' || *cp == '\t')) ++cp;
     if ((strict_protocol > 0) && *cp != 0) {
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	type(SS, 501, m554, "Extra junk after 'DATA' verb");
 	return 0;
     }
@@ -113,7 +113,7 @@ const char *buf, *cp;
 	    cp = NULL;
 	    break;
 	}
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	type(SS, 503, m552, "Hi %s, %s", SS->rhostaddr, cp);
 	typeflush(SS);
 	if (SS->mfp) {
@@ -136,7 +136,7 @@ const char *buf, *cp;
 	policytest(&SS->policystate, POLICY_DATAABORT,
 		   NULL, SS->rcpt_count, NULL);
 
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	SS->mfp = NULL;
 	reporterr(SS, tell, "message file error");
 	return 0;
@@ -150,7 +150,7 @@ const char *buf, *cp;
 	  policytest(&SS->policystate, POLICY_DATAABORT,
 		     NULL, SS->rcpt_count, NULL);
 	}
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	SS->mfp = NULL;
 	return 0;
     }
@@ -160,7 +160,7 @@ const char *buf, *cp;
 	typeflush(SS);
 	SS->state = MailOrHello;
 	mail_abort(SS->mfp);
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	SS->mfp = NULL;
 	return 0;
     }
@@ -172,7 +172,7 @@ const char *buf, *cp;
 	mail_abort(SS->mfp);
 	policytest(&SS->policystate, POLICY_DATAABORT,
 		   NULL, SS->rcpt_count, NULL);
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	SS->mfp = NULL;
 	return 0;
     }
@@ -258,7 +258,7 @@ const char *buf, *cp;
 	mail_abort(SS->mfp);
 	policytest(&SS->policystate, POLICY_DATAABORT,
 		   NULL, SS->rcpt_count, NULL);
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	SS->mfp = NULL;
 	type(SS, 452, m430, "%s", msg);
 	if (lmtp_mode) for(i = 1; i < SS->ok_rcpt_count; ++i)
@@ -273,7 +273,7 @@ const char *buf, *cp;
 	  policytest(&SS->policystate, POLICY_DATAABORT,
 		     NULL, SS->rcpt_count, NULL);
 	}
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	SS->mfp = NULL;
 	reporterr(SS, tell, "premature EOF on DATA input");
 	typeflush(SS);
@@ -288,13 +288,13 @@ const char *buf, *cp;
 	mail_abort(SS->mfp);
 	policytest(&SS->policystate, POLICY_DATAABORT,
 		   NULL, SS->rcpt_count, NULL);
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	SS->mfp = NULL;
     } else if (maxsize > 0 && filsiz > maxsize) {
 	mail_abort(SS->mfp);
 	policytest(&SS->policystate, POLICY_DATAABORT,
 		   NULL, SS->rcpt_count, NULL);
-	MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	SS->mfp = NULL;
 	type(SS, 552, "5.3.4", "Size of this message exceeds the fixed maximum size of  %ld  chars for received email ", maxsize);
 	if (lmtp_mode) for(i = 1; i < SS->ok_rcpt_count; ++i)
@@ -381,7 +381,7 @@ const char *buf, *cp;
 	  mail_abort(SS->mfp);
 	  policytest(&SS->policystate, POLICY_DATAABORT,
 		     NULL, SS->rcpt_count, NULL);
-	  MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	  MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 	  SS->mfp = NULL;
 	} else if (SS->policyresult > 0) {
 	  char polbuf[20];
@@ -431,7 +431,7 @@ const char *buf, *cp;
 	    zsyslog((LOG_INFO, "accepted  %s (%ldc) from %s/%d into freeze[%d]",
 		     taspid, tell, SS->rhostname, SS->rport, SS->policyresult));
 	  }
-	  MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	  MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 
 	  runastrusteduser();
 	} else {
@@ -446,7 +446,7 @@ const char *buf, *cp;
 	    typeflush(SS);
 	    SS->mfp = NULL;
 	    reporterr(SS, tell, "message file close failed");
-	    MIBMtaEntry->ss.IncomingSMTP_DATA_bad += 1;
+	    MIBMtaCnt->ss.IncomingSMTP_DATA_bad += 1;
 
 	  } else {
 	    /* Ok, build response with proper "spoolid" */
@@ -489,13 +489,13 @@ const char *buf, *cp;
 	    policytest(&SS->policystate, POLICY_DATAOK,
 		       NULL, SS->rcpt_count, NULL);
 
-	    MIBMtaEntry->ss.IncomingSMTP_DATA_ok    += 1;
+	    MIBMtaCnt->ss.IncomingSMTP_DATA_ok    += 1;
 
-	    MIBMtaEntry->ss.TransmittedMessagesSs   += 1;
-	    MIBMtaEntry->ss.TransmittedRecipientsSs += SS->ok_rcpt_count;
+	    MIBMtaCnt->ss.TransmittedMessagesSs   += 1;
+	    MIBMtaCnt->ss.TransmittedRecipientsSs += SS->ok_rcpt_count;
 
-	    MIBMtaEntry->ss.IncomingSMTP_DATA_KBYTES  += (SS->messagesize+1023)/1024;
-	    MIBMtaEntry->ss.IncomingSMTP_spool_KBYTES += (tell + 1023)/1024;
+	    MIBMtaCnt->ss.IncomingSMTP_DATA_KBYTES  += (SS->messagesize+1023)/1024;
+	    MIBMtaCnt->ss.IncomingSMTP_spool_KBYTES += (tell + 1023)/1024;
 
 	    type(NULL,0,NULL,"%s: %ld bytes", taspid, tell);
 	    if (logfp)
@@ -524,9 +524,9 @@ const char *buf, *cp;
     char taspid[30];
 
     
-    MIBMtaEntry->ss.ReceivedMessagesSs  += 1;
-    MIBMtaEntry->ss.ReceivedRecipientsSs += SS->ok_rcpt_count;
-    MIBMtaEntry->ss.IncomingSMTP_BDAT   += 1;
+    MIBMtaCnt->ss.ReceivedMessagesSs  += 1;
+    MIBMtaCnt->ss.ReceivedRecipientsSs += SS->ok_rcpt_count;
+    MIBMtaCnt->ss.IncomingSMTP_BDAT   += 1;
 
     if (SS->state == RecipientOrData) {
 	SS->state = BData;
@@ -541,7 +541,7 @@ const char *buf, *cp;
 	  && (rc == 1 || (rc == 2 && bdata_last)))) {
 	type(SS, 501, m552, NULL);
 	typeflush(SS);
-	MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	return 0;
     }
     if (SS->bdata_blocknum == 1 && SS->mfp) {
@@ -627,7 +627,7 @@ const char *buf, *cp;
 	    policytest(&SS->policystate, POLICY_DATAABORT,
 		       NULL, SS->rcpt_count, NULL);
 	}
-	MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	SS->mfp = NULL;
 	return 0;
     }
@@ -648,7 +648,7 @@ const char *buf, *cp;
 	      policytest(&SS->policystate, POLICY_DATAABORT,
 			 NULL, SS->rcpt_count, NULL);
 	    }
-	    MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	    MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	    SS->mfp = NULL;
 	    return 0;
 	}
@@ -664,7 +664,7 @@ const char *buf, *cp;
 	  mail_abort(SS->mfp);
 	  policytest(&SS->policystate, POLICY_DATAABORT,
 		     NULL, SS->rcpt_count, NULL);
-	  MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	  MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	  SS->mfp = NULL;
 	  return 0;
 	}
@@ -693,7 +693,7 @@ const char *buf, *cp;
       type(SS, 452, m430, "BDAT block discarded due to earlier error");
 	if (lmtp_mode && bdata_last) for(i = 1; i < SS->ok_rcpt_count; ++i)
 	  type(SS, 452, m430, "BDAT block discarded due to earlier error");
-	MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
     } else if (*msg != 0) {
 	mail_abort(SS->mfp);
 	policytest(&SS->policystate, POLICY_DATAABORT,
@@ -702,7 +702,7 @@ const char *buf, *cp;
 	type(SS, 452, "%s", msg);
 	if (lmtp_mode && bdata_last) for(i = 1; i < SS->ok_rcpt_count; ++i)
 	  type(SS, 452, "%s", msg);
-	MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
     } else if (s_feof(SS)) {
 	/* [mea@utu.fi] says this can happen */
 	if (STYLE(SS->cfinfo,'D')) {
@@ -713,7 +713,7 @@ const char *buf, *cp;
 	  policytest(&SS->policystate, POLICY_DATAABORT,
 		     NULL, SS->rcpt_count, NULL);
 	}
-	MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	SS->mfp = NULL;
 	reporterr(SS, tell, "premature EOF on BDAT input");
 	typeflush(SS); /* Pointless ?? */
@@ -729,13 +729,13 @@ const char *buf, *cp;
 	mail_abort(SS->mfp);
 	policytest(&SS->policystate, POLICY_DATAABORT,
 		   NULL, SS->rcpt_count, NULL);
-	MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	SS->mfp = NULL;
     } else if (maxsize > 0 && tell > maxsize) {
 	mail_abort(SS->mfp);
 	policytest(&SS->policystate, POLICY_DATAABORT,
 		   NULL, SS->rcpt_count, NULL);
-	MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	SS->mfp = NULL;
 	type(SS, 552, "5.3.4", "Size of this message exceeds the fixed maximum size of  %ld  chars for received email ", maxsize);
 	if (lmtp_mode && bdata_last) for(i = 1; i < SS->ok_rcpt_count; ++i)
@@ -820,7 +820,7 @@ const char *buf, *cp;
 	  mail_abort(SS->mfp);
 	  policytest(&SS->policystate, POLICY_DATAABORT,
 		     NULL, SS->rcpt_count, NULL);
-	  MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	  MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	  SS->mfp = NULL;
 
 	} else if (SS->policyresult > 0) {
@@ -872,7 +872,7 @@ const char *buf, *cp;
 	    zsyslog((LOG_INFO, "accepted  %s (%ldc) from %s/%d into freeze[%d]",
 		     taspid, tell, SS->rhostname, SS->rport, SS->policyresult));
 	  }
-	  MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	  MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	  runastrusteduser();
 	} else if (mail_close(SS->mfp) == EOF) {
 
@@ -882,7 +882,7 @@ const char *buf, *cp;
 
 	  SS->mfp = NULL;
 	  reporterr(SS, tell, "message file close failed");
-	  MIBMtaEntry->ss.IncomingSMTP_BDAT_bad += 1;
+	  MIBMtaCnt->ss.IncomingSMTP_BDAT_bad += 1;
 	} else {
 	  /* Ok, build response with proper "spoolid" */
 
@@ -925,13 +925,13 @@ const char *buf, *cp;
 		     NULL, SS->rcpt_count, NULL);
 
 
-	  MIBMtaEntry->ss.IncomingSMTP_BDAT_ok    += 1;
+	  MIBMtaCnt->ss.IncomingSMTP_BDAT_ok    += 1;
 
-	  MIBMtaEntry->ss.TransmittedMessagesSs   += 1;
-	  MIBMtaEntry->ss.TransmittedRecipientsSs += SS->ok_rcpt_count;
+	  MIBMtaCnt->ss.TransmittedMessagesSs   += 1;
+	  MIBMtaCnt->ss.TransmittedRecipientsSs += SS->ok_rcpt_count;
 
-	  MIBMtaEntry->ss.IncomingSMTP_BDAT_KBYTES  += (SS->messagesize+1023)/1024;
-	  MIBMtaEntry->ss.IncomingSMTP_spool_KBYTES += (tell + 1023)/1024;
+	  MIBMtaCnt->ss.IncomingSMTP_BDAT_KBYTES  += (SS->messagesize+1023)/1024;
+	  MIBMtaCnt->ss.IncomingSMTP_spool_KBYTES += (tell + 1023)/1024;
 
 	  if (smtp_syslog)
 	    zsyslog((LOG_INFO,
@@ -1139,8 +1139,11 @@ static int /* count of bytes */ mvdata(SS, msg)
 SmtpState *SS;
 char *msg;
 {
-    register int c, state, *sts, endstate, cnt;
+    register int c, *sts, endstate, cnt;
     register char *idxnum;
+    int state;			/* Shared with data_copybulk() */
+    const char *bp;
+    int n, bulk = 1;
 
 #ifdef NO_INCOMING_HEADER_PROCESSING
     idxnum = indexnum + 1;
@@ -1551,7 +1554,21 @@ char *msg;
 #endif
 
     /* ================ Normal email BODY input.. ================ */
+#ifdef USE_TRANSLATION
+    bulk = (!do_decode && !do_translate);
+#endif
     for (;;) {
+	/* What is in the input buffer already goes in blocks;
+	   see datacopy.c.  The s_getc() refills it. */
+	if (bulk && (n = s_bufdata(SS, &bp)) > 0) {
+	    n = data_copybulk(&state, bp, n, SS->mfp);
+	    s_bufskip(SS, n);
+	    cnt += n;
+	    if (state == endstate)
+		break;
+	    continue;
+	}
+
 	c = s_getc(SS, 1);
 #if EOF != -1
 	if (c == EOF)		/* a little slower... */
@@ -1650,6 +1667,8 @@ char *msg;
 register long incount;
 {
     register int c, cnt;
+    const char *bp;
+    int n;
 
     cnt = 0;
 
@@ -1659,6 +1678,17 @@ register long incount;
 
     /* ================ Normal email BODY input.. ================ */
     for (; incount > 0; --incount) {
+	/* Buffered input in blocks, see datacopy.c */
+	if ((n = s_bufdata(SS, &bp)) > 0) {
+	    if (n > incount)
+		n = incount;
+	    bdat_copybulk(&SS->mvbstate, bp, n, SS->mfp);
+	    s_bufskip(SS, n);
+	    cnt += n;
+	    incount -= n - 1;	/* The loop does the last one */
+	    continue;
+	}
+
 	c = s_getc(SS, 1);
 	if (c == EOF)
 	    break;
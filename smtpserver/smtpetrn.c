@@ -391,7 +391,7 @@ SmtpState *SS;
 const char *name, *cp;
 {
 
-    MIBMtaEntry->ss.IncomingSMTP_ETRN += 1;
+    MIBMtaCnt->ss.IncomingSMTP_ETRN += 1;
 
     while (*cp == ' ' || *cp == '\t') ++cp;
     if (*cp == 0) {
@@ -28,7 +28,7 @@ const char *query;
     Command cmd;
     char linebuf[3000];
 
-    MIBMtaEntry->ss.IncomingSMTP_HELP ++;
+    MIBMtaCnt->ss.IncomingSMTP_HELP ++;
 
     while (query && (*query == ' ' || *query == '\t')) ++query;
 
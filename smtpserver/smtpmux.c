@@ -0,0 +1,866 @@
+/*
+ *  ZMailer smtpserver session multiplexer
+ *
+ *  A session from a rejected source address (the policy database
+ *  says so) does nothing but get "550 GO AWAY" replies to whatever
+ *  it says, each after a tarpit delay that grows as it goes on.
+ *  Such clients tend to sit there for a long time, and each one
+ *  of them used to keep an entire smtpserver process sleeping.
+ *
+ *  Here one event-driven process carries all of those sessions,
+ *  each with a small state machine:
+ *
+ *	MS_READ  --(command line)-->  MS_DELAY  --(tarpit over)--> MS_READ
+ *	   |
+ *	   +--(QUIT, too many unknown commands)--> MS_CLOSE
+ *
+ *  The smtpserver child hands the connection over when it has found
+ *  the source address rejected, and has not started TLS on it, nor
+ *  has pipelined input waiting.  Along with the connection comes
+ *  a record of the reply texts, and of the tarpit parameters, thus
+ *  the client sees the same dialogue as from the child itself.
+ *  The child then goes away; the multiplexer has its own limit,
+ *  PARAM MuxSessions.  It tells the master of each session that it
+ *  takes, and of its end, back thru the rendezvous socket, and the
+ *  master keeps them in the child registry under the multiplexer's
+ *  pid, thus the childsameip() limits see them as before.
+ *
+ *  Only these sessions are multiplexed.  The command parsing and
+ *  the DATA of the accepted sessions stay in the blocking code of
+ *  smtpcmds.c and smtpdata.c, with their TLS, SASL and hooks.
+ */
+
+#include "smtpserver.h"
+
+int smtpmux_rdz_fd     = -1;
+int smtpmux_server_pid = 0;
+
+extern const char *contact_pointer_message;
+
+#define MUX_NTEXTS   6	/* hostname, rhostaddr, greet, greet2, reject, reject2 */
+#define MUX_LINESIZE 128	/* We need the verb, the rest is dropped */
+
+struct smtpmux_rec {
+	double tarpit;
+	double tarpit_exponent;
+	double tarpit_toplimit;
+	int    readtmo;		/* Seconds of idle input before we close */
+	int    unknownlimit;
+	int    enhanced;	/* Enhanced status codes on replies */
+	int    socktag;		/* For the master's child registry */
+	Usockaddr raddr;
+	char   text[4000];	/* MUX_NTEXTS strings, each NUL terminated */
+};
+
+/* From the multiplexer to the master */
+struct smtpmux_note {
+	int    open;		/* 1: a new session, 0: it is over */
+	int    id;
+	int    socktag;
+	Usockaddr raddr;
+};
+
+#define MS_READ  0	/* Waiting for a command			*/
+#define MS_DELAY 1	/* In tarpit, 'after' to be said at its end	*/
+#define MS_CLOSE 2	/* Saying the last words			*/
+
+struct muxsess {
+	int    fd;
+	int    id;		/* For the notes to the master */
+	int    state;
+	int    hpos;		/* Index in the deadline heap */
+	time_t deadline;
+	double tarpit;
+	int    unknowns;
+	int    discard;		/* Skipping the rest of a too long line */
+	const char *after;
+	char  *afterbuf;	/* 'after' made just for this session */
+	char  *out;		/* Pending output */
+	int    outlen, outptr;
+	int    inlen;
+	char   inbuf[MUX_LINESIZE];
+	const char *text[MUX_NTEXTS];
+	struct smtpmux_rec *rec;
+};
+
+#define T_HOSTNAME  0
+#define T_RHOSTADDR 1
+#define T_GREET     2
+#define T_GREET2    3
+#define T_REJECT    4
+#define T_REJECT2   5
+
+static struct muxsess **sessions;	/* Indexed by the fd */
+static int mux_rdz = -1;
+static int mux_lastid;
+static int mux_nofiles;
+static int mux_count;
+static struct zmpollset *muxset;
+
+static struct muxsess **heap;		/* By the deadline */
+static int heap_count;
+
+static volatile int mux_mustexit;
+
+
+/* ---------------------------------------------------------------- */
+/*  The child side							    */
+
+static void mux_addline __((SmtpState *, char **, char *, int, const char *, const char *));
+static void
+mux_addline(SS, pp, eop, code, status, text)
+     SmtpState *SS;
+     char **pp, *eop;
+     int code;
+     const char *status, *text;
+{
+	char *p = *pp;
+	int  room = eop - p;
+	int  c = ' ', n;
+
+	if (code <= 0) {
+	  code = -code;
+	  c = '-';
+	}
+	if (OCP->enhancedstatusok && status && *status)
+	  n = snprintf(p, room, "%03d%c%s %s\r\n", code, c, status, text);
+	else
+	  n = snprintf(p, room, "%03d%c%s\r\n", code, c, text);
+	if (n < 0 || n >= room)
+	  n = room - 1;
+	*pp = p + n;
+}
+
+static void mux_endtext __((char **, char *));
+static void
+mux_endtext(pp, eop)
+     char **pp, *eop;
+{
+	if (*pp < eop)
+	  *(*pp)++ = '\0';
+	else
+	  eop[-1] = '\0';
+}
+
+/*
+ *  Hand the rejected session over to the multiplexer;
+ *  returns 0 when it has it, and we are to go away.
+ */
+int smtpmux_handoff(SS, msg)
+     SmtpState *SS;
+     const char *msg;
+{
+	struct smtpmux_rec rec;
+	char line[1200];
+	char *p, *eop;
+	int len;
+
+	if (smtpmux_rdz_fd < 0 || !SS->netconnected_flg)
+	  return -1;
+	if (SS->sslmode || s_hasinput(SS))
+	  return -1;
+
+	memset(&rec, 0, sizeof(rec) - sizeof(rec.text));
+	rec.tarpit          = SS->tarpit;
+	rec.tarpit_exponent = OCP->tarpit_exponent;
+	rec.tarpit_toplimit = OCP->tarpit_toplimit;
+	rec.readtmo         = SMTP_COMMAND_ALARM_IVAL;
+	rec.unknownlimit    = unknown_cmd_limit;
+	rec.enhanced        = OCP->enhancedstatusok;
+	rec.socktag         = SS->socktag;
+	rec.raddr           = SS->raddr;
+
+	p   = rec.text;
+	eop = rec.text + sizeof(rec.text);
+
+	snprintf(p, eop - p, "%.200s", SS->myhostname);
+	p += strlen(p) + 1;
+	snprintf(p, eop - p, "%s", SS->rhostaddr);
+	p += strlen(p) + 1;
+
+	/* What the  s_child()  would say at the start.. */
+	snprintf(line, sizeof(line),
+		 "Hello %s; If you feel we mistreat you, do contact us.",
+		 SS->rhostaddr);
+	mux_addline(SS, &p, eop, -550, m571, line);
+	snprintf(line, sizeof(line), "Hello %s; %s",
+		 SS->rhostaddr, contact_pointer_message);
+	mux_addline(SS, &p, eop, -550, m571, line);
+	mux_endtext(&p, eop);
+
+	if (msg != NULL)
+	  snprintf(line, sizeof(line), "Hello %s; %s", SS->rhostaddr, msg);
+	else
+	  snprintf(line, sizeof(line), "Hello %s; %s - You are on our reject-IP-address -list, GO AWAY!",
+		   SS->rhostaddr, SS->myhostname);
+	mux_addline(SS, &p, eop, 550, m571, line);
+	mux_endtext(&p, eop);
+
+	/* .. and to each command */
+	snprintf(line, sizeof(line), "Hello %s; %s",
+		 SS->rhostaddr, contact_pointer_message);
+	mux_addline(SS, &p, eop, -550, m571, line);
+	mux_addline(SS, &p, eop, -550, m571,
+		    "If you feel we mistreat you, do contact us.");
+	mux_endtext(&p, eop);
+
+	snprintf(line, sizeof(line),
+		 "Hello %s; you are on our reject-IP-address -list, GO AWAY!",
+		 SS->rhostaddr);
+	mux_addline(SS, &p, eop, 550, m571, line);
+	mux_endtext(&p, eop);
+
+	len = p - (char *) &rec;
+
+	if (fdpass_sendmsg(smtpmux_rdz_fd, SS->outputfd, &rec, len) < 0) {
+	  type(NULL,0,NULL,"-- session multiplexer handoff failed; errno=%d",
+	       errno);
+	  return -1;
+	}
+
+	type(NULL,0,NULL,"-- rejected session handed to the session multiplexer");
+	return 0;
+}
+
+
+/* ---------------------------------------------------------------- */
+/*  Deadline heap							    */
+
+static void heap_swap __((int, int));
+static void
+heap_swap(i, j)
+     int i, j;
+{
+	struct muxsess *s = heap[i];
+	heap[i] = heap[j];
+	heap[j] = s;
+	heap[i]->hpos = i;
+	heap[j]->hpos = j;
+}
+
+static void heap_up __((int));
+static void
+heap_up(i)
+     int i;
+{
+	while (i > 0) {
+	  int parent = (i - 1) / 2;
+	  if (heap[parent]->deadline <= heap[i]->deadline)
+	    break;
+	  heap_swap(i, parent);
+	  i = parent;
+	}
+}
+
+static void heap_down __((int));
+static void
+heap_down(i)
+     int i;
+{
+	for (;;) {
+	  int l = 2*i + 1, m = i;
+	  if (l < heap_count && heap[l]->deadline < heap[m]->deadline)
+	    m = l;
+	  if (l+1 < heap_count && heap[l+1]->deadline < heap[m]->deadline)
+	    m = l+1;
+	  if (m == i)
+	    break;
+	  heap_swap(i, m);
+	  i = m;
+	}
+}
+
+static void heap_set __((struct muxsess *, time_t));
+static void
+heap_set(s, when)
+     struct muxsess *s;
+     time_t when;
+{
+	if (s->hpos < 0) {
+	  s->hpos = heap_count++;
+	  heap[s->hpos] = s;
+	  s->deadline = when;
+	  heap_up(s->hpos);
+	  return;
+	}
+	if (when < s->deadline) {
+	  s->deadline = when;
+	  heap_up(s->hpos);
+	} else {
+	  s->deadline = when;
+	  heap_down(s->hpos);
+	}
+}
+
+static void heap_del __((struct muxsess *));
+static void
+heap_del(s)
+     struct muxsess *s;
+{
+	int i = s->hpos;
+
+	if (i < 0)
+	  return;
+	s->hpos = -1;
+	if (--heap_count == i)
+	  return;
+	heap[i] = heap[heap_count];
+	heap[i]->hpos = i;
+	heap_up(i);
+	heap_down(heap[i]->hpos);
+}
+
+
+/* ---------------------------------------------------------------- */
+/*  Sessions								    */
+
+/* Tell the master that the session came, or went */
+static void mux_note __((struct muxsess *, int));
+static void
+mux_note(s, open)
+     struct muxsess *s;
+     int open;
+{
+	struct smtpmux_note note;
+
+	if (mux_rdz < 0)
+	  return;
+
+	memset(&note, 0, sizeof(note));
+	note.open    = open;
+	note.id      = s->id;
+	note.socktag = s->rec->socktag;
+	note.raddr   = s->rec->raddr;
+
+	/* The registry must not miss one, so this may wait */
+	fd_blockingmode(mux_rdz);
+	while (write(mux_rdz, &note, sizeof(note)) < 0 && errno == EINTR)
+	  ;
+	fd_nonblockingmode(mux_rdz);
+}
+
+static void mux_close __((struct muxsess *));
+static void
+mux_close(s)
+     struct muxsess *s;
+{
+	mux_note(s, 0);
+	heap_del(s);
+	zmpollset_del(muxset, s->fd);
+	close(s->fd);
+	sessions[s->fd] = NULL;
+	--mux_count;
+
+	if (s->afterbuf) free(s->afterbuf);
+	if (s->out)      free(s->out);
+	free(s->rec);
+	free(s);
+}
+
+/* With a full input buffer we stop reading until the tarpit is over */
+static void mux_pollupdate __((struct muxsess *));
+static void
+mux_pollupdate(s)
+     struct muxsess *s;
+{
+	zmpollset_mod(muxset, s->fd,
+		      (s->inlen < sizeof(s->inbuf) ? ZM_POLLIN : 0) |
+		      (s->outlen > s->outptr ? ZM_POLLOUT : 0));
+}
+
+/* Write what we can; returns -1 when the session got closed */
+static int mux_flush __((struct muxsess *));
+static int
+mux_flush(s)
+     struct muxsess *s;
+{
+	int rc;
+
+	while (s->outptr < s->outlen) {
+	  rc = write(s->fd, s->out + s->outptr, s->outlen - s->outptr);
+	  if (rc > 0) {
+	    s->outptr += rc;
+	    continue;
+	  }
+	  if (rc < 0 && errno == EINTR)
+	    continue;
+	  if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    break;
+	  mux_close(s);
+	  return -1;
+	}
+	if (s->outptr >= s->outlen) {
+	  free(s->out);
+	  s->out = NULL;
+	  s->outlen = s->outptr = 0;
+	  if (s->state == MS_CLOSE) {
+	    mux_close(s);
+	    return -1;
+	  }
+	}
+	mux_pollupdate(s);
+	return 0;
+}
+
+static void mux_say __((struct muxsess *, const char *));
+static void
+mux_say(s, text)
+     struct muxsess *s;
+     const char *text;
+{
+	int len = strlen(text);
+
+	if (s->out == NULL)
+	  s->out = emalloc(len + 1);
+	else
+	  s->out = erealloc(s->out, s->outlen + len + 1);
+	memcpy(s->out + s->outlen, text, len + 1);
+	s->outlen += len;
+}
+
+/* Like smtp_tarpit(), except that we don't sleep */
+static void mux_tarpit __((struct muxsess *, const char *, char *));
+static void
+mux_tarpit(s, after, afterbuf)
+     struct muxsess *s;
+     const char *after;
+     char *afterbuf;
+{
+	if (s->tarpit <= 0.9999) {
+	  mux_say(s, after);
+	  if (afterbuf) free(afterbuf);
+	  heap_set(s, now + s->rec->readtmo);
+	  return;
+	}
+
+	s->state    = MS_DELAY;
+	s->after    = after;
+	s->afterbuf = afterbuf;
+	heap_set(s, now + (int)(s->tarpit + 0.500));
+
+	s->tarpit += (s->tarpit * s->rec->tarpit_exponent);
+	if (s->tarpit < 0.0 || s->tarpit > s->rec->tarpit_toplimit)
+	  s->tarpit = s->rec->tarpit_toplimit;
+
+	MIBMtaCnt->ss.IncomingSmtpTarpits ++;
+}
+
+static void mux_reply __((struct muxsess *, const char *, char *, int));
+static void
+mux_reply(s, text, buf, code)
+     struct muxsess *s;
+     const char *text;
+     char *buf;
+     int code;
+{
+	/* Same format as  type()  */
+	if (s->rec->enhanced)
+	  sprintf(buf, "%03d %s %s\r\n", code,
+		  (code == 221 ? m200 : m552), text);
+	else
+	  sprintf(buf, "%03d %s\r\n", code, text);
+}
+
+/* One command line from the client */
+static void mux_command __((struct muxsess *, char *));
+static void
+mux_command(s, line)
+     struct muxsess *s;
+     char *line;
+{
+	struct command *carp;
+	char text[MUX_LINESIZE + 200], *p, c;
+
+	MIBMtaCnt->ss.IncomingCommands ++;
+
+	for (p = line; (c = *p) && c != ' ' && c != '\t'; ++p)
+	  ;
+	*p = '\0';
+
+	if (CISTREQ(line, "QUIT")) {
+	  char buf[sizeof(text) + 30];
+	  MIBMtaCnt->ss.IncomingSMTP_QUIT ++;
+	  sprintf(text, "%.200s Out", s->text[T_HOSTNAME]);
+	  mux_reply(s, text, buf, 221);
+	  mux_say(s, buf);
+	  s->state = MS_CLOSE;
+	  heap_set(s, now + 10);
+	  return;
+	}
+
+	carp = NULL;
+	if (p - line <= 8) {	/* "STARTTLS" is longest of them.. */
+	  for (carp = &command_list[0]; carp->verb != NULL; carp += 1)
+	    if (CISTREQ(carp->verb, line))
+	      break;
+	  if (carp->verb == NULL)
+	    carp = NULL;
+	}
+
+	if (carp == NULL) {
+	  char *buf = emalloc(sizeof(text) + 30);
+
+	  MIBMtaCnt->ss.IncomingCommands_unknown ++;
+	  if (++s->unknowns >= s->rec->unknownlimit) {
+	    sprintf(text, "Hi %s, One too many unknown command '%.100s'",
+		    s->text[T_RHOSTADDR], line);
+	    mux_reply(s, text, buf, 550);
+	    mux_say(s, buf);
+	    free(buf);
+	    s->state = MS_CLOSE;
+	    heap_set(s, now + 10);
+	    return;
+	  }
+	  sprintf(text, "Unknown command '%.100s'", line);
+	  mux_reply(s, text, buf, 550);
+	  mux_tarpit(s, buf, buf);
+	  return;
+	}
+
+	mux_say(s, s->text[T_REJECT]);
+	mux_tarpit(s, s->text[T_REJECT2], NULL);
+}
+
+/* Run the complete lines we have, as long as we are not in tarpit */
+static void mux_lines __((struct muxsess *));
+static void
+mux_lines(s)
+     struct muxsess *s;
+{
+	char line[MUX_LINESIZE + 1];
+	char *nl;
+	int  len;
+
+	while (s->state == MS_READ && s->inlen > 0) {
+	  nl = memchr(s->inbuf, '\n', s->inlen);
+	  if (nl == NULL) {
+	    if (s->inlen < sizeof(s->inbuf))
+	      break;
+	    /* Too long, the start of it will do */
+	    nl = s->inbuf + s->inlen - 1;
+	    s->discard = 1;
+	  }
+	  len = nl - s->inbuf;
+	  memcpy(line, s->inbuf, len);
+	  line[len] = '\0';
+	  if (len > 0 && line[len-1] == '\r')
+	    line[len-1] = '\0';
+	  s->inlen -= len + 1;
+	  memmove(s->inbuf, nl + 1, s->inlen);
+
+	  mux_command(s, line);
+	}
+}
+
+static void mux_input __((struct muxsess *));
+static void
+mux_input(s)
+     struct muxsess *s;
+{
+	int rc;
+	char *nl;
+
+	for (;;) {
+	  if (s->inlen >= sizeof(s->inbuf))
+	    break;	/* Let the tarpit slow it down.. */
+	  rc = read(s->fd, s->inbuf + s->inlen, sizeof(s->inbuf) - s->inlen);
+	  if (rc < 0 && errno == EINTR)
+	    continue;
+	  if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    break;
+	  if (rc <= 0) {
+	    /* EOF, or an error; either way it is over */
+	    mux_close(s);
+	    return;
+	  }
+	  if (s->discard) {
+	    nl = memchr(s->inbuf + s->inlen, '\n', rc);
+	    if (nl == NULL)
+	      continue;
+	    s->discard = 0;
+	    rc -= (nl + 1) - (s->inbuf + s->inlen);
+	    memmove(s->inbuf + s->inlen, nl + 1, rc);
+	  }
+	  s->inlen += rc;
+	}
+
+	if (s->state == MS_READ)
+	  heap_set(s, now + s->rec->readtmo);
+	mux_lines(s);
+	mux_flush(s);
+}
+
+/* The deadline of the session has come */
+static void mux_timer __((struct muxsess *));
+static void
+mux_timer(s)
+     struct muxsess *s;
+{
+	if (s->state != MS_DELAY) {
+	  /* Idle for too long, or can't get the last words out */
+	  mux_close(s);
+	  return;
+	}
+
+	s->state = MS_READ;
+	mux_say(s, s->after);
+	if (s->afterbuf) free(s->afterbuf);
+	s->after    = NULL;
+	s->afterbuf = NULL;
+	heap_set(s, now + s->rec->readtmo);
+
+	mux_lines(s);
+	mux_flush(s);
+}
+
+static void mux_newsession __((int, struct smtpmux_rec *, int));
+static void
+mux_newsession(fd, rec, len)
+     int fd;
+     struct smtpmux_rec *rec;
+     int len;
+{
+	struct muxsess *s;
+	const char *p, *eop;
+	int i;
+
+	if (fd >= mux_nofiles || sessions[fd] != NULL) {
+	  close(fd);
+	  return;
+	}
+
+	s = emalloc(sizeof(*s));
+	memset(s, 0, sizeof(*s));
+	s->fd   = fd;
+	s->hpos = -1;
+	s->rec  = emalloc(len);
+	memcpy(s->rec, rec, len);
+
+	/* The texts must all be there */
+	p   = s->rec->text;
+	eop = ((const char *) s->rec) + len;
+	for (i = 0; i < MUX_NTEXTS; ++i) {
+	  const char *z = p < eop ? memchr(p, 0, eop - p) : NULL;
+	  if (z == NULL) {
+	    free(s->rec);
+	    free(s);
+	    close(fd);
+	    return;
+	  }
+	  s->text[i] = p;
+	  p = z + 1;
+	}
+	if (s->rec->unknownlimit < 1)
+	  s->rec->unknownlimit = 1;
+	if (s->rec->readtmo < 10)
+	  s->rec->readtmo = 10;
+
+	sessions[fd] = s;
+	++mux_count;
+	s->tarpit = s->rec->tarpit;
+	if (++mux_lastid <= 0)
+	  mux_lastid = 1;
+	s->id = mux_lastid;
+	mux_note(s, 1);
+
+	fd_nonblockingmode(fd);
+	zmpollset_add(muxset, fd, ZM_POLLIN, s);
+
+	if (mux_count > MuxSessions) {
+	  char buf[300];
+	  sprintf(buf, "421 %.200s Too many sessions, closing\r\n",
+		  s->text[T_HOSTNAME]);
+	  mux_say(s, buf);
+	  s->state = MS_CLOSE;
+	  heap_set(s, now + 10);
+	  mux_flush(s);
+	  return;
+	}
+
+	s->state = MS_READ;
+	mux_say(s, s->text[T_GREET]);
+	mux_tarpit(s, s->text[T_GREET2], NULL);
+	mux_flush(s);
+}
+
+
+static RETSIGTYPE mux_sigterm __((int));
+static RETSIGTYPE
+mux_sigterm(sig)
+     int sig;
+{
+	mux_mustexit = 1;
+	SIGNAL_HANDLE(sig, mux_sigterm);
+}
+
+static void smtpmux_loop __((int));
+static void
+smtpmux_loop(rdz)
+     int rdz;
+{
+	struct smtpmux_rec rec;
+	struct zmpollev *evs;
+	struct muxsess *s;
+	int n, i, rc, nevs, newfd;
+	long timeout;
+
+	SIGNAL_HANDLE(SIGPIPE, SIG_IGN);
+	SIGNAL_HANDLE(SIGHUP,  SIG_IGN);
+	SIGNAL_HANDLE(SIGALRM, SIG_IGN);
+	SIGNAL_HANDLE(SIGCHLD, SIG_DFL);
+	SIGNAL_HANDLE(SIGTERM, mux_sigterm);
+	SIGNAL_RELEASE(SIGTERM);
+
+	mux_nofiles = resources_query_nofiles();
+	if (mux_nofiles < 32) mux_nofiles = 32; /* failsafe */
+
+	/* Only our rendezvous socket; the listeners, and the sister
+	   subdaemons' sockets are not ours to keep. */
+	for (n = 0; n < mux_nofiles; ++n)
+	  if (n != rdz)
+	    close(n);
+
+	sessions = calloc(mux_nofiles, sizeof(*sessions));
+	heap     = calloc(mux_nofiles, sizeof(*heap));
+	muxset   = zmpollset_new(mux_nofiles);
+	if (!sessions || !heap || !muxset)
+	  return;
+
+	fd_nonblockingmode(rdz);
+	zmpollset_add(muxset, rdz, ZM_POLLIN, NULL);
+	mux_rdz = rdz;
+
+	while (!mux_mustexit) {
+
+	  if (rdz < 0 && mux_count <= 0)
+	    break;  /* The master is gone, and the sessions are over */
+
+	  time(&now);
+	  timeout = 10000;
+	  if (heap_count > 0) {
+	    if (heap[0]->deadline <= now)
+	      timeout = 0;
+	    else if ((heap[0]->deadline - now) * 1000 < timeout)
+	      timeout = (heap[0]->deadline - now) * 1000;
+	  }
+
+	  rc = zmpollset_wait(muxset, NULL, 0, timeout);
+	  time(&now);
+
+	  if (rc > 0) {
+	    evs = zmpollset_events(muxset, &nevs);
+	    for (i = 0; i < nevs; ++i) {
+	      if (evs[i].cookie == NULL) {
+		/* The rendezvous -- new sessions */
+		for (;;) {
+		  rc = fdpass_receivemsg(rdz, &newfd, &rec, sizeof(rec));
+		  if (rc < 0 && errno == EINTR)
+		    continue;
+		  if (rc == 0) {
+		    /* Master, and all of its children, are gone */
+		    zmpollset_del(muxset, rdz);
+		    close(rdz);
+		    rdz = mux_rdz = -1;
+		  }
+		  if (rc <= 0)
+		    break;
+		  if (newfd < 0)
+		    continue;
+		  if (rc < sizeof(rec) - sizeof(rec.text))
+		    close(newfd);
+		  else
+		    mux_newsession(newfd, &rec, rc);
+		}
+		continue;
+	      }
+
+	      s = (struct muxsess *) evs[i].cookie;
+	      if (sessions[evs[i].fd] != s)
+		continue; /* Gone while we were at the earlier ones */
+
+	      if (evs[i].revents & ZM_POLLOUT) {
+		if (mux_flush(s) < 0)
+		  continue;
+	      }
+	      if (evs[i].revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))
+		mux_input(s);
+	    }
+	  }
+
+	  /* Tarpits that are over, and the idle timeouts */
+	  while (heap_count > 0 && heap[0]->deadline <= now)
+	    mux_timer(heap[0]);
+	}
+}
+
+/*
+ *  Start the multiplexer; the children get to pass the
+ *  sessions to it via the  smtpmux_rdz_fd.
+ */
+int smtpmux_init()
+{
+	int to[2];
+
+	if (MuxSessions <= 0)
+	  return 0;
+
+	resources_maximize_nofiles();
+
+	if (fdpass_create_msgsock(to) < 0)
+	  return -1;
+
+	smtpmux_rdz_fd = to[1];
+	smtpmux_server_pid = fork();
+	if (smtpmux_server_pid == 0) { /* CHILD */
+	  Z_SHM_MIB_Forked();
+	  if (logfp) fclose(logfp);
+	  logfp = NULL;
+	  disable_childreap();
+
+	  smtpmux_loop(to[0]);
+	  exit(0);
+	}
+	fdpass_close_parent(to);
+
+	if (smtpmux_server_pid < 0) {
+	  close(smtpmux_rdz_fd);
+	  smtpmux_rdz_fd = -1;
+	  smtpmux_server_pid = 0;
+	  return -1;
+	}
+	return 0;
+}
+
+
+/*
+ *  Master side: the notes of the multiplexer keep its sessions in
+ *  the child registry.  The fd is shared with the children, who
+ *  write to it, thus it stays in the blocking mode, and is read
+ *  with MSG_DONTWAIT.
+ */
+void smtpmux_pollfds(fdsp, nfdsp)
+     struct zmpollfd **fdsp;
+     int *nfdsp;
+{
+	if (smtpmux_rdz_fd >= 0)
+	  zmpoll_addfd(fdsp, nfdsp, smtpmux_rdz_fd, -1, NULL);
+}
+
+void smtpmux_events()
+{
+	struct smtpmux_note note;
+
+	if (smtpmux_rdz_fd < 0)
+	  return;
+
+	while (recv(smtpmux_rdz_fd, &note, sizeof(note), MSG_DONTWAIT)
+	       == sizeof(note)) {
+	  SIGNAL_HOLD(SIGCHLD);
+	  if (note.open)
+	    childregister_mux(smtpmux_server_pid, note.id,
+			      &note.raddr, note.socktag);
+	  else
+	    childreap_mux(smtpmux_server_pid, note.id);
+	  SIGNAL_RELEASE(SIGCHLD);
+	}
+}
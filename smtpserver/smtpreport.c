@@ -309,7 +309,7 @@ char *cp;
     int l;
     struct mq2pw *pw;
 
-    MIBMtaEntry->ss.IncomingSMTP_REPORT ++;
+    MIBMtaCnt->ss.IncomingSMTP_REPORT ++;
 
     /* At entry the  cp  points right after the verb, skip LWSP.. */
     while (*cp == ' ') ++cp;
@@ -190,6 +190,10 @@ int MaxSameIpSource = 100;	/* Max number of smtp connections in progress
 				   the remote SMTP server... */
 int MaxParallelConnections = 800; /* Total number of childs allowed */
 
+int PreforkWorkers = 0;		/* Pre-forked workers, 0: fork per connection */
+int PreforkSessions = 500;	/* .. and sessions each, before it retires */
+int MuxSessions = 0;		/* Rejected sessions in the multiplexer */
+
 int percent_accept = -1;
 
 
@@ -318,6 +322,11 @@ static RETSIGTYPE timedout __((int sig));
 static RETSIGTYPE sigterminator __((int sig));
 static void smtpserver __((SmtpState *, int insecure));
 static void s_setup  __((SmtpState * SS, int infd, int outfd));
+static void s_child  __((SmtpState *, int, int, int, int));
+static void s_worker __((int, void *));
+
+static int *worker_lsocks;	/* For the workers to close */
+static int  worker_lsocks_count;
 
 
 
@@ -621,6 +630,7 @@ int main(argc, argv, envp)
 
 	setvbuf(stdout, NULL, _IOFBF, 8192);
 	setvbuf(stderr, NULL, _IOLBF, 8192);
+	mail_bufsize = 64*1024;	/* Message files get written in big blocks */
 
 	memset(&SS, 0, sizeof(SS));
 
@@ -1413,7 +1423,7 @@ int main(argc, argv, envp)
 
 	  MIBMtaEntry->sys.SmtpServerMasterPID         = getpid();
 	  MIBMtaEntry->sys.SmtpServerMasterStartTime   = time(NULL);
-	  MIBMtaEntry->sys.SmtpServerMasterStarts     += 1;
+	  MIBMtaCnt->sys.SmtpServerMasterStarts     += 1;
 
 	  MIBMtaEntry->ss.IncomingSMTPSERVERprocesses    = 1; /* myself at first */
 	  MIBMtaEntry->ss.IncomingParallelSMTPconnects   = 0;
@@ -1443,6 +1453,22 @@ int main(argc, argv, envp)
 	  SIGNAL_HANDLE(SIGHUP, SIG_IGN);
 	  SIGNAL_HANDLE(SIGTERM, sigterminator);
 
+	  rbl_cache_init();	/* Before any forks.. */
+	  spoolsync_init();
+	  smtpmux_init();
+#ifdef HAVE_OPENSSL
+	  /* The children get a ready SSL_CTX, with the keys and the
+	     certificates loaded, and the shared session cache open. */
+	  OCP = CP;
+	  Z_init();
+#endif /* - HAVE_OPENSSL */
+
+	  if (PreforkWorkers > 0) {
+	    worker_lsocks       = listensocks;
+	    worker_lsocks_count = listensocks_count;
+	    smtpworker_init(PreforkWorkers, s_worker, &SS);
+	  }
+
 	  while (!mustexit) {
 	    int n;
 	    int socktag;
@@ -1455,9 +1481,16 @@ int main(argc, argv, envp)
 
 
 
+	    /* Replace retired and dead workers */
+	    smtpworker_spawn();
+
 	    for (i = 0; i < listensocks_count; ++i) {
 	      zmpoll_addfd(&pollfds, &socketcount, listensocks[i], -1, NULL);
 	    }
+	    /* ... the listening sockets first, as they are indexed so */
+	    smtpworker_pollfds(&pollfds, &socketcount);
+	    smtpmux_pollfds(&pollfds, &socketcount);
+
 	    n = zmpoll(pollfds, socketcount, 10000 /* milliseconds */);
 
 	    if (n == 0) /* Timeout is just to keep the loop alive... */
@@ -1470,11 +1503,17 @@ int main(argc, argv, envp)
 	      continue;
 	    }
 
+	    /* Workers done with their sessions ? */
+	    if (PreforkWorkers > 0)
+	      smtpworker_events();
+	    /* .. and the multiplexer with its ? */
+	    smtpmux_events();
+
 	    /* Ok, here the  select()  has reported that we have something
 	       appearing in the listening socket(s).
 	       We are simple, and try them in order.. */
 
-	    for (i = 0; i < socketcount; ++i) {
+	    for (i = 0; i < listensocks_count; ++i) {
 
 	      if (pollfds[i].revents & ZM_POLLIN) { /* NO HUP or ERR here ? */
 
@@ -1530,15 +1569,15 @@ int main(argc, argv, envp)
 
 		switch (socktag) {
 		case LSOCKTYPE_SMTP:
-		  MIBMtaEntry->ss.IncomingSMTPconnects += 1;
+		  MIBMtaCnt->ss.IncomingSMTPconnects += 1;
 		  MIBMtaEntry->ss.IncomingParallelSMTPconnects = childcnt;
 		  break;
 		case LSOCKTYPE_SSMTP:
-		  MIBMtaEntry->ss.IncomingSMTPSconnects += 1;
+		  MIBMtaCnt->ss.IncomingSMTPSconnects += 1;
 		  MIBMtaEntry->ss.IncomingParallelSMTPSconnects = childcnt;
 		  break;
 		case LSOCKTYPE_SUBMIT:
-		  MIBMtaEntry->ss.IncomingSUBMITconnects += 1;
+		  MIBMtaCnt->ss.IncomingSUBMITconnects += 1;
 		  MIBMtaEntry->ss.IncomingParallelSUBMITconnects = childcnt;
 		  break;
 		default:
@@ -1553,21 +1592,44 @@ int main(argc, argv, envp)
 		   limit */
 		if (sameipcount > 4 * MaxSameIpSource) {
 		  close(msgfd);
-		  MIBMtaEntry->ss.MaxSameIpSourceCloses ++;
+		  MIBMtaCnt->ss.MaxSameIpSourceCloses ++;
 		  continue;
 		}
 		  
 		if (childcnt > 100+MaxParallelConnections) {
 		  close(msgfd);
-		  MIBMtaEntry->ss.MaxParallelConnections ++;
+		  MIBMtaCnt->ss.MaxParallelConnections ++;
 		  continue;
 		}
 
+		if (PreforkWorkers > 0) {
+		  struct smtpworker_job job;
+
+		  memset(&job, 0, sizeof(job));
+		  job.socktag     = socktag;
+		  job.sameipcount = sameipcount;
+		  job.childcnt    = childcnt;
+		  job.raddr       = SS.raddr;
+		  for (job.cpindex = 0; job.cpindex < CPpSetSize; ++job.cpindex)
+		    if (CPpSet[job.cpindex] == OCP)
+		      break;
+
+		  if (job.cpindex < CPpSetSize &&
+		      (childpid = smtpworker_dispatch(msgfd, &job)) > 0) {
+		    SIGNAL_HOLD(SIGCHLD);
+		    childregister(childpid, &SS.raddr, socktag);
+		    SIGNAL_RELEASE(SIGCHLD);
+		    close(msgfd); /* The worker has it now */
+		    continue;
+		  }
+		  /* All busy, fork one just for this */
+		}
+
 		SIGNAL_HOLD(SIGCHLD);
 		if ((childpid = fork()) < 0) {	/* can't fork! */
 		  SIGNAL_RELEASE(SIGCHLD);
 		  close(msgfd);
-		  MIBMtaEntry->ss.ForkFailures ++;
+		  MIBMtaCnt->ss.ForkFailures ++;
 		  fprintf(stderr,
 			  "%s: fork(): %s\n",
 			  progname, strerror(errno));
@@ -1581,191 +1643,16 @@ int main(argc, argv, envp)
 		  close(msgfd); /* Child has it, close at parent */
 		} else {			/* Child */
 		  SIGNAL_RELEASE(SIGCHLD);
+		  Z_SHM_MIB_Forked();
 		  
 		  disable_childreap(); /* Child does not do childreap..
 					  it may do other reaps, though. */
 
-		  SS.netconnected_flg = 1;
-		  debug_no_stdout = 1;
-		  
-		  switch (socktag) {
-		  case LSOCKTYPE_SMTP:
-		    SS.with_protocol_set |= WITH_SMTP;
-		    break;
-		  case LSOCKTYPE_SSMTP:
-		    ssmtp_connected = 1;
-		    SS.with_protocol_set |= WITH_SMTPS;
-		    SS.with_protocol_set |= WITH_TLS;
-		    break;
-		  case LSOCKTYPE_SUBMIT:
-		    /* submit_connected = 1; */
-		    msa_mode = 1;
-		    SS.with_protocol_set |= WITH_SUBMIT;
-		    break;
-		  default:
-		    break;
-		  }
-
 		  for (i = 0; i < listensocks_count; ++i)
 		    close(listensocks[i]); /* Close listening sockets */
 		    
-		  pid = getpid();
-		
-		  if (msgfd != 0)
-		    dup2(msgfd, 0);
-		  dup2(0, 1);
-		  if (msgfd > 1)
-		    close(msgfd);
-		  msgfd = 0;
-		  
-		  if (logfp)	/* Open the logfp later.. */
-		    fclose(logfp);
-		  logfp = NULL;
-		  
-#if 0
-		  if (maxloadavg != 999 &&
-		      maxloadavg < loadavg_current()) {
-		    write(msgfd, msg_toohighload,
-			  strlen(msg_toohighload));
-		    zsleep(2);
-		    exit(1);
-		  }
-#endif
-		  /* SIGNAL_HANDLE(SIGTERM, SIG_IGN); */
-		  SIGNAL_HANDLE(SIGTERM, sigterminator);
-		    
-#if defined(AF_INET6) && defined(INET6)
-		  if (SS.raddr.v6.sin6_family == AF_INET6)
-		    SS.rport = ntohs(SS.raddr.v6.sin6_port);
-		  else
-#endif
-		    SS.rport = ntohs(SS.raddr.v4.sin_port);
-
-		  pid = getpid();
-		  openlogfp(&SS, daemon_flg);
-
-		  setrhostname(&SS);
-
-		  /* Lets figure-out who we are this time around -- we may
-		     be on a machine with multiple identities per multiple
-		     interfaces, or via virtual IP-numbers, or ... */
-
-		  localsocksize = sizeof(SS.localsock);
-		  if (getsockname(msgfd, &SS.localsock.sa,
-				  &localsocksize) != 0) {
-		    /* XX: ERROR! */
-		  }
-#if defined(AF_INET6) && defined(INET6)
-		  if (SS.localsock.v6.sin6_family == AF_INET6)
-		    SS.lport = ntohs(SS.localsock.v6.sin6_port);
-		  else
-#endif
-		    SS.lport = ntohs(SS.localsock.v4.sin_port);
-
-		  zopenlog("smtpserver", LOG_PID, LOG_MAIL);
-		  
-		  /* We have set the OCP above.. */
-		  /* OCP = OCP; */
-#ifdef HAVE_OPENSSL
-		  Z_init(); /* Some things for private processors */
-#endif /* - HAVE_OPENSSL */
-
-		  s_setup(&SS, msgfd, msgfd);
-		  
-		  if (ident_flag != 0)
-		    setrfc1413ident(&SS);
-		  else
-		    strcpy(SS.ident_username, "IDENT-NOT-QUERIED");
-
-#ifdef HAVE_WHOSON_H
-		  if (do_whoson && SS.netconnected_flg) {
-		    char buf[64];
-		    buf[0]='\0';
-		    if (SS.raddr.v4.sin_family == AF_INET) {  
-		      inet_ntop(AF_INET, (void *) &SS.raddr.v4.sin_addr,    /* IPv4 */
-				buf, sizeof(buf) - 1);
-#if defined(AF_INET6) && defined(INET6)
-		    } else if (SS.raddr.v6.sin6_family == AF_INET6) {
-		      inet_ntop(AF_INET6, (void *) &SS.raddr.v6.sin6_addr,  /* IPv6 */
-				buf, sizeof(buf) - 1);
-#endif
-		    }
-		    if ((SS.whoson_result = wso_query(buf, SS.whoson_data,
-						      sizeof(SS.whoson_data)))) {
-		      strcpy(SS.whoson_data,"-unregistered-");
-		    }
-#ifdef DO_PERL_EMBED
-		    else {
-		      if (use_perlhook)
-			ZSMTP_hook_set_user(SS.whoson_data, "whoson");
-		    }
-#endif
-		  } else {
-		    strcpy(SS.whoson_data,"NOT-CHECKED");
-		    SS.whoson_result = -1;
-		  }
-#endif /* HAVE_WHOSON_H */  
+		  s_child(&SS, msgfd, socktag, sameipcount, childcnt);
 
-
-		  if (smtp_syslog && ident_flag) {
-#ifdef HAVE_WHOSON_H
-		    zsyslog((LOG_INFO, "connection from %s@%s on port %d (whoson: %s)\n",
-			     SS.ident_username, SS.rhostname, SS.lport, SS.whoson_data));
-#else /* WHOSON */
-		    zsyslog((LOG_INFO, "connection from %s@%s on port %d\n",
-			     SS.ident_username, SS.rhostname, SS.lport));
-#endif
-		  }
-
-#ifdef HAVE_WHOSON_H
-		  type(NULL,0,NULL,
-		       "connection from %s %s:%d on port %d ipcnt %d childs %d pid %d ident: %s whoson: %s",
-		       SS.rhostname, SS.rhostaddr,SS.rport,SS.lport,
-		       sameipcount, childcnt, pid,
-		       SS.ident_username, SS.whoson_data);
-#else
-		  type(NULL,0,NULL,
-		       "connection from %s %s:%d on port %d ipcnt %d childs %d pid %d ident: %s",
-		       SS.rhostname, SS.rhostaddr,SS.rport,SS.lport,
-		       sameipcount, childcnt, pid,
-		       SS.ident_username);
-#endif
-
-		  /* if (logfp) type(NULL,0,NULL,"Input fd=%d",getpid(),msgfd); */
-		  
-		  if (childcnt > MaxParallelConnections) {
-		    type(&SS, -450, m571, "%s", contact_pointer_message);
-		    type(&SS, -450, m571, "Come again later");
-		    type(&SS,  450, m571, "Too many simultaneous connections to this server (%d max %d)", childcnt, MaxParallelConnections);
-		    typeflush(&SS);
-		    MIBMtaEntry->ss.MaxParallelConnections ++;
-		    close(0); close(1); close(2);
-#if 1
-		    zsleep(2);	/* Not so fast!  We need to do this to
-				   avoid (as much as possible) the child
-				   to exit before the parent has called
-				   childregister() -- not so easy to be
-				   100% reliable (this isn't!) :-( */
-#endif
-		    exit(0);	/* Now exit.. */
-		  }
-		  if (sameipcount > MaxSameIpSource && sameipcount > 1) {
-		    type(&SS, -450, m571, "Come again later");
-		    type(&SS, -450, m571, "%s", contact_pointer_message);
-		    type(&SS,  450, m571, "Too many simultaneous connections from same IP address (%d max %d)", sameipcount, MaxSameIpSource);
-		    typeflush(&SS);
-		    MIBMtaEntry->ss.MaxSameIpSourceCloses ++;
-		    close(0); close(1); close(2);
-#if 1
-		    zsleep(2);	/* Not so fast!  We need to do this to
-				   avoid (as much as possible) the child
-				   to exit before the parent has called
-				   childregister() -- not so easy to be
-				   100% reliable (this isn't!) :-( */
-#endif
-		    exit(0);	/* Now exit.. */
-		  }
-		  smtpserver(&SS, 1);
 		  /* Expediated filehandle closes before
 		     the mandatory sleep(2) below. */
 		  close(0); close(1); close(2);
@@ -1774,6 +1661,8 @@ int main(argc, argv, envp)
 		    
 		  if (SS.netconnected_flg)
 		    zsleep(2);
+		  if (logfp)
+		    fflush(logfp);
 		  _exit(0);
 
 		} /* .. end of child code */
@@ -1783,6 +1672,7 @@ int main(argc, argv, envp)
 	  } /* .. while (!mustexit) */
 
 	  /* Stand-alone server, kill the pidfile at the exit! */
+	  smtpworker_shutdown();
 	  killpidfile(pidfile);
 	  subdaemons_kill_cluster_listeners();
 
@@ -2054,8 +1944,21 @@ reaper(sig)
 	    subdaemons_init_contentfilter();
 	    continue;
 	}
+	if (lpid == smtpmux_server_pid) {
+	    smtpmux_server_pid = 0;
+	    if (smtpmux_rdz_fd >= 0)
+	      close(smtpmux_rdz_fd);
+	    smtpmux_rdz_fd = -1;
+	    /* Its sessions leave the child registry */
+	    childreap(lpid);
+	    type(NULL,0,NULL,"Session multiplexer had died, reiniting..");
+	    smtpmux_init();
+	    continue;
+	}
 
-	childreap(lpid);
+	/* A worker's registry slot goes with its worker slot */
+	if (!smtpworker_reap(lpid))
+	  childreap(lpid);
     }
 
     if (nologfp && logfp) {
@@ -2372,6 +2275,29 @@ void s_ungetc(SS, ch)
 	SS->s_ungetcbuf = ch;
 }
 
+/*
+ *  The input already in the buffer, for those who can take it in
+ *  one go; 0 when there is none (or an ungetc()'d char is pending),
+ *  then  s_getc()  does the reading.  Consume it with  s_bufskip().
+ */
+int s_bufdata(SS, bufp)
+     SmtpState *SS;
+     const char **bufp;
+{
+	if (SS->s_ungetcbuf >= 0 || SS->s_status ||
+	    SS->s_readout >= SS->s_bufread)
+	  return 0;
+	*bufp = SS->s_buffer + SS->s_readout;
+	return SS->s_bufread - SS->s_readout;
+}
+
+void s_bufskip(SS, n)
+     SmtpState *SS;
+     int n;
+{
+	SS->s_readout += n;
+}
+
 
 int s_gets(SS, buf, buflen, rcp, cop, cp)
 SmtpState *SS;
@@ -2439,6 +2365,237 @@ int buflen, *rcp;
 }
 
 
+/*
+ *  One SMTP session on an accepted connection; in a forked child,
+ *  or in a pre-forked worker.  The caller closes the connection,
+ *  and kills possible content filter.
+ */
+
+static void s_child(SS, msgfd, socktag, sameipcount, childcnt)
+     SmtpState *SS;
+     int msgfd, socktag, sameipcount, childcnt;
+{
+	unsigned int localsocksize; /* Solaris: size_t, new BSD: socklen_t */
+
+	SS->netconnected_flg = 1;
+	SS->socktag = socktag;
+	debug_no_stdout = 1;
+
+	switch (socktag) {
+	case LSOCKTYPE_SMTP:
+	  SS->with_protocol_set |= WITH_SMTP;
+	  break;
+	case LSOCKTYPE_SSMTP:
+	  ssmtp_connected = 1;
+	  SS->with_protocol_set |= WITH_SMTPS;
+	  SS->with_protocol_set |= WITH_TLS;
+	  break;
+	case LSOCKTYPE_SUBMIT:
+	  /* submit_connected = 1; */
+	  msa_mode = 1;
+	  SS->with_protocol_set |= WITH_SUBMIT;
+	  break;
+	default:
+	  break;
+	}
+
+	pid = getpid();
+
+	if (msgfd != 0)
+	  dup2(msgfd, 0);
+	dup2(0, 1);
+	if (msgfd > 1)
+	  close(msgfd);
+	msgfd = 0;
+
+	if (logfp)	/* Open the logfp later.. */
+	  fclose(logfp);
+	logfp = NULL;
+
+#if 0
+	if (maxloadavg != 999 &&
+	    maxloadavg < loadavg_current()) {
+	  write(msgfd, msg_toohighload,
+		strlen(msg_toohighload));
+	  zsleep(2);
+	  exit(1);
+	}
+#endif
+	/* SIGNAL_HANDLE(SIGTERM, SIG_IGN); */
+	SIGNAL_HANDLE(SIGTERM, sigterminator);
+
+#if defined(AF_INET6) && defined(INET6)
+	if (SS->raddr.v6.sin6_family == AF_INET6)
+	  SS->rport = ntohs(SS->raddr.v6.sin6_port);
+	else
+#endif
+	  SS->rport = ntohs(SS->raddr.v4.sin_port);
+
+	pid = getpid();
+	openlogfp(SS, daemon_flg);
+
+	setrhostname(SS);
+
+	/* Lets figure-out who we are this time around -- we may
+	   be on a machine with multiple identities per multiple
+	   interfaces, or via virtual IP-numbers, or ... */
+
+	localsocksize = sizeof(SS->localsock);
+	if (getsockname(msgfd, &SS->localsock.sa,
+			&localsocksize) != 0) {
+	  /* XX: ERROR! */
+	}
+#if defined(AF_INET6) && defined(INET6)
+	if (SS->localsock.v6.sin6_family == AF_INET6)
+	  SS->lport = ntohs(SS->localsock.v6.sin6_port);
+	else
+#endif
+	  SS->lport = ntohs(SS->localsock.v4.sin_port);
+
+	zopenlog("smtpserver", LOG_PID, LOG_MAIL);
+
+	/* We have set the OCP above.. */
+	/* OCP = OCP; */
+#ifdef HAVE_OPENSSL
+	Z_init(); /* Some things for private processors */
+#endif /* - HAVE_OPENSSL */
+
+	s_setup(SS, msgfd, msgfd);
+
+	if (ident_flag != 0)
+	  setrfc1413ident(SS);
+	else
+	  strcpy(SS->ident_username, "IDENT-NOT-QUERIED");
+
+#ifdef HAVE_WHOSON_H
+	if (do_whoson && SS->netconnected_flg) {
+	  char buf[64];
+	  buf[0]='\0';
+	  if (SS->raddr.v4.sin_family == AF_INET) {  
+	    inet_ntop(AF_INET, (void *) &SS->raddr.v4.sin_addr,    /* IPv4 */
+		      buf, sizeof(buf) - 1);
+#if defined(AF_INET6) && defined(INET6)
+	  } else if (SS->raddr.v6.sin6_family == AF_INET6) {
+	    inet_ntop(AF_INET6, (void *) &SS->raddr.v6.sin6_addr,  /* IPv6 */
+		      buf, sizeof(buf) - 1);
+#endif
+	  }
+	  if ((SS->whoson_result = wso_query(buf, SS->whoson_data,
+					    sizeof(SS->whoson_data)))) {
+	    strcpy(SS->whoson_data,"-unregistered-");
+	  }
+#ifdef DO_PERL_EMBED
+	  else {
+	    if (use_perlhook)
+	      ZSMTP_hook_set_user(SS->whoson_data, "whoson");
+	  }
+#endif
+	} else {
+	  strcpy(SS->whoson_data,"NOT-CHECKED");
+	  SS->whoson_result = -1;
+	}
+#endif /* HAVE_WHOSON_H */  
+
+
+	if (smtp_syslog && ident_flag) {
+#ifdef HAVE_WHOSON_H
+	  zsyslog((LOG_INFO, "connection from %s@%s on port %d (whoson: %s)\n",
+		   SS->ident_username, SS->rhostname, SS->lport, SS->whoson_data));
+#else /* WHOSON */
+	  zsyslog((LOG_INFO, "connection from %s@%s on port %d\n",
+		   SS->ident_username, SS->rhostname, SS->lport));
+#endif
+	}
+
+#ifdef HAVE_WHOSON_H
+	type(NULL,0,NULL,
+	     "connection from %s %s:%d on port %d ipcnt %d childs %d pid %d ident: %s whoson: %s",
+	     SS->rhostname, SS->rhostaddr,SS->rport,SS->lport,
+	     sameipcount, childcnt, pid,
+	     SS->ident_username, SS->whoson_data);
+#else
+	type(NULL,0,NULL,
+	     "connection from %s %s:%d on port %d ipcnt %d childs %d pid %d ident: %s",
+	     SS->rhostname, SS->rhostaddr,SS->rport,SS->lport,
+	     sameipcount, childcnt, pid,
+	     SS->ident_username);
+#endif
+
+	/* if (logfp) type(NULL,0,NULL,"Input fd=%d",getpid(),msgfd); */
+
+	if (childcnt > MaxParallelConnections) {
+	  type(SS, -450, m571, "%s", contact_pointer_message);
+	  type(SS, -450, m571, "Come again later");
+	  type(SS,  450, m571, "Too many simultaneous connections to this server (%d max %d)", childcnt, MaxParallelConnections);
+	  typeflush(SS);
+	  MIBMtaCnt->ss.MaxParallelConnections ++;
+	  return;	/* The caller closes, and holds a moment */
+	}
+	if (sameipcount > MaxSameIpSource && sameipcount > 1) {
+	  type(SS, -450, m571, "Come again later");
+	  type(SS, -450, m571, "%s", contact_pointer_message);
+	  type(SS,  450, m571, "Too many simultaneous connections from same IP address (%d max %d)", sameipcount, MaxSameIpSource);
+	  typeflush(SS);
+	  MIBMtaCnt->ss.MaxSameIpSourceCloses ++;
+	  return;	/* The caller closes, and holds a moment */
+	}
+	smtpserver(SS, 1);
+}
+
+/*
+ *  A pre-forked worker: sessions one after another, as long as
+ *  the master hands them to us, and we have not done too many.
+ */
+
+static void s_worker(ctlfd, ctx)
+     int ctlfd;
+     void *ctx;
+{
+	SmtpState SS;
+	SmtpState *SS0 = (SmtpState *)ctx;
+	struct smtpworker_job job;
+	int i, msgfd, sessions, nullfd;
+	int msa_mode0 = msa_mode;
+
+	for (i = 0; i < worker_lsocks_count; ++i)
+	  close(worker_lsocks[i]); /* Close listening sockets */
+
+	nullfd = open("/dev/null", O_RDWR, 0);
+
+	for (sessions = 0;
+	     !mustexit && (PreforkSessions <= 0 || sessions < PreforkSessions);
+	     ++sessions) {
+
+	  if (smtpworker_getjob(ctlfd, &job, &msgfd) <= 0)
+	    break; /* Master has gone away */
+
+	  /* Fresh state for each session */
+	  SS = *SS0;
+	  SS.raddr        = job.raddr;
+	  SS.sameipcount  = job.sameipcount;
+	  ssmtp_connected = 0;
+	  msa_mode        = msa_mode0;
+	  OCP             = CPpSet[job.cpindex];
+
+	  s_child(&SS, msgfd, job.socktag, job.sameipcount, job.childcnt);
+
+	  /* Connection off from 0 and 1, and the buffers away */
+	  if (nullfd >= 0) {
+	    dup2(nullfd, 0);
+	    dup2(nullfd, 1);
+	  }
+	  killcfilter(&SS);
+	  if (SS.sslwrbuf)
+	    free(SS.sslwrbuf);
+	  if (logfp)
+	    fclose(logfp);
+	  logfp = NULL;
+
+	  smtpworker_done(ctlfd);
+	}
+	/* Retiring; the master starts a new one */
+}
+
 static void s_setup(SS, infd, outfd)
 SmtpState *SS;
 int infd, outfd;
@@ -2476,6 +2633,7 @@ int insecure;
     struct hostent *hostent;
     int localport;
     long maxsameip = 0;
+    struct timeval cmd_tv;
 #ifdef DO_PERL_EMBED
     char localaddr[sizeof("[ipv6.ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255]") + 8];
 #endif
@@ -2697,6 +2855,11 @@ int insecure;
 #endif
 #endif
 
+    if (SS->reject_net &&
+	smtpmux_handoff(SS, policymsg(&SS->policystate)) == 0) {
+	return; /* The multiplexer carries on with it */
+    }
+
     if (SS->reject_net) {
 	char *msg = policymsg(&SS->policystate);
 	type(SS, -550, m571, "Hello %s; If you feel we mistreat you, do contact us.", SS->rhostaddr);
@@ -2714,7 +2877,7 @@ int insecure;
 	smtp_tarpit(SS);
 	type(SS, 450, NULL, "%s - Come again latter, too many simultaneous connections from this IP address /ms(%li of %li)",
 	       SS->myhostname, SS->sameipcount, maxsameip);
-	MIBMtaEntry->ss.MaxSameIpSourceCloses ++;
+	MIBMtaCnt->ss.MaxSameIpSourceCloses ++;
     } else {
 #ifdef USE_TRANSLATION
 	if (hdr220lines[0] == NULL) {
@@ -2751,6 +2914,7 @@ int insecure;
 	if (logfp)
 	  fflush(logfp);
     }
+    cmd_tv.tv_sec = 0;
     while (1) {
 
 	char buf[SMTPLINESIZE];	/* limits size of SMTP commands...
@@ -2763,6 +2927,9 @@ int insecure;
 	if (always_flush_replies)
 	  typeflush(SS);
 
+	if (cmd_tv.tv_sec) /* The previous command is done */
+	  Z_SHM_MIB_Since(&MIBMtaCnt->ss.CommandTime, &cmd_tv);
+
 	i = s_gets(SS, buf, sizeof(buf), &rc, &co, &c );
 
 	if (mustexit)
@@ -2771,9 +2938,10 @@ int insecure;
 	if (i <= 0)	/* EOF ??? */
 	  break;
 
-	MIBMtaEntry->ss.IncomingCommands ++;
+	MIBMtaCnt->ss.IncomingCommands ++;
 
-	time( & now );
+	gettimeofday(&cmd_tv, NULL);
+	now = cmd_tv.tv_sec;
 
 	if (s_hasinput(SS)) {
 	  if (logfp || logfp_to_syslog)
@@ -2795,7 +2963,7 @@ int insecure;
 	  }
 
 	  if (!SS->s_seen_pipeline)
-	    MIBMtaEntry->ss.IncomingClientPipelines ++;
+	    MIBMtaCnt->ss.IncomingClientPipelines ++;
 	  SS->s_seen_pipeline = 1;
 	}
 
@@ -2845,7 +3013,7 @@ int insecure;
 			((buf[rc] & 0x80) ? "8-bit char on SMTP input" :
 			 "Control chars on SMTP input")));
 	    typeflush(SS);
-	    MIBMtaEntry->ss.IncomingCommands_unknown ++;
+	    MIBMtaCnt->ss.IncomingCommands_unknown ++;
 	    continue;
 	}
 	if (c != '\n' && i > 3) {
@@ -2862,7 +3030,7 @@ int insecure;
 		type(SS, 500, m552, "Line not terminated with CRLF..");
 	    else
 		type(SS, 500, m552, "Line too long (%d chars)", i);
-	    MIBMtaEntry->ss.IncomingCommands_unknown ++;
+	    MIBMtaCnt->ss.IncomingCommands_unknown ++;
 	    continue;
 	}
 	if (verbose && !daemon_flg)
@@ -2888,7 +3056,7 @@ int insecure;
 
 	unknown_command:
 
-	    MIBMtaEntry->ss.IncomingCommands_unknown ++;
+	    MIBMtaCnt->ss.IncomingCommands_unknown ++;
 	    ++SS->unknown_cmd_count;
 
 	    if (SS->unknown_cmd_count >= unknown_cmd_limit) {
@@ -3022,24 +3190,24 @@ int insecure;
 	case SendOrMail:
 	case SendAndMail:
 	    /* This code is LONG.. */
-	    MIBMtaEntry->ss.IncomingSMTP_MAIL += 1;
+	    MIBMtaCnt->ss.IncomingSMTP_MAIL += 1;
 	    if (smtp_mail(SS, buf, cp, insecure) != 0 ||
 		SS->mfp == NULL) {
 	      if (! SS->mfp)
 		policytest(&SS->policystate, POLICY_DATAABORT,
 			   NULL, 1, NULL);
-	      MIBMtaEntry->ss.IncomingSMTP_MAIL_bad += 1;
+	      MIBMtaCnt->ss.IncomingSMTP_MAIL_bad += 1;
 	    } else {
-	      MIBMtaEntry->ss.IncomingSMTP_MAIL_ok += 1;
+	      MIBMtaCnt->ss.IncomingSMTP_MAIL_ok += 1;
 	    }
 	    break;
 	case Recipient:
 	    /* This code is LONG.. */
-	    MIBMtaEntry->ss.IncomingSMTP_RCPT += 1;
+	    MIBMtaCnt->ss.IncomingSMTP_RCPT += 1;
 	    if (smtp_rcpt(SS, buf, cp) != 0 || SS->mfp == NULL)
-	      MIBMtaEntry->ss.IncomingSMTP_RCPT_bad += 1;
+	      MIBMtaCnt->ss.IncomingSMTP_RCPT_bad += 1;
 	    else
-	      MIBMtaEntry->ss.IncomingSMTP_RCPT_ok += 1;
+	      MIBMtaCnt->ss.IncomingSMTP_RCPT_ok += 1;
 	    break;
 	case Data:
 
@@ -3061,7 +3229,7 @@ int insecure;
 	    break;
 	case Reset:
 
-	    MIBMtaEntry->ss.IncomingSMTP_RSET ++;
+	    MIBMtaCnt->ss.IncomingSMTP_RSET ++;
 
 	    if (SS->mfp != NULL) {
 		clearerr(SS->mfp);
@@ -3104,7 +3272,7 @@ int insecure;
 	    typeflush(SS);
 	    break;
 	case Turn:
-	    MIBMtaEntry->ss.IncomingSMTP_TURN ++;
+	    MIBMtaCnt->ss.IncomingSMTP_TURN ++;
 	    if (*cp != 0 && STYLE(SS->cfinfo,'R')) {
 	      type(SS, -502, m554, "Extra junk after 'TURN' verb");
 	    }
@@ -3112,7 +3280,7 @@ int insecure;
 	    typeflush(SS);
 	    break;
 	case NoOp:
-	    MIBMtaEntry->ss.IncomingSMTP_NOOP ++;
+	    MIBMtaCnt->ss.IncomingSMTP_NOOP ++;
 	    if (*cp != 0 && STYLE(SS->cfinfo,'R')) {
 	      type(SS, 501, m554, "Extra junk after 'NOOP' verb");
 	      break;
@@ -3121,7 +3289,7 @@ int insecure;
 	    typeflush(SS);
 	    break;
 	case Verbose:
-	    MIBMtaEntry->ss.IncomingSMTP_VERBOSE ++;
+	    MIBMtaCnt->ss.IncomingSMTP_VERBOSE ++;
 	    type(SS, -250, m200, VerbID, Version);
 	    type(SS, -250, m200, Copyright);
 	    type(SS, 250, m200, Copyright2);
@@ -3129,7 +3297,7 @@ int insecure;
 	    SS->VerboseCommand = 1;
 	    break;
 	case DebugMode:
-	    MIBMtaEntry->ss.IncomingSMTP_DEBUG ++;
+	    MIBMtaCnt->ss.IncomingSMTP_DEBUG ++;
 	    ++debug;
 	    debug_report(SS, SS->VerboseCommand, SS->rhostname, buf);
 	    typeflush(SS);
@@ -3140,13 +3308,13 @@ int insecure;
 	    typeflush(SS);
 	    break;
 	case Tick:
-	    MIBMtaEntry->ss.IncomingSMTP_TICK ++;
+	    MIBMtaCnt->ss.IncomingSMTP_TICK ++;
 	    type(SS, 250, m200, "%s", buf);
 	    typeflush(SS);
 	    SS->with_protocol_set |= WITH_BSMTP;
 	    break;
 	case Quit:
-	    MIBMtaEntry->ss.IncomingSMTP_QUIT ++;
+	    MIBMtaCnt->ss.IncomingSMTP_QUIT ++;
 	    if (*cp != 0 && STYLE(SS->cfinfo,'R')) {
 	      type(SS, -221, m554, "Extra junk after 'QUIT' verb");
 	    }
@@ -3762,7 +3930,7 @@ void smtp_tarpit(SS)
 
 
 	/* XX: Count each tarpit call, or just once per connection ? */
-	MIBMtaEntry->ss.IncomingSmtpTarpits ++;
+	MIBMtaCnt->ss.IncomingSmtpTarpits ++;
     }
 }
 
@@ -291,6 +291,7 @@ typedef struct SmtpState {
     int  lport;
     Usockaddr raddr;
     Usockaddr localsock;
+    int  socktag;		/* LSOCKTYPE_* of the listening socket */
 
     const char * smtpfrom;	/* MAIL FROM:<...> */
     time_t  deliverby_time;	/* RFC 2852 */
@@ -371,6 +372,9 @@ extern long maxsize;
 extern int use_ipv6;
 extern int MaxSameIpSource;
 extern int MaxParallelConnections;
+extern int PreforkWorkers;
+extern int PreforkSessions;
+extern int MuxSessions;
 extern int percent_accept;
 extern int smtp_syslog;
 extern int allow_source_route;
@@ -460,6 +464,8 @@ typedef struct ConfigParams_ {
 
   int tls_scache_timeout, tls_use_scache;
   char *tls_scache_name;
+  char *tls_scache_file;
+  int tls_scache_slots, tls_ticket_lifetime;
 
 
   const char *contact_pointer_message; 	/* group, can default */
@@ -614,6 +620,8 @@ extern int s_feof __((SmtpState * SS));
 extern int s_seen_eof __((SmtpState * SS));
 extern int s_getc __((SmtpState * SS, int timeout_is_fatal));
 extern int s_hasinput __((SmtpState * SS));
+extern int s_bufdata __((SmtpState * SS, const char **bufp));
+extern void s_bufskip __((SmtpState * SS, int n));
 extern int s_gets __((SmtpState *SS, char *buf, int buflen, int *rcp, char *cop, char *cp));
 
 extern void zsleep __((int delay));
@@ -637,8 +645,38 @@ extern char *optarg;
 extern int  childsameip __((Usockaddr *addr, int, int *childcntp));
 extern void childregister __((int cpid, Usockaddr *addr, int tag));
 extern void childreap   __((int cpid));
+extern void childregister_mux __((int muxpid, int id, Usockaddr *addr, int tag));
+extern void childreap_mux     __((int muxpid, int id));
 extern void disable_childreap __((void));
 
+/* smtpworker.c */
+struct smtpworker_job {
+    int socktag;	/* LSOCKTYPE_* of the listening socket */
+    int cpindex;	/* Index of the OCP in CPpSet[] */
+    int sameipcount;
+    int childcnt;
+    Usockaddr raddr;
+};
+typedef void (*smtpworker_fn) __((int ctlfd, void *ctx));
+
+extern void smtpworker_init     __((int count, smtpworker_fn fn, void *ctx));
+extern void smtpworker_spawn    __((void));
+extern int  smtpworker_dispatch __((int msgfd, struct smtpworker_job *job));
+extern void smtpworker_pollfds  __((struct zmpollfd **fdsp, int *nfdsp));
+extern void smtpworker_events   __((void));
+extern int  smtpworker_reap     __((int pid));
+extern void smtpworker_shutdown __((void));
+extern int  smtpworker_getjob   __((int ctlfd, struct smtpworker_job *job, int *msgfdp));
+extern void smtpworker_done     __((int ctlfd));
+
+/* smtpmux.c */
+extern int smtpmux_rdz_fd;
+extern int smtpmux_server_pid;
+extern int smtpmux_init    __((void));
+extern int smtpmux_handoff __((SmtpState *SS, const char *msg));
+extern void smtpmux_pollfds __((struct zmpollfd **fdsp, int *nfdsp));
+extern void smtpmux_events  __((void));
+
 extern void smtp_helo   __((SmtpState * SS, const char *buf, const char *cp));
 extern int  smtp_mail   __((SmtpState * SS, const char *buf, const char *cp, int insecure));
 extern int  smtp_rcpt   __((SmtpState * SS, const char *buf, const char *cp));
@@ -734,7 +772,6 @@ struct peerdata {
 					   process from head. */
 	struct peerhead *head;
 	struct subdaemon_handler *handler;
-	struct zmpollfd *pollfd;
 };
 
 struct peerhead {
@@ -761,6 +798,7 @@ struct subdaemon_handler {
 };
 
 extern int subdaemon_send_to_peer __((struct peerdata *, const char *, int));
+extern void subdaemon_kill_peer __((struct peerdata *));
 
 
 extern struct subdaemon_handler subdaemon_handler_ratetracker;
@@ -794,6 +832,28 @@ extern void  smtpcontentfilter_kill __((void *));
 extern int mx_client_verify  __((struct policystate *, int, const char *, int));
 extern int sender_dns_verify __((struct policystate *, int, const char *, int));
 extern int client_dns_verify __((struct policystate *, int, const char *, int));
+
+/* datacopy.c */
+extern int data_copybulk __((int *statep, const char *buf, int len, FILE *fp));
+extern int bdat_copybulk __((int *crp, const char *buf, int len, FILE *fp));
+
+/* spoolsync.c */
+extern int SpoolGroupCommit;
+extern void spoolsync_init __((void));
+
+/* policymmap.c */
+struct pmdb;
+extern struct pmdb *pmdb_open __((const char *path));
+extern void pmdb_close __((struct pmdb *));
+extern int pmdb_changed __((struct pmdb *, const char *path));
+extern const void *pmdb_get __((struct pmdb *, const unsigned char *key, int *rlenp));
+extern int pmdb_ipmatch __((struct pmdb *, unsigned char *pbuf));
+extern int pmdb_dommatch __((struct pmdb *, unsigned char *pbuf, int size));
+
+/* rbldns.c */
+extern int RblCacheSize;
+extern int RblTimeout;
+extern void rbl_cache_init __((void));
 extern int rbl_dns_test __((struct policystate *, const int, const u_char *, char *, char **));
 
 /* smtphook.c */
@@ -16,6 +16,8 @@
 
 #ifdef HAVE_OPENSSL
 
+#include "tlsscache.h"
+
 #ifdef HAVE_DISTCACHE
 #include <distcache/dc_client.h>
 
@@ -23,15 +25,17 @@ static DC_CTX *dc_ctx;
 
 static const char MAIL_TLS_SRVR_CACHE[] = "TLSsrvrcache";
 static const int id_maxlength = 32;	/* Max ID length in bytes */
-static char server_session_id_context[] = "ZMailer/TLS"; /* anything will do */
 #endif
 
+static char server_session_id_context[] = "ZMailer/TLS"; /* anything will do */
+
+/* The shared session cache file, "tls-scache-file" */
+static struct tlsscache *scache;
+
 static int do_dump = 0;
 static int verify_depth = 1;
 static int verify_error = X509_V_OK;
 
-#define SSL_SESSION_MAX_DER 10*1024
-
 
 /* We must keep some of info available */
 static const char hexcodes[] = "0123456789ABCDEF";
@@ -56,11 +60,11 @@ smtp_starttls(SS, buf, cp)
     }
 
 
-    MIBMtaEntry->ss.IncomingSMTP_STARTTLS += 1;
+    MIBMtaCnt->ss.IncomingSMTP_STARTTLS += 1;
 
     if (SS->sslmode) {
       type(SS, 554, m540, "TLS already active, restart not allowed!");
-      MIBMtaEntry->ss.IncomingSMTP_STARTTLS_fail += 1;
+      MIBMtaCnt->ss.IncomingSMTP_STARTTLS_fail += 1;
       return;
     }
 
@@ -68,13 +72,13 @@ smtp_starttls(SS, buf, cp)
       while (*cp == ' ' || *cp == '\t') ++cp;
     if (*cp != 0) {
       type(SS, 501, m513, "Extra junk following 'STARTTLS' command!");
-      MIBMtaEntry->ss.IncomingSMTP_STARTTLS_fail += 1;
+      MIBMtaCnt->ss.IncomingSMTP_STARTTLS_fail += 1;
       return;
     }
     if (s_hasinput(SS)) {
       /* The STARTTLS command-line must not be followed by anything  */
       type(SS, 501, m513, "Extra junk following 'STARTTLS' command!");
-      MIBMtaEntry->ss.IncomingSMTP_STARTTLS_fail += 1;
+      MIBMtaCnt->ss.IncomingSMTP_STARTTLS_fail += 1;
       return;
     }
     /* XX: engine ok ?? */
@@ -100,7 +104,7 @@ smtp_starttls(SS, buf, cp)
 		   NULL, SS->rcpt_count, NULL);
 	SS->mfp = NULL;
       }
-      MIBMtaEntry->ss.IncomingSMTP_STARTTLS_fail += 1;
+      MIBMtaCnt->ss.IncomingSMTP_STARTTLS_fail += 1;
       exit(2);
     }
     SS->with_protocol_set |= WITH_TLS;
@@ -187,8 +191,6 @@ Z_SSL_flush(SS)
 
 
 #ifdef HAVE_DISTCACHE
-
-
 static DC_CTX      *ssl_scache_dc_init     __((void));
 static SSL_SESSION *ssl_scache_dc_retrieve __((SSL *, unsigned char *, int));
 static int          ssl_scache_dc_store    __((SSL_SESSION *, unsigned char *, int, time_t));
@@ -202,7 +204,25 @@ static void         ssl_scache_dc_remove   __((SSL_SESSION *, unsigned char *, i
  * SSL_get_ex_new_index() is called, so we _must_ do this at startup.
  */
 static int TLScontext_index = -1;
+#endif
+
 
+/*
+ * The server sessions are in the shared cache by their ids, with
+ * an 's' in front; the smtp transport agents keep theirs by the
+ * peer name with a 'c' in front, so one file can do for both.
+ */
+static int scache_key __((unsigned char *, unsigned char *, int));
+static int scache_key(key, id, idlen)
+     unsigned char *key, *id;
+     int idlen;
+{
+    if (idlen > TLSSCACHE_IDMAX - 1)
+	idlen = TLSSCACHE_IDMAX - 1;
+    key[0] = 's';
+    memcpy(key+1, id, idlen);
+    return idlen + 1;
+}
 
 /*
  * Callback to retrieve a session from the external session cache.
@@ -210,9 +230,26 @@ static int TLScontext_index = -1;
 static SSL_SESSION *get_session_cb(SSL *ssl, unsigned char *SessionID,
 				   int length, int *copy)
 {
-    SSL_SESSION *session;
+    SSL_SESSION *session = NULL;
+    unsigned char der[SSL_SESSION_MAX_DER];
+    unsigned char key[TLSSCACHE_IDMAX];
+    unsigned char *pder = der;
+    int der_len;
 
-    session = ssl_scache_dc_retrieve(ssl, SessionID, length);
+    if (scache) {
+	der_len = tlsscache_fetch(scache, key,
+				  scache_key(key, SessionID, length),
+				  der, sizeof(der));
+	if (der_len > 0)
+	    session = d2i_SSL_SESSION(NULL, &pder, der_len);
+	if (OCP->tls_loglevel >= 2)
+	    type(NULL,0,NULL,"shared scache 'get_session' %s",
+		 session ? "HIT" : "MISS");
+    }
+#ifdef HAVE_DISTCACHE
+    if (!session)
+	session = ssl_scache_dc_retrieve(ssl, SessionID, length);
+#endif
 
     *copy = 0;
 
@@ -227,8 +264,12 @@ static int new_session_cb(SSL *ssl, SSL_SESSION *session)
 {
     unsigned char *id;
     unsigned int idlen;
-    int rc;
+    int rc = 0;
     long timeout = OCP->tls_scache_timeout;
+    unsigned char der[SSL_SESSION_MAX_DER];
+    unsigned char key[TLSSCACHE_IDMAX];
+    unsigned char *pder = der;
+    int der_len;
 
     SSL_set_timeout(session, timeout);
     id    = session->session_id;
@@ -236,7 +277,19 @@ static int new_session_cb(SSL *ssl, SSL_SESSION *session)
 
     timeout += SSL_SESSION_get_time(session);
 
+    if (scache) {
+	der_len = i2d_SSL_SESSION(session, NULL);
+	if (der_len > 0 && der_len <= sizeof(der)) {
+	    i2d_SSL_SESSION(session, &pder);
+	    if (tlsscache_store(scache, key, scache_key(key, id, idlen),
+				der, der_len, timeout) < 0 &&
+		OCP->tls_loglevel >= 2)
+		type(NULL,0,NULL,"shared scache 'add_session' failed");
+	}
+    }
+#ifdef HAVE_DISTCACHE
     rc = ssl_scache_dc_store(session,id,idlen,timeout);
+#endif
 
     return rc;
 }
@@ -248,25 +301,87 @@ static void remove_session_cb(SSL_CTX *ssl, SSL_SESSION *session)
 {
     unsigned char *id;
     unsigned int idlen;
+    unsigned char key[TLSSCACHE_IDMAX];
 
     id    = session->session_id;
     idlen = session->session_id_length;
 
+    if (scache)
+	tlsscache_remove(scache, key, scache_key(key, id, idlen));
+#ifdef HAVE_DISTCACHE
     ssl_scache_dc_remove(session,id,idlen);
+#endif
 }
 
 
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+/*
+ * The session tickets (RFC 4507) are made with the keys kept in the
+ * shared cache, so that any of the children can take a ticket that
+ * another one made.  A ticket of the previous key is taken, and then
+ * renewed.
+ */
+static int ticket_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+			 EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
+{
+    struct tlsscache_tkey keys[2];
+    int i;
+
+    if (tlsscache_tkeys(scache, OCP->tls_ticket_lifetime,
+			RAND_bytes, keys) < 0)
+	return (enc ? -1 : 0);
+
+    if (enc) {
+	if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0)
+	    return -1;
+	memcpy(name, keys[0].name, sizeof(keys[0].name));
+	EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, keys[0].aes, iv);
+	HMAC_Init_ex(hctx, keys[0].hmac, sizeof(keys[0].hmac),
+		     EVP_sha256(), NULL);
+	return 1;
+    }
+
+    for (i = 0; i < 2; ++i)
+	if (memcmp(name, keys[i].name, sizeof(keys[i].name)) == 0) {
+	    HMAC_Init_ex(hctx, keys[i].hmac, sizeof(keys[i].hmac),
+			 EVP_sha256(), NULL);
+	    EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL,
+			       keys[i].aes, iv);
+	    return (i == 0 ? 1 : 2);
+	}
+    return 0;	/* Unknown key, a full handshake then */
+}
+#endif
+
 
 static void tls_scache_init(ssl_ctx)
      SSL_CTX *ssl_ctx;
 {
+	if (OCP->tls_scache_timeout <= 0)
+	  OCP->tls_scache_timeout = 3600;
+
+	/*
+	 * The shared cache file.  In the daemon this is done before
+	 * the children are forked, and they all have the same mapping.
+	 */
+	if (OCP->tls_scache_file && !scache) {
+	  scache = tlsscache_open(OCP->tls_scache_file,
+				  OCP->tls_scache_slots);
+	  if (!scache)
+	    type(NULL,0,NULL,"TLS session cache file '%s': %s",
+		 OCP->tls_scache_file, strerror(errno));
+	}
 
+#ifdef HAVE_DISTCACHE
 	/*
 	 * Initialize the DISTCACHE context.
 	 */
 
 	dc_ctx = ssl_scache_dc_init();
-	if (!dc_ctx) return; /* No can do.. */
+	if (!dc_ctx && !scache) return; /* No can do.. */
+#else
+	if (!scache) return;
+#endif
 
 	/*
 	 * Initialize the session cache. We only want external caching to
@@ -288,17 +403,25 @@ static void tls_scache_init(ssl_ctx)
 				       sizeof(server_session_id_context));
 
 	/*
-	 * The session cache is realized by distcache, if at all..
+	 * The session cache is realized by the shared file, and/or
+	 * by distcache.
 	 */
-	if (OCP->tls_scache_name) {
-	    SSL_CTX_set_session_cache_mode(ssl_ctx,
-					   ( SSL_SESS_CACHE_SERVER |
-					     SSL_SESS_CACHE_NO_INTERNAL ));
-	    SSL_CTX_sess_set_get_cb(ssl_ctx,    get_session_cb);
-	    SSL_CTX_sess_set_new_cb(ssl_ctx,    new_session_cb);
-	    SSL_CTX_sess_set_remove_cb(ssl_ctx, remove_session_cb);
+	SSL_CTX_set_session_cache_mode(ssl_ctx,
+				       ( SSL_SESS_CACHE_SERVER |
+					 SSL_SESS_CACHE_NO_INTERNAL ));
+	SSL_CTX_sess_set_get_cb(ssl_ctx,    get_session_cb);
+	SSL_CTX_sess_set_new_cb(ssl_ctx,    new_session_cb);
+	SSL_CTX_sess_set_remove_cb(ssl_ctx, remove_session_cb);
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+	if (scache) {
+	  if (OCP->tls_ticket_lifetime <= 0)
+	    OCP->tls_ticket_lifetime = OCP->tls_scache_timeout;
+	  SSL_CTX_set_tlsext_ticket_key_cb(ssl_ctx, ticket_key_cb);
 	}
-	
+#endif
+
+#ifdef HAVE_DISTCACHE
 	/*
 	 * Finally create the global index to access TLScontext information
 	 * inside verify_callback.
@@ -312,8 +435,8 @@ static void tls_scache_init(ssl_ctx)
 						  "TLScontext ex_data index",
 						  NULL, NULL, NULL);
 	}
-}
 #endif
+}
 
 
 /* skeleton taken from OpenSSL crypto/err/err_prn.c */
@@ -877,8 +1000,20 @@ tls_init_serverengine(verifydepth, askcert, requirecert)
 	const char   *s_dcert_file;
 	const char   *s_dkey_file;
 
-	if (tls_serverengine)
-	  return (0);				/* already running */
+	if (tls_serverengine) {
+	  /*
+	   * Already running; maybe made in the daemon before it forked
+	   * us, and then the random state must not be the same as in
+	   * all the other children.
+	   */
+	  if (tls_randseed.pid != getpid()) {
+	    tls_randseed.pid  = getpid();
+	    tls_randseed.ppid = getppid();
+	    gettimeofday(&tls_randseed.tv, NULL);
+	    RAND_seed(&tls_randseed, sizeof(tls_randseed));
+	  }
+	  return (0);
+	}
 
 	if (OCP->tls_loglevel >= 1)
 	  type(NULL,0,NULL,"starting TLS engine");
@@ -1179,9 +1314,7 @@ tls_init_serverengine(verifydepth, askcert, requirecert)
 	
 
 
-#ifdef HAVE_DISTCACHE
 	tls_scache_init(ssl_ctx);
-#endif
 
 	tls_serverengine = 1;
 	return (0);
@@ -0,0 +1,313 @@
+/*
+ *  ZMailer smtpserver pre-forked worker pool
+ *
+ *  Instead of a fork() after every accept(), the master can keep
+ *  a set of long-lived workers around, and hand each accepted
+ *  connection to an idle one thru an AF_UNIX socket (fd-passing).
+ *  A worker runs its SMTP sessions one after another, and retires
+ *  after a configured number of them; the master then starts a new
+ *  one in its place.  When no worker is idle, the master falls back
+ *  to the classic fork-per-connection.
+ *
+ *  The master registers the worker PID in the child-registry at
+ *  each dispatch, and reaps it at the end of the session, thus the
+ *  childsameip() accounting sees the sessions just as it sees the
+ *  forked children.
+ */
+
+#include "smtpserver.h"
+
+extern volatile int mustexit;
+
+#define WORKER_DONE   'D'	/* Session over, ready for the next one */
+
+static struct worker {
+  int pid;
+  int ctlfd;		/* Master's end of the fd-passing socket */
+  int busy;		/* Has a session now */
+  int cpindex;		/* Parameter group it has served, or -1 */
+  int sessions;
+  int dead;		/* Reaped, the slot is to be dropped */
+} *workers = NULL;
+
+static int worker_space = 0;
+static int worker_count = 0;	/* How many we want */
+static smtpworker_fn worker_fn = NULL;
+static void *worker_ctx = NULL;
+static time_t worker_nextspawn = 0;
+
+
+void smtpworker_init(count, fn, ctx)
+     int count;
+     smtpworker_fn fn;
+     void *ctx;
+{
+	int i;
+
+	worker_count = count;
+	worker_fn    = fn;
+	worker_ctx   = ctx;
+
+	if (count > worker_space) {
+	  workers = erealloc(workers, count * sizeof(*workers));
+	  for (i = worker_space; i < count; ++i) {
+	    memset(&workers[i], 0, sizeof(workers[i]));
+	    workers[i].ctlfd = -1;
+	  }
+	  worker_space = count;
+	}
+}
+
+static void worker_drop __((struct worker *));
+static void worker_drop(w)
+     struct worker *w;
+{
+	if (w->busy)
+	  childreap(w->pid);
+	if (w->ctlfd >= 0)
+	  close(w->ctlfd);
+	memset(w, 0, sizeof(*w));
+	w->ctlfd = -1;
+}
+
+/*
+ *  Top up the pool; called from the master loop.  The slots of
+ *  the workers that the reaper() has seen die are dropped here,
+ *  thus the workers[] changes only in the master loop.
+ */
+void smtpworker_spawn()
+{
+	int i, pid, fds[2];
+	time_t now_;
+
+	if (worker_count <= 0 || worker_fn == NULL)
+	  return;
+
+	for (i = 0; i < worker_count; ++i)
+	  if (workers[i].dead)
+	    worker_drop(&workers[i]);
+
+	/* Don't spin on fork failures */
+	time(&now_);
+	if (now_ < worker_nextspawn)
+	  return;
+
+	for (i = 0; i < worker_count; ++i) {
+	  if (workers[i].pid != 0)
+	    continue;
+
+	  if (fdpass_create(fds) < 0) {
+	    worker_nextspawn = now_ + 5;
+	    return;
+	  }
+
+	  /* The slot has its pid before the reaper() may look for it */
+	  SIGNAL_HOLD(SIGCHLD);
+	  pid = fork();
+	  if (pid < 0) {
+	    SIGNAL_RELEASE(SIGCHLD);
+	    close(fds[0]);
+	    close(fds[1]);
+	    MIBMtaCnt->ss.ForkFailures ++;
+	    worker_nextspawn = now_ + 5;
+	    return;
+	  }
+
+	  if (pid == 0) {		/* Worker */
+	    int j;
+
+	    SIGNAL_RELEASE(SIGCHLD);
+	    Z_SHM_MIB_Forked();
+	    /* Not ours: the other workers' control sockets */
+	    for (j = 0; j < worker_count; ++j)
+	      if (workers[j].ctlfd >= 0)
+		close(workers[j].ctlfd);
+	    close(fds[0]);
+	    disable_childreap();
+	    worker_count = 0;
+
+	    worker_fn(fds[1], worker_ctx);
+	    _exit(0);
+	  }
+
+	  /* Master */
+	  close(fds[1]);
+	  workers[i].pid      = pid;
+	  workers[i].ctlfd    = fds[0];
+	  workers[i].busy     = 0;
+	  workers[i].cpindex  = -1;
+	  workers[i].sessions = 0;
+	  workers[i].dead     = 0;
+	  SIGNAL_RELEASE(SIGCHLD);
+	  fd_nonblockingmode(fds[0]);
+	}
+}
+
+/*
+ *  Hand the connection to an idle worker; returns the worker PID,
+ *  or -1 when there are none available for this parameter group.
+ */
+int smtpworker_dispatch(msgfd, job)
+     int msgfd;
+     struct smtpworker_job *job;
+{
+	int i, rc;
+	struct worker *w = NULL;
+
+	for (i = 0; i < worker_count; ++i) {
+	  if (workers[i].pid == 0 || workers[i].ctlfd < 0 ||
+	      workers[i].busy || workers[i].dead)
+	    continue;
+	  /* TLS engine gets set up with the first group's parameters,
+	     keep the workers with the group they started with. */
+	  if (workers[i].cpindex == job->cpindex) {
+	    w = &workers[i];
+	    break;
+	  }
+	  if (workers[i].cpindex < 0 && w == NULL)
+	    w = &workers[i];
+	}
+	if (w == NULL)
+	  return -1;
+
+	fd_blockingmode(w->ctlfd);
+	rc = write(w->ctlfd, job, sizeof(*job));
+	if (rc == sizeof(*job))
+	  rc = fdpass_sendfd(w->ctlfd, msgfd);
+	else
+	  rc = -1;
+	fd_nonblockingmode(w->ctlfd);
+
+	if (rc < 0) {
+	  /* It is gone, or going; the reaper() will clean up */
+	  kill(w->pid, SIGTERM);
+	  close(w->ctlfd);
+	  w->ctlfd = -1;  /* Not to be picked again */
+	  return -1;
+	}
+
+	w->busy     = 1;
+	w->cpindex  = job->cpindex;
+	w->sessions += 1;
+	return w->pid;
+}
+
+/* Add the worker control sockets into the master's poll set */
+void smtpworker_pollfds(fdsp, nfdsp)
+     struct zmpollfd **fdsp;
+     int *nfdsp;
+{
+	int i;
+
+	for (i = 0; i < worker_count; ++i)
+	  if (workers[i].pid != 0 && workers[i].ctlfd >= 0)
+	    zmpoll_addfd(fdsp, nfdsp, workers[i].ctlfd, -1, NULL);
+}
+
+/* Collect the "session over" reports; they free the registry slots */
+void smtpworker_events()
+{
+	int i, n, k;
+	char buf[32];
+
+	for (i = 0; i < worker_count; ++i) {
+	  struct worker *w = &workers[i];
+	  if (w->pid == 0 || w->ctlfd < 0 || w->dead)
+	    continue;
+
+	  while ((n = read(w->ctlfd, buf, sizeof(buf))) > 0) {
+	    for (k = 0; k < n; ++k)
+	      if (buf[k] == WORKER_DONE && w->busy) {
+		childreap(w->pid);
+		w->busy = 0;
+	      }
+	  }
+	  if (n == 0) {
+	    /* Worker has closed its end -- it is retiring.
+	       Keep the slot until reaper() sees it go. */
+	    if (w->busy)
+	      childreap(w->pid);
+	    close(w->ctlfd);
+	    w->ctlfd = -1;
+	    w->busy  = 0;
+	  }
+	}
+}
+
+/*
+ *  From the reaper(); returns 1 when the pid was a worker, and then
+ *  the reaper() leaves the child registry to us.  The slot is only
+ *  marked here, and dropped by the next smtpworker_spawn().
+ */
+int smtpworker_reap(pid)
+     int pid;
+{
+	int i;
+
+	for (i = 0; i < worker_count; ++i)
+	  if (workers[i].pid == pid) {
+	    workers[i].dead = 1;
+	    return 1;
+	  }
+	return 0;
+}
+
+/* Master exits, so do the workers as they see the EOF */
+void smtpworker_shutdown()
+{
+	int i;
+
+	for (i = 0; i < worker_count; ++i)
+	  if (workers[i].pid != 0) {
+	    if (workers[i].ctlfd >= 0)
+	      close(workers[i].ctlfd);
+	    workers[i].ctlfd = -1;
+	    if (!workers[i].busy)
+	      kill(workers[i].pid, SIGTERM);
+	  }
+	worker_count = 0;
+}
+
+
+/*
+ *  Worker side: wait for the next connection.
+ *  Returns 1 with *msgfdp set, 0 when the master has gone away.
+ */
+int smtpworker_getjob(ctlfd, job, msgfdp)
+     int ctlfd;
+     struct smtpworker_job *job;
+     int *msgfdp;
+{
+	int rc, got = 0;
+
+	*msgfdp = -1;
+
+	while (got < sizeof(*job)) {
+	  rc = read(ctlfd, ((char *)job) + got, sizeof(*job) - got);
+	  if (rc < 0 && errno == EINTR) {
+	    if (mustexit) return 0;
+	    continue;
+	  }
+	  if (rc <= 0)
+	    return 0;
+	  got += rc;
+	}
+
+	/* The connection comes right behind it */
+	do {
+	  rc = fdpass_receivefd(ctlfd, msgfdp);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc <= 0 || *msgfdp < 0)
+	  return 0;
+	return 1;
+}
+
+void smtpworker_done(ctlfd)
+     int ctlfd;
+{
+	char c = WORKER_DONE;
+
+	while (write(ctlfd, &c, 1) < 0 && errno == EINTR)
+	  ;
+}
@@ -0,0 +1,156 @@
+/*
+ *  Group commit of the received message files
+ *
+ *  The  mail_close()  does fsync() for each message file before it is
+ *  moved into the router queue, and only then the smtpserver says the
+ *  "250 OK".  With lots of sessions doing that at the same time, the
+ *  fsync()s of each go to the filesystem journal one after another.
+ *
+ *  With PARAM SpoolGroupCommit the sessions share the syncing instead:
+ *  each takes a ticket from a shared memory counter; whoever finds no
+ *  sync going on becomes the leader, and does one syncfs() on the
+ *  spool filesystem for all of the tickets taken by then.  The others
+ *  wait until a sync that started after their ticket has completed,
+ *  then carry on with the rename and the "250 OK".  Thus the data is
+ *  on the disk before the reply, as before, but one sync covers all
+ *  of the messages that arrived meanwhile.
+ *
+ *  A leader that dies in the middle is noticed by the waiters, and
+ *  one of them takes over.  When the syncfs() fails, that round does
+ *  not count, and the leader falls back to the plain fsync() of its
+ *  own file.
+ */
+
+#include "smtpserver.h"
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+int SpoolGroupCommit = 0;	/* PARAM SpoolGroupCommit */
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define spoolsync_barrier() __sync_synchronize()
+#endif
+
+#if defined(HAVE_SYNCFS) && defined(HAVE_MMAP) && defined(spoolsync_barrier)
+
+#define SPOOLSYNC_STALE	60	/* seconds; a leader this old has hung	*/
+
+extern int syncfs __((int));	/* Not in <unistd.h> without _GNU_SOURCE */
+
+struct spoolsync {
+	volatile unsigned long	requested;	/* Tickets handed out	*/
+	volatile unsigned long	synced;		/* Those are on disk	*/
+	volatile int		leader;		/* pid, or 0		*/
+	volatile time_t		leadtime;
+};
+
+static struct spoolsync *spoolsync = NULL;
+
+/* A short nap while the leader works */
+static void spoolsync_nap __((void));
+static void spoolsync_nap()
+{
+	struct timeval tv;
+
+	tv.tv_sec  = 0;
+	tv.tv_usec = 500;
+	select(0, NULL, NULL, NULL, &tv);
+}
+
+/* The mail_sync_hook; called in place of fsync(fd) */
+static int spoolsync_fd __((int));
+static int spoolsync_fd(fd)
+	int fd;
+{
+	unsigned long ticket, target;
+	int me = getpid(), pid, rc;
+
+	ticket = __sync_add_and_fetch(&spoolsync->requested, 1);
+
+	for (;;) {
+	  spoolsync_barrier();
+	  if ((long)(spoolsync->synced - ticket) >= 0)
+	    return 0;	/* Someone did it for us */
+
+	  pid = spoolsync->leader;
+	  if (pid == 0) {
+	    if (!__sync_bool_compare_and_swap(&spoolsync->leader, 0, me))
+	      continue;
+
+	    spoolsync->leadtime = time(NULL);
+	    spoolsync_barrier();
+	    target = spoolsync->requested;	/* All taken by now */
+
+	    rc = syncfs(fd);
+
+	    if (rc == 0) {
+	      if ((long)(target - spoolsync->synced) > 0)
+		spoolsync->synced = target;
+	      MIBMtaCnt->ss.IncomingSMTP_spool_syncs ++;
+	    }
+	    spoolsync_barrier();
+	    spoolsync->leader = 0;
+
+	    if (rc < 0)
+	      return fsync(fd);
+	    continue;	/* The 'synced' covers us now */
+	  }
+
+	  if (pid != me &&
+	      ((kill(pid, 0) < 0 && errno == ESRCH) ||
+	       spoolsync->leadtime + SPOOLSYNC_STALE < time(NULL))) {
+	    /* Gone, or hung; let us try again */
+	    __sync_bool_compare_and_swap(&spoolsync->leader, pid, 0);
+	    continue;
+	  }
+	  spoolsync_nap();
+	}
+}
+
+/*
+ *  At the master, before any forks; the children inherit
+ *  the shared counters, and the hook.
+ */
+void spoolsync_init()
+{
+	void *p;
+
+	if (!SpoolGroupCommit || spoolsync != NULL)
+	  return;
+
+#ifdef MAP_ANONYMOUS
+	p = mmap(NULL, sizeof(*spoolsync), PROT_READ|PROT_WRITE,
+		 MAP_ANONYMOUS|MAP_SHARED, -1, 0);
+#else
+	{
+	  /* Must have a file ? (SunOS 4.1, et.al.) */
+	  FILE *fp = tmpfile();
+	  p = MAP_FAILED;
+	  if (fp && ftruncate(fileno(fp), sizeof(*spoolsync)) == 0)
+	    p = mmap(NULL, sizeof(*spoolsync), PROT_READ|PROT_WRITE,
+		     MAP_SHARED, fileno(fp), 0);
+	  if (fp) fclose(fp);
+	}
+#endif
+	if (p == MAP_FAILED) {
+	  type(NULL,0,NULL, "spool group commit: mmap() failed; errno=%d",
+	       errno);
+	  return;
+	}
+	memset(p, 0, sizeof(*spoolsync));
+	spoolsync = (struct spoolsync *)p;
+
+	mail_sync_hook = spoolsync_fd;
+}
+
+#else /* No syncfs(), or no shared memory */
+
+void spoolsync_init()
+{
+	if (SpoolGroupCommit)
+	  type(NULL,0,NULL, "PARAM SpoolGroupCommit is not supported on this system");
+}
+
+#endif
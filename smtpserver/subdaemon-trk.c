@@ -695,10 +695,8 @@ dump_trk(state, peerdata)
 
 	pid = fork();
 	if (pid > 0) {
-	  /* Parent.. */
-	  if (peerdata->fd >= 0)
-	    close(peerdata->fd);
-	  peerdata->fd = -1;
+	  /* Parent.. the child owns the socket now */
+	  subdaemon_kill_peer(peerdata);
 	  peerdata->outlen = peerdata->outptr = 0;
 	  return;
 	}
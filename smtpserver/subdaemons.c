@@ -20,6 +20,10 @@
 
 static int subdaemon_nofiles = 256;
 
+/* Client peers are registered here once; see subdaemon_loop() */
+static struct zmpollset *peerset = NULL;
+static int peercount = 0;
+
 int  ratetracker_rdz_fd = -1;
 int  ratetracker_server_pid  = 0;
 
@@ -111,6 +115,7 @@ int subdaemons_init_router __((void))
 	    router_rdz_fd = to[1];
 	    router_server_pid = fork();
 	    if (router_server_pid == 0) { /* CHILD */
+	      Z_SHM_MIB_Forked();
 	      
 	      if (router_rdz_fd >= 0)
 		close(router_rdz_fd); /* Our sister server's handle */
@@ -164,6 +169,7 @@ int subdaemons_init_ratetracker __((void))
 	  ratetracker_rdz_fd = to[1];
 	  ratetracker_server_pid = fork();
 	  if (ratetracker_server_pid == 0) { /* CHILD */
+	    Z_SHM_MIB_Forked();
 
 	    if (router_rdz_fd >= 0)
 	      close(router_rdz_fd); /* Our sister server's handle */
@@ -221,6 +227,7 @@ int subdaemons_init_contentfilter __((void))
 	    contentfilter_rdz_fd = to[1];
 	    contentfilter_server_pid = fork();
 	    if (contentfilter_server_pid == 0) { /* CHILD */
+	      Z_SHM_MIB_Forked();
 	      
 	      if (router_rdz_fd >= 0)
 		close(router_rdz_fd); /* Our sister server's handle */
@@ -351,26 +358,141 @@ void
 subdaemon_kill_peer(peer)
      struct peerdata *peer;
 {
-	close(peer->fd);
+	if (peer->fd >= 0) {
+	  if (peerset)
+	    zmpollset_del(peerset, peer->fd);
+	  close(peer->fd);
+	  --peercount;
+	}
 	peer->fd     = -1;
 	peer->in_job = 0;
 
 	job_unlink( peer );
 }
 
+/* Readability is always of interest (EOF detection!),
+   writability only when we have something to say.  */
+static void subdaemon_peer_pollupdate __((struct peerdata *));
+static void
+subdaemon_peer_pollupdate(peer)
+     struct peerdata *peer;
+{
+	if (peerset && peer->fd >= 0)
+	  zmpollset_mod(peerset, peer->fd,
+			ZM_POLLIN | (peer->outlen > 0 ? ZM_POLLOUT : 0));
+}
+
+
+/* Do whatever  revents  tell us to do with this peer */
+static void subdaemon_peer_io __((struct peerdata *, int, struct peerhead *, struct subdaemon_handler *, struct subdaemon_state *));
+static void
+subdaemon_peer_io(peer, revents, job_head, subdaemon_handler, statep)
+     struct peerdata *peer;
+     int revents;
+     struct peerhead *job_head;
+     struct subdaemon_handler *subdaemon_handler;
+     struct subdaemon_state *statep;
+{
+	int rc;
+
+	if (peer->fd < 0) return;
+
+	/* If we have things to output, and write is doable ? */
+	if (peer->outlen > 0 && (revents & ZM_POLLOUT)) {
+
+	  rc = 0;
+	  for (;;) {
+#ifdef DEBUG_WITH_UNLINK
+	    {
+	      char pp[50];
+	      sprintf(pp,"/tmp/-write-to-peer-%d",peer->fd);
+	      unlink(pp);
+	    }
+#endif
+	    rc = write(peer->fd,
+		       peer->outbuf + peer->outptr,
+		       peer->outlen - peer->outptr);
+	    if ((rc < 0) && (errno == EINTR))
+	      continue; /* try again -- later */
+	    if ((rc < 0) && (errno == EPIPE)) {
+	      /* SIGPIPE from writing to the socket..
+		 Abort it completely! */
+	      subdaemon_kill_peer(peer);
+	      if (subdaemon_handler->killpeer)
+		(subdaemon_handler->killpeer)( statep, peer );
+	      return;
+	    }
+	    break;
+	  }
+	  if (rc > 0) {
+	    if (rc == peer->outlen) {
+	      peer->outlen = peer->outptr = 0;
+	    } else {
+	      /* Sigh..  partial write :-( */
+	      peer->outptr += rc;
+	      rc = peer->outlen - peer->outptr;
+	      /* (rc > 0) */
+	      memmove(peer->outbuf, peer->outbuf+peer->outptr, rc);
+	      peer->outptr = 0;
+	      peer->outlen = rc;
+	    }
+	    /* Clean debug outputs */
+	    peer->outbuf[ peer->outlen ] = 0;
+	  }
+	  subdaemon_peer_pollupdate(peer);
+	} /* ... Writability testing */
+
+	/* Now if we have something to read ?? */
+	if (peer->fd >= 0 &&
+	    (revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))) {
+	  for (;;) {
+	    if ((peer->inpspace - peer->inlen) < 32) {
+	      /* Enlarge the buffer! */
+	      peer->inpspace *= 2; /* Double the size */
+	      peer->inpbuf = realloc( peer->inpbuf,
+				      peer->inpspace+1 );
+	    }
+	    rc = read( peer->fd, peer->inpbuf + peer->inlen,
+		       peer->inpspace - peer->inlen );
+	    if (rc > 0) {
+	      char *p;
+	      peer->inlen += rc;
+	      p = memchr( peer->inpbuf, '\n', peer->inlen );
+	      if (p) {
+		peer->in_job = 1;
+		peer->when_in = now;
+		job_linkin( job_head, peer );
+		break; /* Stop here! */
+	      }
+	      continue; /* read more, if there is.. */
+	    }
+	    if ((rc < 0) && (errno == EINTR))
+	      continue; /* try again */
+	    break; /* Something else wrong.. */
+	  }
+	  if (rc == 0) { /* EOF! */
+	    subdaemon_kill_peer(peer);
+	    if (subdaemon_handler->killpeer)
+	      (subdaemon_handler->killpeer)( statep, peer );
+	  }
+	} /* ... read things */
+}
+
 
 int subdaemon_loop(rendezvous_socket, subdaemon_handler)
      int rendezvous_socket;
      struct subdaemon_handler *subdaemon_handler;
 {
-	int n, rc, tv_sec;
+	int n, rc, tv_sec, nevs;
 	static struct peerdata *peers, *peer;
 	static struct peerhead job_head;
 	static struct subdaemon_state *statep = NULL;
+	struct zmpollev *evs;
 	/* int ppid; */
-	static int top_peer = 0, top_peer2;
-	/* int last_peer_index = 0; */
 
+	/* Peers are in the persistent  peerset,  these are
+	   the rendezvous socket, and whatever the handler's
+	   prepoll() wants to add at each round.  */
 	static struct zmpollfd *pollfds = NULL;
 	static int fdcount = 0;
 	static struct zmpollfd *rendezvous_cbp = NULL;
@@ -413,12 +535,17 @@ int subdaemon_loop(rendezvous_socket, subdaemon_handler)
 	  openlogfp(NULL, 1);
 	}
 #endif
+	/* Peer slots are indexed by their fd */
 	peers = calloc(subdaemon_nofiles, sizeof(*peers));
 	if (!peers) return -1; /* ENOMEM ?? */
 
 	for (n = 0; n < subdaemon_nofiles; ++n)
 	  peers[n].fd = -1;
 
+	peerset = zmpollset_new(subdaemon_nofiles);
+	if (!peerset) return -1; /* ENOMEM ?? */
+	peercount = 0;
+
 	fd_nonblockingmode(rendezvous_socket);
 
 	rc = (subdaemon_handler->init)( & statep );
@@ -441,7 +568,7 @@ int subdaemon_loop(rendezvous_socket, subdaemon_handler)
 	  }
 
 	  if ( (rendezvous_socket < 0) &&
-	       (top_peer <= 0)) break; /* parent is gone, clients are gone
+	       (peercount <= 0)) break; /* parent is gone, clients are gone
 					  -> kill self! */
 
 
@@ -454,29 +581,12 @@ int subdaemon_loop(rendezvous_socket, subdaemon_handler)
 	    zmpoll_addfd( &pollfds, &fdcount,
 			  rendezvous_socket, -1, &rendezvous_cbp);
 
-	  top_peer2 = 0;
-	  for (n = 0; n < top_peer; ++n) {
-	    if (peers[n].fd >= 0) {
-	      top_peer2 = n+1;
-	      /* if (peers[n].inlen == 0) */
-	      /* Always check for readability:
-		 There might have been timeout and connection close! */
-	      if (peers[n].outlen > 0)
-		zmpoll_addfd( &pollfds, &fdcount,
-			      peers[n].fd, peers[n].fd, &peers[n].pollfd );
-	      else
-		zmpoll_addfd( &pollfds, &fdcount,
-			      peers[n].fd, -1, &peers[n].pollfd );
-	    }
-	  }
-	  top_peer = top_peer2; /* New topmost peer index */
-
 	  time(&now);
 
 	  rc = (subdaemon_handler->prepoll)( statep, & pollfds, & fdcount );
 	  if (rc > 0) tv_sec = 0; /* RAPID select */
 
-	  rc = zmpoll( pollfds, fdcount, tv_sec * 1000 );
+	  rc = zmpollset_wait( peerset, pollfds, fdcount, tv_sec * 1000 );
 	  time(&now);
 
 	  if (rc == 0) {
@@ -499,6 +609,9 @@ int subdaemon_loop(rendezvous_socket, subdaemon_handler)
 	    }
 #endif
 
+	    /* Collect these before the peer set changes below */
+	    evs = zmpollset_events( peerset, &nevs );
+
 	    /* The rendezvous socket ?? */
 
 	    if (rendezvous_socket >= 0 && rendezvous_cbp &&
@@ -519,47 +632,48 @@ int subdaemon_loop(rendezvous_socket, subdaemon_handler)
 		   too bright for our continued existence.. */
 		continue;
 
-	      } else if ((rc > 0)  && (newfd >= 0)) { /* Successfully received something */
-		/* Ok, we have 'newfd', now we need a new peer slot.. */
-		for (n = 0; n < subdaemon_nofiles; ++n) {
-		  peer = & peers[n];
-		  if (peer->fd < 0) {
-		    /* FREE SLOT! */
-		    char *p = peer->inpbuf;
-		    char *o = peer->outbuf;
-		    int  sp = peer->inpspace;
-		    int  so = peer->outspace;
-		    if (top_peer <= n)  top_peer = n + 1;
-		    memset( peer, 0, sizeof(*peer) );
-		    peer->inpbuf   = p;
-		    peer->inpspace = sp;
-		    peer->outbuf   = o;
-		    peer->outspace = so;
-		    peer->handler  = subdaemon_handler;
-
-		    if (!peer->inpbuf) {
-		      peer->inpspace = 250;
-		      peer->inpbuf = calloc(1, peer->inpspace+1);
-		    }
-		    if (!peer->outbuf) {
-		      peer->outspace = 250;  /* FIXME: MAGIC! - big enough ? */
-		      peer->outbuf = calloc(1, peer->outspace+1);
-		    }
-
-		    peer->fd = newfd;
-		    fd_nonblockingmode(newfd);
-		    /* We write our greeting right away .. semi fake state! */
-		    if (peer->pollfd)
-		      peer->pollfd->revents |= ZM_POLLOUT;
-
-		    memcpy(peer->outbuf, "#hungry\n", 8);
-		    peer->outlen = 8;
-		    peer->outptr = 0;
-		    newfd = -1;
-
-		    break; /* Out of the for-loop! */
-		  }
+	      } else if ((rc > 0)  && (newfd >= 0) &&
+			 (newfd < subdaemon_nofiles)) {
+		/* Successfully received something.
+		   Ok, we have 'newfd', its slot is free for sure. */
+		char *p, *o;
+		int  sp, so;
+
+		peer = & peers[newfd];
+		p  = peer->inpbuf;
+		o  = peer->outbuf;
+		sp = peer->inpspace;
+		so = peer->outspace;
+		memset( peer, 0, sizeof(*peer) );
+		peer->inpbuf   = p;
+		peer->inpspace = sp;
+		peer->outbuf   = o;
+		peer->outspace = so;
+		peer->handler  = subdaemon_handler;
+
+		if (!peer->inpbuf) {
+		  peer->inpspace = 250;
+		  peer->inpbuf = calloc(1, peer->inpspace+1);
+		}
+		if (!peer->outbuf) {
+		  peer->outspace = 250;  /* FIXME: MAGIC! - big enough ? */
+		  peer->outbuf = calloc(1, peer->outspace+1);
 		}
+
+		peer->fd = newfd;
+		fd_nonblockingmode(newfd);
+		++peercount;
+
+		memcpy(peer->outbuf, "#hungry\n", 8);
+		peer->outlen = 8;
+		peer->outptr = 0;
+		newfd = -1;
+
+		zmpollset_add( peerset, peer->fd, ZM_POLLIN|ZM_POLLOUT, peer );
+
+		/* We write our greeting right away .. semi fake state! */
+		subdaemon_peer_io( peer, ZM_POLLOUT, &job_head,
+				   subdaemon_handler, statep );
 	      }
 	      if (newfd >= 0) {
 		/* Oh no...  We had no place to put this in... */
@@ -568,95 +682,14 @@ int subdaemon_loop(rendezvous_socket, subdaemon_handler)
 	      }
 	    }
 
-	    /* Now I/O of all of my peers.. */
-
-	    for (n = 0; n < top_peer; ++n) {
-	      peer = & peers[n];
-	      if (peer->fd >= 0) {
-
-		/* If we have things to output, and write is doable ? */
-		if (peer->outlen > 0 && peer->pollfd &&
-		    (peer->pollfd->revents & ZM_POLLOUT)) {
+	    /* Now I/O of those peers that have something happening.. */
 
-		  rc = 0;
-		  for (;;) {
-#ifdef DEBUG_WITH_UNLINK
-		    {
-		      char pp[50];
-		      sprintf(pp,"/tmp/-write-to-peer-%d",peer->fd);
-		      unlink(pp);
-		    }
-#endif
-		    rc = write(peer->fd,
-			       peer->outbuf + peer->outptr,
-			       peer->outlen - peer->outptr);
-		    if ((rc < 0) && (errno == EINTR))
-		      continue; /* try again -- later */
-		    if ((rc < 0) && (errno == EPIPE)) {
-		      /* SIGPIPE from writing to the socket..
-			 Abort it completely! */
-		      subdaemon_kill_peer(peer);
-		      if (subdaemon_handler->killpeer)
-			(subdaemon_handler->killpeer)( statep, peer );
-		      break;
-		    }
-		    break;
-		  }
-		  if (rc > 0) {
-		    if (rc == peer->outlen) {
-		      peer->outlen = peer->outptr = 0;
-		    } else {
-		      /* Sigh..  partial write :-( */
-		      peer->outptr += rc;
-		      rc = peer->outlen - peer->outptr;
-		      /* (rc > 0) */
-		      memmove(peer->outbuf, peer->outbuf+peer->outptr, rc);
-		      peer->outptr = 0;
-		      peer->outlen = rc;
-		    }
-		    /* Clean debug outputs */
-		    peer->outbuf[ peer->outlen ] = 0;
-		  }
-		} /* ... Writability testing */
-
-		/* Now if we have something to read ?? */
-		if (peer->fd >= 0 && peer->pollfd &&
-		    (peer->pollfd->revents & (ZM_POLLIN|ZM_POLLERR|ZM_POLLHUP))) {
-		  for (;;) {
-		    if ((peer->inpspace - peer->inlen) < 32) {
-		      /* Enlarge the buffer! */
-		      peer->inpspace *= 2; /* Double the size */
-		      peer->inpbuf = realloc( peer->inpbuf,
-					      peer->inpspace+1 );
-		    }
-		    rc = read( peer->fd, peer->inpbuf + peer->inlen,
-			       peer->inpspace - peer->inlen );
-		    if (rc > 0) {
-		      char *p;
-		      peer->inlen += rc;
-		      p = memchr( peer->inpbuf, '\n', peer->inlen );
-		      if (p) {
-			peer->in_job = 1;
-			peer->when_in = now;
-			job_linkin( &job_head, peer );
-			break; /* Stop here! */
-		      }
-		      continue; /* read more, if there is.. */
-		    }
-		    if ((rc < 0) && (errno == EINTR))
-		      continue; /* try again */
-		    break; /* Something else wrong.. */
-		  }
-		  if (rc == 0) { /* EOF! */
-		    subdaemon_kill_peer(peer);
-		    if (subdaemon_handler->killpeer)
-		      (subdaemon_handler->killpeer)( statep, peer );
-		    continue;
-		  }
-		} /* ... read things */
-
-	      } /* peers with valid fd */
-	    } /* all peers */
+	    for (n = 0; n < nevs; ++n) {
+	      peer = (struct peerdata *) evs[n].cookie;
+	      if (peer->fd == evs[n].fd)
+		subdaemon_peer_io( peer, evs[n].revents, &job_head,
+				   subdaemon_handler, statep );
+	    } /* all peers with events */
 	  } /* readability or writeability detected */
 
 
@@ -665,7 +698,7 @@ int subdaemon_loop(rendezvous_socket, subdaemon_handler)
 
 	talk_with_subprocesses:;
 
-	  for (n = 0; n < top_peer; ++n) {
+	  for (n = 0; n < peercount; ++n) {
 #if 1
 	    peer = job_head.head;
 	    if (!peer) break;
@@ -889,6 +922,9 @@ subdaemon_send_to_peer(peer, buf, len)
 	}
 	peer->outbuf[ peer->outlen ] = 0; /* Debugging time buffer cleanup */
 
+	/* Leftovers go out when the peer becomes writable */
+	subdaemon_peer_pollupdate(peer);
+
 	time(&now);
 	*(peer->handler->reply_delay_G) = now - peer->when_in;
 
@@ -60,7 +60,7 @@ static void SHM_MIB_diag(rc)
   switch (rc) {
   case EX_OK:
     /* OK */
-    MIBMtaEntry->taerrm.TaRcptsOk ++;
+    MIBMtaCnt->taerrm.TaRcptsOk ++;
     break;
   case EX_TEMPFAIL:
   case EX_IOERR:
@@ -69,7 +69,7 @@ static void SHM_MIB_diag(rc)
   case EX_SOFTWARE:
   case EX_DEFERALL:
     /* DEFER */
-    MIBMtaEntry->taerrm.TaRcptsRetry ++;
+    MIBMtaCnt->taerrm.TaRcptsRetry ++;
     break;
   case EX_NOPERM:
   case EX_PROTOCOL:
@@ -79,7 +79,7 @@ static void SHM_MIB_diag(rc)
   case EX_UNAVAILABLE:
   default:
     /* FAIL */
-    MIBMtaEntry->taerrm.TaRcptsFail ++;
+    MIBMtaCnt->taerrm.TaRcptsFail ++;
     break;
   }
 }
@@ -124,7 +124,8 @@ main(argc, argv)
 
 	Z_SHM_MIB_Attach(1); /* we don't care if it succeeds or fails.. */
 
-	MIBMtaEntry->taerrm.TaProcessStarts += 1;
+	MIBMtaCnt->taerrm.TaProcessStarts += 1;
+	MIBTaDeliveryTime = &MIBMtaCnt->taerrm.TaDeliveryTime;
 	MIBMtaEntry->taerrm.TaProcCountG    += 1;
 
 	atexit(MIBcountCleanup);
@@ -160,15 +161,12 @@ main(argc, argv)
 	while (!getout) {
 	  char *host;
 
-	  printf("#hungry\n");
-	  fflush(stdout);
-
-	  if (fgets(msgfilename, sizeof msgfilename, stdin) == NULL) break;
+	  if (ta_getjob(msgfilename, sizeof msgfilename) == NULL) break;
 	  if (strchr(msgfilename, '\n') == NULL) break; /* No ending '\n' !
 							   Must have been
 							   partial input! */
 	  if (strcmp(msgfilename, "#idle\n") == 0) {
-	    MIBMtaEntry->taerrm.TaIdleStates += 1;
+	    MIBMtaCnt->taerrm.TaIdleStates += 1;
 	    continue; /* Ah well, we can stay idle.. */
 	  }
 
@@ -179,7 +177,7 @@ main(argc, argv)
 	  if (emptyline(msgfilename, sizeof msgfilename))
 	    break;
 
-	  MIBMtaEntry->taerrm.TaMessages += 1;
+	  MIBMtaCnt->taerrm.TaMessages += 1;
 
 	  host = strchr(msgfilename,'\t');
 	  if (host != NULL)
@@ -190,8 +188,7 @@ main(argc, argv)
 	    process(dp);
 	    ctlclose(dp);
 	  } else {
-	    printf("#resync %s\n",msgfilename);
-	    fflush(stdout);
+	    ta_resync(msgfilename);
 	  }
 	}
 	return 0;
@@ -296,7 +293,7 @@ process(dp)
 	if (fstat(dp->msgfd, &stbuf) != 0)
 	  abort(); /* This is a "CAN'T FAIL" case.. */
 
-	MIBMtaEntry->taerrm.TaDeliveryStarts += 1;
+	MIBMtaCnt->taerrm.TaDeliveryStarts += 1;
 
 	/* recipient host field is the error message file name in FORMSDIR */
 	/* recipient user field is the address causing the error */
@@ -99,7 +99,7 @@ static void SHM_MIB_diag(rc)
   switch (rc) {
   case EX_OK:
     /* OK */
-    MIBMtaEntry->taexpi.TaRcptsOk ++;
+    MIBMtaCnt->taexpi.TaRcptsOk ++;
     break;
   case EX_TEMPFAIL:
   case EX_IOERR:
@@ -108,7 +108,7 @@ static void SHM_MIB_diag(rc)
   case EX_SOFTWARE:
   case EX_DEFERALL:
     /* DEFER */
-    MIBMtaEntry->taexpi.TaRcptsRetry ++;
+    MIBMtaCnt->taexpi.TaRcptsRetry ++;
     break;
   case EX_NOPERM:
   case EX_PROTOCOL:
@@ -118,7 +118,7 @@ static void SHM_MIB_diag(rc)
   case EX_UNAVAILABLE:
   default:
     /* FAIL */
-    MIBMtaEntry->taexpi.TaRcptsFail ++;
+    MIBMtaCnt->taexpi.TaRcptsFail ++;
     break;
   }
 }
@@ -207,7 +207,8 @@ main(argc, argv)
 
 	Z_SHM_MIB_Attach(1); /* we don't care if it succeeds or fails.. */
 
-	MIBMtaEntry->taexpi.TaProcessStarts += 1;
+	MIBMtaCnt->taexpi.TaProcessStarts += 1;
+	MIBTaDeliveryTime = &MIBMtaCnt->taexpi.TaDeliveryTime;
 	MIBMtaEntry->taexpi.TaProcCountG    += 1;
 
 	atexit(MIBcountCleanup);
@@ -289,21 +290,18 @@ main(argc, argv)
 	       spool/file/name [ \t host.info [ \t explanation ]] \n
 	   */
 
-	  printf("#hungry\n");
-	  fflush(stdout);
-
-	  if (fgets(file, sizeof file, stdin) == NULL)
+	  if (ta_getjob(file, sizeof file) == NULL)
 	    break;
 	  if (strchr(file, '\n') == NULL) break; /* No ending '\n' !  Must
 						    have been partial input! */
 	  if (strcmp(file, "#idle\n") == 0) {
-	    MIBMtaEntry->taexpi.TaIdleStates += 1;
+	    MIBMtaCnt->taexpi.TaIdleStates += 1;
 	    continue; /* Ah well, we can stay idle.. */
 	  }
 	  if (emptyline(file, sizeof file))
 	    break;
 
-	  MIBMtaEntry->taexpi.TaMessages += 1;
+	  MIBMtaCnt->taexpi.TaMessages += 1;
 
 
 	  s = strchr(file,'\t');
@@ -321,8 +319,7 @@ main(argc, argv)
 
 	  dp = ctlopen(file, channel, saparam.host, &getout, selectaddr, &saparam);
 	  if (dp == NULL) {
-	    printf("#resync %s\n",file);
-	    fflush(stdout);
+	    ta_resync(file);
 	    continue;
 	  }
 	  if (verboselog) {
@@ -358,7 +355,7 @@ process(dp, optmsg, silent, verboselog)
 	if (optmsg == NULL || *optmsg == 0)
 	  optmsg = "x-local; 500 (Administrative message deletion from delivery queue)";
 
-	MIBMtaEntry->taexpi.TaDeliveryStarts += 1;
+	MIBMtaCnt->taexpi.TaDeliveryStarts += 1;
 
 
 	for (rp = dp->recipients; rp != NULL; rp = rp->next) {
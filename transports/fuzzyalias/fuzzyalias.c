@@ -156,10 +156,7 @@ main(argc, argv)
 	while (!getout) {
 	  char *s;
 
-	  printf("#hungry\n");
-	  fflush(stdout);
-
-	  if (fgets(msgfilename, sizeof msgfilename, stdin) == NULL) break;
+	  if (ta_getjob(msgfilename, sizeof msgfilename) == NULL) break;
 	  if (strchr(msgfilename, '\n') == NULL) break; /* No ending '\n' !
 							   Must have been
 							   partial input! */
@@ -184,8 +181,7 @@ main(argc, argv)
 	    process(dp, answer);
 	    ctlclose(dp);
 	  } else {
-	    printf("#resync %s\n",msgfilename);
-	    fflush(stdout);
+	    ta_resync(msgfilename);
 	  }
 	}
 	if (logfp != NULL)
@@ -158,7 +158,7 @@ static void SHM_MIB_diag(rc)
   switch (rc) {
   case EX_OK:
     /* OK */
-    MIBMtaEntry->tahold.TaRcptsOk ++;
+    MIBMtaCnt->tahold.TaRcptsOk ++;
     break;
   case EX_TEMPFAIL:
   case EX_IOERR:
@@ -167,7 +167,7 @@ static void SHM_MIB_diag(rc)
   case EX_SOFTWARE:
   case EX_DEFERALL:
     /* DEFER */
-    MIBMtaEntry->tahold.TaRcptsRetry ++;
+    MIBMtaCnt->tahold.TaRcptsRetry ++;
     break;
   case EX_NOPERM:
   case EX_PROTOCOL:
@@ -177,7 +177,7 @@ static void SHM_MIB_diag(rc)
   case EX_UNAVAILABLE:
   default:
     /* FAIL */
-    MIBMtaEntry->tahold.TaRcptsFail ++;
+    MIBMtaCnt->tahold.TaRcptsFail ++;
     break;
   }
 }
@@ -229,7 +229,8 @@ main(argc, argv)
 
 	Z_SHM_MIB_Attach(1); /* we don't care if it succeeds or fails.. */
 
-	MIBMtaEntry->tahold.TaProcessStarts += 1;
+	MIBMtaCnt->tahold.TaProcessStarts += 1;
+	MIBTaDeliveryTime = &MIBMtaCnt->tahold.TaDeliveryTime;
 	MIBMtaEntry->tahold.TaProcCountG    += 1;
 
 	atexit(MIBcountCleanup);
@@ -268,20 +269,18 @@ main(argc, argv)
 	       spool/file/name [ \t host.info ] \n
 	   */
 
-	  printf("#hungry\n");
-	  fflush(stdout);
-	  if (fgets(filename, sizeof(filename), stdin) == NULL)
+	  if (ta_getjob(filename, sizeof(filename)) == NULL)
 	    break;
 	  if (strchr(filename, '\n') == NULL) break; /* No ending '\n' !  Must
 						    have been partial input! */
 	  if (strcmp(filename, "#idle\n") == 0) {
-	    MIBMtaEntry->tahold.TaIdleStates += 1;
+	    MIBMtaCnt->tahold.TaIdleStates += 1;
 	    continue; /* Ah well, we can stay idle.. */
 	  }
 	  if (emptyline(filename, sizeof(filename)))
 	    break;
 
-	  MIBMtaEntry->tahold.TaMessages += 1;
+	  MIBMtaCnt->tahold.TaMessages += 1;
 
 
 	  s = strchr(filename,'\t');
@@ -316,8 +315,7 @@ main(argc, argv)
 	      verboselog = NULL;
 	    }
 	  } else {
-	    printf("#resync %s\n",filename);
-	    fflush(stdout);
+	    ta_resync(filename);
 	  }
 	}
 	exit(0);
@@ -339,7 +337,7 @@ process(dp)
 	const char *cp;
 	char buf[BUFSIZ];
 
-	MIBMtaEntry->tahold.TaDeliveryStarts += 1;
+	MIBMtaCnt->tahold.TaDeliveryStarts += 1;
 
 	sawok = 0;
 	for (rp = dp->recipients; rp != NULL; rp = rp->next) {
@@ -121,6 +121,10 @@ ctlclose(dp)
 	    continue;
 	  diagnostic(NULL, rp, EX_TEMPFAIL, 0, "address was left locked!!");
 	}
+	ctlcommit(dp);
+	if (dp->diagbuf)
+	  free(dp->diagbuf);
+	dp->diagbuf = NULL;
 #ifdef HAVE_MMAP
 	if (ta_use_mmap > 0) {
 	  if (dp->let_buffer != NULL)
@@ -59,6 +59,7 @@ int zmalloc_failure; /* For 0/NULL values: let BSS handle it */
 
 static char *notarybuf;
 time_t retryat_time; /* Used at SMTP to avoid trying same host too soon.. */
+struct MIB_Histogram *MIBTaDeliveryTime; /* Set by the TA, if it likes */
 
 const char *
 notaryacct(rc,okstr)
@@ -215,6 +216,193 @@ notaryflush __((void))
 }
 
 
+/*
+   The diagnostics that we log into the transport specification file
+   are not written, nor fsync()ed one by one; with a list expansion of
+   thousands of recipients that would be thousands of fsync()s.
+   Instead the lines are collected per control file, and appended as
+   one block with one fsync() at the commit:  when the SMTP transaction
+   ends, at ctlclose(), before the "#hungry", or when the first line
+   of the block has waited for  ta_diagcommit  seconds.
+
+   Until the commit the scheduler does not hear of these recipients,
+   and they are not marked in the control file, thus when we die in
+   between, they get done again, as they would have been before.
+   The  TA_DIAGCOMMIT  ZENV variable sets the time; zero returns to
+   the write-and-fsync of every diagnostic.
+ */
+
+int ta_diagcommit = -1;		/* -1: from the ZENV at the first use */
+
+#define DIAGBUFMAX  (64*1024)	/* Commit before the block gets larger */
+
+struct ctldiag {
+	struct ctldiag	*next;
+	int		id;		/* rp->id		*/
+	int		lockoffset;	/* rp->lockoffset	*/
+	int		mark;		/* .. and its new mark	*/
+	char		*statmsg;
+	char		*message;
+	char		*host;		/* for the lockaddr() gripes */
+	/* The strings follow */
+};
+
+/* The control file that has uncommitted diagnostics; just one at a time */
+static struct ctldesc *diagdp;
+
+static int ctldiag_queue __((struct rcpt *, const char *, const char *, const char *, int, int));
+static int
+ctldiag_queue(rp, line, statmsg, message, report, mark)
+	struct rcpt *rp;
+	const char *line, *statmsg, *message;
+	int report, mark;
+{
+	struct ctldesc *dp = rp->desc;
+	struct ctldiag *cd = NULL;
+	int len = strlen(line);
+
+	if (ta_diagcommit < 0) {
+	  const char *s = getzenv("TA_DIAGCOMMIT");
+	  ta_diagcommit = s ? atoi(s) : 5;
+	  if (ta_diagcommit < 0)
+	    ta_diagcommit = 0;
+	}
+
+	/* Just one control file with uncommitted diagnostics */
+	if (diagdp && diagdp != dp)
+	  ctlcommit(diagdp);
+
+	if (dp->diagbuflen + len > dp->diagbufspace) {
+	  int space = dp->diagbufspace ? dp->diagbufspace : 4096;
+	  char *p;
+	  while (space < dp->diagbuflen + len)
+	    space <<= 1;
+	  p = realloc(dp->diagbuf, space);
+	  if (!p)
+	    return -1;
+	  dp->diagbuf = p;
+	  dp->diagbufspace = space;
+	}
+
+	if (report) {
+	  const char *host = rp->addr->host ? rp->addr->host : "";
+	  cd = malloc(sizeof(*cd) + strlen(statmsg) + strlen(message) +
+		      strlen(host) + 3);
+	  if (!cd)
+	    return -1;
+	  cd->next       = NULL;
+	  cd->id         = rp->id;
+	  cd->lockoffset = rp->lockoffset;
+	  cd->mark       = mark;
+	  cd->statmsg    = (char *)(cd + 1);
+	  strcpy(cd->statmsg, statmsg);
+	  cd->message    = cd->statmsg + strlen(statmsg) + 1;
+	  strcpy(cd->message, message);
+	  cd->host       = cd->message + strlen(message) + 1;
+	  strcpy(cd->host, host);
+
+	  if (!dp->diagpendtail)
+	    dp->diagpendtail = &dp->diagpend;
+	  *dp->diagpendtail = cd;
+	  dp->diagpendtail  = &cd->next;
+	}
+
+	if (dp->diagbuflen == 0)
+	  time(&dp->diagbuftime);
+	memcpy(dp->diagbuf + dp->diagbuflen, line, len);
+	dp->diagbuflen += len;
+	diagdp = dp;
+
+	if (ta_diagcommit == 0 || dp->diagbuflen >= DIAGBUFMAX ||
+	    time(NULL) - dp->diagbuftime >= ta_diagcommit)
+	  ctlcommit(dp);
+
+	return 0;
+}
+
+/*
+ *  Append the collected diagnostics into the control file, fsync() it,
+ *  and only then tell the scheduler about those recipients, and mark
+ *  them done.  With NULL: whichever control file has them.
+ */
+void
+ctlcommit(dp)
+	struct ctldesc *dp;
+{
+	struct ctldiag *cd;
+	int oldfl, newfl, rc2;
+	off_t ctlsize;
+	long oldalarm;
+
+	if (!dp)
+	  dp = diagdp;
+	if (!dp)
+	  return;
+	if (dp == diagdp)
+	  diagdp = NULL;
+
+	if (dp->diagbuflen > 0) {
+
+	  /* Set the APPEND-mode on.. We need it now !
+	     (and make sure the non-blocking mode is NOT on!) */
+	  oldfl = fcntl(dp->ctlfd, F_GETFL);
+	  newfl = (oldfl & ~O_NONBLOCK) | O_APPEND;
+	  if (oldfl != newfl)
+	    fcntl(dp->ctlfd, F_SETFL, newfl);
+
+	  oldalarm = alarm(0);	/* We do NOT want to be alarmed while
+				   writing to the log! */
+
+	  ctlsize = lseek(dp->ctlfd, 0, SEEK_END);
+
+	  rc2 = write(dp->ctlfd, dp->diagbuf, dp->diagbuflen);
+
+	  if (rc2 != dp->diagbuflen) {
+	    /* UAARGH! -- write failed, must have disk full! */
+#ifdef HAVE_FTRUNCATE
+	    while (ftruncate(dp->ctlfd, ctlsize) < 0) /* Sigh.. */
+	      if (errno != EINTR && errno != EAGAIN)
+		break;
+#endif /* HAVE_FTRUNCATE */
+	    fprintf(stdout,"#HELP! diagnostic writeout with bad results!: len=%d, rc=%d\n", dp->diagbuflen, rc2);
+	    fflush(stdout);
+	    exit(EX_DATAERR);
+	  }
+#ifdef HAVE_FSYNC
+	  while (fsync(dp->ctlfd) < 0) {
+	    if (errno == EINTR || errno == EAGAIN)
+	      continue;
+	    break;
+	  }
+#endif
+	  if (oldalarm)		/* Restore it, if it was ticking. */
+	    alarm(oldalarm);
+
+	  /* If we had to set the APPEND mode previously, clear it now! */
+	  if (oldfl != newfl)
+	    fcntl(dp->ctlfd, F_SETFL, oldfl);
+
+	  dp->diagbuflen = 0;
+	}
+
+	/* Now it is on the disk, and we can tell about it */
+	while ((cd = dp->diagpend) != NULL) {
+	  dp->diagpend = cd->next;
+
+	  ta_report(dp->ctlid, cd->id, "", cd->statmsg, cd->message);
+
+	  if (!lockaddr(dp->ctlfd, dp->ctlmap, cd->lockoffset,
+			_CFTAG_LOCK, cd->mark, (char*)dp->msgfile,
+			cd->host, getpid())) {
+	    /* FIXME: something went wrong in unlocking it,
+	       FIXME: concurrency problem? */
+	  }
+	  free(cd);
+	}
+	dp->diagpendtail = NULL;
+}
+
+
 #ifdef HAVE_STDARG_H
 #ifdef __STDC__
 void
@@ -248,6 +436,7 @@ diagnostic(verboselog, rp, rc, timeout, fmt, va_alist) /* (verboselog, rp, rc, t
 	int report_notary = 1;
 	int logreport = 0;
 	int no_notary = 0;
+	int queued = 0;
 	int lockoffset = rp->lockoffset;
 
 
@@ -313,12 +502,9 @@ diagnostic(verboselog, rp, rc, timeout, fmt, va_alist) /* (verboselog, rp, rc, t
 
 	  if (!rp->lockoffset) return; /* Don't re-report... */
 
-	  fprintf(stdout,"%d/%d\t%s\t%s %s\n",
-		  rp->desc->ctlid, rp->id,
-		  (notarybuf && report_notary) ? notarybuf : "",
-		  
-		  "deferred", "MALLOC FAILURE!");
-	  fflush(stdout);
+	  ta_report(rp->desc->ctlid, rp->id,
+		    (notarybuf && report_notary) ? notarybuf : "",
+		    "deferred", "MALLOC FAILURE!");
 
 	  if (!lockaddr(rp->desc->ctlfd, rp->desc->ctlmap,
 			rp->lockoffset, _CFTAG_LOCK, _CFTAG_DEFER,
@@ -352,6 +538,9 @@ diagnostic(verboselog, rp, rc, timeout, fmt, va_alist) /* (verboselog, rp, rc, t
 		  statmsg = "ok";
 		mark = _CFTAG_OK;
 		logreport = ta_logs_diagnostics && report_notary;
+		if (MIBTaDeliveryTime)
+		  Z_SHM_MIB_Hist(MIBTaDeliveryTime,
+				 (time(NULL) - rp->desc->msgmtime) * 1000UL);
 		break;
 	case EX_TEMPFAIL:
 	case EX_IOERR:
@@ -403,87 +592,37 @@ diagnostic(verboselog, rp, rc, timeout, fmt, va_alist) /* (verboselog, rp, rc, t
 
 	if (logreport && rp->lockoffset) {
 	  /* Right, we have a honour to append our diagnostics to the
-	     transport specification file ourselves */
-	  int oldfl = fcntl(rp->desc->ctlfd, F_GETFL);
-	  int newfl;
+	     transport specification file ourselves -- at the commit */
 	  int len = 80 + strlen(notarybuf ? notarybuf : "") + strlen(message);
-	  int rc2;
-	  off_t ctlsize;
-	  long oldalarm;
+	  int report = !(rp->notifyflgs & _DSN__DIAGDELAYMODE);
 	  char *sbuf;
 
-	  /* Set the APPEND-mode on.. We need it now !
-	     (and make sure the non-blocking mode is NOT on!) */
-	  newfl = (oldfl & ~O_NONBLOCK) | O_APPEND;
-	  if (oldfl != newfl)
-	    fcntl(rp->desc->ctlfd, F_SETFL, newfl);
-
 #ifdef HAVE_ALLOCA
 	  sbuf = alloca(len);
 #else
 	  sbuf = malloc(len);
-	  if (!sbuf)
-	    zmalloc_failure = 1;
 #endif
 
 	  if (sbuf) {
-	    /* Log the diagnostic string to the file */
-	    int oldflg;
-#ifndef SPRINTF_CHAR
-	    len = 
-#endif
-	      sprintf(sbuf, "%c%c%d:%d:%d::%ld\t%s\t%s\n",
-		      _CF_DIAGNOSTIC, _CFTAG_NORMAL,
-		      rp->id, rp->headeroffset, rp->drptoffset,
-		      (long)time(NULL), notarybuf ? notarybuf : "", message);
-#ifdef SPRINTF_CHAR
-	    len = strlen(sbuf);
-#endif
-
-	    oldalarm = alarm(0);	/* We do NOT want to be alarmed while
-					   writing to the log! */
-
-	    ctlsize = lseek(rp->desc->ctlfd, 0, SEEK_END);
-	    oldflg = fcntl(rp->desc->ctlfd, F_GETFL, 0);
-	    fcntl(rp->desc->ctlfd, F_SETFL, oldflg | O_APPEND);
-
-	    rc2 = write(rp->desc->ctlfd, sbuf, len);
-
-	    fcntl(rp->desc->ctlfd, F_SETFL, oldflg);
-
-
-	    if (rc2 != len || rc2 < 0 || len < 0) {
-	      /* UAARGH! -- write failed, must have disk full! */
-#ifdef HAVE_FTRUNCATE
-	      while (ftruncate(rp->desc->ctlfd, ctlsize) < 0) /* Sigh.. */
-		if (errno != EINTR && errno != EAGAIN)
-		  break;
-#endif /* HAVE_FTRUNCATE */
-	      fprintf(stdout,"#HELP! diagnostic writeout with bad results!: len=%d, rc=%d\n", len, rc2);
-	      fflush(stdout);
-	      exit(EX_DATAERR);
+	    sprintf(sbuf, "%c%c%d:%d:%d::%ld\t%s\t%s\n",
+		    _CF_DIAGNOSTIC, _CFTAG_NORMAL,
+		    rp->id, rp->headeroffset, rp->drptoffset,
+		    (long)time(NULL), notarybuf ? notarybuf : "", message);
+
+	    if (ctldiag_queue(rp, sbuf, statmsg, message, report, mark) == 0) {
+	      queued = report;
+	      /* Now we have no reason to send also the NOTARY report up.. */
+	      no_notary = 1;
 	    }
-#ifdef HAVE_FSYNC
-	    while (fsync(rp->desc->ctlfd) < 0) {
-	      if (errno == EINTR || errno == EAGAIN)
-		continue;
-	      break;
-	    }
-#endif
-	    if (oldalarm)		/* Restore it, if it was ticking. */
-	      alarm(oldalarm);
-
 #ifndef HAVE_ALLOCA
 	    free(sbuf);
 #endif
 	  }
-
-	  /* If we had to set the APPEND mode previously, clear it now! */
-	  if (oldfl != newfl)
-	    fcntl(rp->desc->ctlfd, F_SETFL, oldfl);
-
-	  /* Now we have no reason to send also the NOTARY report up.. */
-	  no_notary = 1;
+	  if (!no_notary) {
+	    /* Report it unlogged, after the ones before it */
+	    zmalloc_failure = 1;
+	    ctlcommit(rp->desc);
+	  }
 	}
 
 
@@ -508,13 +647,22 @@ diagnostic(verboselog, rp, rc, timeout, fmt, va_alist) /* (verboselog, rp, rc, t
 
 	/* "Delay" the diagnostics from mailbox sieve subprocessing.
 	   Actually DON'T do then at all! */
-	if (rp->lockoffset && (!(rp->notifyflgs & _DSN__DIAGDELAYMODE))) {
+	if (queued) {
+	  /* The ctlcommit() tells the scheduler, and unlocks it */
+	  rp->lockoffset = 0;
+
+	  syslogmsg = strrchr(message, '\r');
+	  if (!syslogmsg) syslogmsg = message;
+	  else syslogmsg++; /* Skip the last \r ... */
+
+	  tasyslog(rp, xdelay, wtthost, wttip, statmsg, syslogmsg);
+
+	} else if (rp->lockoffset &&
+		   (!(rp->notifyflgs & _DSN__DIAGDELAYMODE))) {
 
-	  fprintf(stdout,"%d/%d\t%s\t%s %s\n",
-		  rp->desc->ctlid, rp->id,
-		  (!no_notary && notarybuf && report_notary) ? notarybuf : "",
-		  statmsg, message);
-	  fflush(stdout);
+	  ta_report(rp->desc->ctlid, rp->id,
+		    (!no_notary && notarybuf && report_notary) ? notarybuf : "",
+		    statmsg, message);
 
 	  switch(rp->status) {
 	  case EX_IOERR:
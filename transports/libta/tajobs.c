@@ -0,0 +1,241 @@
+/*
+ *  Job intake and result reporting of the transport agents.
+ *
+ *  The classic protocol with the scheduler is text lines: we say
+ *  "#hungry", read "spool/file[\thost]" (or "#idle", or an empty line
+ *  meaning "go away") from stdin, and write diagnostics as lines of
+ *  "inum/offset\tnotary\tstatus message" to stdout.
+ *
+ *  When the scheduler has given us a shared memory job ring (see
+ *  include/taring.h), the same things travel as ring records, and
+ *  the stdin/stdout pipes are left for the EOF at the shutdown, and
+ *  for the odd report lines.  Callers see the same text either way.
+ */
+
+#include "hostenv.h"
+#include <stdio.h>
+#include <errno.h>
+#include "zmalloc.h"
+#include "libz.h"
+#include "libc.h"
+#include "zmpoll.h"
+#include "taring.h"
+#include "ta.h"
+
+static struct taring *ta_ring = NULL;
+static struct taring_msg ta_ringmsg;
+static int ta_ringinit = 0;
+
+static struct taring *ta_ringopen __((void));
+static struct taring *
+ta_ringopen()
+{
+	if (!ta_ringinit) {
+	  ta_ringinit = 1;
+	  ta_ring = taring_attach();
+	}
+	return ta_ring;
+}
+
+/* Wait a bit for the scheduler to eat our reports; -1 when it is gone */
+static int ta_ringwait __((void));
+static int
+ta_ringwait()
+{
+	static struct zmpollfd *fds = NULL;
+	int fdscount = 0;
+
+	zmpoll_addfd(&fds, &fdscount, FILENO(stdin), -1, NULL);
+	if (zmpoll(fds, fdscount, 10) > 0) {
+	  /* Anything on the stdin at this point is the shutdown */
+	  taring_free(ta_ring);
+	  ta_ring = NULL;
+	  return -1;
+	}
+	return 0;
+}
+
+static int ta_ringput __((int, int, int, int, const char **));
+static int
+ta_ringput(type, id0, id1, nstr, str)
+	int type, id0, id1, nstr;
+	const char **str;
+{
+	while (ta_ring) {
+	  if (taring_put(ta_ring, type, id0, id1, nstr, str) == 0)
+	    return 0;
+	  if (errno != EAGAIN)
+	    return -1;
+	  if (ta_ringwait() < 0)
+	    break;
+	}
+	return -1;
+}
+
+void
+ta_askjob()
+{
+	ctlcommit(NULL);	/* Report all before asking for more */
+
+	if (ta_ringopen() && ta_ringput(TARING_HUNGRY, 0, 0, 0, NULL) == 0)
+	  return;
+
+	fprintf(stdout, "#hungry\n");
+	fflush(stdout);
+}
+
+/* Format the next DOWN record into 'buf' the way it came as a line */
+static char *ta_ringline __((char *, int));
+static char *
+ta_ringline(buf, bufsize)
+	char *buf;
+	int bufsize;
+{
+	int rc;
+
+	rc = taring_get(ta_ring, &ta_ringmsg);
+	if (rc < 0) {
+	  /* Corrupted ring -- treat it as the end of work */
+	  taring_free(ta_ring);
+	  ta_ring = NULL;
+	  strcpy(buf, "\n");
+	  return buf;
+	}
+	if (rc == 0)
+	  return NULL;
+
+	switch (ta_ringmsg.type) {
+	case TARING_JOB:
+	  if (*ta_ringmsg.str[1])
+	    snprintf(buf, bufsize, "%s\t%s\n",
+		     ta_ringmsg.str[0], ta_ringmsg.str[1]);
+	  else
+	    snprintf(buf, bufsize, "%s\n", ta_ringmsg.str[0]);
+	  break;
+	case TARING_IDLE:
+	  snprintf(buf, bufsize, "#idle\n");
+	  break;
+	default: /* TARING_END */
+	  strcpy(buf, "\n");
+	  break;
+	}
+	return buf;
+}
+
+/*
+ *  Non-blocking: the next job line, if there is one in the ring.
+ *  When there is none, the ring fd  ta_jobfd()  becomes readable
+ *  at the arrival of one.
+ */
+char *
+ta_nextjob(buf, bufsize)
+	char *buf;
+	int bufsize;
+{
+	if (!ta_ring)
+	  return NULL;
+	for (;;) {
+	  if (ta_ringline(buf, bufsize))
+	    return buf;
+	  if (!ta_ring || !taring_sleep(ta_ring))
+	    return NULL;
+	}
+}
+
+/* The fd to wait at for ta_nextjob(), or -1 in the text mode */
+int
+ta_jobfd()
+{
+	if (!ta_ringopen())
+	  return -1;
+	return taring_fd(ta_ring);
+}
+
+/*
+ *  Blocking: say "#hungry", and get the next job line, like fgets()
+ *  from the stdin.  NULL at the EOF.
+ */
+char *
+ta_getjob(buf, bufsize)
+	char *buf;
+	int bufsize;
+{
+	static struct zmpollfd *fds = NULL;
+	struct zmpollfd *jobfd, *infd;
+	int fdscount;
+
+	ta_askjob();
+
+	while (ta_ring) {
+	  if (ta_nextjob(buf, bufsize))
+	    return buf;
+	  if (!ta_ring)
+	    break;
+
+	  fdscount = 0;
+	  jobfd = infd = NULL;
+	  zmpoll_addfd(&fds, &fdscount, taring_fd(ta_ring), -1, &jobfd);
+	  zmpoll_addfd(&fds, &fdscount, FILENO(stdin), -1, &infd);
+	  if (zmpoll(fds, fdscount, -1) < 0)
+	    continue;
+	  if (infd && infd->revents)
+	    /* The scheduler shuts us down thru the pipe */
+	    break;
+	}
+
+	if (fgets(buf, bufsize, stdin) == NULL)
+	  return NULL;
+	return buf;
+}
+
+void
+ta_resync(file)
+	const char *file;
+{
+	if (ta_ringopen() && ta_ringput(TARING_TEXT, 0, 0, 1, &file) == 0)
+	  return;
+
+	fprintf(stdout, "#resync %s\n", file);
+	fflush(stdout);
+}
+
+/*
+ *  One diagnostic for the scheduler.  The 'statmsg' can carry an
+ *  argument ("retryat +60"), thus the status word is split here at
+ *  the first space, like the scheduler does for the text lines.
+ */
+void
+ta_report(ctlid, id, notary, statmsg, message)
+	int ctlid, id;
+	const char *notary, *statmsg, *message;
+{
+	const char *str[3];
+	char *s = NULL;
+
+	if (ta_ringopen()) {
+	  const char *p = strchr(statmsg, ' ');
+	  str[0] = notary;
+	  str[1] = statmsg;
+	  str[2] = message;
+	  if (p) {
+	    int l = p - statmsg;
+	    s = malloc(strlen(statmsg) + strlen(message) + 2);
+	    if (s) {
+	      memcpy(s, statmsg, l);
+	      s[l] = 0;
+	      sprintf(s + l + 1, "%s %s", p + 1, message);
+	      str[1] = s;
+	      str[2] = s + l + 1;
+	    }
+	  }
+	  if ((!p || s) && ta_ringput(TARING_DIAG, ctlid, id, 3, str) == 0) {
+	    if (s) free(s);
+	    return;
+	  }
+	  if (s) free(s);
+	}
+
+	fprintf(stdout, "%d/%d\t%s\t%s %s\n",
+		ctlid, id, notary, statmsg, message);
+	fflush(stdout);
+}
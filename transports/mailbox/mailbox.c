@@ -408,7 +408,7 @@ static void SHM_MIB_diag(rc)
   switch (rc) {
   case EX_OK:
     /* OK */
-    MIBMtaEntry->tambox.TaRcptsOk ++;
+    MIBMtaCnt->tambox.TaRcptsOk ++;
     break;
   case EX_TEMPFAIL:
   case EX_IOERR:
@@ -417,7 +417,7 @@ static void SHM_MIB_diag(rc)
   case EX_SOFTWARE:
   case EX_DEFERALL:
     /* DEFER */
-    MIBMtaEntry->tambox.TaRcptsRetry ++;
+    MIBMtaCnt->tambox.TaRcptsRetry ++;
     break;
   case EX_NOPERM:
   case EX_PROTOCOL:
@@ -427,7 +427,7 @@ static void SHM_MIB_diag(rc)
   case EX_UNAVAILABLE:
   default:
     /* FAIL */
-    MIBMtaEntry->tambox.TaRcptsFail ++;
+    MIBMtaCnt->tambox.TaRcptsFail ++;
     break;
   }
 }
@@ -521,7 +521,8 @@ main(argc, argv)
 
 	Z_SHM_MIB_Attach(1); /* we don't care if it succeeds or fails.. */
 
-	MIBMtaEntry->tambox.TaProcessStarts += 1;
+	MIBMtaCnt->tambox.TaProcessStarts += 1;
+	MIBTaDeliveryTime = &MIBMtaCnt->tambox.TaDeliveryTime;
 	MIBMtaEntry->tambox.TaProcCountG    += 1;
 
 	atexit(MIBcountCleanup);
@@ -676,21 +677,18 @@ main(argc, argv)
 	       spool/file/name [ \t host.info ] \n
 	   */
 
-	  printf("#hungry\n");
-	  fflush(stdout);
-
-	  if (fgets(filename, sizeof(filename), stdin) == NULL)
+	  if (ta_getjob(filename, sizeof(filename)) == NULL)
 	    break;
 	  if (strchr(filename, '\n') == NULL) break; /* No ending '\n' !  Must
 						    have been partial input! */
 	  if (strcmp(filename, "#idle\n") == 0) {
-	    MIBMtaEntry->tambox.TaIdleStates += 1;
+	    MIBMtaCnt->tambox.TaIdleStates += 1;
 	    continue; /* Ah well, we can stay idle.. */
 	  }
 	  if (emptyline(filename, sizeof filename))
 	    break;
 
-	  MIBMtaEntry->tambox.TaMessages += 1;
+	  MIBMtaCnt->tambox.TaMessages += 1;
 
 	  s = strchr(filename,'\t');
 	  if (s != NULL) {
@@ -709,8 +707,7 @@ main(argc, argv)
 
 	  dp = ctlopen(filename, channel, host, &getout, NULL, NULL);
 	  if (dp == NULL) {
-	    printf("#resync %s\n",filename);
-	    fflush(stdout);
+	    ta_resync(filename);
 	    continue;
 	  }
 	  if (verboselog) {
@@ -1185,7 +1182,7 @@ deliver(dp, rp, usernam, timestring)
 	struct Zpasswd *pw = NULL;
 	time_t starttime;
 
-	MIBMtaEntry->tambox.TaDeliveryStarts += 1;
+	MIBMtaCnt->tambox.TaDeliveryStarts += 1;
 
 	time(&starttime);
 	notary_setxdelay(0); /* Our initial speed estimate is
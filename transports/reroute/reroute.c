@@ -106,7 +106,7 @@ static void SHM_MIB_diag(rc)
   switch (rc) {
   case EX_OK:
     /* OK */
-    MIBMtaEntry->tarert.TaRcptsOk ++;
+    MIBMtaCnt->tarert.TaRcptsOk ++;
     break;
   case EX_TEMPFAIL:
   case EX_IOERR:
@@ -115,7 +115,7 @@ static void SHM_MIB_diag(rc)
   case EX_SOFTWARE:
   case EX_DEFERALL:
     /* DEFER */
-    MIBMtaEntry->tarert.TaRcptsRetry ++;
+    MIBMtaCnt->tarert.TaRcptsRetry ++;
     break;
   case EX_NOPERM:
   case EX_PROTOCOL:
@@ -125,7 +125,7 @@ static void SHM_MIB_diag(rc)
   case EX_UNAVAILABLE:
   default:
     /* FAIL */
-    MIBMtaEntry->tarert.TaRcptsFail ++;
+    MIBMtaCnt->tarert.TaRcptsFail ++;
     break;
   }
 }
@@ -175,7 +175,8 @@ main(argc, argv)
 
 	Z_SHM_MIB_Attach(1); /* we don't care if it succeeds or fails.. */
 
-	MIBMtaEntry->tarert.TaProcessStarts += 1;
+	MIBMtaCnt->tarert.TaProcessStarts += 1;
+	MIBTaDeliveryTime = &MIBMtaCnt->tarert.TaDeliveryTime;
 	MIBMtaEntry->tarert.TaProcCountG    += 1;
 
 	atexit(MIBcountCleanup);
@@ -220,20 +221,18 @@ main(argc, argv)
 	       spool/file/name [ \t host.info ] \n
 	   */
 
-	  printf("#hungry\n");
-	  fflush(stdout);
-	  if (fgets(filename, sizeof(filename), stdin) == NULL)
+	  if (ta_getjob(filename, sizeof(filename)) == NULL)
 	    break;
 	  if (strchr(filename, '\n') == NULL) break; /* No ending '\n' !  Must
 						    have been partial input! */
 	  if (strcmp(filename, "#idle\n") == 0) {
-	    MIBMtaEntry->tarert.TaIdleStates += 1;
+	    MIBMtaCnt->tarert.TaIdleStates += 1;
 	    continue; /* Ah well, we can stay idle.. */
 	  }
 	  if (emptyline(filename, sizeof(filename)))
 	    break;
 
-	  MIBMtaEntry->tarert.TaMessages += 1;
+	  MIBMtaCnt->tarert.TaMessages += 1;
 
 	  s = strchr(filename,'\t');
 
@@ -272,8 +271,7 @@ main(argc, argv)
 
 	  } else {
 
-	    printf("#resync %s\n",filename);
-	    fflush(stdout);
+	    ta_resync(filename);
 	  }
 	}
 	exit(0);
@@ -298,7 +296,7 @@ process(dp)
 	time_t mtime;
 	int rcpt_cnt = 0;
 
-	MIBMtaEntry->tarert.TaDeliveryStarts += 1;
+	MIBMtaCnt->tarert.TaDeliveryStarts += 1;
 
 	sawok = 0;
 	for (rp = dp->recipients; rp != NULL; rp = rp->next) {
@@ -154,7 +154,7 @@ static void SM_MIB_diag(rc)
   switch (rc) {
   case EX_OK:
     /* OK */
-    MIBMtaEntry->tasmcm.TaRcptsOk ++;
+    MIBMtaCnt->tasmcm.TaRcptsOk ++;
     break;
   case EX_TEMPFAIL:
   case EX_IOERR:
@@ -163,7 +163,7 @@ static void SM_MIB_diag(rc)
   case EX_SOFTWARE:
   case EX_DEFERALL:
     /* DEFER */
-    MIBMtaEntry->tasmcm.TaRcptsRetry ++;
+    MIBMtaCnt->tasmcm.TaRcptsRetry ++;
     break;
   case EX_NOPERM:
   case EX_PROTOCOL:
@@ -173,7 +173,7 @@ static void SM_MIB_diag(rc)
   case EX_UNAVAILABLE:
   default:
     /* FAIL */
-    MIBMtaEntry->tasmcm.TaRcptsFail ++;
+    MIBMtaCnt->tasmcm.TaRcptsFail ++;
     break;
   }
 }
@@ -286,7 +286,8 @@ main(argc, argv)
 
 	Z_SHM_MIB_Attach(1); /* we don't care if it succeeds or fails.. */
 
-	MIBMtaEntry->tasmcm.TaProcessStarts += 1;
+	MIBMtaCnt->tasmcm.TaProcessStarts += 1;
+	MIBTaDeliveryTime = &MIBMtaCnt->tasmcm.TaDeliveryTime;
 	MIBMtaEntry->tasmcm.TaProcCountG    += 1;
 
 	atexit(MIBcountCleanup);
@@ -362,21 +363,18 @@ main(argc, argv)
 	       spool/file/name [ \t host.info ] \n
 	   */
 
-	  printf("#hungry\n");
-	  fflush(stdout);
-
-	  if (fgets(file, sizeof file, stdin) == NULL)
+	  if (ta_getjob(file, sizeof file) == NULL)
 	    break;
 	  if (strchr(file, '\n') == NULL) break; /* No ending '\n' !  Must
 						    have been partial input! */
 	  if (strcmp(file, "#idle\n") == 0) {
-	    MIBMtaEntry->tasmcm.TaIdleStates += 1;
+	    MIBMtaCnt->tasmcm.TaIdleStates += 1;
 	    continue; /* Ah well, we can stay idle.. */
 	  }
 	  if (emptyline(file, sizeof file))
 	    break;
 
-	  MIBMtaEntry->tasmcm.TaMessages += 1;
+	  MIBMtaCnt->tasmcm.TaMessages += 1;
 
 	  s = strchr(file,'\t');
 	  if (s != NULL) {
@@ -388,8 +386,7 @@ main(argc, argv)
 	  ctlsticky(NULL, NULL, NULL); /* reset */
 	  dp = ctlopen(file, channel, host, &getout, ctlsticky, NULL);
 	  if (dp == NULL) {
-	    printf("#resync %s\n",file);
-	    fflush(stdout);
+	    ta_resync(file);
 	    continue;
 	  }
 	  if (verboselog != stdout && verboselog != NULL) {
@@ -466,7 +463,7 @@ deliver(dp, mp, startrp, endrp, verboselog)
 	CONVERTMODE convertmode = _CONVERT_NONE;
 	char *lineendseq = "\n";
 
-	MIBMtaEntry->tasmcm.TaDeliveryStarts += 1;
+	MIBMtaCnt->tasmcm.TaDeliveryStarts += 1;
 
 	now = time((time_t *)0);
 	timestring = ctime(&now);
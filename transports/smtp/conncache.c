@@ -0,0 +1,274 @@
+/*
+ *	Idle connection cache for the SMTP client.
+ *
+ *	The scheduler feeds us jobs grouped by the destination, and
+ *	when the destination changes, the open connection used to be
+ *	closed with a QUIT.  When the jobs for that host come again
+ *	a bit later, we did the connect, the EHLO, and possibly the
+ *	STARTTLS all over again.
+ *
+ *	With  -C count[,seconds]  the connection is parked here instead,
+ *	and picked up again when a job for the same host comes along.
+ *	The reuse goes thru the normal RSET probe of deliver(), thus
+ *	a connection that the remote has closed meanwhile just gets
+ *	reopened.  Connections idle for longer than 'seconds' (default
+ *	CONNCACHE_IDLE), and all of them at "#idle" and at the exit,
+ *	are closed with a QUIT.
+ *
+ *	A parked connection is the whole SmtpState copied aside;
+ *	the Sfio discipline and the TLS session point to the state
+ *	in main(), thus a connection is always moved back into that
+ *	same state before anything is done with it.  The buffers
+ *	(pipelining, chunking, stdin) belong to the job processing,
+ *	and stay where they are.
+ */
+
+#include "smtp.h"
+
+#define CONNCACHE_IDLE	60	/* seconds */
+
+struct conncache {
+	char	   host[MAXHOSTNAMELEN+1];	/* The job's host		*/
+	time_t	   parked;
+	SmtpState *SS;
+};
+
+static struct conncache *conncache = NULL;
+static int conncache_max   = 0;
+static int conncache_count = 0;
+static int conncache_idle  = CONNCACHE_IDLE;
+
+void
+conncache_init(max, idle)
+	int max, idle;
+{
+	conncache_max = max;
+	if (idle > 0)
+	  conncache_idle = idle;
+	if (max > 0)
+	  conncache = (struct conncache *) emalloc(max * sizeof(*conncache));
+}
+
+/* Things that belong to the job processing, not to the connection */
+static void conncache_jobstate __((SmtpState *to, SmtpState *from));
+static void
+conncache_jobstate(to, from)
+	SmtpState *to, *from;
+{
+	to->pipebuf      = from->pipebuf;
+	to->pipebufspace = from->pipebufspace;
+	to->pipecmds     = from->pipecmds;
+	to->pipercpts    = from->pipercpts;
+	to->pipestates   = from->pipestates;
+	to->pipespace    = from->pipespace;
+	to->pipeindex    = 0;
+
+	to->chunkbuf     = from->chunkbuf;
+	to->chunksize    = from->chunksize;
+	to->chunkspace   = from->chunkspace;
+
+	memcpy(to->stdinbuf, from->stdinbuf, sizeof(to->stdinbuf));
+	to->stdinsize    = from->stdinsize;
+	to->stdincurs    = from->stdincurs;
+
+	to->verboselog   = from->verboselog;
+	to->taspoolid    = from->taspoolid;
+	to->sel_channel  = from->sel_channel;
+	to->sel_host     = from->sel_host;
+	to->servport     = from->servport;
+#ifdef HAVE_OPENSSL
+	to->TLS.ctx      = from->TLS.ctx;
+#endif /* - HAVE_OPENSSL */
+}
+
+static void conncache_mxfree __((SmtpState *));
+static void
+conncache_mxfree(SS)
+	SmtpState *SS;
+{
+	int i;
+
+	for (i = 0; i < MAXFORWARDERS; ++i) {
+	  if (SS->mxh[i].host != NULL)
+	    free(SS->mxh[i].host);
+	  if (SS->mxh[i].ai != NULL)
+	    freeaddrinfo(SS->mxh[i].ai);
+	}
+	memset(SS->mxh, 0, sizeof(SS->mxh));
+	SS->mxcount = 0;
+}
+
+/* Move cache entry 'i' into the SS, and drop it from the cache */
+static void conncache_swapin __((SmtpState *, int));
+static void
+conncache_swapin(SS, i)
+	SmtpState *SS;
+	int i;
+{
+	SmtpState *CS = conncache[i].SS;
+
+	conncache_mxfree(SS);
+	if (SS->myhostname)
+	  free(SS->myhostname);
+
+	conncache_jobstate(CS, SS);
+	*SS = *CS;
+	free(CS);
+
+	--conncache_count;
+	if (i < conncache_count)
+	  conncache[i] = conncache[conncache_count];
+}
+
+/* QUIT and close the cache entry 'i' */
+static void conncache_drop __((SmtpState *, int));
+static void
+conncache_drop(SS, i)
+	SmtpState *SS;
+	int i;
+{
+	SmtpState *saved = (SmtpState *) emalloc(sizeof(*saved));
+
+	if (logfp)
+	  fprintf(logfp, "%s#\t(closed cached SMTP channel to %s)\n",
+		  logtag(), conncache[i].host);
+
+	/* The connection can only be used as 'SS' itself */
+	*saved = *SS;
+	memset(SS->mxh, 0, sizeof(SS->mxh));	/* Those are in 'saved' */
+	SS->myhostname = NULL;
+	conncache_swapin(SS, i);
+
+	if (!getout && !zmalloc_failure) {
+	  SS->rcptstates = 0;
+	  timeout = 30;		/* Not worth waiting much for */
+	  smtpwrite(SS, 0, "QUIT", -1, NULL);
+	}
+	smtpclose(SS, 0);
+	conncache_mxfree(SS);
+	if (SS->myhostname)
+	  free(SS->myhostname);
+
+	conncache_jobstate(saved, SS);
+	*SS = *saved;
+	free(saved);
+}
+
+/*
+ *  Park the open connection of SS; returns -1 when the
+ *  caller should close it the classic way instead.
+ */
+int
+conncache_park(SS, host)
+	SmtpState *SS;
+	const char *host;
+{
+	struct conncache *cc;
+	SmtpState *CS;
+	int i, oldest;
+
+	if (conncache_max <= 0 || !SS->smtpfp || SS->writeclosed)
+	  return -1;
+
+	if (conncache_count >= conncache_max) {
+	  oldest = 0;
+	  for (i = 1; i < conncache_count; ++i)
+	    if (conncache[i].parked < conncache[oldest].parked)
+	      oldest = i;
+	  conncache_drop(SS, oldest);
+	}
+
+	CS = (SmtpState *) malloc(sizeof(*CS));
+	if (!CS)
+	  return -1;
+
+	smtp_flush(SS);
+	*CS = *SS;
+
+	/* The parked one has no job buffers.. */
+	CS->pipebuf    = NULL;
+	CS->pipecmds   = NULL;
+	CS->pipercpts  = NULL;
+	CS->pipestates = NULL;
+	CS->chunkbuf   = NULL;
+	CS->verboselog = NULL;
+
+	/* .. and the SS has no connection */
+	SS->smtpfp      = NULL;
+	SS->smtpfd      = -1;
+	SS->writeclosed = 0;
+	SS->myhostname  = NULL;
+	memset(SS->mxh, 0, sizeof(SS->mxh));
+	SS->mxcount     = 0;
+#ifdef HAVE_OPENSSL
+	{
+	  SSL_CTX *ctx = SS->TLS.ctx;
+	  memset(&SS->TLS, 0, sizeof(SS->TLS));
+	  SS->TLS.ctx = ctx;
+	}
+#endif /* - HAVE_OPENSSL */
+
+	cc = &conncache[conncache_count++];
+	strncpy(cc->host, host, sizeof(cc->host));
+	cc->host[sizeof(cc->host)-1] = 0;
+	cc->parked = time(NULL);
+	cc->SS     = CS;
+
+	if (logfp)
+	  fprintf(logfp, "%s#\t(parked SMTP channel to %s)\n",
+		  logtag(), cc->host);
+	MIBMtaCnt->tasmtp.SmtpConnCacheParks ++;
+	return 0;
+}
+
+/* Pick up a parked connection to the 'host'; returns 0 if found */
+int
+conncache_fetch(SS, host)
+	SmtpState *SS;
+	const char *host;
+{
+	char buf[MAXHOSTNAMELEN+20];
+	int i;
+
+	if (SS->smtpfp)
+	  return -1;
+
+	for (i = 0; i < conncache_count; ++i)
+	  if (CISTREQ(conncache[i].host, host))
+	    break;
+	if (i >= conncache_count)
+	  return -1;
+
+	if (logfp)
+	  fprintf(logfp, "%s#\t(reusing cached SMTP channel to %s)\n",
+		  logtag(), conncache[i].host);
+
+	conncache_swapin(SS, i);
+
+	/* Verify it with RSET before use */
+	SS->do_rset = 1;
+
+	sprintf(buf, "dns; %.200s", SS->remotehost);
+	notary_setwtt(buf);
+	notary_setwttip(SS->ipaddress);
+
+	MIBMtaCnt->tasmtp.SmtpConnCacheHits ++;
+	return 0;
+}
+
+/* Close the connections idle for too long, or all of them */
+void
+conncache_expire(SS, all)
+	SmtpState *SS;
+	int all;
+{
+	time_t now_ = time(NULL);
+	int i;
+
+	for (i = 0; i < conncache_count; ) {
+	  if (all || conncache[i].parked + conncache_idle < now_)
+	    conncache_drop(SS, i);  /* Moves the last one to 'i' */
+	  else
+	    ++i;
+	}
+}
@@ -181,7 +181,8 @@ SmtpState *SS;
 	time_t tmout;
 	char *s;
 	static struct zmpollfd *fds = NULL;
-	int fdscount;
+	struct zmpollfd *infdp;
+	int fdscount, jobfd;
 
 	time(&now);
 
@@ -228,6 +229,12 @@ outbuf_fillup:
 
 	while (!getout) {
 
+	  /* Jobs thru the shared memory ring, if the scheduler gave one;
+	     the stdin has then only the EOF, or the shutdown. */
+	  if (ta_jobfd() >= 0 && ta_nextjob(*bufp, *bufsizp))
+	    return *bufp;
+	  jobfd = ta_jobfd(); /* -1 also when the ring went bad */
+
 	  time(&now);
 	  if (now < tmout)
 	    tv = tmout - now;
@@ -235,7 +242,9 @@ outbuf_fillup:
 	    tv = 0;
 
 	  fdscount = 0;
-	  zmpoll_addfd(&fds, &fdscount, infd, -1, NULL);
+	  zmpoll_addfd(&fds, &fdscount, infd, -1, &infdp);
+	  if (jobfd >= 0)
+	    zmpoll_addfd(&fds, &fdscount, jobfd, -1, NULL);
 
 	  rc = zmpoll(fds, fdscount, tv * 1000);
 	  time(&now);
@@ -264,7 +273,7 @@ outbuf_fillup:
 	  if (now >= tmout)
 	    tmout = now + 3*60; /* Another 'keepalive' in 3 minutes */
 
-	  if (rc == 1) { /* We have only ONE descriptor readable.. */
+	  if (rc > 0 && infdp->revents) { /* The stdin is readable.. */
 	    /* Got something to read on 'infd' (or EOF)
 	       .. and we are non-blocking! */
 	    int rdspace = sizeof(SS->stdinbuf) - SS->stdinsize;
@@ -450,6 +459,7 @@ main(argc, argv)
 	RETSIGTYPE (*oldsig)__((int));
 	volatile const char *smtphost = NULL;
 	int one_per_connection = 0;
+	int cachemax = 0, cacheidle = 0;
 
 #ifdef GLIBC_MALLOC_DEBUG__ /* memory allocation debugging with GLIBC */
 	old_malloc_hook = __malloc_hook;
@@ -480,7 +490,8 @@ main(argc, argv)
 
 	Z_SHM_MIB_Attach(1); /* we don't care if it succeeds or fails.. */
 
-	MIBMtaEntry->tasmtp.TaProcessStarts += 1;
+	MIBMtaCnt->tasmtp.TaProcessStarts += 1;
+	MIBTaDeliveryTime = &MIBMtaCnt->tasmtp.TaDeliveryTime;
 	MIBMtaEntry->tasmtp.TaProcCountG    += 1;
 
 	atexit(MIBcountCleanup);
@@ -538,7 +549,7 @@ main(argc, argv)
 	SS.remotemsg[0] = '\0';
 	SS.remotehost[0] = '\0';
 	while (1) {
-	  c = getopt(argc, argv, "A:c:deh:l:p:rsvw:xXDEF:L:HMO:PS:T:VWZ:1678");
+	  c = getopt(argc, argv, "A:C:c:deh:l:p:rsvw:xXDEF:L:HMO:PS:T:VWZ:1678");
 	  if (c == EOF)
 	    break;
 	  switch (c) {
@@ -673,6 +684,9 @@ main(argc, argv)
 	  case '1':
 	    one_per_connection = 1;
 	    break;
+	  case 'C':		/* cache idle connections: count[,seconds] */
+	    sscanf(optarg, "%d,%d", &cachemax, &cacheidle);
+	    break;
 	  case '8':
 	    force_8bit = 1;
 	    force_7bit = 0;
@@ -713,7 +727,7 @@ main(argc, argv)
 
 	if (errflg || optind > argc) {
 	  fprintf(stderr,
-		  "Usage: %s [-8|-8H|-7][-e][-r][-x][-X][-E][-P][-W][-T timeout][-h myhostname][-l logfile][-p portnum][-c channel][-F forcedest][-L localidentity][-S /path/to/SmtpSSL.conf] [host]\n", argv[0]);
+		  "Usage: %s [-8|-8H|-7][-e][-r][-x][-X][-E][-P][-W][-C count[,secs]][-T timeout][-h myhostname][-l logfile][-p portnum][-c channel][-F forcedest][-L localidentity][-S /path/to/SmtpSSL.conf] [host]\n", argv[0]);
 	  exit(EX_USAGE);
 	}
 
@@ -779,6 +793,9 @@ main(argc, argv)
 	filenamesize = 80;
 	filename = malloc(filenamesize);
 
+	if (!one_per_connection)
+	  conncache_init(cachemax, cacheidle);
+
 #ifdef	BIND
 	res_init();
 #ifdef RES_USE_INET6
@@ -811,8 +828,9 @@ main(argc, argv)
 
 	  fd_blockingmode(FILENO(stdout));
 
-	  fprintf(stdout, "#hungry\n");
-	  fflush(stdout);
+	  conncache_expire(&SS, 0);
+
+	  ta_askjob();
 
 	  if (statusreport) {
 	    if (idle)
@@ -836,7 +854,8 @@ main(argc, argv)
 
 	  if (STREQ(filename, "#idle\n")) {
 	    idle = 1;
-	    MIBMtaEntry->tasmtp.TaIdleStates += 1;
+	    MIBMtaCnt->tasmtp.TaIdleStates += 1;
+	    conncache_expire(&SS, 1); /* Nothing coming for them soon */
 	    continue; /* XX: We can't stay idle for very long, but.. */
 	  }
 	  if (emptyline(filename, filenamesize))
@@ -844,7 +863,7 @@ main(argc, argv)
 
 	  time(&now);
 
-	  MIBMtaEntry->tasmtp.TaMessages += 1;
+	  MIBMtaCnt->tasmtp.TaMessages += 1;
 
 	  s = strchr(filename,'\t');
 	  if (s != NULL) {
@@ -868,7 +887,16 @@ main(argc, argv)
 	       In theory we could use same host via MX, but...     */
 	    if (host && !STREQ(s,(char*)host)) {
 	      smtp_flush(&SS); /* Flush in every case */
-	      if (SS.smtpfp) {
+	      if (SS.smtpfp && !close_after_data && !getout &&
+		  conncache_park(&SS, (char*)host) == 0) {
+		/* Kept aside for the next jobs to the same host */
+		notary_setwtt(NULL);
+		notary_setwttip(NULL);
+		strncpy(SS.remotehost, (char*)host, sizeof(SS.remotehost));
+		SS.remotehost[sizeof(SS.remotehost)-1] = 0;
+		if (statusreport)
+		  report(&SS, "NewDomain: %s", host);
+	      } else if (SS.smtpfp) {
 		if (!getout && !zmalloc_failure) {
 		  SS.rcptstates = 0;
 		  smtpstatus = smtpwrite(&SS, 0, "QUIT", -1, NULL);
@@ -889,6 +917,9 @@ main(argc, argv)
 	    }
 	    if (host) free((void*)host);
 	    host = strdup(s);
+
+	    if (!SS.smtpfp && !skip_host)
+	      conncache_fetch(&SS, (char*)host);
 	  } else
 	    if (need_host) {
 	      fprintf(stdout,"# smtp needs defined host!\n");
@@ -913,8 +944,7 @@ main(argc, argv)
 	  SS.sel_host    = (const char *)host;
 
 	  if (dp == NULL) {
-	    fprintf(stdout,"#resync %.200s\n", filename);
-	    fflush(stdout);
+	    ta_resync(filename);
 	    if (logfp)
 	      fprintf(logfp, "%s#\tc='%s' h='%s' #resync %s\n", logtag(), channel, host, filename);
 	    continue;
@@ -996,6 +1026,7 @@ main(argc, argv)
 	  if (logfp)
 	    fprintf(logfp, "%s#\t(closed SMTP channel - final close)\n", logtag());
 	}
+	conncache_expire(&SS, 1);
 
 	if (SS.verboselog != NULL)
 	  fclose(SS.verboselog);
@@ -1156,7 +1187,7 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 	int doing_reopen, did_open;
 	int r, once;
 
-	MIBMtaEntry->tasmtp.TaDeliveryStarts += 1;
+	MIBMtaCnt->tasmtp.TaDeliveryStarts += 1;
 
 	hdr = has_header(startrp,"Content-Type:");
 	if (hdr)
@@ -1243,7 +1274,7 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 	SS->pipelining = pipelining;
 
 	if (pipelining && did_open)
-	  MIBMtaEntry->tasmtp.SmtpPIPELINING ++;
+	  MIBMtaCnt->tasmtp.SmtpPIPELINING ++;
 
 	SS->chunking   = ( SS->ehlo_capabilities & ESMTP_CHUNKING );
 
@@ -1373,6 +1404,9 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 
  more_recipients:;
 
+	/* The previous transaction is over, commit its diagnostics */
+	ctlcommit(dp);
+
 	if (more_rp != NULL) {
 
 	  startrp   = more_rp;
@@ -1454,7 +1488,7 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 	SS->do_rset = 1; /* Unless completed successfully,
 			    we must do RSET later... */
 
-	MIBMtaEntry->tasmtp.SmtpMAIL ++;
+	MIBMtaCnt->tasmtp.SmtpMAIL ++;
 
 	strcpy(SMTPbuf, "MAIL From:<");
 	s = SMTPbuf + 11;
@@ -1530,7 +1564,7 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 	if (SS->ehlo_capabilities & ESMTP_SIZEOPT) {
 	  sprintf(s, " SIZE=%ld", startrp->desc->msgsizeestimate);
 	  s += strlen(s);
-	  MIBMtaEntry->tasmtp.SmtpOPT_SIZE ++;
+	  MIBMtaCnt->tasmtp.SmtpOPT_SIZE ++;
 	}
 
 	/* DSN parameters ... */
@@ -1538,11 +1572,11 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 	  if (startrp->desc->envid != NULL) {
 	    sprintf(s," ENVID=%.800s",startrp->desc->envid);
 	    s += strlen(s);
-	    MIBMtaEntry->tasmtp.SmtpOPT_ENVID ++;
+	    MIBMtaCnt->tasmtp.SmtpOPT_ENVID ++;
 	  }
 	  if (startrp->desc->dsnretmode != NULL) {
 	    sprintf(s, " RET=%.20s", startrp->desc->dsnretmode);
-	    MIBMtaEntry->tasmtp.SmtpOPT_RET ++;
+	    MIBMtaCnt->tasmtp.SmtpOPT_RET ++;
 	  }
 	}
 
@@ -1715,8 +1749,8 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 	    } else
 	      strcat(s, " NOTIFY=FAILURE,DELAY"); /* Default value.. */
 
-	    MIBMtaEntry->tasmtp.SmtpOPT_NOTIFY ++;
-	    MIBMtaEntry->tasmtp.SmtpOPT_ORCPT  ++;
+	    MIBMtaCnt->tasmtp.SmtpOPT_NOTIFY ++;
+	    MIBMtaCnt->tasmtp.SmtpOPT_ORCPT  ++;
 
 
 	    s += strlen(s);
@@ -1740,7 +1774,7 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 	    }
 	  }
 	  
-	  MIBMtaEntry->tasmtp.SmtpRCPT ++;
+	  MIBMtaCnt->tasmtp.SmtpRCPT ++;
 
 	  timeout = timeout_cmd;
 	  /* RCPT To:<...> -- pipelineable */
@@ -1890,7 +1924,7 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 	  /* In PIPELINING mode ...... send "DATA" and SYNC ! */
 	  /* In non-pipelining mode .. send "DATA" and SYNC ! */
 
-	  MIBMtaEntry->tasmtp.SmtpDATA ++;
+	  MIBMtaCnt->tasmtp.SmtpDATA ++;
 
 	  timeout = timeout_data;
 	  r = smtpwrite(SS, 1, "DATA", 0 /* SYNC! */, NULL);
@@ -2283,6 +2317,7 @@ deliver(SS, dp, startrp, endrp, host, noMX)
 
  post_cleanup:
 
+	ctlcommit(dp);
 
 	if (CT)  free_content_type(CT);
 	if (CTE) free_content_encoding(CTE);
@@ -2301,42 +2336,42 @@ const char *buf;
 	if (r != NULL) *r = 0;
 	if (STREQ(buf,"8BITMIME")) {
 	  SS->ehlo_capabilities |= ESMTP_8BITMIME;
-	  MIBMtaEntry->tasmtp.EHLOcapability8BITMIME ++;
+	  MIBMtaCnt->tasmtp.EHLOcapability8BITMIME ++;
 	} else if (STREQ(buf,"DSN")) {
 	  SS->ehlo_capabilities |= ESMTP_DSN;
-	  MIBMtaEntry->tasmtp.EHLOcapabilityDSN ++;
+	  MIBMtaCnt->tasmtp.EHLOcapabilityDSN ++;
 	} else if (STREQ(buf,"ENHANCEDSTATUSCODES")) {
 	  SS->ehlo_capabilities |= ESMTP_ENHSTATUS;
-	  MIBMtaEntry->tasmtp.EHLOcapabilityENHANCEDSTATUSCODES ++;
+	  MIBMtaCnt->tasmtp.EHLOcapabilityENHANCEDSTATUSCODES ++;
 	} else if (STREQ(buf,"CHUNKING")) {
 	  SS->ehlo_capabilities |= ESMTP_CHUNKING;
-	  MIBMtaEntry->tasmtp.EHLOcapabilityCHUNKING ++;
+	  MIBMtaCnt->tasmtp.EHLOcapabilityCHUNKING ++;
 	} else if (STREQ(buf,"PIPELINING")) {
 	  SS->ehlo_capabilities |= ESMTP_PIPELINING;
-	  MIBMtaEntry->tasmtp.EHLOcapabilityPIPELINING ++;
+	  MIBMtaCnt->tasmtp.EHLOcapabilityPIPELINING ++;
 	} else if (STREQ(buf,"STARTTLS")) {
 #ifdef HAVE_OPENSSL
 	  SS->ehlo_capabilities |= ESMTP_STARTTLS;
 #endif /* - HAVE_OPENSSL */
-	  MIBMtaEntry->tasmtp.EHLOcapabilitySTARTTLS ++;
+	  MIBMtaCnt->tasmtp.EHLOcapabilitySTARTTLS ++;
 	} else if (STREQN(buf,"SIZE ",5) ||
 		   STREQ (buf,"SIZE")   ) {
 	  SS->ehlo_capabilities |= ESMTP_SIZEOPT;
 	  SS->ehlo_sizeval = -1;
 	  if (buf[4] == ' ')
 	    sscanf(buf+5,"%ld",&SS->ehlo_sizeval);
-	  MIBMtaEntry->tasmtp.EHLOcapabilitySIZE ++;
+	  MIBMtaCnt->tasmtp.EHLOcapabilitySIZE ++;
 	} else if (STREQN(buf,"AUTH ",5) ||
 		   STREQN(buf,"AUTH=",5)      ) {
 	  SS->ehlo_capabilities |= ESMTP_AUTH;
-	  MIBMtaEntry->tasmtp.EHLOcapabilityAUTH ++;
+	  MIBMtaCnt->tasmtp.EHLOcapabilityAUTH ++;
 	} else if (STREQN(buf,"DELIVERBY ",10) ||
 		   STREQ (buf,"DELIVERBY")    ) {
 	  SS->ehlo_capabilities |= ESMTP_DELIVERBY;
 	  SS->ehlo_deliverbyval = -1;
 	  if (buf[9] == ' ')
 	    sscanf(buf+10,"%ld;",&SS->ehlo_deliverbyval);
-	  MIBMtaEntry->tasmtp.EHLOcapabilityDELIVERBY ++;
+	  MIBMtaCnt->tasmtp.EHLOcapabilityDELIVERBY ++;
 	} else if (STREQN(buf,"X-RCPTLIMIT ",12)) {
 	  int nn = atoi(buf+12);
 	  if (nn < 10)
@@ -2405,23 +2440,23 @@ smtpopen(SS, host, noMX)
 
 	    if (lmtp_mode) {
 	      SMTPbuf[0] = 'L';
-	      MIBMtaEntry->tasmtp.SmtpLHLO ++;
+	      MIBMtaCnt->tasmtp.SmtpLHLO ++;
 	    } else {
-	      MIBMtaEntry->tasmtp.SmtpEHLO ++;
+	      MIBMtaCnt->tasmtp.SmtpEHLO ++;
 	    }
 
 	    i = smtp_ehlo(SS, SMTPbuf);
 
 	    if (i == EX_OK) {
 	      if (lmtp_mode)
-		MIBMtaEntry->tasmtp.SmtpLHLOok ++;
+		MIBMtaCnt->tasmtp.SmtpLHLOok ++;
 	      else
-		MIBMtaEntry->tasmtp.SmtpEHLOok ++;
+		MIBMtaCnt->tasmtp.SmtpEHLOok ++;
 	    } else {
 	      if (lmtp_mode)
-		MIBMtaEntry->tasmtp.SmtpLHLOfail ++;
+		MIBMtaCnt->tasmtp.SmtpLHLOfail ++;
 	      else
-		MIBMtaEntry->tasmtp.SmtpEHLOfail ++;
+		MIBMtaCnt->tasmtp.SmtpEHLOfail ++;
 	    }
 
 
@@ -2444,9 +2479,9 @@ smtpopen(SS, host, noMX)
 	      strcpy(SS->remotemsg,"500 (Remote system doesn't support mandated TLS mode)");
 
 	      if (lmtp_mode) /* really sort of TLS failure... */
-		MIBMtaEntry->tasmtp.SmtpLHLOfail ++;
+		MIBMtaCnt->tasmtp.SmtpLHLOfail ++;
 	      else
-		MIBMtaEntry->tasmtp.SmtpEHLOfail ++;
+		MIBMtaCnt->tasmtp.SmtpEHLOfail ++;
 
 	      continue;
 	    }
@@ -2454,7 +2489,7 @@ smtpopen(SS, host, noMX)
 	    if ((i == EX_OK) && tls_available &&
 		(SS->ehlo_capabilities & ESMTP_STARTTLS)) {
 
-	      MIBMtaEntry->tasmtp.SmtpSTARTTLS += 1;
+	      MIBMtaCnt->tasmtp.SmtpSTARTTLS += 1;
 
 	      SS->rcptstates = 0;
 	      timeout = timeout_cmd;
@@ -2463,9 +2498,9 @@ smtpopen(SS, host, noMX)
 		/* Wow, "STARTTLS" command started successfully! */
 		i = tls_start_clienttls(SS, host);
 		if (i)
-		  MIBMtaEntry->tasmtp.SmtpSTARTTLSfail += 1;
+		  MIBMtaCnt->tasmtp.SmtpSTARTTLSfail += 1;
 		else
-		  MIBMtaEntry->tasmtp.SmtpSTARTTLSok += 1;
+		  MIBMtaCnt->tasmtp.SmtpSTARTTLSok += 1;
 
 		if (i != 0) {
 		  /* TLS startup failed :-( */
@@ -2559,7 +2594,7 @@ smtpopen(SS, host, noMX)
 	      } else {
 		smtpclose(SS, 1); /* D'uh.. STARTTLS verb failed! */
 		
-		MIBMtaEntry->tasmtp.SmtpSTARTTLSfail += 1;
+		MIBMtaCnt->tasmtp.SmtpSTARTTLSfail += 1;
 
 		SS->esmtp_on_banner = SS->main_esmtp_on_banner;
 		SS->ehlo_capabilities = 0;
@@ -2612,14 +2647,14 @@ smtpopen(SS, host, noMX)
 	      sprintf(SMTPbuf, "HELO %.200s", SS->myhostname);
 	    else
 	      sprintf(SMTPbuf, "HELO %.200s", myhostname);
-	    MIBMtaEntry->tasmtp.SmtpHELO ++;
+	    MIBMtaCnt->tasmtp.SmtpHELO ++;
 
 	    i = smtp_ehlo(SS, SMTPbuf);
 
 	    if (i == EX_OK)
-	      MIBMtaEntry->tasmtp.SmtpHELOok ++;
+	      MIBMtaCnt->tasmtp.SmtpHELOok ++;
 	    else
-	      MIBMtaEntry->tasmtp.SmtpHELOfail ++;
+	      MIBMtaCnt->tasmtp.SmtpHELOfail ++;
 
 	    if (i != EX_OK && SS->smtpfp) {
 	      smtpclose(SS, 1);
@@ -3165,7 +3200,7 @@ makeconn(SS, hostname, ai, ismx)
 	int isreconnect = (ai == &SS->ai);
 	char	hostbuf[MAXHOSTNAMELEN+1];
 
-	MIBMtaEntry->tasmtp.SmtpStarts += 1;
+	MIBMtaCnt->tasmtp.SmtpStarts += 1;
 
 #ifdef	BIND
 #ifdef	RFC974
@@ -3321,9 +3356,9 @@ makeconn(SS, hostname, ai, ismx)
 	  case EX_OK:
 
 	      if (lmtp_mode)
-		MIBMtaEntry->tasmtp.LmtpConnects  += 1;
+		MIBMtaCnt->tasmtp.LmtpConnects  += 1;
 	      else
-		MIBMtaEntry->tasmtp.SmtpConnects  += 1;
+		MIBMtaCnt->tasmtp.SmtpConnects  += 1;
 
 	      SS->smtpfd = mfd;
 	      SS->smtpfp = sfnew(NULL, NULL, SS->smtp_bufsize, mfd, SF_WRITE);
@@ -3379,7 +3414,7 @@ makeconn(SS, hostname, ai, ismx)
 	      return EX_OK;
 
 	  default:
-	      MIBMtaEntry->tasmtp.SmtpConnectFails  += 1;
+	      MIBMtaCnt->tasmtp.SmtpConnectFails  += 1;
 	      if (logfp)
 		fprintf(logfp,"%s#\t(vcsetup() did yield %d )\n",logtag(), i);
 	      break;
@@ -3883,7 +3918,7 @@ int bdat_flush(SS, lastflg)
 	if (SS->smtpfp) tcpstream_denagle(sffileno(SS->smtpfp));
 
 
-	MIBMtaEntry->tasmtp.SmtpBDAT ++;
+	MIBMtaCnt->tasmtp.SmtpBDAT ++;
 
 	if (lastflg)
 	  sprintf(lbuf, "BDAT %d LAST", SS->chunksize);
@@ -5368,7 +5403,7 @@ static void SMTP_MIB_diag(rc)
   switch (rc) {
   case EX_OK:
     /* OK */
-    MIBMtaEntry->tasmtp.TaRcptsOk ++;
+    MIBMtaCnt->tasmtp.TaRcptsOk ++;
     break;
   case EX_TEMPFAIL:
   case EX_IOERR:
@@ -5377,7 +5412,7 @@ static void SMTP_MIB_diag(rc)
   case EX_SOFTWARE:
   case EX_DEFERALL:
     /* DEFER */
-    MIBMtaEntry->tasmtp.TaRcptsRetry ++;
+    MIBMtaCnt->tasmtp.TaRcptsRetry ++;
     break;
   case EX_NOPERM:
   case EX_PROTOCOL:
@@ -5387,7 +5422,7 @@ static void SMTP_MIB_diag(rc)
   case EX_UNAVAILABLE:
   default:
     /* FAIL */
-    MIBMtaEntry->tasmtp.TaRcptsFail ++;
+    MIBMtaCnt->tasmtp.TaRcptsFail ++;
     break;
   }
 }
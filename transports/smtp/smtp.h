@@ -437,4 +437,10 @@ extern char *logtag __((void));
 extern time_t starttime, endtime;
 
 extern int smtpauth  __((SmtpState *SS));
+
+/* conncache.c */
+extern void conncache_init   __((int max, int idle));
+extern int  conncache_park   __((SmtpState *SS, const char *host));
+extern int  conncache_fetch  __((SmtpState *SS, const char *host));
+extern void conncache_expire __((SmtpState *SS, int all));
 extern char *authpasswdfile;
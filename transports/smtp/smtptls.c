@@ -9,6 +9,7 @@
  */
 
 #include "smtp.h"
+#include "tlsscache.h"
 
 extern int timeout_tcpw;
 
@@ -114,6 +115,9 @@ static int do_dump = 0;
 
 int	tls_scache_timeout = 3600;	/* One hour */
 int	tls_use_scache     = 0;
+const char *tls_scache_file;
+
+static struct tlsscache *scache;	/* Shared with the smtpserver */
 
 extern int demand_TLS_mode;
 extern int tls_available;
@@ -712,224 +716,78 @@ static int dup_peername_func(CRYPTO_EX_DATA *to,
 }
 
 
-#if 0 /* some day */
-static SSL_SESSION *load_clnt_session(const char *hostname,
-				      int enforce_peername)
+/*
+ * The client sessions are kept in the shared cache file (see the
+ * smtpserver's  tls-scache-file)  by the peer name with a 'c' in front;
+ * a 'C' tells that the peer name was enforced when the session was made.
+ * We do not want to reuse a session that was not sufficiently checked.
+ */
+static int scache_clnt_key(key, hostname, enforce_peername)
+     unsigned char *key;
+     const char *hostname;
+     int enforce_peername;
 {
-    SSL_SESSION *session = NULL;
     int n;
-    int uselength;
-    int length;
-    int hex_length;
-    const char *session_hex;
-    pfixtls_scache_info_t scache_info;
-    unsigned char nibble, *data, *sess_data;
-    char *idstring[ID_MAXLENGTH + 1]; /* ALLOCA!! */
-
-    length = strlen(hostname); 
-    if (length > id_maxlength)
-	uselength = id_maxlength;	/* Limit length of ID */
-    else
-	uselength = length;
-
-    for(n=0 ; n < uselength ; n++)
-	idstring[n] = tolower(hostname[n]);
-    idstring[uselength] = '\0';
-    if (var_smtp_tls_loglevel >= 3)
-	msg_info("Trying to reload Session from disc: %s", idstring);
-
-    session_hex = dict_get(scache_db, idstring);
-    if (session_hex) {
-	hex_length = strlen(session_hex);
-	data = (unsigned char *)mymalloc(hex_length / 2);
-	if (!data) {
-	    msg_info("could not allocate memory for session reload");
-	    return(NULL);
-	}
-
-	memset(data, 0, hex_length / 2);
-	for (n = 0; n < hex_length; n++) {
-	    if ((session_hex[n] >= '0') && (session_hex[n] <= '9'))
-		nibble = session_hex[n] - '0';
-	    else
-		nibble = session_hex[n] - 'A' + 10;
-	    if (n % 2)
-		data[n / 2] |= nibble;
-	    else
-		data[n / 2] |= (nibble << 4);
-	}
 
-	/*
-	 * First check the version numbers, since wrong session data might
-	 * hit us hard (SEGFAULT). We also have to check for expiry.
-	 * When we enforce_peername, we may find an old session, that was
-	 * saved when enforcement was not set. In this case the session will
-	 * be removed and a fresh session will be negotiated.
-	 */
-	memcpy(&scache_info, data, sizeof(pfixtls_scache_info_t));
-	if ((scache_info.scache_db_version != scache_db_version) ||
-	    (scache_info.openssl_version != openssl_version) ||
-	    (scache_info.timestamp + var_smtpd_tls_scache_timeout < time(NULL)))
-	    dict_del(scache_db, idstring);
-	else if (enforce_peername && (!scache_info.enforce_peername))
-	    dict_del(scache_db, idstring);
-	else {
-	    sess_data = data + sizeof(pfixtls_scache_info_t);
-	    session = d2i_SSL_SESSION(NULL, &sess_data,
-				      hex_length / 2 - sizeof(time_t));
-	    strncpy(SSL_SESSION_get_ex_data(session, TLSpeername_index),
-		    idstring, id_maxlength + 1);
-	    if (!session)
-		pfixtls_print_errors();
-	}
-	free((char *)data);
-    }
-
-    if (session && (var_smtp_tls_loglevel >= 3))
-        msg_info("Successfully reloaded session from disc");
-
-    return (session);
+    key[0] = enforce_peername ? 'C' : 'c';
+    for (n = 0; hostname[n] && n < TLSSCACHE_IDMAX - 1; ++n)
+	key[n+1] = tolower((unsigned char)hostname[n]);
+    return n + 1;
 }
 
-
-static void create_client_lookup_id(char *idstring, char *hostname)
+static SSL_SESSION *load_clnt_session(SS, hostname, enforce_peername)
+     SmtpState *SS;
+     const char *hostname;
+     int enforce_peername;
 {
-    int n, len, uselength;
-
-    len = strlen(hostname);
-    if (len > id_maxlength)
-	uselength = id_maxlength;	/* Limit length of ID */
-    else
-	uselength = len;
-
-    for (n = 0 ; n < uselength ; n++)
-	idstring[n] = tolower(hostname[n]);
-    idstring[uselength] = '\0';
+    SSL_SESSION *session = NULL;
+    unsigned char der[SSL_SESSION_MAX_DER];
+    unsigned char key[TLSSCACHE_IDMAX];
+    unsigned char *pder = der;
+    int keylen, der_len;
+
+    keylen = scache_clnt_key(key, hostname, enforce_peername);
+    der_len = tlsscache_fetch(scache, key, keylen, der, sizeof(der));
+    if (der_len > 0) {
+      session = d2i_SSL_SESSION(NULL, &pder, der_len);
+      if (!session)
+	tlsscache_remove(scache, key, keylen);
+    }
+    if (tls_loglevel >= 3)
+      msg_info(SS, "Session for %s %sfound in the shared cache",
+	       hostname, session ? "" : "not ");
+    return (session);
 }
 
 /*
- * Save a new session to the external cache
+ * Save a new session to the shared cache
  */
-static int new_session_cb(SSL *ssl, SSL_SESSION *session)
+static void new_session_cb(SS, hostname, enforce_peername, session)
+     SmtpState *SS;
+     const char *hostname;
+     int enforce_peername;
+     SSL_SESSION *session;
 {
-  char idstring[2 * ID_MAXLENGTH + 1]; /* ALLOCA! */
-    int n;
-    int dsize;
-    int len;
-    unsigned char *data, *sess_data;
-    pfixtls_scache_info_t scache_info;
-    char *hexdata, *hostname;
-    SmtpState *SS;
-
-    if (tls_clientengine) {
-        TLScontext = SSL_get_ex_data(ssl, TLScontext_index);
-	hostname = SS->TLS.peername_save;
-	create_client_lookup_id(idstring, hostname);
-	strncpy(SSL_SESSION_get_ex_data(session, TLSpeername_index),
-		hostname, id_maxlength + 1);
-	/*
-	 * Remember, whether peername matching was enforced when the session
-	 * was created. If later enforce mode is enabled, we do not want to
-	 * reuse a session that was not sufficiently checked.
-	 */
-	scache_info.enforce_peername =
-		(SS->TLS.enforce_verify_errors && SS->TLS.enforce_CN);
-
-	if (var_smtp_tls_loglevel >= 3)
-	    msg_info(SS,"Trying to save session for hostID to disc: %s", idstring);
-
-#if (OPENSSL_VERSION_NUMBER < 0x00906011L) || (OPENSSL_VERSION_NUMBER == 0x00907000L)
-	    /*
-	     * Ugly Hack: OpenSSL before 0.9.6a does not store the verify
-	     * result in sessions for the client side.
-	     * We modify the session directly which is version specific,
-	     * but this bug is version specific, too.
-	     *
-	     * READ: 0-09-06-01-1 = 0-9-6-a-beta1: all versions before
-	     * beta1 have this bug, it has been fixed during development
-	     * of 0.9.6a. The development version of 0.9.7 can have this
-	     * bug, too. It has been fixed on 2000/11/29.
-	     */
-	    session->verify_result = SSL_get_verify_result(SS->TLS.con);
-#endif
-
-    } else {
-	create_server_lookup_id(idstring, session);
-	if (var_smtpd_tls_loglevel >= 3)
-	    msg_info(SS,"Trying to save Session to disc: %s", idstring);
+    unsigned char der[SSL_SESSION_MAX_DER];
+    unsigned char key[TLSSCACHE_IDMAX];
+    unsigned char *pder = der;
+    int keylen, der_len;
+
+    der_len = i2d_SSL_SESSION(session, NULL);
+    if (der_len <= 0 || der_len > sizeof(der)) {
+      msg_info(SS, "Could not access session");
+      return;
     }
-
-
-    /*
-     * Get the session and convert it into some "database" useable form.
-     * First, get the length of the session to allocate the memory.
-     */
-    dsize = i2d_SSL_SESSION(session, NULL);
-    if (dsize < 0) {
-	msg_info(SS,"Could not access session");
-	return 0;
-    }
-    data = (unsigned char *)mymalloc(dsize + sizeof(pfixtls_scache_info_t));
-    if (!data) {
-	msg_info(SS,"could not allocate memory for SSL session");
-	return 0;
-    }
-
-    /*
-     * OpenSSL is not robust against wrong session data (might SEGFAULT),
-     * so we secure it against version ids (session cache structure as well
-     * as OpenSSL version).
-     */
-    scache_info.scache_db_version = scache_db_version;
-    scache_info.openssl_version = openssl_version;
-
-    /*
-     * Put a timestamp, so that expiration can be checked without
-     * analyzing the session data itself. (We would need OpenSSL funtions,
-     * since the SSL_SESSION is a private structure.)
-     */
-    scache_info.timestamp = time(NULL);
-
-    memcpy(data, &scache_info, sizeof(pfixtls_scache_info_t));
-    sess_data = data + sizeof(pfixtls_scache_info_t);
-
-    /*
-     * Now, obtain the session. Unfortunately, it is binary and dict_update
-     * cannot handle binary data (it could contain '\0' in it) directly.
-     * To save memory we could use base64 encoding. To make handling easier,
-     * we simply use hex format.
-     */
-    len = i2d_SSL_SESSION(session, &sess_data);
-    len += sizeof(pfixtls_scache_info_t);
-
-    hexdata = (char *)mymalloc(2 * len + 1);
-
-    if (!hexdata) {
-	msg_info(SS,"could not allocate memory for SSL session (HEX)");
-	free((char *)data);
-	return 0;
-    }
-    for (n = 0; n < len; n++) {
-	hexdata[n * 2] = hexcodes[(data[n] & 0xf0) >> 4];
-	hexdata[(n * 2) + 1] = hexcodes[(data[n] & 0x0f)];
-    }
-    hexdata[len * 2] = '\0';
-
-    /*
-     * The session id is a hex string, all uppercase. We are using SDBM as
-     * compiled into Postfix with 8kB maximum entry size, so we set a limit
-     * when caching. If the session is not cached, we have to renegotiate,
-     * not more, not less. For a real session, this limit should never be
-     * met
-     */
-    if (strlen(idstring) + strlen(hexdata) < 8000)
-      dict_put(scache_db, idstring, hexdata);
-
-    free(hexdata);
-    free((char *)data);
-    return (1);
+    i2d_SSL_SESSION(session, &pder);
+
+    keylen = scache_clnt_key(key, hostname, enforce_peername);
+    if (tlsscache_store(scache, key, keylen, der, der_len,
+			time(NULL) + tls_scache_timeout) < 0)
+      msg_info(SS, "Could not save session for %s: %s",
+	       hostname, strerror(errno));
+    else if (tls_loglevel >= 3)
+      msg_info(SS, "Saved session for %s to the shared cache", hostname);
 }
-#endif
 
 
 
@@ -1110,6 +968,8 @@ int     tls_init_clientengine(SS, cfgpath)
 	    tls_random_source = strdup(a1);
 	  } else if (strcasecmp(n, "tls-cipher-list") == 0 && a1) {
 	    tls_cipherlist = strdup(a1);
+	  } else if (strcasecmp(n, "tls-scache-file") == 0 && a1) {
+	    tls_scache_file = strdup(a1);
 	  } else if (strcasecmp(n, "tls-scache-timeout") == 0 && a1) {
 	    tls_scache_timeout = atol(a1);
 	    if (tls_loglevel < 0) tls_loglevel = 0;
@@ -1395,6 +1255,17 @@ int     tls_init_clientengine(SS, cfgpath)
 							 dup_peername_func,
 							 free_peername_func);
 
+	/*
+	 * The shared session cache file.  This is the same file that the
+	 * smtpserver uses, if they are told so;  the keys do not collide.
+	 */
+	if (tls_scache_file && !scache) {
+	  scache = tlsscache_open(tls_scache_file, 0);
+	  if (!scache)
+	    msg_info(SS, "TLS session cache file '%s': %s",
+		     tls_scache_file, strerror(errno));
+	}
+
 	tls_clientengine = 1;
 
 
@@ -1494,11 +1365,10 @@ int     tls_start_clienttls(SS, peername) /* XX: enforce-peername ? */
      */
     SS->TLS.peername_save = strdup(peername);
 
-#if 0 /* some day.. */
-    if (scache_db) {
-      old_session = load_clnt_session(peername, enforce_peername);
+    if (scache) {
+      old_session = load_clnt_session(SS, peername, tls_enforce_peername);
       if (old_session) {
-	SSL_set_session(SS->TLS.con, old_session);
+	SSL_set_session(SS->TLS.ssl, old_session);
 #if (OPENSSL_VERSION_NUMBER < 0x00906011L) || (OPENSSL_VERSION_NUMBER == 0x00907000L)
 	/*
 	 * Ugly Hack: OpenSSL before 0.9.6a does not store the verify
@@ -1511,12 +1381,10 @@ int     tls_start_clienttls(SS, peername) /* XX: enforce-peername ? */
 	 * of 0.9.6a. The development version of 0.9.7 can have this
 	 * bug, too. It has been fixed on 2000/11/29.
 	 */
-	SSL_set_verify_result(SS->TLS.con, old_session->verify_result);
+	SSL_set_verify_result(SS->TLS.ssl, old_session->verify_result);
 #endif
-	   
       }
     }
-#endif
 
 #if 0 /* Some day... */
     /*
@@ -1574,16 +1442,28 @@ int     tls_start_clienttls(SS, peername) /* XX: enforce-peername ? */
 	if (tls_loglevel >= 2)
 	  msg_info(SS, "SSL session removed");
       }
-      if (old_session && (!SSL_session_reused(SS->TLS.ssl)))
-	SSL_SESSION_free(old_session); /* Must also be removed */
+      if (old_session) {
+	/* Must also be removed from the shared cache */
+	unsigned char key[TLSSCACHE_IDMAX];
+	tlsscache_remove(scache, key,
+			 scache_clnt_key(key, peername, tls_enforce_peername));
+	SSL_SESSION_free(old_session);
+      }
       
       tls_stop_clienttls(SS, 1);
       
       alarm(0);
+      return (-1);
     }
 
+    /* SSL_set_session() took a reference of its own */
+    if (old_session)
+      SSL_SESSION_free(old_session);
+
     if (!SSL_session_reused(SS->TLS.ssl)) {
-      SSL_SESSION_free(old_session);	/* Remove unused session */
+      session = SSL_get_session(SS->TLS.ssl);
+      if (scache && session)
+	new_session_cb(SS, peername, tls_enforce_peername, session);
     } else if (tls_loglevel >= 3)
       msg_info(SS,"Reusing old session");
 
@@ -0,0 +1,357 @@
+/*
+ *  The bulk mode of the  makedb  (-b)
+ *
+ *  The records are not stored into the database as they come, but
+ *  collected into memory, into runs of BULK_RUNSIZE bytes.  A full
+ *  run is sorted by the key, and written out into a temporary file
+ *  by a forked child, while the parent goes on parsing the input into
+ *  a fresh run.  At most  'jobs'  sorters run at the same time.  At
+ *  the end the runs are merged, and the records are handed to the
+ *  store function in the key order, thus the btree gets filled one
+ *  page after another, instead of at random.
+ *
+ *  The records of the same key come out in their input order, so
+ *  the duplicate and the append (-A) handling stays as it was.
+ */
+
+#include "hostenv.h"
+#include "mailer.h"
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include "libz.h"
+
+struct bulkrec {
+	int		klen, dlen;
+	int		linenum;
+	long		seq;		/* Input order		*/
+	/* The key, and then the data follow */
+};
+
+#define BULKREC_KEY(r)	 ((char *)(r) + sizeof(struct bulkrec))
+#define BULKREC_DATA(r)	 (BULKREC_KEY(r) + (r)->klen)
+#define BULKREC_SIZE(kl,dl) \
+	((sizeof(struct bulkrec) + (kl) + (dl) + sizeof(long) - 1) & ~(sizeof(long) - 1))
+
+#ifndef BULK_RUNSIZE
+#define BULK_RUNSIZE	(32*1024*1024)	/* Bytes of records per run	*/
+#endif
+
+struct bulkrun {
+	FILE		*fp;		/* NULL for the in-core one	*/
+	struct bulkrec	*cur;		/* The head record, or NULL	*/
+	char		*buf;
+	int		bufsize;
+};
+
+static char		*arena = NULL;
+static long		arenasize = 0, arenaused = 0;
+static struct bulkrec	**recs = NULL;
+static long		nrecs = 0, recspace = 0;
+static long		seqno = 0;
+
+static char		*runbase = NULL;
+static int		nruns    = 0;	/* Run files			*/
+static int		jobs     = 0;
+static int		sorters  = 0;	/* .. children writing them	*/
+static int		sortfail = 0;
+
+long bulk_records = 0;
+int  bulk_runs    = 0;
+
+extern void bulk_init __((const char *, int));
+extern int  bulk_add  __((const void *, int, const void *, int, int));
+extern int  bulk_load __((int (*)(void *, int, int, const void *, int, const void *, int), void *, int));
+
+
+void
+bulk_init(base, njobs)
+	const char *base;
+	int njobs;
+{
+	runbase = strdup(base);
+	jobs    = njobs;
+}
+
+static char *bulk_runname __((int));
+static char *
+bulk_runname(n)
+	int n;
+{
+	static char *name = NULL;
+
+	if (name == NULL)
+	  name = emalloc(strlen(runbase) + 20);
+	sprintf(name, "%s.run%d", runbase, n);
+	return name;
+}
+
+static int bulk_reccmp __((const struct bulkrec *, const struct bulkrec *));
+static int
+bulk_reccmp(a, b)
+	const struct bulkrec *a, *b;
+{
+	int n = a->klen < b->klen ? a->klen : b->klen;
+	int rc = memcmp(BULKREC_KEY(a), BULKREC_KEY(b), n);
+
+	/* The same order as the default btree compare has */
+	if (rc != 0)
+	  return rc;
+	if (a->klen != b->klen)
+	  return a->klen - b->klen;
+	return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+static int bulk_qcmp __((const void *, const void *));
+static int
+bulk_qcmp(a, b)
+	const void *a, *b;
+{
+	return bulk_reccmp(*(const struct bulkrec **)a,
+			   *(const struct bulkrec **)b);
+}
+
+/* Sort the in-core run, and write it out.  Runs in the sorter child. */
+
+static int bulk_writerun __((const char *));
+static int
+bulk_writerun(name)
+	const char *name;
+{
+	FILE *fp;
+	long i;
+	int rc;
+
+	qsort((void*)recs, nrecs, sizeof(*recs), bulk_qcmp);
+
+	fp = fopen(name, "w");
+	if (fp == NULL) {
+	  fprintf(stderr, "makedb: can't create sort run file '%s': %s\n",
+		  name, strerror(errno));
+	  return -1;
+	}
+	for (i = 0; i < nrecs; ++i)
+	  fwrite((void*)recs[i], 1,
+		 sizeof(struct bulkrec) + recs[i]->klen + recs[i]->dlen, fp);
+
+	rc = ferror(fp);
+	if (fclose(fp) != 0)
+	  rc = 1;
+	if (rc) {
+	  fprintf(stderr, "makedb: write of sort run file '%s' failed: %s\n",
+		  name, strerror(errno));
+	  unlink(name);
+	  return -1;
+	}
+	return 0;
+}
+
+/* Collect the exit codes of the sorters; either all, or just one. */
+
+static void bulk_reap __((int));
+static void
+bulk_reap(all)
+	int all;
+{
+	int pid, status;
+
+	while (sorters > 0) {
+	  pid = wait(&status);
+	  if (pid < 0) {
+	    if (errno == EINTR)
+	      continue;
+	    sorters = 0;
+	    break;
+	  }
+	  --sorters;
+	  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    sortfail = 1;
+	  if (!all)
+	    break;
+	}
+}
+
+static int bulk_spill __((void));
+static int
+bulk_spill()
+{
+	char *name;
+	int pid;
+
+	if (sorters >= jobs)
+	  bulk_reap(0);
+	if (sortfail)
+	  return -1;
+
+	name = bulk_runname(nruns);
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = (jobs > 0) ? fork() : -1;
+	if (pid == 0)
+	  _exit(bulk_writerun(name) < 0 ? 1 : 0);
+	if (pid < 0) {
+	  /* No children, or no fork(); do it here then */
+	  if (bulk_writerun(name) < 0)
+	    return -1;
+	} else
+	  ++sorters;
+
+	/* The child has its own copy of the run, we may reuse ours */
+	++nruns;
+	arenaused = 0;
+	nrecs     = 0;
+	return 0;
+}
+
+int
+bulk_add(t, tlen, s, slen, linenum)
+	const void *t, *s;
+	int tlen, slen, linenum;
+{
+	struct bulkrec *r;
+	long size = BULKREC_SIZE(tlen, slen);
+
+	if (arenaused + size > arenasize) {
+	  if (nrecs > 0 && bulk_spill() < 0)
+	    return -1;
+	  if (size > arenasize) {
+	    /* A very long one, or the first one */
+	    if (arena) free(arena);
+	    arenasize = (size > BULK_RUNSIZE) ? size : BULK_RUNSIZE;
+	    arena = emalloc(arenasize);
+	    if (arena == NULL)
+	      return -1;
+	  }
+	}
+
+	if (nrecs >= recspace) {
+	  recspace = recspace ? recspace * 2 : 65536;
+	  recs = (struct bulkrec **)erealloc((void*)recs,
+					     recspace * sizeof(*recs));
+	}
+
+	r = (struct bulkrec *)(arena + arenaused);
+	arenaused += size;
+	recs[nrecs++] = r;
+
+	r->klen    = tlen;
+	r->dlen    = slen;
+	r->linenum = linenum;
+	r->seq     = seqno++;
+	memcpy(BULKREC_KEY(r),  t, tlen);
+	memcpy(BULKREC_DATA(r), s, slen);
+
+	++bulk_records;
+	return 0;
+}
+
+/* Advance the run to its next record, returns -1 at a read error. */
+
+static int bulk_next __((struct bulkrun *, long *));
+static int
+bulk_next(rp, idxp)
+	struct bulkrun *rp;
+	long *idxp;
+{
+	struct bulkrec hdr;
+	int len;
+
+	if (rp->fp == NULL) {
+	  rp->cur = (*idxp < nrecs) ? recs[(*idxp)++] : NULL;
+	  return 0;
+	}
+
+	rp->cur = NULL;
+	if (fread((void*)&hdr, 1, sizeof(hdr), rp->fp) != sizeof(hdr))
+	  return ferror(rp->fp) ? -1 : 0;
+
+	len = sizeof(hdr) + hdr.klen + hdr.dlen;
+	if (len > rp->bufsize) {
+	  rp->bufsize = len + 1024;
+	  rp->buf = erealloc(rp->buf, rp->bufsize);
+	}
+	memcpy(rp->buf, (void*)&hdr, sizeof(hdr));
+	if (fread(rp->buf + sizeof(hdr), 1, len - sizeof(hdr), rp->fp)
+	    != len - sizeof(hdr))
+	  return -1;
+
+	rp->cur = (struct bulkrec *)rp->buf;
+	return 0;
+}
+
+/*
+ *  Merge the runs, and feed the records to the  storefn()  in the
+ *  key order.  Stops at the first store error, and returns -1 then.
+ */
+int
+bulk_load(storefn, dbf, typ)
+	int (*storefn) __((void *, int, int, const void *, int, const void *, int));
+	void *dbf;
+	int typ;
+{
+	struct bulkrun *runs, *rp, *best;
+	long idx = 0;
+	int i, rc = 0;
+
+	bulk_reap(1);
+	if (sortfail) {
+	  fprintf(stderr, "makedb: a sort run failed\n");
+	  rc = -1;
+	}
+
+	qsort((void*)recs, nrecs, sizeof(*recs), bulk_qcmp);
+
+	bulk_runs = nruns + 1;
+	runs = (struct bulkrun *)emalloc(bulk_runs * sizeof(*runs));
+	memset((void*)runs, 0, bulk_runs * sizeof(*runs));
+
+	for (i = 0; i < nruns && rc == 0; ++i) {
+	  rp = &runs[i];
+	  rp->fp = fopen(bulk_runname(i), "r");
+	  if (rp->fp == NULL || bulk_next(rp, &idx) < 0) {
+	    fprintf(stderr, "makedb: can't read sort run file '%s': %s\n",
+		    bulk_runname(i), strerror(errno));
+	    rc = -1;
+	  }
+	}
+	if (rc == 0)
+	  bulk_next(&runs[nruns], &idx);
+
+	/* There are just a few runs, a plain scan over them will do */
+	while (rc == 0) {
+	  best = NULL;
+	  for (i = 0; i < bulk_runs; ++i) {
+	    rp = &runs[i];
+	    if (rp->cur != NULL &&
+		(best == NULL || bulk_reccmp(rp->cur, best->cur) < 0))
+	      best = rp;
+	  }
+	  if (best == NULL)
+	    break;
+
+	  if ((*storefn)(dbf, typ, best->cur->linenum,
+			 BULKREC_KEY(best->cur),  best->cur->klen,
+			 BULKREC_DATA(best->cur), best->cur->dlen) < 0)
+	    rc = -1;
+	  else if (bulk_next(best, &idx) < 0) {
+	    fprintf(stderr, "makedb: read of a sort run file failed: %s\n",
+		    strerror(errno));
+	    rc = -1;
+	  }
+	}
+
+	for (i = 0; i < nruns; ++i) {
+	  if (runs[i].fp)  fclose(runs[i].fp);
+	  if (runs[i].buf) free(runs[i].buf);
+	  unlink(bulk_runname(i));
+	}
+	free(runs);
+
+	if (arena) free(arena);
+	if (recs)  free(recs);
+	arena = NULL;  arenasize = arenaused = 0;
+	recs  = NULL;  recspace  = nrecs     = 0;
+
+	return rc;
+}
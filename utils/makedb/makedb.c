@@ -15,6 +15,7 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <sys/time.h>
 #ifdef HAVE_NDBM
 #define datum Ndatum
 #include <ndbm.h>
@@ -47,11 +48,24 @@ int   uc_key      = 0;
 int   silent      = 0;
 int   aliasinput  = 0;
 int   policyinput = 0;
+int   bulkmode    = 0;
+int   bulkjobs    = 2;
 
 
 /* extern char *strchr(); */
 
 extern void  create_dbase   __((FILE *, void *, int));
+#ifdef HAVE_MMAP
+extern void *mmapdb_create  __((const char *));
+extern int   mmapdb_store   __((void *, const void *, int, const void *, int, int));
+extern int   mmapdb_fetch   __((void *, const void *, int, void **, int *));
+extern int   mmapdb_close   __((void *));
+#endif
+extern void  bulk_init      __((const char *, int));
+extern int   bulk_add       __((const void *, int, const void *, int, int));
+extern int   bulk_load      __((int (*)(void *, int, int, const void *, int, const void *, int), void *, int));
+extern long  bulk_records;
+extern int   bulk_runs;
 extern char *skip821address __((char *));
 extern void  usage          __((const char *, const char *, int));
 
@@ -59,7 +73,7 @@ void usage(prog, errs, err)
 const char *prog, *errs;
 int err;
 {
-	fprintf(stderr, "Usage: %s [-l|-u]] [-A][-a|-p][-s] dbtype database.name [infilename|-]\n", prog);
+	fprintf(stderr, "Usage: %s [-l|-u]] [-A][-a|-p][-s][-b [-j jobs]] dbtype database.name [infilename|-]\n", prog);
 	fprintf(stderr, "  where supported dbtypes are:");
 #ifdef HAVE_NDBM
 	fprintf(stderr, " ndbm");
@@ -69,6 +83,9 @@ int err;
 #endif
 #ifdef HAVE_DB
 	fprintf(stderr, " btree bhash");
+#endif
+#ifdef HAVE_MMAP
+	fprintf(stderr, " mmap");
 #endif
 	fprintf(stderr, "\n");
 	fprintf(stderr, " Error now: %s", errs);
@@ -92,6 +109,10 @@ int err;
 #else
 	fprintf(stderr, "  (Version 1.x ?)\n");
 #endif
+#endif
+#ifdef HAVE_MMAP
+	fprintf(stderr, "  (MMAP appends .zmdb, to the actual db file name;\n");
+	fprintf(stderr, "   it is for the '-p' policy database only..)\n");
 #endif
 	fprintf(stderr, "\n");
 
@@ -103,7 +124,10 @@ int err;
   The '-A' option APPENDS new data to existing keyed data.\n\
   The '-l' and '-u' will lower-/uppercasify key string before\n\
     storing it into the database.  This does not apply to '-p'.\n\
-  The '-s' option orders 'silent running' -- report only errors.\n");
+  The '-s' option orders 'silent running' -- report only errors.\n\
+  The '-b' option builds in bulk: the records are sorted by the key\n\
+    with up to '-j' parallel sorters (default 2), stored in the key\n\
+    order into a temporary file, and that is renamed into place.\n");
 
 	exit(64);
 }
@@ -159,6 +183,15 @@ static int store_db(dbf, typ, overwritemode, linenum, t, tlen, s, slen)
 #endif
 	int rc = -2;
 
+	if (bulkmode == 1) {
+	  /* Collecting for the bulk load; the store is done later */
+	  if (bulk_add(t, tlen, s, slen, linenum) < 0) {
+	    store_errors = 1;
+	    return -1;
+	  }
+	  return 0;
+	}
+
 	if (verbose) {
 	  if (policyinput) {
 	    const char *k = (const char *)t;
@@ -227,6 +260,11 @@ static int store_db(dbf, typ, overwritemode, linenum, t, tlen, s, slen)
 #endif
 	  }
 	  break;
+#endif
+#ifdef HAVE_MMAP
+	case 5:
+	  rc = mmapdb_store(dbf, t, tlen, s, slen, overwritemode);
+	  break;
 #endif
 	} /* end of switch(typ) ... */
 
@@ -290,6 +328,12 @@ static int store_db(dbf, typ, overwritemode, linenum, t, tlen, s, slen)
 	      datalen = Bdat.size;
 	    }
 	    break;
+#endif
+#ifdef HAVE_MMAP
+	  case 5:
+	    if (mmapdb_fetch(dbf, t, tlen, &dataptr, &datalen) != 0)
+	      dataptr = NULL;
+	    break;
 #endif
 	  } /* end of .. switch(typ) ... */
 
@@ -785,6 +829,67 @@ const int typ;
 }
 
 
+/* The bulk load gives the records here in the key order */
+
+static int bulk_store __((void *, int, int, const void *, int, const void *, int));
+static int bulk_store(dbf, typ, linenum, t, tlen, s, slen)
+     void *dbf;
+     int typ, linenum, tlen, slen;
+     const void *t, *s;
+{
+	int rc = store_db(dbf, typ, 0, linenum, t, tlen, s, slen);
+
+	if (rc > 0 && policyinput)
+	  fprintf(stderr, "WARNING: Duplicate key at line %d: %s\n",
+		  linenum, showkey(t));
+	return rc;
+}
+
+/* Move (or remove) the files of the bulk built database */
+
+static int bulk_rename __((const char *, const char *, int));
+static int bulk_rename(tmpbase, finalbase, typ)
+     const char *tmpbase, *finalbase;
+     int typ;
+{
+	static const char *ndbmsfx[] = { ".dir", ".pag", ".db", NULL };
+	static const char *gdbmsfx[] = { ".gdbm", NULL };
+	static const char *dbsfx[]   = { ".db", NULL };
+#ifdef HAVE_MMAP
+	static const char *mmapsfx[] = { PMDB_SUFFIX, NULL };
+#endif
+	const char **sfx = dbsfx;
+	char *from, *to;
+	int rc = 0;
+
+	if (typ == 1) sfx = ndbmsfx;
+	if (typ == 2) sfx = gdbmsfx;
+#ifdef HAVE_MMAP
+	if (typ == 5) sfx = mmapsfx;
+#endif
+
+	from = emalloc(strlen(tmpbase) + 20);
+	to   = emalloc((finalbase ? strlen(finalbase) : 0) + 20);
+	for (; *sfx != NULL; ++sfx) {
+	  sprintf(from, "%s%s", tmpbase, *sfx);
+	  if (finalbase == NULL) {
+	    unlink(from);
+	    continue;
+	  }
+	  sprintf(to, "%s%s", finalbase, *sfx);
+	  /* The NDBM files are by the library, not all may be there */
+	  if (rename(from, to) < 0 && (errno != ENOENT || typ != 1)) {
+	    fprintf(stderr, "makedb: rename('%s','%s') failed: %s\n",
+		    from, to, strerror(errno));
+	    rc = -1;
+	  }
+	}
+	free(from);
+	free(to);
+	return rc;
+}
+
+
 int main(argc, argv)
 int argc;
 char *argv[];
@@ -805,11 +910,13 @@ char *argv[];
     char *dbtype = NULL;
     void *dbf = NULL;
     char *argv0 = argv[0];
+    char *finalname = NULL, *tmpbase = NULL;
+    struct timeval tv0, tv1;
     int err;
 
     progname = argv[0];
 
-    while ((c = getopt(argc, argv, "Aalpsuv")) != EOF) {
+    while ((c = getopt(argc, argv, "Aabj:lpsuv")) != EOF) {
 	switch (c) {
 	case 'l':
 	    lc_key = 1;
@@ -823,6 +930,12 @@ char *argv[];
 	case 'a':
 	    aliasinput = 1;
 	    break;
+	case 'b':
+	    bulkmode = 1;
+	    break;
+	case 'j':
+	    bulkjobs = atoi(optarg);
+	    break;
 	case 'p':
 	    policyinput = 1;
 	    break;
@@ -849,6 +962,14 @@ char *argv[];
 	usage(argv0, "too many arguments", 0);
     dbasename = argv[optind + 1];
 
+    if (bulkmode) {
+	/* Build under a temporary name, and rename at the end */
+	finalname = dbasename;
+	dbasename = emalloc(strlen(finalname) + 20);
+	sprintf(dbasename, "%s.%d", finalname, (int)getpid());
+	tmpbase = dbasename;
+	bulk_init(dbasename, bulkjobs);
+    }
 
     if ((argc - optind) == 3) {
 	if (strcmp(argv[optind + 2], "-") == 0)
@@ -877,6 +998,12 @@ char *argv[];
     if (cistrcmp(dbtype, "bhash") == 0)
 	typ = 4;
 #endif
+#ifdef HAVE_MMAP
+    if (cistrcmp(dbtype, "mmap") == 0)
+	typ = 5;
+    if (typ == 5 && !policyinput)
+	usage(argv0, "the mmap dbtype is for the policy database (-p) only", 0);
+#endif
 
     switch (typ) {
     case 0:
@@ -982,12 +1109,21 @@ char *argv[];
 	break;
 #endif
 #endif
+#endif
+#ifdef HAVE_MMAP
+    case 5:
+	dbasename = strcpy(malloc(strlen(dbasename) + 8), dbasename);
+	strcat(dbasename, PMDB_SUFFIX);	/* ALWAYS append this */
+
+	dbf = mmapdb_create(dbasename);
+	break;
 #endif
     }
     if (dbf == NULL)
 	usage(argv0, "Can't open dbase file", errno);
 
     initzline(BUFSIZ);
+    gettimeofday(&tv0, NULL);
 
     if (policyinput)
 	    rc = create_policy_dbase(infile, dbf, typ);
@@ -996,6 +1132,12 @@ char *argv[];
     else
 	    rc = create_keyed_dbase(infile, dbf, typ);
 
+    if (bulkmode) {
+	bulkmode = 2;
+	if (bulk_load(bulk_store, dbf, typ) < 0)
+	    rc = 1;
+    }
+
     switch (typ) {
 #ifdef HAVE_NDBM
     case 1:
@@ -1016,6 +1158,12 @@ char *argv[];
       (dbfile->close) (dbfile);
 #endif
       break;
+#endif
+#ifdef HAVE_MMAP
+    case 5:
+      if (mmapdb_close(dbf) < 0)
+	usage(argv0, "Can't write the dbase file", errno);
+      break;
 #endif
     }  /* end of .. switch(typ) .. */
 
@@ -1024,5 +1172,20 @@ char *argv[];
       rc = 1;
     }
 
+    if (bulkmode) {
+      /* Put the new one in place only when it is all good */
+      if (bulk_rename(tmpbase, rc ? NULL : finalname, typ) < 0)
+	rc = 1;
+
+      gettimeofday(&tv1, NULL);
+      if (!silent) {
+	double secs = (tv1.tv_sec - tv0.tv_sec) +
+		      (tv1.tv_usec - tv0.tv_usec) / 1000000.0;
+	fprintf(stdout, "%ld records, %d sort runs, %.2f seconds, %.0f records/sec\n",
+		bulk_records, bulk_runs, secs,
+		(secs > 0.0) ? bulk_records / secs : (double)bulk_records);
+      }
+    }
+
     return (rc ? 1 : 0);
 }
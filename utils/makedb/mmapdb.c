@@ -0,0 +1,534 @@
+/*
+ *  The compiler of the "mmap" policy database image for  makedb -p
+ *
+ *  The records are collected into memory as they come, and at the
+ *  close they are laid out into the pointer-free image described at
+ *  "policy.h":  the IP address keys into prefix tries, the domain
+ *  names into the trie of their labels, and everything else into a
+ *  sorted key table.  The image is then written out in one go into
+ *  "NAME.zmdb.tmp", and renamed over the "NAME.zmdb";  the running
+ *  smtpservers have the old one mapped, and must never see it change
+ *  under them.
+ */
+
+#include "hostenv.h"
+#include "mailer.h"
+#include <sys/types.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "libz.h"
+#include "policy.h"
+
+struct mmaprec {
+	struct mmaprec	*next;		/* In the hash chain	*/
+	unsigned char	*key;
+	int		klen;
+	char		*data;
+	int		dlen;
+	unsigned int	doff;		/* In the image		*/
+};
+
+struct mmapdnode {
+	char		 *label;
+	struct mmapdnode *kids, *sibling;
+	int		 nkids;
+	struct mmaprec	 *exact, *wild;
+};
+
+struct mmapdb {
+	char		*fname;
+	char		*tmpname;	/* Written, then renamed	*/
+	struct mmaprec	**hash;
+	int		hashsize, count;
+
+	char		*img;		/* The image being made	*/
+	unsigned int	imglen, imgspace;
+};
+
+extern void *mmapdb_create __((const char *));
+extern int   mmapdb_store __((void *, const void *, int, const void *, int, int));
+extern int   mmapdb_fetch __((void *, const void *, int, void **, int *));
+extern int   mmapdb_close __((void *));
+
+static unsigned int mmapdb_hash __((const unsigned char *, int));
+static unsigned int
+mmapdb_hash(key, klen)
+	const unsigned char *key;
+	int klen;
+{
+	unsigned int h = 5381;
+
+	while (klen-- > 0)
+	  h = (h << 5) + h + *key++;
+	return h;
+}
+
+void *
+mmapdb_create(fname)
+	const char *fname;
+{
+	struct mmapdb *db;
+	char *tmpname;
+	int fd;
+
+	tmpname = emalloc(strlen(fname) + 8);
+	sprintf(tmpname, "%s.tmp", fname);
+
+	/* Fail now, not after all of the work */
+	fd = open(tmpname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) {
+	  free(tmpname);
+	  return NULL;
+	}
+	close(fd);
+	unlink(tmpname);
+
+	db = (struct mmapdb *) emalloc(sizeof(*db));
+	memset(db, 0, sizeof(*db));
+	db->fname    = strdup(fname);
+	db->tmpname  = tmpname;
+	db->hashsize = 4096;
+	db->hash     = (struct mmaprec **) emalloc(db->hashsize * sizeof(*db->hash));
+	memset(db->hash, 0, db->hashsize * sizeof(*db->hash));
+	return db;
+}
+
+static struct mmaprec **mmapdb_find __((struct mmapdb *, const void *, int));
+static struct mmaprec **
+mmapdb_find(db, key, klen)
+	struct mmapdb *db;
+	const void *key;
+	int klen;
+{
+	struct mmaprec **rp;
+
+	rp = &db->hash[mmapdb_hash(key, klen) % db->hashsize];
+	for (; *rp != NULL; rp = &(*rp)->next)
+	  if ((*rp)->klen == klen && memcmp((*rp)->key, key, klen) == 0)
+	    break;
+	return rp;
+}
+
+static void mmapdb_rehash __((struct mmapdb *));
+static void
+mmapdb_rehash(db)
+	struct mmapdb *db;
+{
+	struct mmaprec **old = db->hash, *r, *next;
+	int i, oldsize = db->hashsize;
+	unsigned int h;
+
+	db->hashsize = oldsize * 4;
+	db->hash = (struct mmaprec **) emalloc(db->hashsize * sizeof(*db->hash));
+	memset(db->hash, 0, db->hashsize * sizeof(*db->hash));
+	for (i = 0; i < oldsize; ++i)
+	  for (r = old[i]; r != NULL; r = next) {
+	    next = r->next;
+	    h = mmapdb_hash(r->key, r->klen) % db->hashsize;
+	    r->next = db->hash[h];
+	    db->hash[h] = r;
+	  }
+	free(old);
+}
+
+/* Like the dbm_store(): returns 1 for a duplicate key without 'overwrite' */
+int
+mmapdb_store(dbf, key, klen, data, dlen, overwrite)
+	void *dbf;
+	const void *key, *data;
+	int klen, dlen, overwrite;
+{
+	struct mmapdb *db = dbf;
+	struct mmaprec **rp, *r;
+
+	if (klen < 3 || ((const unsigned char *)key)[0] != klen) {
+	  errno = EINVAL;
+	  return -1;	/* Not a policy key */
+	}
+
+	rp = mmapdb_find(db, key, klen);
+	if ((r = *rp) != NULL) {
+	  if (!overwrite)
+	    return 1;
+	  free(r->data);
+	} else {
+	  r = (struct mmaprec *) emalloc(sizeof(*r));
+	  memset(r, 0, sizeof(*r));
+	  r->key  = (unsigned char *) emalloc(klen);
+	  memcpy(r->key, key, klen);
+	  r->klen = klen;
+	  *rp = r;
+	  if (++db->count > db->hashsize * 2)
+	    mmapdb_rehash(db);
+	}
+	r->data = (char *) emalloc(dlen + 1);
+	memcpy(r->data, data, dlen);
+	r->dlen = dlen;
+	return 0;
+}
+
+int
+mmapdb_fetch(dbf, key, klen, datap, dlenp)
+	void *dbf;
+	const void *key;
+	int klen;
+	void **datap;
+	int *dlenp;
+{
+	struct mmaprec *r = *mmapdb_find((struct mmapdb *)dbf, key, klen);
+
+	if (r == NULL)
+	  return -1;
+	*datap = r->data;
+	*dlenp = r->dlen;
+	return 0;
+}
+
+
+/* Room for 'size' zeroed bytes at the end of the image; their offset */
+static unsigned int mmapdb_alloc __((struct mmapdb *, unsigned int));
+static unsigned int
+mmapdb_alloc(db, size)
+	struct mmapdb *db;
+	unsigned int size;
+{
+	unsigned int off = (db->imglen + 3) & ~3;
+
+	if (off + size < off) {
+	  fprintf(stderr, "makedb: the mmap image grows over 4 GB!\n");
+	  exit(1);
+	}
+	if (off + size > db->imgspace) {
+	  while (off + size > db->imgspace)
+	    db->imgspace = db->imgspace ? db->imgspace * 2 : 64*1024;
+	  db->img = (char *) erealloc(db->img, db->imgspace);
+	}
+	memset(db->img + db->imglen, 0, off + size - db->imglen);
+	db->imglen = off + size;
+	return off;
+}
+
+static unsigned int mmapdb_string __((struct mmapdb *, const void *, int));
+static unsigned int
+mmapdb_string(db, s, len)
+	struct mmapdb *db;
+	const void *s;
+	int len;
+{
+	unsigned int off = mmapdb_alloc(db, len + 1);
+
+	memcpy(db->img + off, s, len);
+	return off;
+}
+
+#define IMG(db, off, type)	((type *)((db)->img + (off)))
+
+
+/* --- The IP prefix tries --- */
+
+static int mmapdb_ipwidth __((const struct mmaprec *));
+static int
+mmapdb_ipwidth(r)
+	const struct mmaprec *r;
+{
+	return r->key[(r->key[1] == P_K_IPv4) ? 6 : 18];
+}
+
+static int mmapdb_ipcmp __((const void *, const void *));
+static int
+mmapdb_ipcmp(a, b)
+	const void *a, *b;
+{
+	const struct mmaprec *ra = *(const struct mmaprec **)a;
+	const struct mmaprec *rb = *(const struct mmaprec **)b;
+	int rc = memcmp(ra->key + 2, rb->key + 2, ra->klen - 3);
+
+	if (rc == 0)
+	  rc = mmapdb_ipwidth(ra) - mmapdb_ipwidth(rb);
+	return rc;
+}
+
+static int mmapdb_ipbit __((const unsigned char *, int));
+static int
+mmapdb_ipbit(addr, bit)
+	const unsigned char *addr;
+	int bit;
+{
+	return (addr[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/*
+ *  The node for the recs[lo..hi-1], sorted by the address, and then
+ *  by the width.  It is the longest prefix they all share; if one of
+ *  them is just that prefix, it is the first one.  The rest are split
+ *  to the children by the next bit.
+ */
+static unsigned int mmapdb_iptrie __((struct mmapdb *, struct mmaprec **, int, int, int));
+static unsigned int
+mmapdb_iptrie(db, recs, lo, hi, maxbits)
+	struct mmapdb *db;
+	struct mmaprec **recs;
+	int lo, hi, maxbits;
+{
+	struct pmdb_ipnode *n;
+	unsigned int off, child;
+	const unsigned char *first = recs[lo]->key + 2, *last = recs[hi-1]->key + 2;
+	int i, width, mid;
+
+	for (width = 0; width < maxbits; ++width)
+	  if (mmapdb_ipbit(first, width) != mmapdb_ipbit(last, width))
+	    break;
+	for (i = lo; i < hi; ++i)
+	  if (mmapdb_ipwidth(recs[i]) < width)
+	    width = mmapdb_ipwidth(recs[i]);
+
+	off = mmapdb_alloc(db, sizeof(*n));
+	n = IMG(db, off, struct pmdb_ipnode);
+	n->width = width;
+	memcpy(n->addr, first, maxbits / 8);
+	for (i = width; i < maxbits; ++i)
+	  n->addr[i >> 3] &= ~(0x80 >> (i & 7));
+
+	if (mmapdb_ipwidth(recs[lo]) == width) {
+	  n->data = recs[lo]->doff;
+	  n->dlen = recs[lo]->dlen;
+	  ++lo;
+	}
+	if (lo >= hi)
+	  return off;
+
+	for (mid = lo; mid < hi; ++mid)
+	  if (mmapdb_ipbit(recs[mid]->key + 2, width))
+	    break;
+	if (mid > lo) {
+	  child = mmapdb_iptrie(db, recs, lo, mid, maxbits);
+	  IMG(db, off, struct pmdb_ipnode)->child[0] = child;
+	}
+	if (hi > mid) {
+	  child = mmapdb_iptrie(db, recs, mid, hi, maxbits);
+	  IMG(db, off, struct pmdb_ipnode)->child[1] = child;
+	}
+	return off;
+}
+
+
+/* --- The domain label trie --- */
+
+static void mmapdb_dominsert __((struct mmapdnode *, struct mmaprec *));
+static void
+mmapdb_dominsert(root, r)
+	struct mmapdnode *root;
+	struct mmaprec *r;
+{
+	struct mmapdnode *n = root, *k;
+	char *name = (char *) r->key + 2, *end, *s;
+	int wild = 0, len;
+
+	if (*name == '.') {
+	  ++name;
+	  wild = 1;
+	}
+	end = name + strlen(name);
+	if (end > name) {
+	  for (;;) {
+	    for (s = end; s > name && s[-1] != '.'; --s)
+	      ;
+	    len = end - s;
+	    for (k = n->kids; k != NULL; k = k->sibling)
+	      if (strncmp(k->label, s, len) == 0 && k->label[len] == 0)
+		break;
+	    if (k == NULL) {
+	      k = (struct mmapdnode *) emalloc(sizeof(*k));
+	      memset(k, 0, sizeof(*k));
+	      k->label = (char *) emalloc(len + 1);
+	      memcpy(k->label, s, len);
+	      k->label[len] = 0;
+	      k->sibling = n->kids;
+	      n->kids = k;
+	      ++n->nkids;
+	    }
+	    n = k;
+	    if (s == name)
+	      break;
+	    end = s - 1;
+	  }
+	}
+	if (wild)
+	  n->wild = r;
+	else
+	  n->exact = r;
+}
+
+static int mmapdb_labelcmp __((const void *, const void *));
+static int
+mmapdb_labelcmp(a, b)
+	const void *a, *b;
+{
+	return strcmp((*(struct mmapdnode * const *)a)->label,
+		      (*(struct mmapdnode * const *)b)->label);
+}
+
+/* Fill in the node at 'off' from 'dn', and make its children */
+static void mmapdb_domtrie __((struct mmapdb *, unsigned int, struct mmapdnode *));
+static void
+mmapdb_domtrie(db, off, dn)
+	struct mmapdb *db;
+	unsigned int off;
+	struct mmapdnode *dn;
+{
+	struct mmapdnode **kids, *k;
+	unsigned int label, arr = 0;
+	struct pmdb_domnode *n;
+	int i;
+
+	label = mmapdb_string(db, dn->label, strlen(dn->label));
+	if (dn->nkids > 0)
+	  arr = mmapdb_alloc(db, dn->nkids * sizeof(*n));
+
+	n = IMG(db, off, struct pmdb_domnode);
+	n->label     = label;
+	n->children  = arr;
+	n->nchildren = dn->nkids;
+	if (dn->exact) {
+	  n->exact    = dn->exact->doff;
+	  n->exactlen = dn->exact->dlen;
+	}
+	if (dn->wild) {
+	  n->wild    = dn->wild->doff;
+	  n->wildlen = dn->wild->dlen;
+	}
+	if (dn->nkids == 0)
+	  return;
+
+	kids = (struct mmapdnode **) emalloc(dn->nkids * sizeof(*kids));
+	for (i = 0, k = dn->kids; k != NULL; k = k->sibling)
+	  kids[i++] = k;
+	qsort(kids, dn->nkids, sizeof(*kids), mmapdb_labelcmp);
+	for (i = 0; i < dn->nkids; ++i)
+	  mmapdb_domtrie(db, arr + i * sizeof(*n), kids[i]);
+	free(kids);
+}
+
+
+/* --- The rest of the keys --- */
+
+/* The same order as the binary search of pmdb_get() wants */
+static int mmapdb_keycmp __((const void *, const void *));
+static int
+mmapdb_keycmp(a, b)
+	const void *a, *b;
+{
+	const unsigned char *ka = (*(const struct mmaprec **)a)->key;
+	const unsigned char *kb = (*(const struct mmaprec **)b)->key;
+	int rc = memcmp(ka, kb, (ka[0] < kb[0]) ? ka[0] : kb[0]);
+
+	if (rc == 0)
+	  rc = ka[0] - kb[0];
+	return rc;
+}
+
+
+/* Lay out the image, and write it; returns 0, or -1 for errors */
+int
+mmapdb_close(dbf)
+	void *dbf;
+{
+	struct mmapdb *db = dbf;
+	struct mmaprec **ip4, **ip6, **keys, *r;
+	struct mmapdnode droot;
+	struct pmdb_head *head;
+	struct pmdb_key *k;
+	int n4 = 0, n6 = 0, nkeys = 0, ndoms = 0, i, fd, rc;
+	unsigned int off, hoff;
+
+	ip4  = (struct mmaprec **) emalloc((db->count + 1) * sizeof(*ip4));
+	ip6  = (struct mmaprec **) emalloc((db->count + 1) * sizeof(*ip6));
+	keys = (struct mmaprec **) emalloc((db->count + 1) * sizeof(*keys));
+	memset(&droot, 0, sizeof(droot));
+	droot.label = "";
+
+	hoff = mmapdb_alloc(db, sizeof(*head));	/* It is at 0 */
+
+	/* The attribute lists first, then the indexes to them */
+	for (i = 0; i < db->hashsize; ++i)
+	  for (r = db->hash[i]; r != NULL; r = r->next) {
+	    r->doff = mmapdb_alloc(db, r->dlen);
+	    memcpy(db->img + r->doff, r->data, r->dlen);
+
+	    if (r->key[1] == P_K_IPv4 && r->klen == 7 && r->key[6] <= 32)
+	      ip4[n4++] = r;
+	    else if (r->key[1] == P_K_IPv6 && r->klen == 19 && r->key[18] <= 128)
+	      ip6[n6++] = r;
+	    else if (r->key[1] == P_K_DOMAIN && r->key[r->klen-1] == 0) {
+	      mmapdb_dominsert(&droot, r);
+	      ++ndoms;
+	    } else
+	      keys[nkeys++] = r;
+	  }
+
+	if (n4 > 0) {
+	  qsort(ip4, n4, sizeof(*ip4), mmapdb_ipcmp);
+	  off = mmapdb_iptrie(db, ip4, 0, n4, 32);
+	  IMG(db, hoff, struct pmdb_head)->ip4root = off;
+	}
+	if (n6 > 0) {
+	  qsort(ip6, n6, sizeof(*ip6), mmapdb_ipcmp);
+	  off = mmapdb_iptrie(db, ip6, 0, n6, 128);
+	  IMG(db, hoff, struct pmdb_head)->ip6root = off;
+	}
+	if (ndoms > 0) {
+	  off = mmapdb_alloc(db, sizeof(struct pmdb_domnode));
+	  IMG(db, hoff, struct pmdb_head)->domroot = off;
+	  mmapdb_domtrie(db, off, &droot);
+	}
+	if (nkeys > 0) {
+	  qsort(keys, nkeys, sizeof(*keys), mmapdb_keycmp);
+	  off = mmapdb_alloc(db, nkeys * sizeof(*k));
+	  for (i = 0; i < nkeys; ++i) {
+	    unsigned int koff = mmapdb_string(db, keys[i]->key, keys[i]->klen);
+	    k = IMG(db, off + i * sizeof(*k), struct pmdb_key);
+	    k->key  = koff;
+	    k->data = keys[i]->doff;
+	    k->dlen = keys[i]->dlen;
+	  }
+	  IMG(db, hoff, struct pmdb_head)->keytab = off;
+	  IMG(db, hoff, struct pmdb_head)->nkeys  = nkeys;
+	}
+
+	head = IMG(db, hoff, struct pmdb_head);
+	memcpy(head->magic, PMDB_MAGIC, sizeof(head->magic));
+	head->byteorder = PMDB_BYTEORDER;
+	head->size      = db->imglen;
+
+	rc = -1;
+	fd = open(db->tmpname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd >= 0) {
+	  off = 0;
+	  while (off < db->imglen) {
+	    i = write(fd, db->img + off, db->imglen - off);
+	    if (i < 0 && errno == EINTR)
+	      continue;
+	    if (i <= 0)
+	      break;
+	    off += i;
+	  }
+	  if (off == db->imglen)
+	    rc = 0;
+	  /* On the disk before the name points to it */
+	  if (rc == 0 && fsync(fd) < 0)
+	    rc = -1;
+	  if (close(fd) < 0)
+	    rc = -1;
+	  if (rc == 0 && rename(db->tmpname, db->fname) < 0)
+	    rc = -1;
+	  if (rc < 0)
+	    unlink(db->tmpname);
+	}
+
+	/* The process exits right after this, the rest is not freed */
+	free(ip4);
+	free(ip6);
+	free(keys);
+	free(db->img);
+	return rc;
+}